@@ -21,6 +21,9 @@
 #include <QHostAddress>
 #include <QUrl>
 #include <QUrlQuery>
+#include <QSettings>
+#include <QCoreApplication>
+#include <QCryptographicHash>
 
 // ===== ߣسʱQt5 ȫݣ =====
 // ===== ߣسʱQt5 ȫݣ =====
@@ -192,6 +195,13 @@ void ChatRoom::dispatchMessage(const QJsonObject& obj)
         handleOnlineInfo(obj);
     } else if (action == "file_meta") {          //  
         handleFileMeta(obj);
+    } else if (action == "file_meta_batch") {   // ϴһ¼ļ
+        const QJsonArray files = obj.value("files").toArray();
+        for (const QJsonValue &v : files) {
+            QJsonObject meta = v.toObject();
+            meta.insert("from", obj.value("from"));
+            handleFileMeta(meta);
+        }
     } else {
         qDebug() << "Unknown action:" << action << obj;
     }
@@ -409,6 +419,13 @@ void ChatRoom::handleFileMeta(const QJsonObject& obj) {
     // const QString urlPath = obj.value("url").toString();
     if (name.isEmpty()) return;
 
+    // տʼϴģstate = uploading±ߴµӣ˫ʹ£ٻذ
+    const QString url = obj.value("url").toString();
+    if (obj.value("state").toString() == "uploading" && !url.isEmpty())
+        m_uploadingUrls.insert(name, url);
+    else
+        m_uploadingUrls.remove(name);
+
     // Ҳࡰļб˫أ
     QStringList list = m_filesModel->stringList();
     if (!list.contains(name)) {
@@ -427,39 +444,80 @@ void ChatRoom::startDownload_(const QString& name, const QString& savePath) {
     url.setScheme("http");
     url.setHost(m_httpHost);
     url.setPort(m_httpPort);
-    url.setPath("/download");
-    QUrlQuery q; q.addQueryItem("name", name);
-    url.setQuery(q);
+    const QString tailUrl = m_uploadingUrls.value(name);
+    if (!tailUrl.isEmpty()) {
+        // ϴ/download?upload=<id>յķģϴʱ
+        const QUrl rel(tailUrl);
+        url.setPath(rel.path());
+        url.setQuery(rel.query());
+    } else {
+        url.setPath("/download");
+        QUrlQuery q; q.addQueryItem("name", name);
+        url.setQuery(q);
+    }
 
     QNetworkRequest req(url);
+
+    // ǰµͬһλá֮ûĹļϵʱ ETag / Last-Modified
+    // ϻͬһݾֻ 304ش
+    QSettings dl(QCoreApplication::applicationDirPath() + "/config.ini", QSettings::IniFormat);
+    const QString key = "downloads/" + QString(QCryptographicHash::hash(savePath.toUtf8(),
+                                                                        QCryptographicHash::Md5).toHex());
+    const QFileInfo local(savePath);
+    if (tailUrl.isEmpty() && local.exists() && local.size() == dl.value(key + "/size", -1).toLongLong()
+        && local.lastModified().toMSecsSinceEpoch() == dl.value(key + "/mtime", -1).toLongLong()) {
+        const QByteArray etag = dl.value(key + "/etag").toByteArray();
+        const QByteArray lastModified = dl.value(key + "/lastModified").toByteArray();
+        if (!etag.isEmpty()) req.setRawHeader("If-None-Match", etag);
+        if (!lastModified.isEmpty()) req.setRawHeader("If-Modified-Since", lastModified);
+    }
+
     // Qt5 û TransferTimeoutAttribute QTimer ף5 ӣ
     m_dlReply = m_http.get(req);
 
-    // 浽ļ
-    QFile* out = new QFile(savePath, m_dlReply);
+    // дʱļյ 200 滻Ŀ꣺304 ʧܶеļ
+    const QString tmpPath = savePath + ".download";
+    QFile* out = new QFile(tmpPath, m_dlReply);
     if (!out->open(QIODevice::WriteOnly)) {
-        QMessageBox::warning(this, u8"ʧ", u8"޷д룺" + savePath);
+        QMessageBox::warning(this, u8"ʧ", u8"޷д룺" + tmpPath);
         m_dlReply->abort();
         return;
     }
 
-    // 󶨳ʱ¼
-    attachTimeoutToReplyDL(m_dlReply, 300000);
+    // 󶨳ʱ¼ߴҪϴܳʱϴʱ˻Ͽ
+    attachTimeoutToReplyDL(m_dlReply, tailUrl.isEmpty() ? 300000 : 0);
 
     connect(m_dlReply, &QIODevice::readyRead, this, [this, out]() {
         out->write(m_dlReply->readAll());
     });
 
-    connect(m_dlReply, &QNetworkReply::finished, this, [this, out, savePath]() {
+    connect(m_dlReply, &QNetworkReply::finished, this, [this, out, savePath, tmpPath, key]() {
         out->write(m_dlReply->readAll());
         out->close();
 
         const bool isTimeout = m_dlReply->property("timedOut").toBool();
+        const int status = m_dlReply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
-        if (m_dlReply->error() == QNetworkReply::NoError) {
-            QMessageBox::information(this, u8"", u8"ѱ浽 " + savePath);
-        } else {
+        if (m_dlReply->error() == QNetworkReply::NoError && status == 304) {
+            QFile::remove(tmpPath);
+            QMessageBox::information(this, u8"", u8"ļ£ " + savePath);
+        } else if (m_dlReply->error() == QNetworkReply::NoError) {
             QFile::remove(savePath);
+            if (!QFile::rename(tmpPath, savePath)) {
+                QFile::remove(tmpPath);
+                QMessageBox::warning(this, u8"ʧ", u8"޷д룺" + savePath);
+            } else {
+                // Уֵ´µʱ
+                QSettings dl(QCoreApplication::applicationDirPath() + "/config.ini", QSettings::IniFormat);
+                const QFileInfo saved(savePath);
+                dl.setValue(key + "/etag", m_dlReply->rawHeader("ETag"));
+                dl.setValue(key + "/lastModified", m_dlReply->rawHeader("Last-Modified"));
+                dl.setValue(key + "/size", saved.size());
+                dl.setValue(key + "/mtime", saved.lastModified().toMSecsSinceEpoch());
+                QMessageBox::information(this, u8"", u8"ѱ浽 " + savePath);
+            }
+        } else {
+            QFile::remove(tmpPath);
             const QString msg = isTimeout ? QStringLiteral("سʱ") : m_dlReply->errorString();
             QMessageBox::critical(this, u8"ʧ", msg);
         }
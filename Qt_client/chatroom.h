@@ -96,6 +96,7 @@ private:
     FileUploader* m_uploader = nullptr;
     QStandardItemModel *m_transfersModel = nullptr; // filessendList 的模型
     QHash<QString, QStandardItem*> m_transferIndex; // filePath -> item
+    QHash<QString, QString> m_uploadingUrls;        // 还在上传的文件名 -> 边传边下的链接
 };
 
 #endif // CHATROOM_H
@@ -102,6 +102,11 @@ void FileUploader::postInit_() {
     url.setPath("/upload/init");
 
     QJsonObject j{{"name", baseName_}, {"size", size_}};
+    // ļһʼ͹㲥˲õȴܱߴ
+    if (size_ >= kEarlyMetaBytes_) {
+        j.insert("early", true);
+        j.insert("from", from_);
+    }
     const QByteArray body = QJsonDocument(j).toJson(QJsonDocument::Compact);
 
     reply_ = nam_.post(makeJsonRequest(url, timeoutMs_), body);
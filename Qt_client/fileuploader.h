@@ -53,6 +53,7 @@ private:
 
     int     retries_ = 0;
     const   int kMaxRetries_ = 3;
+    const   qint64 kEarlyMetaBytes_ = 16LL * 1024 * 1024; // Сļ͹㲥ߴ£
 
     bool    cancel_ = false;
 
@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C（Castagnoli，iSCSI/ext4 用的那个），可分段累加：
+//   uint32_t c = crc32c(0, a, na); c = crc32c(c, b, nb);
+// 支持 SSE4.2 时走硬件 crc32 指令（三路交错以吃满流水线），否则退回 slicing-by-8 查表。
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+// 当前实现的名字（"sse4.2" / "portable"），打日志用
+const char *crc32c_impl();
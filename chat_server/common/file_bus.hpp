@@ -4,7 +4,9 @@
 #include <mutex>
 #include <deque>
 #include <string>
+#include "common/logger.hpp"
 
+// 单向的线程间消息队列（互斥锁 + eventfd）：HTTP -> 聊天广播文件元数据，聊天 -> HTTP 作废下载缓存，各用一条
 class FileBus {
 public:
     FileBus() : efd_(-1) {}
@@ -17,17 +19,20 @@ public:
 
     int fd() const { return efd_; }
 
-    // 生产者（HTTP 线程）发布一条 JSON（或任意字符串）
+    // 生产者线程发布一条 JSON（或任意字符串）
     void publish(std::string msg) {
+        size_t queued;
         {
             std::lock_guard<std::mutex> lk(mu_);
             q_.push_back(std::move(msg));
+            queued = q_.size();
         }
+        LOG_DEBUG("bus: publish, %zu queued", queued);
         uint64_t one = 1;
         (void)::write(efd_, &one, sizeof(one)); // 非阻塞
     }
 
-    // 消费者（TCP 线程）尝试取一条
+    // 消费者（把 fd() 加进自己 epoll 的事件循环线程）尝试取一条
     bool try_pop(std::string& out) {
         std::lock_guard<std::mutex> lk(mu_);
         if (q_.empty()) return false;
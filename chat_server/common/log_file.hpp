@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "common/noncopyable.hpp"
+
+struct LogFileOptions
+{
+    std::string path;                  // 如 logs/chat_server.log，是指向当前段的符号链接
+    size_t segment_bytes = 64u << 20;  // 每段预分配的大小，写满换段
+    int max_age_sec = 24 * 3600;       // 一段最多用这么久（0 不按时间换）
+    int keep = 10;                     // 除当前段外保留几段旧的（含压缩过的），0 不删
+    bool compress = true;              // 旧段在后台压成 .gz
+};
+
+// 日志输出文件：按段写，每段 <path>.YYYYmmdd-HHMMSS[-N]，建段时 fallocate 到 segment_bytes
+// 再整段 mmap，写一行就是一次 memcpy，没有系统调用；页缓存由内核回写，进程崩溃也不丢。
+// 写满或到时间就换段：新段先建好、映射好，再把 <path> 这个符号链接原子地（rename）指过去，
+// 旧段截掉没写到的尾巴后交给后台线程压缩，并按 keep 删掉最旧的。
+// 正在写的段末尾是预分配的零；上次没正常关的段，下次打开时先截掉零尾。
+// 不是线程安全的：Logger 在自己的输出锁里调用
+class LogFile : NonCopyable
+{
+public:
+    explicit LogFile(const LogFileOptions &opt);
+    ~LogFile();
+
+    bool open();
+    void close();
+
+    // 保证接下来 n 字节写进同一段：放不下或到了时间就换段（空段放不下则扩大），换了返回 true
+    bool make_room(size_t n);
+    // 写不进去（建段失败等）返回 false，调用方自己找地方放
+    bool write(const char *p, size_t n);
+
+    const std::string &current() const { return cur_path_; }
+
+private:
+    bool open_segment_(size_t bytes);
+    bool map_(size_t bytes);
+    void close_segment_();
+    void recover_();
+    std::string segment_name_(std::time_t t) const;
+
+    // 后台线程：压缩旧段、按保留数删除（旧段 = 除当前段外的所有段）
+    void bg_loop_();
+    void enqueue_(const std::string &path);
+    bool compress_file_(const std::string &path);
+    void enforce_keep_();
+    std::string current_name_();
+    bool stopping_();
+
+    LogFileOptions opt_;
+    std::string dir_, base_; // path 拆成目录和文件名
+
+    int fd_ = -1;
+    char *map_ptr_ = nullptr;
+    size_t map_size_ = 0;
+    size_t used_ = 0;
+    std::time_t opened_at_ = 0;
+    std::string cur_path_;
+
+    std::thread bg_;
+    std::mutex bg_mu_;
+    std::condition_variable bg_cv_;
+    std::deque<std::string> bg_queue_; // 待压缩的段；空串表示启动时扫一遍上次留下的
+    bool bg_stop_ = false;
+    std::string bg_current_; // 当前段的文件名，后台线程不碰它
+};
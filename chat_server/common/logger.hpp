@@ -1,6 +1,13 @@
 #pragma once
 #include <cstdio>
 #include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <type_traits>
 
 enum class LogLevel
 {
@@ -10,32 +17,300 @@ enum class LogLevel
     ERROR
 };
 
+// 编译期最低等级：低于它的 LOG_* 整条去掉（参数不求值，格式串不进二进制）。
+// 默认 Release 为 1（INFO），其他构建为 0；可用 cmake -DLOG_MIN_LEVEL=N 指定
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+constexpr LogLevel LOG_COMPILED_MIN = static_cast<LogLevel>(LOG_MIN_LEVEL);
+
+// 运行期按模块分别设等级。模块由调用点所在目录决定（见 logdetail::module_of）
+enum class LogModule
+{
+    CHAT = 0, // core/、src/ 及其他
+    HTTP,     // http/
+    FILE,     // file/
+    BUS       // common/file_bus.hpp
+};
+constexpr size_t LOG_MODULES = 4;
+
+// 异步模式下某个线程的环形缓冲写满时怎么办
+enum class LogOverflow
+{
+    DROP,  // 丢掉这一条，计数，后台线程下次写出时补一行 "dropped N"
+    BLOCK  // 等后台线程腾出空间（热路径可能被磁盘拖住）
+};
+
+struct LogFileOptions; // common/log_file.hpp
+
+struct LogAsyncOptions
+{
+    size_t ring_bytes = 256 * 1024; // 每个线程的环形缓冲，向上取 2 的幂
+    int flush_interval_ms = 100;    // 后台线程至少这么久写出一次；缓冲过半或 ERROR 时立即
+    LogOverflow overflow = LogOverflow::DROP;
+    bool binary = false;            // 二进制记录（见下），用 log_decode 转成文本
+};
+
+// 一处 LOG_* 调用点的静态信息：宏里的静态常量，格式串、文件、行号、参数类别都在编译期定好。
+// types 由参数类型推出：i 有符号整数  u 无符号整数  d 浮点  s 字符串  p 指针。
+// 格式 id 在二进制模式下第一次经过时分配（登记一个指针），之后每次只读一下 id。
+// （没用链接段把调用点排成数组：inline 函数、模板里的静态量在 COMDAT 组里，GCC 不让和普通的放进同一段）
+struct LogSite
+{
+    LogLevel level;
+    LogModule module;
+    int line;
+    const char* file;
+    const char* fmt;
+    const char* types;
+    mutable std::atomic<uint32_t> id{0}; // 0：还没分配
+};
+
+// 二进制模式（NanoLog 式延迟格式化）：热路径只把格式 id、时间戳（TSC 计数）和参数原值
+// 写进本线程的环形缓冲，不做 vsnprintf；文本由 tools/log_decode 离线还原。文件格式（小端）：
+//   文件头  "CHATLOG1" | u64 每秒 tick 数，后面紧跟一个包含已有全部调用点的 BIN_SITES 块
+//   BIN_SITES   u8 类型 | u32 起始 id | u32 个数 |
+//               每个调用点：u8 等级 | u32 行号 | u16 长 + 文件名 | u16 长 + 格式串 | u8 长 + types
+//   BIN_RECORDS u8 类型 | u32 线程号 | u64 同步 tick | u64 同步时刻（Unix 纳秒）| u32 长 | 记录…
+//   记录    u32 长 | u32 格式 id | u64 tick | 参数（整数、浮点、指针各 8 字节；字符串 u32 长 + 内容）
+//           格式 id 为 0 的是直接调 Logger::log 的整行文本
+// 新分配的调用点总在引用它的记录之前写出。每个 BIN_RECORDS 是后台线程从一个线程的缓冲里
+// 一次取出的记录，同步点在取出时打，用来把 tick 换成时刻。
+// 换输出（set_output）或分段文件换段后会重写文件头，每个文件都能单独解码。
+// 正在写（或没正常关）的段末尾是预分配的零，读到零就算结束
+namespace logdetail
+{
+constexpr char BIN_MAGIC[8] = {'C', 'H', 'A', 'T', 'L', 'O', 'G', '1'};
+constexpr uint8_t BIN_RECORDS = 1;
+constexpr uint8_t BIN_SITES = 2;
+
+inline uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// 路径里有 dir（在开头或紧跟 '/'）
+constexpr bool path_in(const char* path, const char* dir)
+{
+    for (const char* p = path; *p; ++p)
+    {
+        if (p != path && p[-1] != '/')
+            continue;
+        const char* a = p;
+        const char* b = dir;
+        while (*b && *a == *b)
+            ++a, ++b;
+        if (!*b)
+            return true;
+    }
+    return false;
+}
+
+// 按 __FILE__ 在编译期定模块，调用点不用改
+constexpr LogModule module_of(const char* path)
+{
+    if (path_in(path, "file_bus.hpp"))
+        return LogModule::BUS;
+    if (path_in(path, "http/"))
+        return LogModule::HTTP;
+    if (path_in(path, "file/"))
+        return LogModule::FILE;
+    return LogModule::CHAT;
+}
+
+template <typename T>
+constexpr char type_code()
+{
+    if constexpr (std::is_same_v<T, char*> || std::is_same_v<T, const char*> || std::is_same_v<T, std::string>)
+        return 's';
+    else if constexpr (std::is_pointer_v<T>)
+        return 'p';
+    else if constexpr (std::is_floating_point_v<T>)
+        return 'd';
+    else if constexpr (std::is_enum_v<T>)
+        return std::is_signed_v<std::underlying_type_t<T>> ? 'i' : 'u';
+    else if constexpr (std::is_integral_v<T>)
+        return std::is_signed_v<T> ? 'i' : 'u';
+    else
+        static_assert(std::is_integral_v<T>, "LOG_* argument must be a number, pointer or string");
+}
+
+template <typename... A>
+struct Sig
+{
+    static constexpr char types[sizeof...(A) + 1] = {type_code<A>()..., '\0'};
+};
+// 只用在 decltype 里：按值接收，数组、函数退化成指针，与传给 printf 时一致
+template <typename... A>
+Sig<std::remove_cv_t<A>...> sig(A...);
+
+inline const char* str_arg(const char* s) { return s ? s : "(null)"; }
+
+// 文本模式交给 printf 的参数：std::string 换成 c_str，其余原样
+template <typename T>
+inline const T& c_arg(const T& v) { return v; }
+inline const char* c_arg(const std::string& v) { return v.c_str(); }
+
+template <typename T>
+inline size_t arg_size(const T& v)
+{
+    using D = std::decay_t<T>;
+    if constexpr (std::is_same_v<D, std::string>)
+        return 4 + v.size();
+    else if constexpr (std::is_same_v<D, char*> || std::is_same_v<D, const char*>)
+        return 4 + std::strlen(str_arg(v));
+    else
+        return 8;
+}
+
+template <typename T>
+inline char* put_arg(char* p, const T& v)
+{
+    using D = std::decay_t<T>;
+    if constexpr (std::is_same_v<D, std::string> || std::is_same_v<D, char*> || std::is_same_v<D, const char*>)
+    {
+        const char* s;
+        uint32_t n;
+        if constexpr (std::is_same_v<D, std::string>)
+            s = v.data(), n = (uint32_t)v.size();
+        else
+            s = str_arg(v), n = (uint32_t)std::strlen(s);
+        std::memcpy(p, &n, 4);
+        std::memcpy(p + 4, s, n);
+        return p + 4 + n;
+    }
+    else
+    {
+        uint64_t bits = 0;
+        if constexpr (std::is_floating_point_v<D>)
+        {
+            double d = (double)v;
+            std::memcpy(&bits, &d, 8);
+        }
+        else if constexpr (std::is_pointer_v<D>)
+            bits = (uint64_t)(uintptr_t)v;
+        else if constexpr (std::is_enum_v<D>)
+            bits = (uint64_t)(int64_t)static_cast<std::underlying_type_t<D>>(v);
+        else if constexpr (std::is_signed_v<D>)
+            bits = (uint64_t)(int64_t)v;
+        else
+            bits = (uint64_t)v;
+        std::memcpy(p, &bits, 8);
+        return p + 8;
+    }
+}
+} // namespace logdetail
+
 class Logger
 {
 public:
     // 初始化：默认输出到stdout，等级 INFO
     static void init(LogLevel lvl = LogLevel::INFO, FILE* out = stdout, bool enable_color = true);
 
+    // 运行期随时可调，不用重启。set_level(lvl) 设所有模块；level() 返回各模块里最低的
     static void set_level(LogLevel lvl);
+    static void set_level(LogModule mod, LogLevel lvl);
     static LogLevel level();
+    static LogLevel level(LogModule mod);
+    // "info,http=debug,file=warn"：不带模块名的设全部，按顺序生效；有不认识的就一个都不改
+    static bool set_levels(const std::string& spec);
+    static const char* module_name(LogModule mod);
+    static const char* level_str(LogLevel lvl);
+    static bool parse_level(const std::string& name, LogLevel& out);
+    static bool parse_module(const std::string& name, LogModule& out);
+
+    static bool enabled(LogModule mod, LogLevel lvl)
+    {
+        return static_cast<int>(lvl) >= module_level_[static_cast<size_t>(mod)].load(std::memory_order_relaxed);
+    }
     
     static void set_output(FILE* out);  // 设置输出流,可以切换到文字
+    // 写到按大小、时间轮转的分段文件（见 LogFile）；之后再 set_output 就回到输出流
+    static bool set_file(const LogFileOptions& opt);
     static void set_color(bool enable);
 
+    // 异步模式：各线程把格式化好的一行写进自己的无锁环形缓冲（单生产者单消费者），
+    // 后台线程成批 fwrite + 一次 fflush，热路径上没有锁和系统调用。
+    // 同一线程内保序；不同线程的行按批交错，时间戳可能略有先后颠倒。
+    // 进程退出时（atexit）自动 stop_async，把剩下的写完
+    static bool start_async(const LogAsyncOptions& opt = LogAsyncOptions());
+    static void stop_async();
+    static uint64_t dropped();          // 异步模式下因缓冲满丢掉的条数（累计）
+
     // printf 风格的日志函数
     static void log(LogLevel lvl, const char* file, int line, const char* fmt, ...);
 
+    // LOG_* 宏的入口（宏里已按模块等级判断过）：二进制模式记原值，否则照常格式化成一行
+    template <typename... Args>
+    static void write(const LogSite& site, const Args&... args)
+    {
+        if (!binary_.load(std::memory_order_relaxed))
+            return log(site.level, site.file, site.line, site.fmt, logdetail::c_arg(args)...);
+
+        const size_t n = 12 + (size_t(0) + ... + logdetail::arg_size(args));
+        uint32_t id = site.id.load(std::memory_order_acquire);
+        if (id == 0)
+            id = register_site_(site);
+        char* p = bin_reserve_(n);
+        if (!p)
+            return;
+        uint64_t t = logdetail::ticks();
+        std::memcpy(p, &id, 4);
+        std::memcpy(p + 4, &t, 8);
+        p += 12;
+        ((p = logdetail::put_arg(p, args)), ...);
+        (void)p;
+        bin_commit_(site.level >= LogLevel::ERROR);
+    }
+
     // vpirntf 风格的日志函数
     // static void vlog(LogLevel lvl, std::string_view file, int line, const char* fmt, va_list args);
 
 private:
-    static const char* level_str(LogLevel lvl);
     static const char* level_color(LogLevel lvl);
+
+    // 二进制模式：在本线程的缓冲里预留 n 字节连续空间（满了按溢出策略返回 nullptr），写完 commit
+    static char* bin_reserve_(size_t n);
+    static void bin_commit_(bool urgent);
+    static uint32_t register_site_(const LogSite& site);
+
+    static void update_min_level_();
+
+    inline static std::atomic<int> module_level_[LOG_MODULES] = {
+        {static_cast<int>(LogLevel::INFO)}, {static_cast<int>(LogLevel::INFO)},
+        {static_cast<int>(LogLevel::INFO)}, {static_cast<int>(LogLevel::INFO)}};
+    inline static std::atomic<int> level_{static_cast<int>(LogLevel::INFO)}; // 各模块里最低的，给 log() 用
+    inline static std::atomic<bool> binary_{false};
 };
 
 // 编写宏，自动带上文件名和行号
 // 使用 printf 风格的日志函数, 如：%s，%d，%zu ...
-#define LOG_DEBUG(fmt, ...) Logger::log(LogLevel::DEBUG, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)  Logger::log(LogLevel::INFO, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)  Logger::log(LogLevel::WARN, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
-#define LOG_ERROR(fmt, ...) Logger::log(LogLevel::ERROR, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
\ No newline at end of file
+// 每个调用点一个静态 LogSite（格式串、参数类别在编译期定好）。
+// 低于 LOG_MIN_LEVEL 的在编译期去掉；其余先查本模块的运行期等级，关着的话参数不求值
+#define LOG_AT_(lvl, fmt, ...)                                                                   \
+    do                                                                                           \
+    {                                                                                            \
+        if constexpr (static_cast<int>(lvl) >= LOG_MIN_LEVEL)                                    \
+        {                                                                                        \
+            constexpr LogModule log_mod_ = logdetail::module_of(__FILE__);                       \
+            if (Logger::enabled(log_mod_, lvl))                                                  \
+            {                                                                                    \
+                static const LogSite log_site_ = {                                               \
+                    lvl, log_mod_, __LINE__, __FILE__, fmt,                                      \
+                    decltype(logdetail::sig(__VA_ARGS__))::types};                               \
+                Logger::write(log_site_, ##__VA_ARGS__);                                         \
+            }                                                                                    \
+        }                                                                                        \
+    } while (0)
+
+#define LOG_DEBUG(fmt, ...) LOG_AT_(LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)  LOG_AT_(LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)  LOG_AT_(LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...) LOG_AT_(LogLevel::ERROR, fmt, ##__VA_ARGS__)
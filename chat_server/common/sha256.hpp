@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// SHA-256（FIPS 180-4），可增量 update；用于内容寻址存储的文件/分片摘要
+class Sha256
+{
+public:
+    static constexpr size_t DIGEST_SIZE = 32;
+
+    Sha256() { reset(); }
+    void reset();
+    void update(const void *data, size_t len);
+    void final(uint8_t out[DIGEST_SIZE]);
+
+    // 一次性计算并返回 64 位小写十六进制
+    static std::string hex(const void *data, size_t len);
+    static std::string to_hex(const uint8_t digest[DIGEST_SIZE]);
+    static bool from_hex(const std::string &hex, uint8_t out[DIGEST_SIZE]);
+    static std::string to_base64(const uint8_t digest[DIGEST_SIZE]); // 标准字母表，带 '=' 填充
+    // 当前实现的名字（"sha-ni" / "portable"），打日志、压测用
+    static const char *impl();
+
+private:
+    void compress_(const uint8_t *block, size_t nblocks);
+
+    uint32_t h_[8];
+    uint64_t total_ = 0;
+    uint8_t buf_[64];
+    size_t buf_len_ = 0;
+};
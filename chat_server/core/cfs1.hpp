@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// 聊天连接上的二进制帧（CFS1）。与按行的 JSON 共用同一条连接：
+// 以 "CFS1" 开头的是帧，其余照旧按 '\n' 分行（JSON 行总以 '{' 开头，不会混淆）。
+// 帧头 16 字节，整数一律大端：
+//   magic "CFS1" | u16 type | u16 flags | u32 length | u32 reserved
+// 后面跟 length 字节的 payload。
+//
+// 文件上传（客户端 -> 服务端），走与 HTTP 相同的上传会话表，分片照样是 DEFAULT_CHUNK_SIZE：
+//   FILE_BEGIN  JSON {"sid":n,"name":..,"size":..,"sha256":..}，或 {"sid":n,"id":..} 续传已有的上传；
+//               sid 由客户端在本连接内自选，之后的帧都用它指代这次上传。
+//               带 "early":true 时立即广播 state=uploading 的 file_meta，别人可以边传边下
+//   FILE_CHUNK  二进制：u32 sid | u64 seq | u32 off | 数据。一个分片可拆成多帧，off 是该帧在分片内的偏移，
+//               必须接着上一帧；一个分片发完才能开始下一个
+//   FILE_END    JSON {"sid":n}：所有分片到齐后提交
+// 服务端的回复都是 JSON payload：FILE_BEGIN / FILE_END 原类型回复，每个分片写完（或被拒）回一个 FILE_ACK。
+// 帧不拆开发送，客户端在帧与帧之间插聊天；服务端的文件回复排在聊天之后，一次只放一帧进发送缓冲。
+namespace cfs1 {
+
+constexpr uint32_t MAGIC = 0x43465331; // "CFS1"
+constexpr size_t HEADER_SIZE = 16;
+constexpr size_t CHUNK_HEAD = 16;              // FILE_CHUNK 的 sid | seq | off
+constexpr size_t MAX_PAYLOAD = 1 * 1024 * 1024; // 单帧最大 1MB
+
+enum : uint16_t {
+    FT_CHAT = 1,        // JSON，等同一行
+    FT_ONLINE = 2,      // JSON，等同一行
+    FT_FILE_BEGIN = 10,
+    FT_FILE_CHUNK = 11,
+    FT_FILE_END = 12,
+    FT_FILE_ACK = 13,
+};
+
+inline uint16_t get_be16(const void *p)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    return (uint16_t)((b[0] << 8) | b[1]);
+}
+
+inline uint32_t get_be32(const void *p)
+{
+    const uint8_t *b = (const uint8_t *)p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+inline uint64_t get_be64(const void *p)
+{
+    return ((uint64_t)get_be32(p) << 32) | get_be32((const uint8_t *)p + 4);
+}
+
+inline void put_be(std::string &out, uint64_t v, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; --i)
+        out.push_back((char)(uint8_t)(v >> (i * 8)));
+}
+
+inline std::string header(uint16_t type, size_t length)
+{
+    std::string h;
+    h.reserve(HEADER_SIZE);
+    put_be(h, MAGIC, 4);
+    put_be(h, type, 2);
+    put_be(h, 0, 2);
+    put_be(h, length, 4);
+    put_be(h, 0, 4);
+    return h;
+}
+
+inline std::string frame(uint16_t type, const std::string &payload)
+{
+    return header(type, payload.size()) + payload;
+}
+
+} // namespace cfs1
@@ -1,4 +1,5 @@
 #include "core/server.hpp"
+#include "core/cfs1.hpp"
 #include "common/logger.hpp"
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -8,6 +9,7 @@
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
+#include <algorithm>
 #include <vector>
 #include <nlohmann/json.hpp>
 
@@ -19,8 +21,48 @@ static int set_reuseaddr(int fd)
     return setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
 }
 
-EpollChatServer::EpollChatServer(const ServerConfig &cfg, FileBus *bus, FileCatalog *catalog)
-    : cfg_(cfg), bus_(bus), catalog_(catalog) {}
+// 与 HTTP 侧 publish_file_meta_ 相同的广播格式
+static std::string file_meta_line(const std::string &from, const std::string &name, long long size,
+                                  const std::string &sha256, const std::string &oid)
+{
+    json meta{
+        {"action", "file_meta"},
+        {"from", from},
+        {"name", name},
+        {"size", size},
+        {"sha256", sha256},
+        {"oid", oid},
+        {"url", std::string("/download?oid=") + oid}};
+    return meta.dump() + "\n";
+}
+
+// 与 HTTP 侧 publish_upload_meta_ 相同：上传刚开始就广播，链接是边传边下
+static std::string upload_meta_line(const std::string &from, const std::string &name, long long size,
+                                    const std::string &id)
+{
+    json meta{
+        {"action", "file_meta"},
+        {"state", "uploading"},
+        {"from", from},
+        {"name", name},
+        {"size", size},
+        {"id", id},
+        {"url", std::string("/download?upload=") + id}};
+    return meta.dump() + "\n";
+}
+
+// FILE_BEGIN / FILE_END 的 payload 里的 sid，解析不了时为 0
+static uint32_t frame_sid(const std::string &payload)
+{
+    json j = json::parse(payload, nullptr, false);
+    return j.is_object() ? j.value("sid", 0u) : 0u;
+}
+
+EpollChatServer::EpollChatServer(const ServerConfig &cfg, FileBus *bus, FileCatalog *catalog,
+                                 UploadSessions *uploads, AsyncFileIO *aio, Compressor *gzip,
+                                 BandwidthShaper *shaper, FileBus *cache_bus)
+    : cfg_(cfg), bus_(bus), catalog_(catalog), uploads_(uploads), aio_(aio), gzip_(gzip), shaper_(shaper),
+      cache_bus_(cache_bus) {}
 
 EpollChatServer::~EpollChatServer()
 {
@@ -106,6 +148,28 @@ bool EpollChatServer::setup_epoll_()
             return false;
         }
     }
+    if (aio_)
+    { // 文件通道的写盘完成通知
+        epoll_event aev{};
+        aev.events = EPOLLIN;
+        aev.data.fd = aio_->event_fd();
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, aio_->event_fd(), &aev) < 0)
+        {
+            LOG_ERROR("epoll_ctl ADD aio failed");
+            return false;
+        }
+    }
+    if (uploads_ && (upload_fd_ = uploads_->subscribe()) >= 0)
+    { // 上传会话表的通知（回写反压、摘要算完）
+        epoll_event uev{};
+        uev.events = EPOLLIN;
+        uev.data.fd = upload_fd_;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, upload_fd_, &uev) < 0)
+        {
+            LOG_ERROR("epoll_ctl ADD upload notify failed");
+            return false;
+        }
+    }
     return true;
 }
 
@@ -197,21 +261,55 @@ void EpollChatServer::enqueue_send_(int fd, const std::string &data)
     }
     else
     {
-        if (buf.size() + data.size() > max_sendbuf_)
+        if (buf.size() + it->second.file_q_bytes + data.size() > max_sendbuf_)
         {
             close_client_(fd, "sendbuf overflow");
             return;
         }
         buf.append(data);
     }
+    rearm_(fd);
+}
 
+// 文件帧排在聊天后面：发送缓冲空了才放一帧进去，之后来的聊天最多等这一帧。
+// 只入队、等 EPOLLOUT 再发，不会在这里关连接（调用方手里还拿着 FileLane&）。
+// 客户端只发不收时回执会越积越多：积压到 MAX_FILE_Q_BYTES 就暂停读，parse_input_ 也不再往下解析
+void EpollChatServer::enqueue_file_(int fd, uint16_t type, const std::string &json)
+{
+    auto it = clients_info_.find(fd);
+    if (it == clients_info_.end())
+        return;
+    auto &c = it->second;
+    c.file_q.push_back(cfs1::frame(type, json));
+    c.file_q_bytes += c.file_q.back().size();
+    if (c.send_buffer.empty())
+    {
+        c.file_q_bytes -= c.file_q.front().size();
+        c.send_buffer = std::move(c.file_q.front());
+        c.file_q.pop_front();
+    }
+    else if (c.file_q_bytes >= MAX_FILE_Q_BYTES)
+    {
+        c.file_q_full = true;
+        c.rx_paused = true;
+    }
+    rearm_(fd, false);
+}
+
+void EpollChatServer::rearm_(int fd, bool close_on_error)
+{
+    auto it = clients_info_.find(fd);
+    if (it == clients_info_.end())
+        return;
     epoll_event ev{};
-    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
     ev.data.fd = fd;
-    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) < 0)
-    {
+    ev.events = EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+    if (!it->second.rx_paused)
+        ev.events |= EPOLLIN;
+    if (!it->second.send_buffer.empty())
+        ev.events |= EPOLLOUT;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) < 0 && close_on_error)
         close_client_(fd, "epoll mod error");
-    }
 }
 
 void EpollChatServer::handle_write_(int fd)
@@ -220,6 +318,7 @@ void EpollChatServer::handle_write_(int fd)
     if (it == clients_info_.end())
         return;
     auto &buf = it->second.send_buffer;
+    auto &file_q = it->second.file_q;
 
     while (!buf.empty())
     {
@@ -227,6 +326,12 @@ void EpollChatServer::handle_write_(int fd)
         if (n > 0)
         {
             buf.erase(0, (size_t)n);
+            if (buf.empty() && !file_q.empty())
+            {
+                it->second.file_q_bytes -= file_q.front().size();
+                buf = std::move(file_q.front());
+                file_q.pop_front();
+            }
         }
         else
         {
@@ -235,12 +340,16 @@ void EpollChatServer::handle_write_(int fd)
             close_client_(fd, "send error");
             return;
         }
+        if (it->second.file_q_full && it->second.file_q_bytes <= MAX_FILE_Q_BYTES / 2)
+        {
+            it->second.file_q_full = false;
+            resume_read_(fd);
+            it = clients_info_.find(fd);
+            if (it == clients_info_.end())
+                return;
+        }
     }
-
-    epoll_event ev{};
-    ev.data.fd = fd;
-    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
-    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+    rearm_(fd);
 }
 
 void EpollChatServer::broadcast_(const std::string &line, int exclude_fd)
@@ -275,6 +384,22 @@ void EpollChatServer::handle_events_(int fd, uint32_t ev)
         return;
     }
 
+    // 文件通道的写盘 / 落盘完成
+    if (aio_ && fd == aio_->event_fd())
+    {
+        aio_->poll();
+        return;
+    }
+
+    // 上传会话表有进展（回写完成等）
+    if (upload_fd_ >= 0 && fd == upload_fd_)
+    {
+        uploads_->drain_notify(upload_fd_);
+        wake_writeback_();
+        wake_finishing_();
+        return;
+    }
+
     // 错误/断开
     if (ev & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
     {
@@ -284,48 +409,253 @@ void EpollChatServer::handle_events_(int fd, uint32_t ev)
 
     // 可读
     if (ev & EPOLLIN)
+        handle_read_(fd);
+
+    // 可写
+    if (ev & EPOLLOUT)
+        handle_write_(fd);
+}
+
+// 文件通道正在收一帧分片、且 recv_buffer 已消化完时，数据直接收进它的缓冲，不经过 recv_buffer。
+// 文件数据每轮最多收 FILE_READ_BUDGET，剩下的留给下一轮（水平触发），别的连接的聊天不用排在一整片后面；
+// 配了限速时这一轮的量还要 shaper 放行，与同一用户在 HTTP 上的上传扣同一个桶，令牌不够就暂停读、到点再继续。
+// 当前上传的回写跟不上时（Durability::WRITEBACK）同样暂停读，等会话表通知
+void EpollChatServer::handle_read_(int fd)
+{
+    size_t budget = FILE_READ_BUDGET;
+    bool wb_checked = false;
+    bool granted = shaper_ == nullptr;
+    char tmp[4096];
+    for (;;)
     {
-        auto itc = clients_info_.find(fd);
-        if (itc == clients_info_.end())
+        auto it = clients_info_.find(fd);
+        if (it == clients_info_.end() || it->second.rx_paused)
             return;
-        auto &client = itc->second;
+        auto &client = it->second;
+        FileLane *l = lane_(fd);
 
-        char buf[4096];
-        for (;;)
+        ssize_t n;
+        if (l && l->payload_left > 0 && client.recv_buffer.empty())
+        {
+            if (budget == 0)
+                return;
+            if (!l->discard && !wb_checked && upload_fd_ >= 0)
+            {
+                wb_checked = true;
+                if (uploads_->writeback_behind(l->id))
+                {
+                    l->wb_wait = true;
+                    wb_waiting_.push_back(fd);
+                    client.rx_paused = true;
+                    rearm_(fd);
+                    return;
+                }
+            }
+            size_t room = l->discard ? sizeof(tmp) : l->buf.size - l->buf_len;
+            if (room == 0)
+            {
+                client.rx_paused = true; // 等写盘回调腾出地方
+                rearm_(fd);
+                return;
+            }
+            if (!granted)
+            {
+                granted = true;
+                budget = grant_(*l, budget);
+                if (budget == 0)
+                {
+                    client.rx_paused = true; // 到 wake_ns 由 wake_throttled_ 恢复
+                    rearm_(fd);
+                    return;
+                }
+            }
+            char *dst = l->discard ? tmp : l->buf.data + l->buf_len;
+            n = ::recv(fd, dst, std::min({l->payload_left, room, budget}), 0);
+            if (n > 0)
+            {
+                client.last_active = time(nullptr);
+                budget -= (size_t)n;
+                lane_take_(*l, (size_t)n);
+                continue;
+            }
+        }
+        else
         {
-            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            // 一整帧都放得下还没解析掉，说明在等文件通道（前一个分片还在写盘）
+            if (client.recv_buffer.size() >= cfs1::HEADER_SIZE + cfs1::MAX_PAYLOAD)
+            {
+                client.rx_paused = true;
+                rearm_(fd);
+                return;
+            }
+            n = ::recv(fd, tmp, sizeof(tmp), 0);
             if (n > 0)
             {
                 client.last_active = time(nullptr);
-                client.recv_buffer.append(buf, (size_t)n);
+                client.recv_buffer.append(tmp, (size_t)n);
+                if (!parse_input_(fd))
+                    return;
+                continue;
+            }
+        }
+
+        if (n == 0)
+        {
+            close_client_(fd, "peer closed");
+            return;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            if (l)
+                BandwidthShaper::idle(l->flow);
+            return;
+        }
+        close_client_(fd, "recv error");
+        return;
+    }
+}
 
-                while (true)
+// recv_buffer 里交替出现按行的 JSON 与 CFS1 帧；解析不下去（数据不够、或文件帧要等通道空闲）就留着
+bool EpollChatServer::parse_input_(int fd)
+{
+    for (;;)
+    {
+        auto it = clients_info_.find(fd);
+        if (it == clients_info_.end())
+            return false;
+        auto &client = it->second;
+        std::string &rb = client.recv_buffer;
+        FileLane *l = lane_(fd);
+
+        // 分片途中暂存的 FILE_BEGIN / FILE_END：分片收完、通道空闲了就按到达顺序处理
+        if (l && !l->held.empty() && !l->in_chunk && !l->io_pending)
+        {
+            std::pair<uint16_t, std::string> f = std::move(l->held.front());
+            l->held.pop_front();
+            if (f.first == cfs1::FT_FILE_BEGIN)
+                file_begin_(fd, f.second);
+            else
+                file_end_(fd, f.second);
+            continue;
+        }
+
+        // 正在收的分片帧：recv_buffer 里剩的那部分先挪进通道缓冲
+        if (l && l->payload_left > 0)
+        {
+            if (rb.empty())
+                return true;
+            size_t room = l->discard ? rb.size() : l->buf.size - l->buf_len;
+            if (room == 0)
+            {
+                client.rx_paused = true;
+                rearm_(fd);
+                return true;
+            }
+            size_t n = std::min({rb.size(), l->payload_left, room});
+            if (!l->discard)
+                std::memcpy(l->buf.data + l->buf_len, rb.data(), n);
+            rb.erase(0, n);
+            lane_take_(*l, n);
+            continue;
+        }
+        if (rb.empty())
+            return true;
+        if (client.file_q_full)
+            return true; // 回执积压着，等 handle_write_ 发掉一半再接着解析
+
+        size_t m = std::min<size_t>(rb.size(), 4);
+        if (rb.compare(0, m, "CFS1", m) != 0)
+        {
+            size_t nl = rb.find('\n');
+            if (nl == std::string::npos)
+            {
+                if (rb.size() > cfs1::MAX_PAYLOAD)
                 {
-                    size_t nl = client.recv_buffer.find('\n');
-                    if (nl == std::string::npos)
-                        break;
-                    std::string line = client.recv_buffer.substr(0, nl);
-                    client.recv_buffer.erase(0, nl + 1);
-                    if (!line.empty())
-                        handleClientMessage(fd, line);
+                    close_client_(fd, "line too long");
+                    return false;
                 }
-                continue;
+                return true;
             }
-            if (n == 0)
+            std::string line = rb.substr(0, nl);
+            rb.erase(0, nl + 1);
+            if (!line.empty())
+                handleClientMessage(fd, line);
+            continue;
+        }
+
+        if (rb.size() < cfs1::HEADER_SIZE)
+            return true;
+        uint16_t type = cfs1::get_be16(rb.data() + 4);
+        size_t len = cfs1::get_be32(rb.data() + 8);
+        if (len > cfs1::MAX_PAYLOAD)
+        {
+            close_client_(fd, "frame too large");
+            return false;
+        }
+
+        if (type == cfs1::FT_FILE_CHUNK)
+        {
+            if (len < cfs1::CHUNK_HEAD)
             {
-                close_client_(fd, "peer closed");
-                break;
+                close_client_(fd, "bad chunk frame");
+                return false;
             }
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-                break;
-            close_client_(fd, "recv error");
+            if (rb.size() < cfs1::HEADER_SIZE + cfs1::CHUNK_HEAD)
+                return true;
+            const char *h = rb.data() + cfs1::HEADER_SIZE;
+            uint32_t sid = cfs1::get_be32(h);
+            uint64_t seq = cfs1::get_be64(h + 4);
+            uint32_t off = cfs1::get_be32(h + 12);
+            size_t n = len - cfs1::CHUNK_HEAD;
+            FileLane &lane = *lane_(fd, true);
+            bool cont = lane.in_chunk && lane.sid == sid && lane.seq == seq && off == lane.chunk_got &&
+                        lane.chunk_got + n <= lane.chunk_len;
+            if (!cont && lane.io_pending)
+                return true; // 前一个分片还在写盘，回调里再接着解析
+            rb.erase(0, cfs1::HEADER_SIZE + cfs1::CHUNK_HEAD);
+            chunk_frame_(lane, sid, seq, off, n);
+            continue;
+        }
+
+        if (rb.size() < cfs1::HEADER_SIZE + len)
+            return true;
+        bool control = type == cfs1::FT_FILE_END || type == cfs1::FT_FILE_BEGIN;
+        if (control && l && !l->in_chunk && l->io_pending)
+            return true; // 等通道上的落盘/提交回来，按顺序处理
+        std::string payload = rb.substr(cfs1::HEADER_SIZE, len);
+        rb.erase(0, cfs1::HEADER_SIZE + len);
+        // 分片收到一半：后面还有这个分片的帧排在 recv_buffer 里，不能停在这里等，先放到一边。
+        // 同一 sid 的 FILE_END 照常处理（中断当前分片）
+        if (control && l && l->in_chunk && !(type == cfs1::FT_FILE_END && frame_sid(payload) == l->sid))
+        {
+            if (l->held.size() >= MAX_HELD_FRAMES)
+            {
+                json r{{"sid", frame_sid(payload)}, {"ok", false}, {"reason", "busy"}};
+                enqueue_file_(fd, type, r.dump());
+                continue;
+            }
+            l->held.emplace_back(type, std::move(payload));
+            continue;
+        }
+        switch (type)
+        {
+        case cfs1::FT_CHAT:
+        case cfs1::FT_ONLINE:
+            handleClientMessage(fd, payload);
+            break;
+        case cfs1::FT_FILE_BEGIN:
+            file_begin_(fd, payload);
+            break;
+        case cfs1::FT_FILE_END:
+            file_end_(fd, payload);
+            break;
+        default:
+            LOG_WARN("fd=%d: unknown frame type %u, %zu bytes skipped", fd, (unsigned)type, len);
             break;
         }
     }
-
-    // 可写
-    if (ev & EPOLLOUT)
-        handle_write_(fd);
 }
 
 void EpollChatServer::close_client_(int fd, const char *reason)
@@ -335,6 +665,20 @@ void EpollChatServer::close_client_(int fd, const char *reason)
         return;
 
     LOG_INFO("[LEAVE] fd=%d name=%s, reason: %s", fd, it->second.user_name.c_str(), reason ? reason : "bye");
+    auto lt = lanes_.find(fd);
+    if (lt != lanes_.end())
+    {
+        FileLane &l = *lt->second;
+        if (l.io_pending)
+        {
+            l.closed = true;
+            l.fd = -1;
+            draining_.push_back(std::move(lt->second));
+        }
+        else
+            release_lane_(l);
+        lanes_.erase(lt);
+    }
     epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
     ::close(fd);
     clients_info_.erase(fd);
@@ -346,7 +690,7 @@ void EpollChatServer::run()
     std::vector<epoll_event> evs((size_t)max_events_);
     while (running_)
     {
-        int n = epoll_wait(epoll_fd_, evs.data(), max_events_, ep_timeout_);
+        int n = epoll_wait(epoll_fd_, evs.data(), max_events_, next_wake_ms_(ep_timeout_));
         if (n < 0)
         {
             if (errno == EINTR)
@@ -363,9 +707,14 @@ void EpollChatServer::run()
             else
                 handle_events_(fd, ev);
         }
+        wake_throttled_();
     }
 
-    // 清理
+    // 清理：写盘已停，在途的分片都算没写完
+    for (auto &kv : lanes_)
+        if (!kv.second->io_pending)
+            release_lane_(*kv.second);
+    lanes_.clear();
     for (auto &kv : clients_info_)
     {
         int fd = kv.first;
@@ -532,3 +881,564 @@ void EpollChatServer::sendErrorResponse(int fd, const std::string &reason)
     json r{{"status", "fail"}, {"reason", reason}};
     sendResponse(fd, r.dump());
 }
+
+/* ===================== 文件通道（CFS1） ===================== */
+
+FileLane *EpollChatServer::lane_(int fd, bool create)
+{
+    auto it = lanes_.find(fd);
+    if (it != lanes_.end())
+        return it->second.get();
+    if (!create)
+        return nullptr;
+    auto l = std::make_unique<FileLane>();
+    l->fd = fd;
+    if (shaper_)
+    {
+        char ip[INET_ADDRSTRLEN] = {0};
+        ::inet_ntop(AF_INET, &clients_info_[fd].user_addr.sin_addr, ip, sizeof(ip));
+        shaper_->attach(l->flow, ip, BandwidthShaper::UP);
+    }
+    FileLane *p = l.get();
+    lanes_[fd] = std::move(l);
+    return p;
+}
+
+// FILE_BEGIN：新建上传会话（或认领已有的，续传），会话与 HTTP 共用，
+// 同一个上传也可以一部分分片走 HTTP、一部分走这里
+void EpollChatServer::file_begin_(int fd, const std::string &payload)
+{
+    json req;
+    try
+    {
+        req = json::parse(payload);
+    }
+    catch (...)
+    {
+        req = json::object();
+    }
+    uint32_t sid = req.value("sid", 0u);
+    auto fail = [&](const char *reason) {
+        json r{{"sid", sid}, {"ok", false}, {"reason", reason}};
+        enqueue_file_(fd, cfs1::FT_FILE_BEGIN, r.dump());
+    };
+    if (!req.is_object() || !req.contains("sid"))
+        return fail("bad json");
+    if (!uploads_ || !aio_ || !catalog_)
+        return fail("file transfer disabled");
+    const ClientInfo &client = clients_info_[fd];
+    if (!client.is_authenticated)
+        return fail("please login");
+    FileLane &l = *lane_(fd, true);
+    if (l.uploads.count(sid))
+        return fail("sid in use");
+
+    FileLane::Upload u;
+    u.from = client.user_name;
+    std::string jid = req.value("id", "");
+    if (!jid.empty())
+    {
+        UploadStatus us;
+        if (uploads_->query(jid, us) != UploadSessions::OK)
+            return fail(UploadSessions::status_str(UploadSessions::NOT_FOUND));
+        u.id = jid;
+        u.name = us.name;
+        u.size = us.size;
+        u.chunk_size = us.chunk_size;
+    }
+    else
+    {
+        u.name = req.value("name", "");
+        u.size = req.value("size", 0LL);
+        std::string jsha = req.value("sha256", "");
+        if (u.name.empty() || u.size <= 0)
+            return fail("missing fields");
+        if (!jsha.empty() && !BlobStore::valid_hex(jsha))
+            return fail("bad sha256");
+
+        // 仓库里已有同样的内容：直接把名字指过去。名字日志要落盘，交给工作线程，与提交一样占着 io_pending
+        if (!jsha.empty() && catalog_->has_blob(jsha, u.size))
+        {
+            auto e = std::make_shared<FileEntry>();
+            e->name = u.name;
+            e->sha256 = jsha;
+            e->size = u.size;
+            e->from = u.from;
+            FileLane *lp = &l;
+            l.io_pending = true;
+            aio_->call([this, e] { return catalog_->bind(*e) ? 0 : -EIO; },
+                       [this, lp, sid, e](ssize_t r) {
+                           FileLane &l = *lp;
+                           json j{{"sid", sid}, {"ok", r >= 0}};
+                           if (r < 0)
+                               j["reason"] = "bind failed";
+                           else
+                           {
+                               if (gzip_)
+                                   gzip_->enqueue(e->sha256, e->name);
+                               j["exists"] = true;
+                               j["oid"] = e->oid;
+                               j["sha256"] = e->sha256;
+                           }
+                           enqueue_file_(l.fd, cfs1::FT_FILE_BEGIN, j.dump());
+                           if (r >= 0)
+                           {
+                               invalidate_cache_(e->name, e->oid);
+                               broadcast_(file_meta_line(e->from, e->name, e->size, e->sha256, e->oid), -1);
+                           }
+                           lane_done_(l);
+                       });
+            return;
+        }
+
+        u.id = UploadSessions::new_id();
+        u.chunk_size = DEFAULT_CHUNK_SIZE;
+        auto st = uploads_->create(u.id, u.name, u.size, u.chunk_size, 1, jsha);
+        if (st != UploadSessions::OK)
+            return fail(UploadSessions::status_str(st));
+        if (req.value("early", false))
+            broadcast_(upload_meta_line(u.from, u.name, u.size, u.id), -1);
+    }
+
+    UploadStatus us;
+    uploads_->query(u.id, us);
+    json missing = json::array();
+    for (const auto &r : us.missing)
+        missing.push_back({r.first, r.second});
+    json r{{"sid", sid}, {"ok", true}, {"id", u.id}, {"chunk_size", u.chunk_size}, {"missing", missing}};
+    l.uploads[sid] = std::move(u);
+    enqueue_file_(fd, cfs1::FT_FILE_BEGIN, r.dump());
+}
+
+// 一帧 FILE_CHUNK 的头：off 为 0 开始一个新分片，否则必须接着当前分片；
+// 不接着的帧（分片已被拒、或已因错误结束）整帧丢掉，客户端按 ACK 决定重传哪一片
+void EpollChatServer::chunk_frame_(FileLane &l, uint32_t sid, uint64_t seq, uint32_t off, size_t len)
+{
+    l.payload_left = len;
+    l.discard = true;
+    bool cont = l.in_chunk && l.sid == sid && l.seq == seq && off == l.chunk_got;
+    if (!cont && l.in_chunk)
+        finish_chunk_(l, "interrupted");
+    if (!cont && off != 0)
+        return;
+    if (!cont)
+    {
+        auto it = l.uploads.find(sid);
+        if (it == l.uploads.end() || !aio_)
+            return ack_(l, sid, seq, "unknown sid");
+        const FileLane::Upload &u = it->second;
+        if (seq >= (uint64_t)(u.size + (int64_t)u.chunk_size - 1) / u.chunk_size)
+            return ack_(l, sid, seq, UploadSessions::status_str(UploadSessions::BAD_SEQ));
+        uint64_t want = std::min<uint64_t>(u.chunk_size, (uint64_t)u.size - seq * u.chunk_size);
+        int fd = -1;
+        off_t foff = 0;
+        auto st = uploads_->begin_chunk(u.id, seq, want, fd, foff);
+        if (st != UploadSessions::OK)
+            return ack_(l, sid, seq, UploadSessions::status_str(st));
+        l.file = aio_->acquire_file(fd);
+        l.buf = aio_->get_buffer();
+        l.in_chunk = true;
+        l.id = u.id;
+        l.sid = sid;
+        l.seq = seq;
+        l.chunk_len = want;
+        l.chunk_got = 0;
+        l.file_fd = fd;
+        l.file_off = foff;
+        l.buf_len = 0;
+        if (l.file < 0 || !l.buf.data)
+            return finish_chunk_(l, "no resources");
+    }
+    if (l.chunk_got + len > l.chunk_len)
+        return finish_chunk_(l, UploadSessions::status_str(UploadSessions::BAD_LENGTH));
+    l.discard = false;
+}
+
+// 分片数据进了通道缓冲：攒够半块或分片收全就写盘，写盘在途时后半块接着收。
+// 随帧头一起收进 recv_buffer 的那点数据也从这里过，一并计入限速
+void EpollChatServer::lane_take_(FileLane &l, size_t n)
+{
+    l.payload_left -= n;
+    if (shaper_)
+        shaper_->consume(l.flow, n);
+    if (l.discard)
+        return;
+    l.buf_len += n;
+    l.chunk_got += n;
+    if (l.buf_len >= l.buf.size / 2 || l.chunk_got == l.chunk_len)
+        flush_lane_(l);
+}
+
+void EpollChatServer::flush_lane_(FileLane &l)
+{
+    if (l.io_pending || l.buf_len == 0)
+        return;
+    FileLane *lp = &l;
+    l.io_pending = true;
+    aio_->write(l.file, l.buf.data, l.buf_len, l.file_off, l.buf.index,
+                [this, lp](ssize_t r) { on_lane_io_(*lp, r); });
+}
+
+void EpollChatServer::on_lane_io_(FileLane &l, ssize_t res)
+{
+    l.io_pending = false;
+    if (l.closed)
+        return reap_lane_(l);
+    if (res <= 0)
+    {
+        LOG_WARN("chat upload %s chunk %llu: write failed: %s", l.id.c_str(), (unsigned long long)l.seq,
+                 res == 0 ? "no progress" : strerror((int)-res));
+        finish_chunk_(l, "write fail");
+        return resume_lane_(l);
+    }
+    // 提交之后收进来的数据挪到缓冲开头
+    l.file_off += (off_t)res;
+    l.buf_len -= (size_t)res;
+    if (l.buf_len > 0)
+        std::memmove(l.buf.data, l.buf.data + res, l.buf_len);
+    if (l.chunk_got == l.chunk_len && l.buf_len == 0)
+        finish_chunk_(l, nullptr);
+    else if (l.buf_len >= l.buf.size / 2 || l.chunk_got == l.chunk_len)
+        flush_lane_(l);
+    resume_lane_(l);
+}
+
+// 结束当前分片：error 为空表示全部写完，记入位图；否则丢掉这一片。当前帧剩下的数据都丢弃
+void EpollChatServer::finish_chunk_(FileLane &l, const char *error)
+{
+    aio_->release_file(l.file);
+    l.file = -1;
+    auto st = uploads_->end_chunk(l.id, l.seq, error == nullptr);
+    if (!error && st != UploadSessions::OK)
+        error = UploadSessions::status_str(st); // 没记进位图，客户端重传这一片
+    l.file_fd = -1;
+    aio_->put_buffer(l.buf);
+    l.buf_len = 0;
+    l.in_chunk = false;
+    l.discard = true;
+    ack_(l, l.sid, l.seq, error);
+}
+
+void EpollChatServer::ack_(FileLane &l, uint32_t sid, uint64_t seq, const char *error)
+{
+    json r{{"sid", sid}, {"seq", seq}, {"ok", error == nullptr}};
+    if (error)
+        r["reason"] = error;
+    enqueue_file_(l.fd, cfs1::FT_FILE_ACK, r.dump());
+}
+
+// FILE_END：与 /upload/complete 相同，按位图校验、用服务端算出的摘要提交，需要落盘时 fdatasync 交给 AsyncFileIO
+void EpollChatServer::file_end_(int fd, const std::string &payload)
+{
+    json req;
+    try
+    {
+        req = json::parse(payload);
+    }
+    catch (...)
+    {
+        req = json::object();
+    }
+    uint32_t sid = req.is_object() ? req.value("sid", 0u) : 0u;
+    auto fail = [&](const char *reason) {
+        json r{{"sid", sid}, {"ok", false}, {"reason", reason}};
+        enqueue_file_(fd, cfs1::FT_FILE_END, r.dump());
+    };
+    FileLane *lp = lane_(fd);
+    if (!lp || !lp->uploads.count(sid))
+        return fail("unknown sid");
+    FileLane &l = *lp;
+    if (l.in_chunk && l.sid == sid)
+        finish_chunk_(l, "interrupted");
+    FileLane::Upload u = l.uploads[sid];
+
+    bool durable = catalog_->durability() != Durability::NONE;
+    UploadResult res;
+    auto st = uploads_->finish(u.id, u.size, res, !durable);
+    if (st == UploadSessions::PENDING && upload_fd_ >= 0)
+    { // 摘要还在后台算：挂起，等会话表通知再来，聊天线程不等
+        if (l.end_wait.empty())
+            finishing_.push_back(fd);
+        l.end_wait.push_back(payload);
+        return;
+    }
+    if (st == UploadSessions::INCOMPLETE || st == UploadSessions::PENDING)
+        return fail(UploadSessions::status_str(st)); // sid 留着，补完分片（或稍后）再来
+    l.uploads.erase(sid);
+    if (st != UploadSessions::OK)
+        return fail(UploadSessions::status_str(st));
+    if (!res.claimed_sha256.empty() && res.claimed_sha256 != res.sha256)
+    {
+        LOG_WARN("chat upload %s: sha256 mismatch, claimed %s got %s", u.id.c_str(), res.claimed_sha256.c_str(),
+                 res.sha256.c_str());
+        ::unlink(res.part_path.c_str());
+        return fail("sha256 mismatch");
+    }
+    if (!durable)
+    {
+        commit_file_(l, sid, res, u);
+        return;
+    }
+
+    l.sync_fd = ::open(res.part_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (l.sync_fd < 0 || (l.sync_file = aio_->acquire_file(l.sync_fd)) < 0)
+    {
+        LOG_WARN("chat upload %s: reopen %s failed: %s", u.id.c_str(), res.part_path.c_str(), strerror(errno));
+        if (l.sync_fd >= 0)
+            ::close(l.sync_fd);
+        l.sync_fd = -1;
+        ::unlink(res.part_path.c_str());
+        return fail(UploadSessions::status_str(UploadSessions::IO_ERROR));
+    }
+    l.io_pending = true;
+    aio_->fdatasync(l.sync_file, [this, lp, sid, res, u](ssize_t r) {
+        FileLane &l = *lp;
+        aio_->release_file(l.sync_file);
+        l.sync_file = -1;
+        ::close(l.sync_fd);
+        l.sync_fd = -1;
+        if (r < 0)
+        {
+            LOG_WARN("chat upload %s: fdatasync failed: %s", res.part_path.c_str(), strerror((int)-r));
+            ::unlink(res.part_path.c_str());
+            json e{{"sid", sid}, {"ok", false}, {"reason", UploadSessions::status_str(UploadSessions::IO_ERROR)}};
+            enqueue_file_(l.fd, cfs1::FT_FILE_END, e.dump());
+        }
+        else
+            return commit_file_(l, sid, res, u); // 客户端已断开也照样提交；io_pending 留到提交完
+        lane_done_(l);
+    });
+}
+
+// 提交（rename 进仓库 + 目录 fsync + 名字日志落盘）交给 AsyncFileIO 的工作线程，聊天线程不等；
+// 期间 io_pending 一直为真，这条连接后面的 FILE_BEGIN / FILE_END / 新分片都等提交回来再处理
+void EpollChatServer::commit_file_(FileLane &l, uint32_t sid, const UploadResult &res, const FileLane::Upload &u)
+{
+    auto e = std::make_shared<FileEntry>();
+    e->name = u.name;
+    e->sha256 = res.sha256;
+    e->size = u.size;
+    e->from = u.from;
+    FileLane *lp = &l;
+    l.io_pending = true;
+    aio_->call([this, e, res] { return catalog_->commit(res.part_path, *e, res.chunk_size, res.chunk_digests) ? 0 : -EIO; },
+               [this, lp, sid, e, res, u](ssize_t r) {
+                   FileLane &l = *lp;
+                   json j{{"sid", sid}};
+                   if (r < 0)
+                   {
+                       ::unlink(res.part_path.c_str());
+                       j["ok"] = false;
+                       j["reason"] = "commit failed";
+                       enqueue_file_(l.fd, cfs1::FT_FILE_END, j.dump());
+                       return lane_done_(l);
+                   }
+                   invalidate_cache_(u.name, e->oid);
+                   if (gzip_)
+                       gzip_->enqueue(res.sha256, u.name);
+                   j["ok"] = true;
+                   j["oid"] = e->oid;
+                   j["sha256"] = res.sha256;
+                   enqueue_file_(l.fd, cfs1::FT_FILE_END, j.dump());
+                   // 广播时 io_pending 还在：要是把本连接关了，通道会先挪进 draining_ 而不是直接释放
+                   broadcast_(file_meta_line(u.from, u.name, u.size, res.sha256, e->oid), -1);
+                   lane_done_(l);
+               });
+}
+
+// 通道上的异步操作（写盘、落盘、提交）回来了：连接已关就释放，否则接着解析/恢复读
+void EpollChatServer::lane_done_(FileLane &l)
+{
+    l.io_pending = false;
+    if (l.closed)
+        return reap_lane_(l);
+    if (l.in_chunk && l.buf_len > 0)
+        flush_lane_(l); // 期间收进缓冲的分片数据（正常不会有：分片途中的提交都先放到 held 里）
+    resume_lane_(l);   // 排在 held 里的 FILE_BEGIN / FILE_END 也在这里接着处理
+}
+
+// 文件回执积压消下去了：有文件通道就按通道的规矩恢复，没有的话解析完剩下的就恢复读
+void EpollChatServer::resume_read_(int fd)
+{
+    if (FileLane *l = lane_(fd))
+        return resume_lane_(*l);
+    if (!parse_input_(fd))
+        return;
+    auto it = clients_info_.find(fd);
+    if (it == clients_info_.end() || !it->second.rx_paused || it->second.file_q_full)
+        return;
+    if (it->second.recv_buffer.size() < cfs1::HEADER_SIZE + cfs1::MAX_PAYLOAD)
+    {
+        it->second.rx_paused = false;
+        rearm_(fd);
+    }
+}
+
+// 写盘回调之后：接着解析停在 recv_buffer 里的帧，缓冲腾出地方了就恢复读
+void EpollChatServer::resume_lane_(FileLane &l)
+{
+    int fd = l.fd;
+    if (!parse_input_(fd))
+        return;
+    auto it = clients_info_.find(fd);
+    if (it == clients_info_.end() || !it->second.rx_paused || it->second.file_q_full || l.wb_wait ||
+        l.wake_ns != 0)
+        return;
+    bool room = l.discard || l.payload_left == 0 || l.buf_len < l.buf.size;
+    if (room && it->second.recv_buffer.size() < cfs1::HEADER_SIZE + cfs1::MAX_PAYLOAD)
+    {
+        it->second.rx_paused = false;
+        rearm_(fd);
+    }
+}
+
+// 回写赶上来的通道恢复读，还没赶上的留着等下一次通知
+void EpollChatServer::wake_writeback_()
+{
+    std::vector<int> fds;
+    fds.swap(wb_waiting_);
+    for (int fd : fds)
+    {
+        FileLane *l = lane_(fd);
+        if (!l || !l->wb_wait)
+            continue;
+        if (l->in_chunk && uploads_->writeback_behind(l->id))
+        {
+            wb_waiting_.push_back(fd);
+            continue;
+        }
+        l->wb_wait = false;
+        resume_lane_(*l);
+    }
+}
+
+// 会话表有进展：挂着的 FILE_END 重新处理一遍，摘要还没算完的会再挂回来
+void EpollChatServer::wake_finishing_()
+{
+    std::vector<int> fds;
+    fds.swap(finishing_);
+    for (int fd : fds)
+    {
+        FileLane *l = lane_(fd);
+        if (!l || l->end_wait.empty())
+            continue;
+        std::vector<std::string> payloads;
+        payloads.swap(l->end_wait);
+        for (size_t i = 0; i < payloads.size(); ++i)
+        {
+            // 前一个已开始落盘/提交、或正在收分片（或连接被关掉）：剩下的排进 held，
+            // 通道空下来时 parse_input_ 接着处理
+            FileLane *cur = lane_(fd);
+            if (!cur)
+                break;
+            if (cur->io_pending || cur->in_chunk)
+            {
+                for (size_t j = i; j < payloads.size(); ++j)
+                    cur->held.emplace_back(cfs1::FT_FILE_END, std::move(payloads[j]));
+                break;
+            }
+            file_end_(fd, payloads[i]);
+        }
+    }
+}
+
+// HTTP 下载缓存只在 HTTP 线程里动：名字改指向新对象后，经 cache_bus_ 让它清掉该名字下的旧条目
+void EpollChatServer::invalidate_cache_(const std::string &name, const std::string &oid)
+{
+    if (cache_bus_)
+        cache_bus_->publish(json{{"name", name}, {"oid", oid}}.dump());
+}
+
+size_t EpollChatServer::grant_(FileLane &l, size_t want)
+{
+    int64_t now = BandwidthShaper::now_ns(), wait = 0;
+    size_t n = shaper_->grant(l.flow, want, now, wait);
+    if (n > 0 || wait == 0)
+    {
+        l.wake_ns = 0;
+        return n;
+    }
+    if (l.wake_ns == 0)
+        throttled_.push_back(l.fd);
+    l.wake_ns = now + wait;
+    return 0;
+}
+
+// 到点的通道恢复读；恢复时可能解析出别的帧、关掉连接，所以先挑出 fd 再逐个查
+void EpollChatServer::wake_throttled_()
+{
+    if (throttled_.empty())
+        return;
+    int64_t now = BandwidthShaper::now_ns();
+    std::vector<int> due;
+    for (size_t i = 0; i < throttled_.size();)
+    {
+        FileLane *l = lane_(throttled_[i]);
+        int64_t w = l ? l->wake_ns : 0;
+        if (w != 0 && w > now)
+        {
+            ++i;
+            continue;
+        }
+        if (w != 0)
+            due.push_back(throttled_[i]);
+        throttled_[i] = throttled_.back();
+        throttled_.pop_back();
+    }
+    for (int fd : due)
+    {
+        FileLane *l = lane_(fd);
+        if (!l || l->wake_ns == 0)
+            continue;
+        l->wake_ns = 0;
+        resume_lane_(*l);
+    }
+}
+
+int EpollChatServer::next_wake_ms_(int cap) const
+{
+    int64_t now = BandwidthShaper::now_ns();
+    int ms = cap;
+    for (int fd : throttled_)
+    {
+        auto it = lanes_.find(fd);
+        if (it == lanes_.end() || it->second->wake_ns == 0)
+            continue;
+        int64_t d = (it->second->wake_ns - now + 999999) / 1000000;
+        ms = (int)std::max<int64_t>(0, std::min<int64_t>(ms, d));
+    }
+    return ms;
+}
+
+void EpollChatServer::release_lane_(FileLane &l)
+{
+    if (aio_)
+    {
+        aio_->release_file(l.file); // 先注销，会话表才能在 end_chunk 里关 fd
+        l.file = -1;
+        aio_->release_file(l.sync_file);
+        l.sync_file = -1;
+        aio_->put_buffer(l.buf);
+    }
+    if (l.in_chunk)
+    {
+        uploads_->end_chunk(l.id, l.seq, false); // 分片没写完
+        l.in_chunk = false;
+    }
+    if (l.sync_fd >= 0)
+    {
+        ::close(l.sync_fd);
+        l.sync_fd = -1;
+    }
+}
+
+void EpollChatServer::reap_lane_(FileLane &l)
+{
+    release_lane_(l);
+    for (auto it = draining_.begin(); it != draining_.end(); ++it)
+        if (it->get() == &l)
+        {
+            draining_.erase(it);
+            return;
+        }
+}
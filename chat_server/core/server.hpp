@@ -175,11 +175,18 @@
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <deque>
+#include <memory>
+#include <vector>
 #include <atomic>
 #include <netinet/in.h>
 #include "common/noncopyable.hpp"
 #include "common/file_bus.hpp"
+#include "file/async_io.hpp"
+#include "file/compressor.hpp"
 #include "file/file_catalog.hpp"
+#include "file/upload_sessions.hpp"
+#include "http/bandwidth_shaper.hpp"
 
 struct ServerConfig {
     std::string ip;
@@ -196,13 +203,76 @@ struct ClientInfo {
     std::string send_buffer;
     bool is_authenticated = false;
     bool is_registered = false;
+    bool rx_paused = false;           // 文件通道的缓冲满了、等写盘，暂停读
+    std::deque<std::string> file_q;   // 发往客户端的文件帧；send_buffer 空了才放一帧进去，聊天总是先走
+    size_t file_q_bytes = 0;          // file_q 里的字节数，算进 max_sendbuf_
+    bool file_q_full = false;         // file_q 积压过多、暂停读，等客户端把回执收走
+};
+
+// 聊天连接上的文件通道（CFS1 FILE_* 帧）。同一时刻只写一个分片：分片内容从 socket 收进缓冲池的一块，
+// 攒够半块或分片收完就交给 AsyncFileIO 写进 .part，写盘在途时后半块照样收。
+// 写盘在途时连接被关掉的话先挪进 draining_，等回调回来再释放（回调里拿的是 FileLane*）
+struct FileLane {
+    struct Upload {
+        std::string id;
+        std::string name;
+        std::string from;
+        int64_t size = 0;
+        size_t chunk_size = 0;
+    };
+
+    int fd = -1;
+    bool closed = false;
+    bool io_pending = false;
+    std::unordered_map<uint32_t, Upload> uploads; // sid -> 上传
+
+    // 当前分片；file_fd 属于会话表（已 pin），结束时 end_chunk 释放
+    bool in_chunk = false;
+    std::string id;
+    uint32_t sid = 0;
+    uint64_t seq = 0;
+    uint64_t chunk_len = 0;
+    uint64_t chunk_got = 0;   // 已收到的字节（含还在缓冲里的）
+    int file_fd = -1;
+    int file = -1;            // file_fd 在 AsyncFileIO 里的句柄
+    off_t file_off = 0;       // 下一次写盘的位置
+    AsyncFileIO::Buffer buf;
+    size_t buf_len = 0;
+
+    // 当前 FILE_CHUNK 帧还没收的数据；discard 时收了直接丢（分片被拒或不接着当前分片）
+    size_t payload_left = 0;
+    bool discard = false;
+
+    int sync_fd = -1;         // FILE_END：等 fdatasync 的 .part
+    int sync_file = -1;       // sync_fd 在 AsyncFileIO 里的句柄（与当前分片的分开）
+
+    bool wb_wait = false;     // 当前上传的回写跟不上，暂停收数据，挂在 wb_waiting_ 里等会话表通知
+    std::vector<std::string> end_wait; // 摘要还没算完的 FILE_END（原样的 payload），挂在 finishing_ 里等通知
+    // 收分片途中到的别的 sid 的 FILE_BEGIN / FILE_END（帧类型，原样的 payload）：提交、落盘、秒传都占着
+    // io_pending，放在分片中间做的话当前分片的写盘就排不上了。分片结束、通道空闲后 parse_input_ 按顺序处理
+    std::deque<std::pair<uint16_t, std::string>> held;
+
+    // 分片数据的限速与轮转状态（与 HTTP 共用的 BandwidthShaper，按对端 IP 算用户）；令牌不够时
+    // 暂停读，到 wake_ns（steady_clock 纳秒）再继续，0 表示没在暂停
+    BandwidthShaper::Flow flow;
+    int64_t wake_ns = 0;
 };
 
 class EpollChatServer : NonCopyable {
 public:
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024; // 与 HTTP 分片上传一致
+    static constexpr size_t FILE_READ_BUDGET = 256 * 1024;        // 每个连接每轮最多收这么多文件数据
+    static constexpr size_t MAX_HELD_FRAMES = 16;                 // 一个分片途中最多暂存的 FILE_BEGIN / FILE_END
+    static constexpr size_t MAX_FILE_Q_BYTES = 256 * 1024;        // 文件回执积压到这么多就暂停读，降到一半再恢复
+
     explicit EpollChatServer(const ServerConfig &cfg,
                              FileBus* bus,
-                             FileCatalog* catalog);
+                             FileCatalog* catalog,
+                             UploadSessions* uploads = nullptr,
+                             AsyncFileIO* aio = nullptr,
+                             Compressor* gzip = nullptr,
+                             BandwidthShaper* shaper = nullptr,
+                             FileBus* cache_bus = nullptr);
     ~EpollChatServer();
 
     bool start();
@@ -218,13 +288,40 @@ private:
     // 事件分发
     void handle_accept_();
     void handle_events_(int fd, uint32_t ev);
+    void handle_read_(int fd);
+    bool parse_input_(int fd); // 消化 recv_buffer 里的行与帧；连接已被关掉时返回 false
     void handle_write_(int fd);
     void close_client_(int fd, const char *reason);
+    void rearm_(int fd, bool close_on_error = true); // 按 rx_paused / 发送缓冲重设监听的事件
 
     // 发送辅助
     void enqueue_send_(int fd, const std::string &data);
+    void enqueue_file_(int fd, uint16_t type, const std::string &json);
     void broadcast_(const std::string &line, int exclude_fd = -1);
 
+    // 文件通道（CFS1）
+    FileLane *lane_(int fd, bool create = false);
+    void file_begin_(int fd, const std::string &payload);
+    void chunk_frame_(FileLane &l, uint32_t sid, uint64_t seq, uint32_t off, size_t len);
+    void lane_take_(FileLane &l, size_t n);
+    void flush_lane_(FileLane &l);
+    void on_lane_io_(FileLane &l, ssize_t res);
+    void finish_chunk_(FileLane &l, const char *error);
+    void ack_(FileLane &l, uint32_t sid, uint64_t seq, const char *error);
+    void file_end_(int fd, const std::string &payload);
+    void commit_file_(FileLane &l, uint32_t sid, const UploadResult &res, const FileLane::Upload &u);
+    void resume_lane_(FileLane &l);
+    void resume_read_(int fd);
+    void lane_done_(FileLane &l);
+    void release_lane_(FileLane &l);
+    void reap_lane_(FileLane &l);
+    void wake_writeback_();
+    void wake_finishing_();
+    void invalidate_cache_(const std::string &name, const std::string &oid);
+    size_t grant_(FileLane &l, size_t want); // 本轮可收的文件字节数；令牌不够时登记暂停并返回 0
+    void wake_throttled_();
+    int next_wake_ms_(int cap) const;
+
     // 业务分发
     void handleClientMessage(int fd, const std::string &msg);
     bool handle_register_(int fd, const std::string &username, const std::string &password);
@@ -244,6 +341,12 @@ private:
     // 依赖注入
     FileBus* bus_ = nullptr;
     FileCatalog* catalog_ = nullptr;
+    UploadSessions* uploads_ = nullptr; // 三者都有才接受文件帧
+    AsyncFileIO* aio_ = nullptr;        // 本线程专用的一份，完成事件在这个 epoll 里收
+    int upload_fd_ = -1;                // 会话表给本线程的通知 eventfd
+    Compressor* gzip_ = nullptr;
+    BandwidthShaper* shaper_ = nullptr; // 与 HTTP 线程共用（内部加锁）
+    FileBus* cache_bus_ = nullptr;      // 提交 / 秒传后通知 HTTP 线程作废该名字的下载缓存
 
     // 运行参数
     int backlog_ = 512;
@@ -259,4 +362,9 @@ private:
     std::unordered_map<int, ClientInfo> clients_info_;
     std::unordered_map<std::string, ClientInfo> user_datebase_;
     std::unordered_map<uint64_t, std::string> user_id_to_name_;
+    std::unordered_map<int, std::unique_ptr<FileLane>> lanes_;
+    std::vector<std::unique_ptr<FileLane>> draining_;
+    std::vector<int> wb_waiting_; // 等回写的文件通道（按连接 fd，唤醒时按 wb_wait 核对）
+    std::vector<int> finishing_;  // 有 FILE_END 等摘要的文件通道（按连接 fd，唤醒时按 end_wait 核对）
+    std::vector<int> throttled_;  // 因令牌不够暂停的文件通道（按连接 fd，唤醒时按 wake_ns 核对）
 };
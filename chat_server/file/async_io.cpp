@@ -0,0 +1,529 @@
+#include "file/async_io.hpp"
+#include "common/logger.hpp"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    int uring_setup(unsigned entries, io_uring_params *p)
+    {
+        return (int)::syscall(__NR_io_uring_setup, entries, p);
+    }
+    int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return (int)::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    }
+    int uring_register(int fd, unsigned op, const void *arg, unsigned nr)
+    {
+        return (int)::syscall(__NR_io_uring_register, fd, op, arg, nr);
+    }
+    // 与内核共享的环形队列指针：读对方写的用 acquire，发布自己写的用 release
+    inline unsigned load_acquire(const unsigned *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+    inline void store_release(unsigned *p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+} // namespace
+
+AsyncFileIO::AsyncFileIO() : AsyncFileIO(Options{}) {}
+AsyncFileIO::AsyncFileIO(const Options &opt) : opt_(opt) {}
+
+AsyncFileIO::~AsyncFileIO()
+{
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        quit_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : workers_)
+        t.join();
+    ring_close_();
+    std::free(buf_region_);
+    if (efd_ >= 0)
+        ::close(efd_);
+}
+
+bool AsyncFileIO::init()
+{
+    efd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd_ < 0)
+        return false;
+
+    if (opt_.buffers > 0 && ::posix_memalign((void **)&buf_region_, 4096, opt_.buffers * opt_.buffer_size) == 0)
+        for (int i = (int)opt_.buffers - 1; i >= 0; --i)
+            free_bufs_.push_back(i);
+
+    if (!opt_.force_threads && ring_init_())
+    {
+        LOG_INFO("file I/O: io_uring, depth %u, %s files, %zu x %zuKB %s buffers, %u in flight per device",
+                 sq_entries_, fixed_files_ ? "registered" : "plain", free_bufs_.size(), opt_.buffer_size / 1024,
+                 fixed_bufs_ ? "registered" : "plain", opt_.per_device_inflight);
+        return true;
+    }
+
+    for (unsigned i = 0; i < (opt_.threads ? opt_.threads : 1); ++i)
+        workers_.emplace_back([this] { worker_(); });
+    LOG_INFO("file I/O: thread pool (%zu threads), %u in flight per device", workers_.size(),
+             opt_.per_device_inflight);
+    return true;
+}
+
+// ---------------- 文件与缓冲 ----------------
+
+int AsyncFileIO::acquire_file(int fd)
+{
+    auto it = slot_of_fd_.find(fd);
+    if (it != slot_of_fd_.end())
+    {
+        ++files_[(size_t)it->second].refs;
+        return it->second;
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0)
+        return -1;
+
+    int slot;
+    if (!free_slots_.empty())
+    {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+    }
+    else
+    {
+        slot = (int)files_.size();
+        files_.emplace_back();
+    }
+    File &f = files_[(size_t)slot];
+    f.fd = fd;
+    f.dev = st.st_dev;
+    f.refs = 1;
+    slot_of_fd_[fd] = slot;
+    ++st_.files;
+    if (fixed_files_ && (unsigned)slot < opt_.fixed_files)
+        ring_update_file_(slot, fd);
+    return slot;
+}
+
+void AsyncFileIO::release_file(int handle)
+{
+    if (handle < 0 || (size_t)handle >= files_.size())
+        return;
+    File &f = files_[(size_t)handle];
+    if (--f.refs > 0)
+        return;
+    if (fixed_files_ && (unsigned)handle < opt_.fixed_files)
+        ring_update_file_(handle, -1);
+    slot_of_fd_.erase(f.fd);
+    f.fd = -1;
+    free_slots_.push_back(handle);
+    --st_.files;
+}
+
+AsyncFileIO::Buffer AsyncFileIO::get_buffer()
+{
+    Buffer b;
+    b.size = opt_.buffer_size;
+    if (!free_bufs_.empty())
+    {
+        int i = free_bufs_.back();
+        free_bufs_.pop_back();
+        b.data = buf_region_ + (size_t)i * opt_.buffer_size;
+        b.index = i;
+        return b;
+    }
+    b.data = static_cast<char *>(std::malloc(b.size));
+    b.index = -1; // 堆上的，还回来时 free
+    return b;
+}
+
+void AsyncFileIO::put_buffer(Buffer &b)
+{
+    if (!b.data)
+        return;
+    if (b.index >= 0)
+        free_bufs_.push_back(b.index);
+    else
+        std::free(b.data);
+    b = Buffer{};
+}
+
+// ---------------- 提交 ----------------
+
+void AsyncFileIO::read(int file, char *buf, size_t len, off_t off, int buf_index, IoCallback cb)
+{
+    submit_(new Op{Op::READ, file, files_[(size_t)file].fd, -1, buf, buf_index, len, off, 0, std::move(cb), {}});
+}
+
+void AsyncFileIO::write(int file, const char *buf, size_t len, off_t off, int buf_index, IoCallback cb)
+{
+    submit_(new Op{Op::WRITE, file, files_[(size_t)file].fd, -1, const_cast<char *>(buf), buf_index, len, off, 0,
+                   std::move(cb), {}});
+}
+
+void AsyncFileIO::splice_in(int pipe_r, int file, off_t off, size_t len, IoCallback cb)
+{
+    submit_(new Op{Op::SPLICE_IN, file, files_[(size_t)file].fd, pipe_r, nullptr, -1, len, off, 0, std::move(cb), {}});
+}
+
+void AsyncFileIO::splice_out(int file, off_t off, int pipe_w, size_t len, IoCallback cb)
+{
+    submit_(new Op{Op::SPLICE_OUT, file, files_[(size_t)file].fd, pipe_w, nullptr, -1, len, off, 0, std::move(cb), {}});
+}
+
+void AsyncFileIO::fdatasync(int file, IoCallback cb)
+{
+    submit_(new Op{Op::FDATASYNC, file, files_[(size_t)file].fd, -1, nullptr, -1, 0, 0, 0, std::move(cb), {}});
+}
+
+void AsyncFileIO::call(std::function<ssize_t()> fn, IoCallback cb)
+{
+    Op *op = new Op{Op::CALL, -1, -1, -1, nullptr, -1, 0, 0, 0, std::move(cb), std::move(fn)};
+    ++st_.submitted;
+    ++st_.inflight;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        work_.push_back(op);
+    }
+    if (workers_.empty())
+        workers_.emplace_back([this] { worker_(); });
+    cv_.notify_one();
+}
+
+// 按设备限流：该设备在途数到上限就排队，等它有请求完成再发
+void AsyncFileIO::submit_(Op *op)
+{
+    ++st_.submitted;
+    Device &d = devs_[files_[(size_t)op->file].dev];
+    if (d.inflight >= opt_.per_device_inflight)
+    {
+        d.waiting.push_back(op);
+        ++st_.queued;
+        ++st_.throttled;
+        return;
+    }
+    ++d.inflight;
+    ++st_.inflight;
+    issue_(op);
+}
+
+void AsyncFileIO::issue_(Op *op)
+{
+    if (ring_fd_ >= 0)
+    {
+        if (!sq_overflow_.empty() || !ring_push_(op))
+            sq_overflow_.push_back(op);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        work_.push_back(op);
+    }
+    cv_.notify_one();
+}
+
+void AsyncFileIO::finish_(Op *op)
+{
+    ++st_.completed;
+    --st_.inflight;
+    if (op->kind != Op::CALL) // CALL 不占设备配额
+    {
+        Device &d = devs_[files_[(size_t)op->file].dev];
+        --d.inflight;
+        if (!d.waiting.empty())
+        {
+            Op *next = d.waiting.front();
+            d.waiting.pop_front();
+            --st_.queued;
+            ++d.inflight;
+            ++st_.inflight;
+            issue_(next);
+        }
+    }
+    IoCallback cb = std::move(op->cb);
+    ssize_t res = op->res;
+    delete op;
+    cb(res);
+}
+
+void AsyncFileIO::poll()
+{
+    uint64_t v;
+    while (::read(efd_, &v, sizeof(v)) > 0)
+    {
+    }
+
+    std::vector<Op *> done;
+    {
+        std::lock_guard<std::mutex> lk(mu_); // 线程池后端的全部完成，io_uring 后端的 CALL
+        done.swap(done_);
+    }
+    if (ring_fd_ >= 0)
+    {
+        ring_reap_(done);
+        // 之前 io_uring_enter 因 EAGAIN/EBUSY 没交出去的条目
+        unsigned pending = *sq_tail_ - load_acquire(sq_head_);
+        if (pending > 0)
+            uring_enter(ring_fd_, pending, 0, 0);
+        while (!sq_overflow_.empty() && ring_push_(sq_overflow_.front()))
+            sq_overflow_.pop_front();
+    }
+    for (Op *op : done)
+        finish_(op);
+}
+
+AsyncFileIO::Stats AsyncFileIO::stats() const
+{
+    Stats s = st_;
+    s.buffers_free = (unsigned)free_bufs_.size();
+    return s;
+}
+
+// ---------------- io_uring 后端 ----------------
+
+bool AsyncFileIO::ring_init_()
+{
+    io_uring_params p{};
+    p.flags = IORING_SETUP_CLAMP;
+    int fd = uring_setup(opt_.queue_depth, &p);
+    if (fd < 0)
+    {
+        LOG_INFO("io_uring unavailable (%s), falling back to thread pool", strerror(errno));
+        return false;
+    }
+
+    sq_map_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+    sq_ptr_ = ::mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+    cq_ptr_ = single ? sq_ptr_
+                     : ::mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                              IORING_OFF_CQ_RING);
+    sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (cq_ptr_ == MAP_FAILED || sqes_ == MAP_FAILED)
+    {
+        if (sqes_ != MAP_FAILED)
+            ::munmap(sqes_, sqes_size_);
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_)
+            ::munmap(cq_ptr_, cq_map_size_);
+        ::munmap(sq_ptr_, sq_map_size_);
+        ::close(fd);
+        return false;
+    }
+
+    char *sq = static_cast<char *>(sq_ptr_), *cq = static_cast<char *>(cq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes_ = cq + p.cq_off.cqes;
+    sq_entries_ = p.sq_entries;
+    ring_fd_ = fd;
+
+    if (uring_register(fd, IORING_REGISTER_EVENTFD, &efd_, 1) != 0)
+    {
+        LOG_WARN("io_uring register eventfd failed: %s", strerror(errno));
+        ring_close_();
+        return false;
+    }
+
+    // 稀疏的 registered file 表，按需填槽位；登记失败就用普通 fd
+    if (opt_.fixed_files > 0)
+    {
+        std::vector<int> fds(opt_.fixed_files, -1);
+        fixed_files_ = uring_register(fd, IORING_REGISTER_FILES, fds.data(), (unsigned)fds.size()) == 0;
+    }
+    // 缓冲池整体登记；RLIMIT_MEMLOCK 不够时退回普通 read/write
+    if (!free_bufs_.empty())
+    {
+        std::vector<iovec> iov(opt_.buffers);
+        for (unsigned i = 0; i < opt_.buffers; ++i)
+            iov[i] = {buf_region_ + i * opt_.buffer_size, opt_.buffer_size};
+        fixed_bufs_ = uring_register(fd, IORING_REGISTER_BUFFERS, iov.data(), (unsigned)iov.size()) == 0;
+        if (!fixed_bufs_)
+            LOG_INFO("io_uring register buffers failed (%s), using plain buffers", strerror(errno));
+    }
+    return true;
+}
+
+void AsyncFileIO::ring_close_()
+{
+    if (ring_fd_ < 0)
+        return;
+    ::munmap(sqes_, sqes_size_);
+    if (cq_ptr_ != sq_ptr_)
+        ::munmap(cq_ptr_, cq_map_size_);
+    ::munmap(sq_ptr_, sq_map_size_);
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+    fixed_files_ = fixed_bufs_ = false;
+}
+
+void AsyncFileIO::ring_update_file_(int slot, int fd)
+{
+    io_uring_files_update up{};
+    up.offset = (unsigned)slot;
+    up.fds = (uint64_t)(uintptr_t)&fd;
+    if (uring_register(ring_fd_, IORING_REGISTER_FILES_UPDATE, &up, 1) < 0)
+        LOG_WARN("io_uring files update slot %d failed: %s", slot, strerror(errno));
+}
+
+bool AsyncFileIO::ring_push_(Op *op)
+{
+    unsigned tail = *sq_tail_;
+    if (tail - load_acquire(sq_head_) >= sq_entries_)
+        return false;
+    unsigned idx = tail & *sq_mask_;
+    io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes_) + idx;
+    std::memset(sqe, 0, sizeof(*sqe));
+
+    bool fixed = fixed_files_ && (unsigned)op->file < opt_.fixed_files;
+    int target = fixed ? op->file : op->fd;
+    bool fbuf = fixed_bufs_ && op->buf_index >= 0;
+    switch (op->kind)
+    {
+    case Op::READ:
+    case Op::WRITE:
+        if (fbuf)
+        {
+            sqe->opcode = op->kind == Op::READ ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->buf_index = (uint16_t)op->buf_index;
+        }
+        else
+            sqe->opcode = op->kind == Op::READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = target;
+        sqe->addr = (uint64_t)(uintptr_t)op->buf;
+        sqe->len = (unsigned)op->len;
+        sqe->off = (uint64_t)op->off;
+        if (fixed)
+            sqe->flags |= IOSQE_FIXED_FILE;
+        break;
+    case Op::SPLICE_IN: // 管道 -> 文件：fd 是输出端
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = op->pipe;
+        sqe->splice_off_in = (uint64_t)-1;
+        sqe->fd = target;
+        sqe->off = (uint64_t)op->off;
+        sqe->len = (unsigned)op->len;
+        sqe->splice_flags = SPLICE_F_MOVE;
+        if (fixed)
+            sqe->flags |= IOSQE_FIXED_FILE;
+        break;
+    case Op::SPLICE_OUT: // 文件 -> 管道
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = target;
+        sqe->splice_off_in = (uint64_t)op->off;
+        sqe->fd = op->pipe;
+        sqe->off = (uint64_t)-1;
+        sqe->len = (unsigned)op->len;
+        sqe->splice_flags = SPLICE_F_MOVE | (fixed ? SPLICE_F_FD_IN_FIXED : 0);
+        break;
+    case Op::FDATASYNC:
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = target;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        if (fixed)
+            sqe->flags |= IOSQE_FIXED_FILE;
+        break;
+    case Op::CALL: // 不进环，见 call()
+        break;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    sq_array_[idx] = idx;
+    store_release(sq_tail_, tail + 1);
+
+    while (uring_enter(ring_fd_, 1, 0, 0) < 0 && errno == EINTR)
+    {
+    }
+    return true;
+}
+
+void AsyncFileIO::ring_reap_(std::vector<Op *> &done)
+{
+    unsigned head = *cq_head_;
+    unsigned tail = load_acquire(cq_tail_);
+    const io_uring_cqe *cqes = static_cast<const io_uring_cqe *>(cqes_);
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe &cqe = cqes[head & *cq_mask_];
+        Op *op = reinterpret_cast<Op *>((uintptr_t)cqe.user_data);
+        op->res = cqe.res;
+        done.push_back(op);
+    }
+    store_release(cq_head_, head);
+}
+
+// ---------------- 线程池后端 ----------------
+
+ssize_t AsyncFileIO::run_blocking_(Op *op)
+{
+    if (op->kind == Op::CALL)
+        return op->fn();
+    ssize_t r;
+    loff_t off = op->off;
+    do
+    {
+        switch (op->kind)
+        {
+        case Op::READ:
+            r = ::pread(op->fd, op->buf, op->len, op->off);
+            break;
+        case Op::WRITE:
+            r = ::pwrite(op->fd, op->buf, op->len, op->off);
+            break;
+        case Op::SPLICE_IN:
+            r = ::splice(op->pipe, nullptr, op->fd, &off, op->len, SPLICE_F_MOVE);
+            break;
+        case Op::SPLICE_OUT:
+            r = ::splice(op->fd, &off, op->pipe, nullptr, op->len, SPLICE_F_MOVE);
+            break;
+        case Op::FDATASYNC:
+            r = ::fdatasync(op->fd);
+            break;
+        default:
+            r = -1;
+            errno = EINVAL;
+        }
+    } while (r < 0 && errno == EINTR);
+    return r < 0 ? -errno : r;
+}
+
+void AsyncFileIO::worker_()
+{
+    for (;;)
+    {
+        Op *op;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait(lk, [this] { return quit_ || !work_.empty(); });
+            if (quit_)
+                return;
+            op = work_.front();
+            work_.pop_front();
+        }
+        op->res = run_blocking_(op);
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            done_.push_back(op);
+        }
+        uint64_t one = 1;
+        (void)::write(efd_, &one, sizeof(one));
+    }
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <sys/types.h>
+#include "common/noncopyable.hpp"
+
+// 文件 I/O 完成回调：res >= 0 为字节数，< 0 为 -errno。总在事件循环线程里（poll()）调用。
+using IoCallback = std::function<void(ssize_t res)>;
+
+// 异步文件 I/O：HTTP 事件循环把落盘/读盘交给它，磁盘抖动不再直接卡住网络。
+//  - 首选 io_uring（直接走系统调用，不依赖 liburing）；内核不支持或被禁用时退回线程池，接口不变；
+//  - 完成通知走 eventfd（与 FileBus 一样），事件循环把 event_fd() 加进 epoll，可读时调用 poll()；
+//  - 活跃的文件登记为 registered file，固定大小的缓冲池登记为 registered buffer；
+//  - 每个块设备（st_dev）同时在途的请求数有上限，超出的在该设备的队列里排队。
+// 除 poll() 里执行的回调外，所有接口都只能在同一个线程（事件循环）里调用。
+class AsyncFileIO : NonCopyable
+{
+public:
+    struct Options
+    {
+        unsigned queue_depth = 256;
+        unsigned per_device_inflight = 32; // 每个设备同时在途的请求数
+        unsigned threads = 4;              // 线程池后端的工作线程数
+        unsigned fixed_files = 1024;       // registered file 槽位数
+        unsigned buffers = 64;             // 缓冲池大小
+        size_t buffer_size = 256 * 1024;
+        bool force_threads = false;        // 测试/对比用：不用 io_uring
+    };
+
+    // 缓冲池里的一块；index >= 0 表示已向内核登记，可以走 *_FIXED
+    struct Buffer
+    {
+        char *data = nullptr;
+        size_t size = 0;
+        int index = -1;
+    };
+
+    struct Stats
+    {
+        uint64_t submitted = 0;
+        uint64_t completed = 0;
+        uint64_t throttled = 0; // 因设备在途上限而排过队的请求数
+        unsigned inflight = 0;
+        unsigned queued = 0;
+        unsigned files = 0;
+        unsigned buffers_free = 0;
+    };
+
+    AsyncFileIO();
+    explicit AsyncFileIO(const Options &opt);
+    ~AsyncFileIO();
+
+    bool init();
+    const char *backend() const { return ring_fd_ >= 0 ? "io_uring" : "threads"; }
+    int event_fd() const { return efd_; }
+    void poll(); // 收割完成事件并执行回调
+
+    // 登记文件（按 fd 引用计数，同一 fd 共用一个槽位），返回句柄；调用方关 fd 之前必须 release
+    int acquire_file(int fd);
+    void release_file(int handle);
+
+    // 取/还缓冲；池空时退回堆上分配（index = -1）
+    Buffer get_buffer();
+    void put_buffer(Buffer &b);
+
+    void read(int file, char *buf, size_t len, off_t off, int buf_index, IoCallback cb);
+    void write(int file, const char *buf, size_t len, off_t off, int buf_index, IoCallback cb);
+    void splice_in(int pipe_r, int file, off_t off, size_t len, IoCallback cb);  // 管道 -> 文件
+    void splice_out(int file, off_t off, int pipe_w, size_t len, IoCallback cb); // 文件 -> 管道
+    void fdatasync(int file, IoCallback cb);
+    // 没有对应 io_uring 操作的阻塞活（copy_file_range 循环、rename + 目录 fsync 等）：fn 在工作线程里跑，
+    // 返回值（约定 >= 0 成功，< 0 为 -errno）照常交给 poll() 里的回调。不占设备在途配额；
+    // io_uring 后端第一次用时才起一个工作线程
+    void call(std::function<ssize_t()> fn, IoCallback cb);
+
+    Stats stats() const;
+
+private:
+    struct Op
+    {
+        enum Kind
+        {
+            READ,
+            WRITE,
+            SPLICE_IN,
+            SPLICE_OUT,
+            FDATASYNC,
+            CALL
+        };
+        Kind kind;
+        int file;      // 句柄
+        int fd;        // 提交时的原始 fd（线程池直接用它）
+        int pipe = -1;
+        char *buf = nullptr;
+        int buf_index = -1;
+        size_t len = 0;
+        off_t off = 0;
+        ssize_t res = 0;
+        IoCallback cb;
+        std::function<ssize_t()> fn; // CALL
+    };
+    struct File
+    {
+        int fd = -1;
+        dev_t dev = 0;
+        int refs = 0;
+    };
+    struct Device
+    {
+        unsigned inflight = 0;
+        std::deque<Op *> waiting;
+    };
+
+    void submit_(Op *op);
+    void issue_(Op *op);
+    void finish_(Op *op);
+
+    bool ring_init_();
+    bool ring_push_(Op *op);
+    void ring_reap_(std::vector<Op *> &done);
+    void ring_update_file_(int slot, int fd);
+    void ring_close_();
+
+    void worker_();
+    static ssize_t run_blocking_(Op *op);
+
+    Options opt_;
+    int efd_ = -1;
+
+    std::vector<File> files_;
+    std::vector<int> free_slots_;
+    std::unordered_map<int, int> slot_of_fd_;
+    std::unordered_map<dev_t, Device> devs_;
+    std::deque<Op *> sq_overflow_; // 提交队列满时暂存
+
+    char *buf_region_ = nullptr;
+    std::vector<int> free_bufs_;
+
+    Stats st_;
+
+    // io_uring
+    int ring_fd_ = -1;
+    bool fixed_files_ = false;
+    bool fixed_bufs_ = false;
+    void *sq_ptr_ = nullptr;
+    void *cq_ptr_ = nullptr;
+    size_t sq_map_size_ = 0;
+    size_t cq_map_size_ = 0;
+    void *sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned *sq_head_ = nullptr, *sq_tail_ = nullptr, *sq_mask_ = nullptr, *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr, *cq_mask_ = nullptr;
+    void *cqes_ = nullptr;
+    unsigned sq_entries_ = 0;
+
+    // 线程池
+    std::vector<std::thread> workers_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Op *> work_;
+    std::vector<Op *> done_;
+    bool quit_ = false;
+};
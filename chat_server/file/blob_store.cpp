@@ -0,0 +1,344 @@
+#include "file/blob_store.hpp"
+#include "common/sha256.hpp"
+#include "common/logger.hpp"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+namespace
+{
+    bool read_all(int fd, std::string &out)
+    {
+        char buf[16 * 1024];
+        ssize_t r;
+        while ((r = ::read(fd, buf, sizeof(buf))) > 0)
+            out.append(buf, (size_t)r);
+        return r == 0;
+    }
+
+    // 目录下除 . 和 .. 之外的所有项
+    std::vector<std::string> list_dir(const std::string &dir)
+    {
+        std::vector<std::string> out;
+        DIR *d = ::opendir(dir.c_str());
+        if (!d)
+            return out;
+        while (dirent *e = ::readdir(d))
+            if (std::strcmp(e->d_name, ".") != 0 && std::strcmp(e->d_name, "..") != 0)
+                out.push_back(e->d_name);
+        ::closedir(d);
+        return out;
+    }
+
+    bool is_shard(const std::string &fn) { return fn.size() == 2 && fn[0] != '.'; }
+
+    bool write_all(int fd, const char *p, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += w;
+            n -= (size_t)w;
+        }
+        return true;
+    }
+} // namespace
+
+bool BlobStore::valid_hex(const std::string &hex)
+{
+    if (hex.size() != Sha256::DIGEST_SIZE * 2)
+        return false;
+    for (char c : hex)
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            return false;
+    return true;
+}
+
+std::string BlobStore::dir_(const std::string &hex) const
+{
+    return root_ + "/" + hex.substr(0, 2) + "/" + hex.substr(2, 2);
+}
+
+std::string BlobStore::path(const std::string &hex) const { return dir_(hex) + "/" + hex; }
+
+bool BlobStore::init()
+{
+    if (::mkdir(root_.c_str(), 0755) != 0 && errno != EEXIST)
+        return false;
+    if (::access(root_.c_str(), R_OK | W_OK | X_OK) != 0)
+        return false;
+
+    // 旧版一级目录布局：先整体挪到两级，再统一扫描
+    size_t moved = 0;
+    std::vector<std::string> shards;
+    for (const auto &a : list_dir(root_))
+    {
+        if (!is_shard(a))
+            continue;
+        shards.push_back(a);
+        for (const auto &fn : list_dir(root_ + "/" + a))
+            if (valid_hex(fn) && fn.compare(0, 2, a) == 0 && relocate_(root_ + "/" + a, fn))
+                ++moved;
+    }
+    if (moved > 0)
+        LOG_INFO("blob store: moved %zu blob(s) to the two-level layout", moved);
+
+    std::vector<std::string> leaves;
+    for (const auto &a : shards)
+        for (const auto &b : list_dir(root_ + "/" + a))
+            if (is_shard(b))
+                leaves.push_back(a + "/" + b);
+
+    for (const auto &leaf : leaves)
+    {
+        for (const auto &hex : list_dir(root_ + "/" + leaf))
+        {
+            if (!valid_hex(hex) || hex.compare(0, 2, leaf, 0, 2) != 0 || hex.compare(2, 2, leaf, 3, 2) != 0)
+                continue;
+            struct stat st{};
+            if (::stat(path(hex).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            Blob &b = blobs_[hex];
+            b.size = (int64_t)st.st_size;
+            if (::stat(gzip_path(hex).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                b.gz_size = (int64_t)st.st_size;
+            load_sidecar_(hex, b);
+            index_(hex, b);
+        }
+    }
+    return true;
+}
+
+// 先挪 sidecar 再挪 blob，和 put 的顺序一致：中途崩溃最多留下一个孤儿 sidecar
+bool BlobStore::relocate_(const std::string &old_dir, const std::string &hex)
+{
+    std::string dir = dir_(hex);
+    if ((::mkdir(dir.substr(0, dir.size() - 3).c_str(), 0755) != 0 && errno != EEXIST) ||
+        (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST))
+        return false;
+    std::string old = old_dir + "/" + hex;
+    ::rename((old + ".chunks").c_str(), sidecar_path_(hex).c_str());
+    ::rename((old + ".gz").c_str(), gzip_path(hex).c_str());
+    if (::rename(old.c_str(), path(hex).c_str()) != 0)
+    {
+        LOG_WARN("blob %s: move to %s failed: %s", hex.c_str(), dir.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// .chunks 缺失或损坏时只是少了分片索引，blob 本身仍可用
+void BlobStore::load_sidecar_(const std::string &hex, Blob &b)
+{
+    int fd = ::open(sidecar_path_(hex).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    std::string data;
+    bool ok = read_all(fd, data);
+    ::close(fd);
+    if (!ok || data.size() < 8 || (data.size() - 8) % Sha256::DIGEST_SIZE != 0)
+        return;
+
+    uint64_t cs = 0;
+    for (int i = 7; i >= 0; --i)
+        cs = (cs << 8) | (unsigned char)data[(size_t)i];
+    size_t n = (data.size() - 8) / Sha256::DIGEST_SIZE;
+    if (cs == 0 || n != (uint64_t)((b.size + (int64_t)cs - 1) / (int64_t)cs))
+        return;
+    b.chunk_size = (size_t)cs;
+    b.chunks.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        b.chunks.push_back(data.substr(8 + i * Sha256::DIGEST_SIZE, Sha256::DIGEST_SIZE));
+}
+
+void BlobStore::index_(const std::string &hex, const Blob &b)
+{
+    for (size_t i = 0; i < b.chunks.size(); ++i)
+        chunks_.emplace(b.chunks[i], ChunkRef{hex, (uint64_t)i});
+}
+
+bool BlobStore::has(const std::string &hex, int64_t size) const
+{
+    auto it = blobs_.find(hex);
+    return it != blobs_.end() && it->second.size == size;
+}
+
+int64_t BlobStore::size(const std::string &hex) const
+{
+    auto it = blobs_.find(hex);
+    return it == blobs_.end() ? -1 : it->second.size;
+}
+
+int64_t BlobStore::gzip_size(const std::string &hex) const
+{
+    auto it = blobs_.find(hex);
+    return it == blobs_.end() ? -1 : it->second.gz_size;
+}
+
+bool BlobStore::attach_gzip(const std::string &hex, const std::string &tmp, int64_t size)
+{
+    auto it = blobs_.find(hex);
+    if (it == blobs_.end())
+        return false;
+    if (::rename(tmp.c_str(), gzip_path(hex).c_str()) != 0)
+    {
+        LOG_WARN("blob %s: rename %s failed: %s", hex.c_str(), tmp.c_str(), strerror(errno));
+        return false;
+    }
+    it->second.gz_size = size;
+    return true;
+}
+
+bool BlobStore::put(const std::string &part_path, const std::string &hex, int64_t size, size_t chunk_size,
+                    const std::vector<std::string> &chunks)
+{
+    if (has(hex, size))
+    {
+        ::unlink(part_path.c_str()); // 同内容已在仓库里：这次上传的数据直接丢掉
+        return true;
+    }
+    std::string dir = dir_(hex);
+    if ((::mkdir(dir.substr(0, dir.size() - 3).c_str(), 0755) != 0 && errno != EEXIST) ||
+        (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST))
+        return false;
+
+    // 先落 sidecar 再挪 blob：崩在中间只会留下一个没有 blob 的 sidecar，启动时清掉
+    std::string side = sidecar_path_(hex), side_tmp = side + ".tmp";
+    std::string rec(8, '\0');
+    for (int i = 0; i < 8; ++i)
+        rec[(size_t)i] = (char)((uint64_t)chunk_size >> (8 * i));
+    for (const auto &c : chunks)
+        rec += c;
+    int fd = ::open(side_tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && write_all(fd, rec.data(), rec.size());
+    if (fd >= 0)
+        ::close(fd);
+    if (!ok || ::rename(side_tmp.c_str(), side.c_str()) != 0)
+    {
+        LOG_WARN("blob %s: write sidecar failed: %s", hex.c_str(), strerror(errno));
+        ::unlink(side_tmp.c_str());
+        return false;
+    }
+    if (::rename(part_path.c_str(), path(hex).c_str()) != 0)
+    {
+        LOG_WARN("blob %s: rename %s failed: %s", hex.c_str(), part_path.c_str(), strerror(errno));
+        ::unlink(side.c_str());
+        return false;
+    }
+
+    Blob &b = blobs_[hex];
+    b.size = size;
+    b.chunk_size = chunk_size;
+    b.chunks = chunks;
+    index_(hex, b);
+    return true;
+}
+
+void BlobStore::remove(const std::string &hex)
+{
+    auto it = blobs_.find(hex);
+    if (it == blobs_.end())
+        return;
+    for (const auto &c : it->second.chunks)
+    {
+        auto range = chunks_.equal_range(c);
+        for (auto ci = range.first; ci != range.second;)
+            ci = (ci->second.hex == hex) ? chunks_.erase(ci) : std::next(ci);
+    }
+    blobs_.erase(it);
+    ::unlink(path(hex).c_str());
+    ::unlink(sidecar_path_(hex).c_str());
+    ::unlink(gzip_path(hex).c_str());
+}
+
+bool BlobStore::retire(const std::string &hex, const std::string &trash)
+{
+    auto it = blobs_.find(hex);
+    if (it == blobs_.end())
+        return false;
+    if (::rename(path(hex).c_str(), (trash + "/" + hex).c_str()) != 0)
+    {
+        LOG_WARN("blob %s: move to %s failed: %s", hex.c_str(), trash.c_str(), strerror(errno));
+        return false;
+    }
+    ::rename(sidecar_path_(hex).c_str(), (trash + "/" + hex + ".chunks").c_str());
+    ::rename(gzip_path(hex).c_str(), (trash + "/" + hex + ".gz").c_str());
+    for (const auto &c : it->second.chunks)
+    {
+        auto range = chunks_.equal_range(c);
+        for (auto ci = range.first; ci != range.second;)
+            ci = (ci->second.hex == hex) ? chunks_.erase(ci) : std::next(ci);
+    }
+    blobs_.erase(it);
+    return true;
+}
+
+std::vector<std::string> BlobStore::hexes() const
+{
+    std::vector<std::string> out;
+    out.reserve(blobs_.size());
+    for (const auto &kv : blobs_)
+        out.push_back(kv.first);
+    return out;
+}
+
+bool BlobStore::find_chunk(const std::string &digest, uint64_t len, std::string &blob_path, off_t &off) const
+{
+    auto range = chunks_.equal_range(digest);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const Blob &b = blobs_.at(it->second.hex);
+        int64_t start = (int64_t)(it->second.idx * b.chunk_size);
+        int64_t n = std::min<int64_t>((int64_t)b.chunk_size, b.size - start);
+        if ((uint64_t)n != len)
+            continue;
+        blob_path = path(it->second.hex);
+        off = (off_t)start;
+        return true;
+    }
+    return false;
+}
+
+size_t BlobStore::sweep(const std::unordered_set<std::string> &live, int64_t &freed)
+{
+    std::vector<std::string> dead;
+    for (const auto &kv : blobs_)
+        if (!live.count(kv.first))
+            dead.push_back(kv.first);
+    freed = 0;
+    for (const auto &hex : dead)
+    {
+        freed += blobs_[hex].size;
+        remove(hex);
+    }
+
+    // 没有 blob 的 sidecar 与 gzip 副本，以及写到一半的临时文件（put / 压缩中途崩溃留下的）
+    for (const auto &a : list_dir(root_))
+    {
+        if (!is_shard(a))
+            continue;
+        for (const auto &b : list_dir(root_ + "/" + a))
+        {
+            if (!is_shard(b))
+                continue;
+            std::string leaf = root_ + "/" + a + "/" + b;
+            for (const auto &fn : list_dir(leaf))
+            {
+                auto dot = fn.find('.');
+                bool tmp = fn.size() > 4 && fn.compare(fn.size() - 4, 4, ".tmp") == 0;
+                if (dot != std::string::npos && valid_hex(fn.substr(0, dot)) && (tmp || !blobs_.count(fn.substr(0, dot))))
+                    ::unlink((leaf + "/" + fn).c_str());
+            }
+        }
+    }
+    return dead.size();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <sys/types.h>
+#include "common/noncopyable.hpp"
+
+// 内容寻址的 blob 仓库：每份内容只存一次，路径由 SHA-256 决定，按摘要前缀分两级目录
+// （每级 256 个，百万级 blob 时每个目录也只有十几项）
+//   <root>/<hex[0:2]>/<hex[2:4]>/<hex>          文件内容
+//   <root>/<hex[0:2]>/<hex[2:4]>/<hex>.chunks   分片摘要：8 字节小端 chunk_size + 每片 32 字节 SHA-256
+//   <root>/<hex[0:2]>/<hex[2:4]>/<hex>.gz       可选：内容的 gzip 副本（后台压缩得到，可压缩的才有）
+// 启动时扫描 .chunks 建立「分片摘要 -> (blob, 序号)」的内存索引，上传时据此跳过服务端已有的分片。
+// 不加锁，由 FileCatalog 在自己的锁内调用。
+class BlobStore : NonCopyable
+{
+public:
+    explicit BlobStore(std::string root) : root_(std::move(root)) {}
+
+    bool init(); // 建目录并加载已有 blob（旧的一级目录布局就地挪到两级），返回 false 表示目录不可用
+
+    std::string path(const std::string &hex) const;
+    bool exists(const std::string &hex) const { return blobs_.count(hex) != 0; }
+    bool has(const std::string &hex, int64_t size) const;
+    int64_t size(const std::string &hex) const; // 不存在时返回 -1
+
+    std::string gzip_path(const std::string &hex) const { return path(hex) + ".gz"; }
+    int64_t gzip_size(const std::string &hex) const; // 没有 gzip 副本时返回 -1
+    // 把写好的副本 tmp 挪到 gzip_path 并登记；blob 已不在时返回 false（tmp 留给调用方删）
+    bool attach_gzip(const std::string &hex, const std::string &tmp, int64_t size);
+
+    // 把已算好摘要的 .part 收进仓库（同内容已存在时直接删掉 part）；chunks 为二进制分片摘要
+    bool put(const std::string &part_path, const std::string &hex, int64_t size, size_t chunk_size,
+             const std::vector<std::string> &chunks);
+    void remove(const std::string &hex);
+
+    // 找一个内容为 digest、长度为 len 的分片：返回所在 blob 的路径与偏移
+    bool find_chunk(const std::string &digest, uint64_t len, std::string &blob_path, off_t &off) const;
+
+    // 删掉 live 之外的所有 blob，返回删除个数与释放的字节数
+    size_t sweep(const std::unordered_set<std::string> &live, int64_t &freed);
+    // 把 blob（连同 sidecar）挪进 trash 目录并移出索引，真正的删除留给调用方慢慢做
+    bool retire(const std::string &hex, const std::string &trash);
+    std::vector<std::string> hexes() const;
+
+    size_t count() const { return blobs_.size(); }
+
+    static bool valid_hex(const std::string &hex);
+
+private:
+    struct Blob
+    {
+        int64_t size = 0;
+        size_t chunk_size = 0;
+        std::vector<std::string> chunks;
+        int64_t gz_size = -1;
+    };
+    struct ChunkRef
+    {
+        std::string hex;
+        uint64_t idx;
+    };
+
+    std::string dir_(const std::string &hex) const;
+    std::string sidecar_path_(const std::string &hex) const { return path(hex) + ".chunks"; }
+    bool relocate_(const std::string &old_dir, const std::string &hex);
+    void load_sidecar_(const std::string &hex, Blob &b);
+    void index_(const std::string &hex, const Blob &b);
+
+    std::string root_;
+    std::unordered_map<std::string, Blob> blobs_;
+    std::unordered_multimap<std::string, ChunkRef> chunks_; // 不同 blob 可能含同一分片
+};
@@ -0,0 +1,284 @@
+#include "file/compressor.hpp"
+#include "common/logger.hpp"
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    constexpr int IOPRIO_WHO_PROCESS = 1;
+    constexpr int IOPRIO_CLASS_IDLE = 3;
+    constexpr int IOPRIO_CLASS_SHIFT = 13;
+    constexpr size_t BLOCK = 256 * 1024;
+
+    // 已经压缩过的格式：再压只会白费 CPU
+    const char *const PRECOMPRESSED[] = {
+        "gz", "tgz", "zip", "7z", "rar", "xz", "bz2", "zst", "lz4", "br", "jar", "apk",
+        "jpg", "jpeg", "png", "gif", "webp", "heic", "avif",
+        "mp3", "aac", "ogg", "opus", "flac", "m4a",
+        "mp4", "mkv", "mov", "avi", "webm",
+        "docx", "xlsx", "pptx", "odt", "epub", "pdf"};
+
+    ssize_t pread_full(int fd, char *p, size_t n, off_t off)
+    {
+        size_t got = 0;
+        while (got < n)
+        {
+            ssize_t r = ::pread(fd, p + got, n - got, off + (off_t)got);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0)
+                return -1;
+            if (r == 0)
+                break;
+            got += (size_t)r;
+        }
+        return (ssize_t)got;
+    }
+
+    bool write_all(int fd, const char *p, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += w;
+            n -= (size_t)w;
+        }
+        return true;
+    }
+} // namespace
+
+Compressor::Compressor(FileCatalog &catalog, const Options &opt) : catalog_(catalog), opt_(opt) {}
+
+Compressor::~Compressor() { stop(); }
+
+void Compressor::start()
+{
+    if (opt_.level > 0)
+        th_ = std::thread([this] { loop_(); });
+}
+
+void Compressor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (th_.joinable())
+        th_.join();
+}
+
+void Compressor::enqueue(const std::string &hex, const std::string &name)
+{
+    if (opt_.level <= 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (stop_ || pending_.count(hex))
+            return;
+        if (queue_.size() >= opt_.queue_max)
+        {
+            ++st_.dropped;
+            return;
+        }
+        pending_.insert(hex);
+        queue_.push_back(Job{hex, name});
+        ++st_.queued;
+        st_.pending = queue_.size();
+    }
+    cv_.notify_one();
+}
+
+Compressor::Stats Compressor::stats() const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return st_;
+}
+
+bool Compressor::stopping_()
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return stop_;
+}
+
+void Compressor::loop_()
+{
+    // 和 janitor 一样只在空闲时占用磁盘和 CPU，不和事件循环抢
+    pid_t tid = (pid_t)::syscall(SYS_gettid);
+    if (::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+        LOG_WARN("compressor: ioprio_set failed: %s", strerror(errno));
+    ::setpriority(PRIO_PROCESS, (id_t)tid, 19);
+
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+            if (stop_)
+                break;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+            st_.pending = queue_.size();
+        }
+        process_(job);
+        std::lock_guard<std::mutex> lk(mu_);
+        pending_.erase(job.hex);
+    }
+}
+
+bool Compressor::precompressed_name_(const std::string &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos || name.size() - dot > 6)
+        return false;
+    std::string ext = name.substr(dot + 1);
+    for (char &ch : ext)
+        if (ch >= 'A' && ch <= 'Z')
+            ch = (char)(ch - 'A' + 'a');
+    for (const char *e : PRECOMPRESSED)
+        if (ext == e)
+            return true;
+    return false;
+}
+
+void Compressor::process_(const Job &job)
+{
+    std::string path;
+    int64_t size = 0;
+    if (!catalog_.gzip_source(job.hex, path, size)) // 已经有副本，或者 blob 已被回收
+        return;
+    auto skip = [this] {
+        std::lock_guard<std::mutex> lk(mu_);
+        ++st_.skipped;
+    };
+    if (size < opt_.min_size || precompressed_name_(job.name))
+        return skip();
+
+    int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return; // 刚被回收
+    if (!worth_trying_(in, size))
+    {
+        ::close(in);
+        return skip();
+    }
+    ::posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    std::string tmp = path + ".gz.tmp";
+    int out = ::open(tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0)
+    {
+        LOG_WARN("compressor: create %s failed: %s", tmp.c_str(), strerror(errno));
+        ::close(in);
+        std::lock_guard<std::mutex> lk(mu_);
+        ++st_.failed;
+        return;
+    }
+    int64_t out_size = 0;
+    bool ok = compress_(in, out, size, out_size);
+    bool small = ok && (double)out_size <= (double)size * opt_.max_ratio;
+    // 副本掉电后可能是半截的，启动时只看文件在不在：要求落盘的配置下先刷盘再改名
+    if (small && catalog_.durability() != Durability::NONE && ::fdatasync(out) != 0)
+        ok = small = false;
+    ::close(in);
+    ::close(out);
+
+    if (!small || !catalog_.attach_gzip(job.hex, tmp, out_size))
+    {
+        ::unlink(tmp.c_str());
+        std::lock_guard<std::mutex> lk(mu_);
+        if (ok && !small)
+            ++st_.skipped;
+        else if (!ok && !stop_)
+            ++st_.failed;
+        return;
+    }
+    LOG_DEBUG("compressor: %s (%s) %lld -> %lld bytes", job.hex.c_str(), job.name.c_str(), (long long)size,
+              (long long)out_size);
+    std::lock_guard<std::mutex> lk(mu_);
+    ++st_.compressed;
+    st_.bytes_in += size;
+    st_.bytes_out += out_size;
+}
+
+// 用最快档压开头一段：连这都压不下去的（随机数据、没认出来的压缩格式）就不必整份压了
+bool Compressor::worth_trying_(int fd, int64_t size)
+{
+    std::vector<char> in(std::min(opt_.sample_bytes, (size_t)size));
+    ssize_t n = pread_full(fd, in.data(), in.size(), 0);
+    if (n <= 0)
+        return false;
+    uLongf out_len = compressBound((uLong)n);
+    std::vector<Bytef> out(out_len);
+    if (::compress2(out.data(), &out_len, (const Bytef *)in.data(), (uLong)n, 1) != Z_OK)
+        return false;
+    return (double)out_len <= (double)n * opt_.max_ratio;
+}
+
+// 按块读、按块写，内存占用与文件大小无关；压出来已经超过上限就提前停下（返回 true，out_size 超限）
+bool Compressor::compress_(int in, int out, int64_t size, int64_t &out_size)
+{
+    z_stream zs{};
+    // windowBits 15 + 16：带 gzip 头尾，浏览器 / curl / Qt 都认
+    if (::deflateInit2(&zs, opt_.level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    std::vector<char> ibuf(BLOCK), obuf(BLOCK);
+    int64_t limit = (int64_t)((double)size * opt_.max_ratio);
+    off_t off = 0;
+    bool ok = true, over = false;
+    out_size = 0;
+    for (int flush = Z_NO_FLUSH; ok && !over && flush != Z_FINISH;)
+    {
+        if (stopping_())
+        {
+            ok = false;
+            break;
+        }
+        ssize_t n = pread_full(in, ibuf.data(), ibuf.size(), off);
+        if (n < 0)
+        {
+            LOG_WARN("compressor: read failed: %s", strerror(errno));
+            ok = false;
+            break;
+        }
+        off += n;
+        flush = (n < (ssize_t)ibuf.size() || off >= (off_t)size) ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = (Bytef *)ibuf.data();
+        zs.avail_in = (uInt)n;
+        do
+        {
+            zs.next_out = (Bytef *)obuf.data();
+            zs.avail_out = (uInt)obuf.size();
+            ::deflate(&zs, flush);
+            size_t have = obuf.size() - zs.avail_out;
+            out_size += (int64_t)have;
+            if (out_size > limit)
+            {
+                over = true;
+                break;
+            }
+            if (have > 0 && !write_all(out, obuf.data(), have))
+            {
+                LOG_WARN("compressor: write failed: %s", strerror(errno));
+                ok = false;
+                break;
+            }
+        } while (zs.avail_out == 0);
+    }
+    ::deflateEnd(&zs);
+    return ok;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include "common/noncopyable.hpp"
+#include "file/file_catalog.hpp"
+
+// 后台生成 gzip 副本：上传完成（或秒传）后把内容摘要丢进队列，由一个低优先级线程
+// 把 blob 压成 <blob>.gz，下载时按 Accept-Encoding 直接发这个文件（仍走 splice，不按请求压缩）。
+// 副本按内容存，同一份内容不管多少个名字只压一次。
+// 不是每份内容都值得压：按扩展名跳过已经压缩过的格式，再用最快档压一段开头试探压缩率，
+// 最后整份压完还要比原样小 max_ratio 以上才留下。
+class Compressor : NonCopyable
+{
+public:
+    struct Options
+    {
+        int level = 6;                  // zlib 压缩级别，0 关闭
+        int64_t min_size = 1024;        // 更小的文件省不了几个字节，不压
+        size_t sample_bytes = 64 << 10; // 试探压缩的长度
+        double max_ratio = 0.9;         // 压缩后 / 原样 超过它就不要副本
+        size_t queue_max = 4096;        // 队列满了新任务直接丢掉（只是少一个副本）
+    };
+
+    struct Stats
+    {
+        uint64_t queued = 0;
+        uint64_t compressed = 0;
+        uint64_t skipped = 0;   // 格式、试探或整份压缩后判定不值得
+        uint64_t failed = 0;
+        uint64_t dropped = 0;   // 队列满
+        int64_t bytes_in = 0;   // 已生成副本的原样总字节
+        int64_t bytes_out = 0;  // 副本总字节
+        size_t pending = 0;
+    };
+
+    Compressor(FileCatalog &catalog, const Options &opt);
+    ~Compressor();
+
+    void start();
+    void stop();
+    void enqueue(const std::string &hex, const std::string &name); // 事件循环线程调用，不阻塞
+    Stats stats() const;
+
+private:
+    struct Job
+    {
+        std::string hex;
+        std::string name;
+    };
+
+    void loop_();
+    void process_(const Job &job);
+    bool worth_trying_(int fd, int64_t size);
+    bool compress_(int in, int out, int64_t size, int64_t &out_size);
+    bool stopping_();
+    static bool precompressed_name_(const std::string &name);
+
+    FileCatalog &catalog_;
+    Options opt_;
+
+    std::thread th_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> queue_;
+    std::unordered_set<std::string> pending_; // 在队列里的摘要，重复的不再排
+    bool stop_ = false;
+    Stats st_;
+};
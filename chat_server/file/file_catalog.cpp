@@ -1,7 +1,125 @@
 #include "file/file_catalog.hpp"
+#include "common/logger.hpp"
+#include "common/crc32c.hpp"
+#include "common/sha256.hpp"
+#include <nlohmann/json.hpp>
+#include <dirent.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <unordered_set>
+
+using json = nlohmann::json;
+
+namespace
+{
+    // 快照：
+    //   "CFSNAP01" | u64 条数 | 记录... | u32 crc32c（前面所有字节）
+    // 每条记录：u8 标志（bit0 = 名字当前指向它）| 16 字节 oid | 32 字节 SHA-256 | i64 大小 | i64 时间
+    //           | u32 名字长度 | 名字 | u32 上传者长度 | 上传者      （整数均为小端）
+    constexpr char SNAP_MAGIC[8] = {'C', 'F', 'S', 'N', 'A', 'P', '0', '1'};
+    constexpr uint8_t SNAP_LATEST = 1;
+
+    void put_le(std::string &out, uint64_t v, int n)
+    {
+        for (int i = 0; i < n; ++i)
+            out.push_back((char)(v >> (8 * i)));
+    }
+
+    uint64_t get_le(const char *p, int n)
+    {
+        uint64_t v = 0;
+        for (int i = n - 1; i >= 0; --i)
+            v = (v << 8) | (unsigned char)p[i];
+        return v;
+    }
+
+    // 小写 hex 与二进制互转（oid 与摘要在快照里按二进制存）
+    void put_hex(std::string &out, const std::string &hex)
+    {
+        auto nib = [](char c) { return c <= '9' ? c - '0' : c - 'a' + 10; };
+        for (size_t i = 0; i + 1 < hex.size(); i += 2)
+            out.push_back((char)(nib(hex[i]) << 4 | nib(hex[i + 1])));
+    }
+
+    std::string get_hex(const char *p, size_t n)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex(n * 2, '0');
+        for (size_t i = 0; i < n; ++i)
+        {
+            hex[2 * i] = digits[(unsigned char)p[i] >> 4];
+            hex[2 * i + 1] = digits[(unsigned char)p[i] & 0xf];
+        }
+        return hex;
+    }
+
+    // 读 path 从 from 起的全部内容
+    bool read_file(const std::string &path, std::string &out, off_t from = 0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && st.st_size > from)
+            out.reserve((size_t)(st.st_size - from));
+        if (from > 0 && ::lseek(fd, from, SEEK_SET) != from)
+        {
+            ::close(fd);
+            return false;
+        }
+        char buf[64 * 1024];
+        ssize_t r;
+        while ((r = ::read(fd, buf, sizeof(buf))) > 0)
+            out.append(buf, (size_t)r);
+        int e = errno;
+        ::close(fd);
+        errno = e;
+        return r == 0;
+    }
+
+    bool write_all(int fd, const char *p, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += w;
+            n -= (size_t)w;
+        }
+        return true;
+    }
+
+    // 写临时文件、落盘后 rename 到 path
+    bool replace_file(const std::string &path, const std::string &data)
+    {
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0 && write_all(fd, data.data(), data.size()) && ::fdatasync(fd) == 0;
+        int e = errno;
+        if (fd >= 0)
+            ::close(fd);
+        if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            e = ok ? errno : e;
+            ::unlink(tmp.c_str());
+            errno = e;
+            return false;
+        }
+        return true;
+    }
+} // namespace
 
 static bool ensure_dir(const std::string &dir)
 {
@@ -19,6 +137,883 @@ static bool ensure_dir(const std::string &dir)
     return ::mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
 }
 
-bool FileCatalog::init() { return ensure_dir(root_); }
-std::string FileCatalog::temp_path(const std::string &id) const { return root_ + "/" + id + ".part"; }
+const char *durability_str(Durability d)
+{
+    switch (d)
+    {
+    case Durability::NONE:
+        return "none";
+    case Durability::FDATASYNC:
+        return "fdatasync";
+    case Durability::WRITEBACK:
+        return "writeback";
+    }
+    return "unknown";
+}
+
+bool parse_durability(const std::string &s, Durability &d)
+{
+    for (Durability v : {Durability::NONE, Durability::FDATASYNC, Durability::WRITEBACK})
+        if (s == durability_str(v))
+        {
+            d = v;
+            return true;
+        }
+    return false;
+}
+
+// rename 只有在目录本身落盘后才算数
+static bool fsync_dir(const std::string &dir)
+{
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+FileCatalog::FileCatalog(std::string root, Durability durability)
+    : root_(std::move(root)), durability_(durability), blobs_(root_ + "/.blobs") {}
+
+FileCatalog::~FileCatalog()
+{
+    if (names_fd_ >= 0)
+        ::close(names_fd_);
+    if (lock_fd_ >= 0)
+        ::close(lock_fd_);
+}
+
+bool FileCatalog::init()
+{
+    if (!ensure_dir(root_) || !ensure_dir(root_ + "/.parts"))
+        return false;
+    lock_fd_ = ::open((root_ + "/.lock").c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (lock_fd_ < 0 || ::flock(lock_fd_, LOCK_EX | LOCK_NB) != 0)
+    {
+        LOG_ERROR("catalog: %s is in use by another process", root_.c_str());
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!blobs_.init())
+        {
+            LOG_ERROR("blob store %s/.blobs unusable: %s", root_.c_str(), strerror(errno));
+            return false;
+        }
+        if (!load_names_())
+            return false;
+        // 保留规则可能改过：超出的旧版本在内存里删掉，靠下面的快照落盘
+        std::vector<std::string> names;
+        for (const auto &kv : history_)
+            names.push_back(kv.first);
+        size_t pruned = prune_locked_(names, ::time(nullptr), false);
+        if (pruned > 0)
+        {
+            dirty_ = true;
+            LOG_INFO("catalog: %zu old version(s) past retention dropped", pruned);
+        }
+    }
+    // 加载时补发的 oid、丢掉的对象、按保留规则删掉的旧版本都靠这次快照落盘
+    if (!compact())
+        return false;
+
+    std::lock_guard<std::mutex> lk(mu_);
+    std::unordered_set<std::string> live;
+    for (const auto &kv : refs_)
+        live.insert(kv.first);
+    int64_t freed = 0;
+    size_t n = blobs_.sweep(live, freed);
+    LOG_INFO("catalog: %zu object(s), %zu name(s), %zu blob(s); gc removed %zu blob(s), %lld bytes",
+             objects_.size(), names_.size(), blobs_.count(), n, (long long)freed);
+    return true;
+}
+
+// 上传 id 由客户端带回来，按它的 FNV-1a 哈希而不是字面前缀分目录，分布与 id 格式无关
+std::string FileCatalog::shard_dir_(const std::string &id) const
+{
+    uint32_t h = 2166136261u;
+    for (unsigned char ch : id)
+        h = (h ^ ch) * 16777619u;
+    char sub[8];
+    std::snprintf(sub, sizeof(sub), "%02x/%02x", h >> 24, (h >> 16) & 0xff);
+    return root_ + "/.parts/" + sub;
+}
+
+std::string FileCatalog::temp_path(const std::string &id) const { return shard_dir_(id) + "/" + id + ".part"; }
+std::string FileCatalog::journal_path(const std::string &id) const { return temp_path(id) + ".journal"; }
 std::string FileCatalog::final_path(const std::string &name) const { return root_ + "/" + name; }
+
+bool FileCatalog::prepare_temp(const std::string &id) const { return ensure_dir(shard_dir_(id)); }
+
+// 扫 .parts 下的两级目录；顺带把旧版平铺在 root 下的 .part / .part.journal 挪进分片目录
+std::vector<std::string> FileCatalog::journal_ids() const
+{
+    static const std::string suffix = ".part.journal";
+    auto journal_id = [](const std::string &fn, std::string &id) {
+        if (fn.size() <= suffix.size() || fn.compare(fn.size() - suffix.size(), suffix.size(), suffix) != 0)
+            return false;
+        id = fn.substr(0, fn.size() - suffix.size());
+        return true;
+    };
+    auto list = [](const std::string &dir) {
+        std::vector<std::string> out;
+        if (DIR *d = ::opendir(dir.c_str()))
+        {
+            while (dirent *e = ::readdir(d))
+                if (e->d_name[0] != '.')
+                    out.push_back(e->d_name);
+            ::closedir(d);
+        }
+        return out;
+    };
+
+    std::vector<std::string> ids;
+    std::string id;
+    for (const auto &fn : list(root_))
+    {
+        if (!journal_id(fn, id) || !prepare_temp(id))
+            continue;
+        std::string old = root_ + "/" + id + ".part";
+        if (::rename(old.c_str(), temp_path(id).c_str()) == 0 || errno == ENOENT)
+            ::rename((old + ".journal").c_str(), journal_path(id).c_str());
+    }
+    for (const auto &a : list(root_ + "/.parts"))
+        for (const auto &b : list(root_ + "/.parts/" + a))
+            for (const auto &fn : list(root_ + "/.parts/" + a + "/" + b))
+                if (journal_id(fn, id))
+                    ids.push_back(id);
+    return ids;
+}
+
+bool FileCatalog::valid_oid(const std::string &oid)
+{
+    if (oid.size() != 32)
+        return false;
+    for (char c : oid)
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            return false;
+    return true;
+}
+
+// 128 位随机数；对象表里查重，撞上就再来一次
+std::string FileCatalog::new_oid_()
+{
+    static std::mt19937_64 rng{((uint64_t)std::random_device{}() << 32) ^ std::random_device{}()};
+    char s[33];
+    std::snprintf(s, sizeof(s), "%016llx%016llx", (unsigned long long)rng(), (unsigned long long)rng());
+    return s;
+}
+
+// 旧版直接以文件名落在 root 下；只允许不会逃出 root、不会撞上内部文件的名字
+bool FileCatalog::legacy_name_ok_(const std::string &name)
+{
+    return !name.empty() && name[0] != '.' && name.find('/') == std::string::npos;
+}
+
+// 对象内容不可变，摘要就是最好的强 ETag：换了 inode（迁移、重建仓库）也不变，
+// 同样的内容不论哪个对象都一样
+void FileCatalog::object_tags_(const Object &o, FileInfo &info)
+{
+    info.etag = "\"" + o.hex + "\"";
+    if (o.created > 0)
+        info.mtime = o.created;
+}
+
+int FileCatalog::open_final(const std::string &name, FileInfo &info) const
+{
+    std::string path;
+    Object o;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = names_.find(name);
+        if (it != names_.end())
+        {
+            o = objects_.at(it->second);
+            path = blobs_.path(o.hex);
+            info.oid = it->second;
+            info.digest = o.hex;
+        }
+    }
+    if (path.empty())
+    {
+        if (!legacy_name_ok_(name))
+        {
+            errno = ENOENT;
+            return -1;
+        }
+        path = final_path(name);
+        info.oid.clear();
+        info.digest.clear();
+    }
+    info.name = name;
+    int fd = open_blob_(path, info);
+    if (fd >= 0 && !o.hex.empty())
+        object_tags_(o, info);
+    return fd;
+}
+
+int FileCatalog::open_object(const std::string &oid, FileInfo &info) const
+{
+    std::string path;
+    Object o;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = objects_.find(oid);
+        if (it == objects_.end())
+        {
+            errno = ENOENT;
+            return -1;
+        }
+        o = it->second;
+        path = blobs_.path(o.hex);
+        info.oid = oid;
+        info.name = o.name;
+        info.digest = o.hex;
+    }
+    int fd = open_blob_(path, info);
+    if (fd >= 0)
+        object_tags_(o, info);
+    return fd;
+}
+
+bool FileCatalog::lookup(const std::string &oid, const std::string &name, FileInfo &info) const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = objects_.end();
+    if (!oid.empty())
+        it = objects_.find(oid);
+    else
+    {
+        auto n = names_.find(name);
+        if (n != names_.end())
+            it = objects_.find(n->second);
+    }
+    if (it == objects_.end())
+        return false;
+    info.oid = it->first;
+    info.name = it->second.name;
+    info.size = it->second.size;
+    info.digest = it->second.hex;
+    info.mtime = 0;
+    info.gz_size = blobs_.gzip_size(it->second.hex);
+    info.encoding.clear();
+    object_tags_(it->second, info);
+    return true;
+}
+
+// 副本是另一种表示，ETag 必须和原样的不同（否则缓存会把两者混用）
+void FileCatalog::select_gzip(FileInfo &info)
+{
+    info.encoding = "gzip";
+    info.size = info.gz_size;
+    info.etag = "\"" + info.digest + "+gzip\"";
+}
+
+int FileCatalog::open_gzip(const std::string &hex) const
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (blobs_.gzip_size(hex) < 0)
+        {
+            errno = ENOENT;
+            return -1;
+        }
+        path = blobs_.gzip_path(hex);
+    }
+    return ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+bool FileCatalog::gzip_source(const std::string &hex, std::string &path, int64_t &size) const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    size = blobs_.size(hex);
+    if (size < 0 || blobs_.gzip_size(hex) >= 0)
+        return false;
+    path = blobs_.path(hex);
+    return true;
+}
+
+bool FileCatalog::attach_gzip(const std::string &hex, const std::string &tmp, int64_t size)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return blobs_.attach_gzip(hex, tmp, size);
+}
+
+int FileCatalog::open_blob_(const std::string &path, FileInfo &info) const
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        int e = (st.st_mode == 0) ? errno : EISDIR;
+        ::close(fd);
+        errno = e;
+        return -1;
+    }
+    info.size = (int64_t)st.st_size;
+    info.mtime = st.st_mtime;
+
+    // inode + 纳秒级 mtime + 大小：文件被替换或改写都会变化
+    char tag[80];
+    std::snprintf(tag, sizeof(tag), "\"%llx-%llx%08lx-%llx\"",
+                  (unsigned long long)st.st_ino, (unsigned long long)st.st_mtim.tv_sec,
+                  (unsigned long)st.st_mtim.tv_nsec, (unsigned long long)st.st_size);
+    info.etag = tag;
+    return fd;
+}
+
+bool FileCatalog::has_blob(const std::string &hex, int64_t size) const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return blobs_.has(hex, size);
+}
+
+bool FileCatalog::bind(FileEntry &e)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return bind_locked_(e);
+}
+
+bool FileCatalog::commit(const std::string &part_path, FileEntry &e, size_t chunk_size,
+                         const std::vector<std::string> &chunks)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!put_locked_(part_path, e.sha256, e.size, chunk_size, chunks))
+        return false;
+    if (!bind_locked_(e))
+    {
+        if (!refs_.count(e.sha256))
+            blobs_.remove(e.sha256);
+        return false;
+    }
+    return true;
+}
+
+bool FileCatalog::adopt(const std::string &path, FileEntry &e, size_t chunk_size,
+                        const std::vector<std::string> &chunks, bool &named)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    if (!put_locked_(path, e.sha256, e.size, chunk_size, chunks))
+        return false;
+    named = !names_.count(e.name);
+    if (!bind_locked_(e, named))
+    {
+        if (!refs_.count(e.sha256))
+            blobs_.remove(e.sha256);
+        return false;
+    }
+    return true;
+}
+
+bool FileCatalog::put_locked_(const std::string &path, const std::string &hex, int64_t size, size_t chunk_size,
+                              const std::vector<std::string> &chunks)
+{
+    if (!blobs_.put(path, hex, size, chunk_size, chunks))
+        return false;
+    if (durability_ != Durability::NONE)
+    {
+        std::string p = blobs_.path(hex);
+        if (!fsync_dir(p.substr(0, p.find_last_of('/'))))
+            LOG_WARN("blob %s: fsync dir failed: %s", hex.c_str(), strerror(errno));
+    }
+    return true;
+}
+
+// 名字改指向最新的对象；被顶替的旧对象还能按 id 下载，直到按保留规则删掉。
+// 旧版同名的平铺文件也不再删除，留给迁移工具收进仓库
+bool FileCatalog::bind_locked_(FileEntry &e, bool take_name)
+{
+    auto it = names_.find(e.name);
+    if (take_name && it != names_.end() && objects_.at(it->second).hex == e.sha256)
+    {
+        // 同名同内容：重复上传，不另建对象
+        const Object &o = objects_.at(it->second);
+        e.oid = it->second;
+        e.from = o.from;
+        e.created = o.created;
+        return true;
+    }
+    do
+        e.oid = new_oid_();
+    while (objects_.count(e.oid));
+    if (e.created == 0)
+        e.created = ::time(nullptr);
+    Object o{e.name, e.sha256, e.from, e.size, e.created};
+    if (!append_object_(e.oid, o, take_name))
+        return false;
+
+    ++refs_[e.sha256];
+    objects_.emplace(e.oid, std::move(o));
+    if (take_name)
+        point_name_(e.name, e.oid);
+    else
+    {
+        // 迁移来的撞名旧文件：按上传时间插进旧版本里
+        auto &h = history_[e.name];
+        auto pos = std::find_if(h.begin(), h.end(),
+                                [&](const std::string &id) { return objects_.at(id).created > e.created; });
+        h.insert(pos, e.oid);
+    }
+    prune_locked_({e.name}, ::time(nullptr));
+    return true;
+}
+
+// 加载完按上传时间重排各名字的旧版本
+void FileCatalog::rebuild_history_()
+{
+    history_.clear();
+    for (const auto &kv : objects_)
+        if (!kv.second.latest)
+            history_[kv.second.name].push_back(kv.first);
+    for (auto &kv : history_)
+        std::sort(kv.second.begin(), kv.second.end(), [this](const std::string &a, const std::string &b) {
+            return objects_.at(a).created < objects_.at(b).created;
+        });
+}
+
+// 名字 name 的旧版本 q（先旧后新）里按保留规则该删的个数，从最旧的数起：超出 keep_versions 的，
+// 或被顶替超过 max_age_sec 的。一个旧版本被顶替的时间取紧接着它的那个版本的上传时间
+size_t FileCatalog::over_retention_(const std::deque<std::string> &q, const std::string &name, time_t now) const
+{
+    auto latest = names_.find(name);
+    size_t n = 0;
+    for (; n < q.size(); ++n)
+    {
+        time_t superseded = n + 1 < q.size() ? objects_.at(q[n + 1]).created
+                            : latest != names_.end() ? objects_.at(latest->second).created
+                                                     : now;
+        bool over = retention_.keep_versions > 0 && q.size() - n > (size_t)retention_.keep_versions;
+        bool old = retention_.max_age_sec > 0 && now - superseded > retention_.max_age_sec;
+        if (!(over || old))
+            break;
+    }
+    return n;
+}
+
+// 先挑出这几个名字下所有该删的旧版本，删除记录一次写进日志、落盘一次，再从内存里删。
+// 日志写不进去就一个都不删（否则重启后对象又回来了，引用却已经减过）
+size_t FileCatalog::prune_locked_(const std::vector<std::string> &names, time_t now, bool log)
+{
+    if (retention_.keep_versions <= 0 && retention_.max_age_sec <= 0)
+        return 0;
+    std::vector<std::pair<std::deque<std::string> *, size_t>> plan;
+    std::string lines;
+    for (const auto &name : names)
+    {
+        auto h = history_.find(name);
+        if (h == history_.end())
+            continue;
+        size_t k = over_retention_(h->second, name, now);
+        if (k == 0)
+            continue;
+        plan.emplace_back(&h->second, k);
+        for (size_t i = 0; i < k; ++i)
+            lines += json{{"oid", h->second[i]}, {"deleted", true}}.dump() + "\n";
+    }
+    if (plan.empty())
+        return 0;
+    if (log && (names_fd_ < 0 || ::write(names_fd_, lines.data(), lines.size()) != (ssize_t)lines.size() ||
+                (durability_ != Durability::NONE && ::fdatasync(names_fd_) != 0)))
+    {
+        LOG_WARN("catalog: log removal of old versions failed: %s", strerror(errno));
+        return 0;
+    }
+    size_t n = 0;
+    for (auto &p : plan)
+    {
+        for (size_t i = 0; i < p.second; ++i)
+        {
+            drop_object_locked_(p.first->front());
+            p.first->pop_front();
+        }
+        n += p.second;
+    }
+    for (const auto &name : names)
+    {
+        auto h = history_.find(name);
+        if (h != history_.end() && h->second.empty())
+            history_.erase(h);
+    }
+    return n;
+}
+
+void FileCatalog::drop_object_locked_(const std::string &oid)
+{
+    auto it = objects_.find(oid);
+    if (it == objects_.end())
+        return;
+    auto r = refs_.find(it->second.hex);
+    if (r != refs_.end() && --r->second <= 0)
+        refs_.erase(r); // blob 由 retire_garbage 挪进回收站
+    LOG_DEBUG("catalog: old version %s of \"%s\" removed", oid.c_str(), it->second.name.c_str());
+    objects_.erase(it);
+}
+
+size_t FileCatalog::expire_versions()
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    if (retention_.max_age_sec <= 0)
+        return 0;
+    time_t now = ::time(nullptr);
+    std::vector<std::string> names;
+    for (const auto &kv : history_)
+        names.push_back(kv.first);
+    return prune_locked_(names, now);
+}
+
+void FileCatalog::point_name_(const std::string &name, const std::string &oid)
+{
+    auto r = names_.emplace(name, oid);
+    if (!r.second)
+    {
+        auto old = objects_.find(r.first->second);
+        if (old != objects_.end())
+        {
+            old->second.latest = false;
+            history_[name].push_back(old->first);
+        }
+        r.first->second = oid;
+    }
+    objects_.at(oid).latest = true;
+}
+
+bool FileCatalog::find_chunk(const std::string &digest, uint64_t len, std::string &blob_path, off_t &off) const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return blobs_.find_chunk(digest, len, blob_path, off);
+}
+
+void FileCatalog::list(const std::string &prefix, const std::string &after, size_t limit,
+                       std::vector<FileEntry> &out, bool &more) const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    more = false;
+    auto it = names_.lower_bound(std::max(prefix, after));
+    if (it != names_.end() && it->first == after)
+        ++it;
+    for (; it != names_.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+    {
+        if (out.size() >= limit)
+        {
+            more = true;
+            break;
+        }
+        const Object &o = objects_.at(it->second);
+        out.push_back(FileEntry{it->second, it->first, o.hex, o.from, o.size, o.created});
+    }
+}
+
+size_t FileCatalog::name_count() const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return names_.size();
+}
+
+size_t FileCatalog::gc()
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    std::unordered_set<std::string> live;
+    for (const auto &kv : refs_)
+        live.insert(kv.first);
+    int64_t freed = 0;
+    size_t n = blobs_.sweep(live, freed);
+    if (n > 0)
+        LOG_INFO("catalog gc: removed %zu blob(s), %lld bytes", n, (long long)freed);
+    return n;
+}
+
+// refs_ 只含还有对象引用的摘要，且每个都有 blob（加载时缺 blob 的对象已丢掉）；
+// 数目对得上说明没有无主的 blob，不用逐个比
+size_t FileCatalog::retire_garbage()
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    if (blobs_.count() == refs_.size())
+        return 0;
+    if (!ensure_dir(trash_dir()))
+        return 0;
+    size_t n = 0;
+    for (const auto &hex : blobs_.hexes())
+        if (!refs_.count(hex) && blobs_.retire(hex, trash_dir()))
+            ++n;
+    return n;
+}
+
+int64_t FileCatalog::log_bytes() const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    struct stat st{};
+    return (names_fd_ >= 0 && ::fstat(names_fd_, &st) == 0) ? (int64_t)st.st_size : 0;
+}
+
+// 启动时：快照 -> 日志。日志里的对象可能已经在快照里（压缩写完快照、还没截日志时崩溃），
+// 按 oid 跳过即可，名字指向也以先加载的为准——快照之后的新对象 oid 一定是新的。
+bool FileCatalog::load_names_()
+{
+    if (!load_snapshot_(root_ + "/.catalog.snap") || !load_log_(root_ + "/.names.log"))
+        return false;
+
+    for (auto it = objects_.begin(); it != objects_.end();)
+    {
+        Object &o = it->second;
+        if (!blobs_.exists(o.hex))
+        {
+            LOG_WARN("catalog: blob %s for \"%s\" (%s) is missing, object dropped", o.hex.c_str(), o.name.c_str(),
+                     it->first.c_str());
+            if (o.latest)
+                names_.erase(o.name);
+            it = objects_.erase(it);
+            dirty_ = true;
+            continue;
+        }
+        if (o.size < 0)
+            o.size = blobs_.size(o.hex); // 早期的日志行没有记大小（日志非空，压缩时自然会写进快照）
+        ++refs_[o.hex];
+        ++it;
+    }
+    rebuild_history_();
+
+    names_fd_ = ::open((root_ + "/.names.log").c_str(), O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0644);
+    if (names_fd_ < 0)
+        LOG_ERROR("catalog: open %s/.names.log failed: %s", root_.c_str(), strerror(errno));
+    return names_fd_ >= 0;
+}
+
+bool FileCatalog::load_snapshot_(const std::string &path)
+{
+    std::string data;
+    if (!read_file(path, data))
+    {
+        if (errno == ENOENT)
+            return true;
+        LOG_ERROR("catalog: read %s failed: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    // 快照是落盘后 rename 上去的，坏了说明磁盘有问题；拒绝启动，免得 gc 按残缺的表删 blob
+    auto corrupt = [&path]() {
+        LOG_ERROR("catalog: snapshot %s is corrupt", path.c_str());
+        return false;
+    };
+    if (data.size() < sizeof(SNAP_MAGIC) + 8 + 4 || data.compare(0, sizeof(SNAP_MAGIC), SNAP_MAGIC, 8) != 0 ||
+        crc32c(0, data.data(), data.size() - 4) != (uint32_t)get_le(data.data() + data.size() - 4, 4))
+        return corrupt();
+
+    const char *p = data.data() + sizeof(SNAP_MAGIC) + 8, *end = data.data() + data.size() - 4;
+    uint64_t count = get_le(data.data() + sizeof(SNAP_MAGIC), 8);
+    objects_.reserve((size_t)count);
+    constexpr size_t FIXED = 1 + 16 + Sha256::DIGEST_SIZE + 8 + 8;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        if ((size_t)(end - p) < FIXED + 4)
+            return corrupt();
+        uint8_t flags = (uint8_t)p[0];
+        std::string oid = get_hex(p + 1, 16);
+        Object o;
+        o.hex = get_hex(p + 17, Sha256::DIGEST_SIZE);
+        o.size = (int64_t)get_le(p + 17 + Sha256::DIGEST_SIZE, 8);
+        o.created = (time_t)(int64_t)get_le(p + 25 + Sha256::DIGEST_SIZE, 8);
+        p += FIXED;
+        for (std::string *s : {&o.name, &o.from})
+        {
+            if ((size_t)(end - p) < 4 || (size_t)(end - p - 4) < get_le(p, 4))
+                return corrupt();
+            size_t n = (size_t)get_le(p, 4);
+            s->assign(p + 4, n);
+            p += 4 + n;
+        }
+        // 当前对象按名字升序写在前面，插入有序表时每次都落在末尾
+        if (flags & SNAP_LATEST)
+        {
+            o.latest = true;
+            names_.emplace_hint(names_.end(), o.name, oid);
+        }
+        objects_.emplace(std::move(oid), std::move(o));
+    }
+    if (p != end)
+        return corrupt();
+    return true;
+}
+
+// 日志：每行 {"oid","name","sha256","size","from","time"}，同名的后写的成为该名字的当前对象；
+// "latest":false 的行只登记对象、不改名字指向（迁移时给撞名的旧文件）；
+// {"oid","deleted":true} 删掉一个旧版本。
+// 更早的版本只有 {"oid","name","sha256"} 或 {"name","sha256"}：缺的大小从 blob 仓库补，
+// 没有 oid 的补发一个。
+bool FileCatalog::load_log_(const std::string &path)
+{
+    std::string data;
+    if (!read_file(path, data))
+    {
+        if (errno == ENOENT)
+            return true;
+        LOG_ERROR("catalog: read %s failed: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::map<std::string, std::string> legacy; // 旧格式：名字 -> 摘要，后写覆盖先写
+    size_t pos = 0;
+    while (pos < data.size())
+    {
+        size_t nl = data.find('\n', pos);
+        if (nl == std::string::npos)
+            break; // 最后一行没写完（崩溃），丢弃
+        try
+        {
+            json j = json::parse(data.substr(pos, nl - pos));
+            std::string oid = j.value("oid", "");
+            if (j.value("deleted", false))
+            {
+                // 按保留规则删掉的旧版本（当前对象不会被删）
+                auto it = objects_.find(oid);
+                if (it != objects_.end() && !it->second.latest)
+                    objects_.erase(it);
+                pos = nl + 1;
+                continue;
+            }
+            std::string name = j.value("name", "");
+            std::string hex = j.value("sha256", "");
+            if (!name.empty() && BlobStore::valid_hex(hex))
+            {
+                if (oid.empty())
+                    legacy[name] = hex;
+                else if (valid_oid(oid) && !objects_.count(oid))
+                {
+                    objects_.emplace(oid, Object{name, hex, j.value("from", ""), j.value("size", (int64_t)-1),
+                                                 (time_t)j.value("time", (int64_t)0)});
+                    if (j.value("latest", true))
+                        point_name_(name, oid);
+                }
+            }
+        }
+        catch (...)
+        {
+        }
+        pos = nl + 1;
+    }
+    for (const auto &kv : legacy)
+    {
+        if (names_.count(kv.first))
+            continue;
+        std::string oid;
+        do
+            oid = new_oid_();
+        while (objects_.count(oid));
+        objects_.emplace(oid, Object{kv.first, kv.second, "", -1, 0});
+        point_name_(kv.first, oid);
+        dirty_ = true;
+    }
+    return true;
+}
+
+std::string FileCatalog::serialize_locked_() const
+{
+    std::string out(SNAP_MAGIC, sizeof(SNAP_MAGIC));
+    put_le(out, objects_.size(), 8);
+    out.reserve(objects_.size() * 128);
+    auto record = [&out](const std::string &oid, const Object &o) {
+        out.push_back((char)(o.latest ? SNAP_LATEST : 0));
+        put_hex(out, oid);
+        put_hex(out, o.hex);
+        put_le(out, (uint64_t)o.size, 8);
+        put_le(out, (uint64_t)(int64_t)o.created, 8);
+        put_le(out, o.name.size(), 4);
+        out += o.name;
+        put_le(out, o.from.size(), 4);
+        out += o.from;
+    };
+    // 先按名字顺序写各名字的当前对象，再写被顶替的旧对象
+    for (const auto &kv : names_)
+        record(kv.second, objects_.at(kv.second));
+    for (const auto &kv : objects_)
+        if (!kv.second.latest)
+            record(kv.first, kv.second);
+    put_le(out, crc32c(0, out.data(), out.size()), 4);
+    return out;
+}
+
+// 锁内只做内存序列化与截日志，写快照（百万条约百 MB）在锁外：
+//   1. 序列化全表，记下此刻日志的长度 L；
+//   2. 快照写临时文件、落盘、rename，再 fsync 目录；
+//   3. 把日志里 L 之后（压缩期间新追加）的行搬进新日志，rename 替换。
+// 任一步崩溃，重启看到的都是「旧快照 + 全量日志」或「新快照 + 全量/剩余日志」，加载时按 oid 去重。
+// 不论 durability 设置，快照都要落盘：之后截掉的日志再也找不回来。
+bool FileCatalog::compact()
+{
+    std::unique_lock<std::mutex> busy(compact_mu_, std::try_to_lock);
+    if (!busy.owns_lock())
+        return true;
+
+    std::string log_path = root_ + "/.names.log", snap_path = root_ + "/.catalog.snap";
+    std::string snap;
+    off_t covered;
+    size_t count;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        struct stat st{};
+        if (names_fd_ < 0 || ::fstat(names_fd_, &st) != 0)
+            return false;
+        covered = st.st_size;
+        if (covered == 0 && !dirty_)
+            return true; // 上次压缩之后没有变化
+        dirty_ = false;
+        count = objects_.size();
+        snap = serialize_locked_();
+    }
+    if (!replace_file(snap_path, snap) || !fsync_dir(root_))
+    {
+        LOG_ERROR("catalog: write snapshot %s failed: %s", snap_path.c_str(), strerror(errno));
+        std::lock_guard<std::mutex> lk(mu_);
+        dirty_ = true;
+        return false;
+    }
+    size_t snap_bytes = snap.size();
+    std::string().swap(snap);
+
+    std::lock_guard<std::mutex> lk(mu_);
+    std::string rest;
+    if (!read_file(log_path, rest, covered))
+    {
+        LOG_ERROR("catalog: reread %s failed: %s", log_path.c_str(), strerror(errno));
+        return false;
+    }
+    if (!replace_file(log_path, rest))
+    {
+        LOG_ERROR("catalog: truncate %s failed: %s", log_path.c_str(), strerror(errno));
+        return false;
+    }
+    ::close(names_fd_);
+    names_fd_ = ::open(log_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (names_fd_ < 0)
+    {
+        LOG_ERROR("catalog: reopen %s failed: %s", log_path.c_str(), strerror(errno));
+        return false;
+    }
+    if (durability_ != Durability::NONE)
+        fsync_dir(root_);
+    LOG_INFO("catalog: snapshot %zu object(s), %zu bytes; log %lld -> %zu bytes", count, snap_bytes,
+             (long long)covered, rest.size());
+    return true;
+}
+
+bool FileCatalog::append_object_(const std::string &oid, const Object &o, bool latest)
+{
+    json j{{"oid", oid}, {"name", o.name}, {"sha256", o.hex}, {"size", o.size}, {"from", o.from},
+           {"time", (int64_t)o.created}};
+    if (!latest)
+        j["latest"] = false;
+    std::string line = j.dump() + "\n";
+    if (names_fd_ < 0 || ::write(names_fd_, line.data(), line.size()) != (ssize_t)line.size())
+    {
+        LOG_WARN("catalog: append object \"%s\" failed: %s", o.name.c_str(), strerror(errno));
+        return false;
+    }
+    if (durability_ != Durability::NONE && ::fdatasync(names_fd_) != 0)
+    {
+        LOG_WARN("catalog: fdatasync names log failed: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
@@ -1,16 +1,181 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <mutex>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <cstdint>
+#include <ctime>
+#include <sys/types.h>
+#include "common/noncopyable.hpp"
+#include "file/blob_store.hpp"
 
-class FileCatalog
+// 已完成文件的元信息（下载时的校验值都从这里取）
+struct FileInfo
+{
+    std::string oid;  // 对象 id；旧版直接落在 root 下的文件为空
+    std::string name; // 显示名
+    int64_t size = 0;
+    time_t mtime = 0;   // Last-Modified：对象的上传时间（没记录的取 blob 的 mtime）
+    std::string etag;   // 强 ETag，含引号：有摘要时就是摘要，旧版平铺的文件用 inode+mtime+大小
+    std::string digest; // 内容 SHA-256（hex）；旧版直接落在 root 下的文件为空
+    int64_t gz_size = -1;  // 有预压缩的 gzip 副本时为其大小（只有 lookup 填）
+    std::string encoding;  // 选中的内容编码："gzip" 时 size / etag 都是副本的，空为原样
+};
+
+// 文件索引里的一条：一个对象的元信息（/files 列表、快照与追加日志里都是它）
+struct FileEntry
+{
+    std::string oid;
+    std::string name;
+    std::string sha256;
+    std::string from; // 上传者（可空）
+    int64_t size = 0;
+    time_t created = 0; // 上传完成（或秒传）的时间；旧数据没有记录时为 0
+};
+
+// 上传数据的落盘策略
+enum class Durability
+{
+    NONE,      // 全靠页缓存回写，掉电可能丢掉刚完成的文件
+    FDATASYNC, // complete 时 fdatasync .part，rename 后 fsync 目录，名字表每行都 fdatasync
+    WRITEBACK  // 同 FDATASYNC，另外每写完一个分片就用 sync_file_range 提前回写，
+               // 脏页不会在 complete 前堆积，fdatasync 时基本无事可做
+};
+
+const char *durability_str(Durability d);
+bool parse_durability(const std::string &s, Durability &d); // "none" / "fdatasync" / "writeback"
+
+// 文件目录：对象 id -> (显示名, 内容摘要) -> blob。
+// 每次上传完成（或秒传）得到一个新对象，对象 id 随机生成、永不复用，聊天里广播的链接
+// 用 id 下载，之后有人再传同名文件也不会把它顶掉；按名字下载取该名字最新的对象。
+// 同样的内容无论上传多少次、叫什么名字都只存一份（root/.blobs，按摘要分两级目录）。
+// 对象表（名字、大小、上传者、时间、摘要）常驻内存：新对象以 JSON 行追加到 root/.names.log，
+// compact() 把全表写成二进制快照 root/.catalog.snap 并截掉已经写进快照的日志；启动时先读快照
+// 再重放日志。列目录只查内存里按名字排好序的表，不碰文件系统。
+// 每个 blob 按引用它的对象数计数，启动时把没有任何对象引用的 blob 扫一遍（gc）。
+// 被顶替的旧对象默认一直留着（聊天里发过的 /download?oid= 链接一直有效）。配了 Retention 才删：
+// 每个名字最多留 keep_versions 个，被顶替超过 max_age_sec 的也删（janitor 定期调 expire_versions），
+// 代价是指向被删版本的旧链接变成 404；删除以 {"oid","deleted":true} 行记进日志（一批只落盘一次），
+// 引用计数归零的 blob 由 retire_garbage 收走。
+// 上传中的 .part 与进度日志在 root/.parts 下按 id 的哈希分两级目录存放。
+// root 下的 .lock 在进程存活期间持有排他 flock，迁移工具与服务不会同时改同一个目录。
+class FileCatalog : NonCopyable
 {
 public:
-    explicit FileCatalog(std::string root) : root_(std::move(root)) {}
-    bool init(); // 确保目录存在（递归创建）
+    // 旧版本（名字已指向更新的对象）的保留规则；0 表示不限（默认全留）
+    struct Retention
+    {
+        int keep_versions = 0; // 每个名字最多留几个旧版本
+        int max_age_sec = 0;   // 旧版本被顶替后最多留多久
+    };
+
+    explicit FileCatalog(std::string root, Durability durability = Durability::NONE);
+    void set_retention(const Retention &r) { retention_ = r; } // init 之前调用
+    ~FileCatalog();
+    bool init(); // 确保目录存在（递归创建），加锁，加载 blob 仓库与对象表，压缩一次并做一次 gc
 
     const std::string &root() const { return root_; }
-    std::string temp_path(const std::string &id) const;    // root/<id>.part
-    std::string final_path(const std::string &name) const; // root/<name>
+    Durability durability() const { return durability_; }
+    std::string temp_path(const std::string &id) const;    // root/.parts/xx/yy/<id>.part
+    std::string journal_path(const std::string &id) const; // <temp_path>.journal（上传进度）
+    bool prepare_temp(const std::string &id) const;        // 建好 id 所在的分片目录
+    std::vector<std::string> journal_ids() const;          // 所有留有进度日志的上传 id
+    std::string final_path(const std::string &name) const; // root/<name>（旧版平铺存放的位置）
+
+    // 以只读方式打开 name 当前对应的（最新的）文件并填写元信息；失败返回 -1（errno 保留）
+    int open_final(const std::string &name, FileInfo &info) const;
+    // 按对象 id 打开
+    int open_object(const std::string &oid, FileInfo &info) const;
+    // 只查内存里的对象表、不碰文件：oid 非空按 id，否则按名字；填 oid / name / size / digest
+    // 与 etag；mtime 只在记有上传时间时填，否则为 0。找不到（包括旧版平铺的文件）返回 false
+    bool lookup(const std::string &oid, const std::string &name, FileInfo &info) const;
+    // 改选 lookup 得到的对象的 gzip 副本（需 gz_size >= 0）：size 换成副本大小，ETag 换成副本自己的
+    static void select_gzip(FileInfo &info);
+    // 打开摘要为 hex 的内容的 gzip 副本；没有时返回 -1
+    int open_gzip(const std::string &hex) const;
+
+    // 仓库里是否已有该内容（摘要与大小都要对上）
+    bool has_blob(const std::string &hex, int64_t size) const;
+    // 以下三个接口读 e 的 name / sha256 / size / from，填回 oid 与 created
+    // 为已有内容建对象并让 name 指向它；name 当前就是这份内容时沿用原对象
+    bool bind(FileEntry &e);
+    // 上传完成：.part 收进仓库（已有则丢弃），建对象并让 name 指向它
+    bool commit(const std::string &part_path, FileEntry &e, size_t chunk_size, const std::vector<std::string> &chunks);
+    // 迁移工具用：把 root 下旧版平铺的文件收进仓库并建对象；name 已被占用时只建对象、不改名字指向。
+    // e.created 非 0 时沿用（原文件的 mtime）
+    bool adopt(const std::string &path, FileEntry &e, size_t chunk_size, const std::vector<std::string> &chunks,
+               bool &named);
+    // 后台压缩用：hex 还在仓库里且没有 gzip 副本时给出 blob 路径与大小
+    bool gzip_source(const std::string &hex, std::string &path, int64_t &size) const;
+    // 压缩好的临时文件 tmp 登记为 hex 的 gzip 副本；blob 已被回收时返回 false，tmp 由调用方删
+    bool attach_gzip(const std::string &hex, const std::string &tmp, int64_t size);
+    // 找一个已存的、内容为 digest（二进制）且长度为 len 的分片
+    bool find_chunk(const std::string &digest, uint64_t len, std::string &blob_path, off_t &off) const;
+
+    // 按名字字典序列出各名字当前的对象：名字以 prefix 开头且严格大于 after，最多 limit 条；
+    // more 表示后面还有。不 stat 任何文件
+    void list(const std::string &prefix, const std::string &after, size_t limit, std::vector<FileEntry> &out,
+              bool &more) const;
+    size_t name_count() const;
+
+    // 把对象表写成快照并截掉日志里已进快照的部分；另一个线程正在压缩时直接返回 true
+    bool compact();
+    int64_t log_bytes() const; // 上次压缩以来追加的日志长度
+
+    // 删除没有对象引用的 blob，返回删除个数
+    size_t gc();
+    // 删掉被顶替超过 max_age_sec 的旧版本，返回删除的对象数（blob 留给 retire_garbage）
+    size_t expire_versions();
+    // 运行期的 gc：只在内存里比对，把没有对象引用的 blob 挪进 trash_dir()，返回挪走的个数；
+    // 删除由调用方（janitor）在锁外限速进行
+    size_t retire_garbage();
+    std::string trash_dir() const { return root_ + "/.blobs/.trash"; }
+
+    static bool valid_oid(const std::string &oid);
 
 private:
+    struct Object
+    {
+        std::string name;
+        std::string hex;
+        std::string from;
+        int64_t size = 0;
+        time_t created = 0;
+        bool latest = false; // 名字当前指向它
+    };
+
+    void point_name_(const std::string &name, const std::string &oid);
+    void rebuild_history_();
+    size_t over_retention_(const std::deque<std::string> &q, const std::string &name, time_t now) const;
+    size_t prune_locked_(const std::vector<std::string> &names, time_t now, bool log = true);
+    void drop_object_locked_(const std::string &oid);
+    bool load_snapshot_(const std::string &path);
+    bool load_log_(const std::string &path);
+    bool load_names_();
+    std::string serialize_locked_() const;
+    bool append_object_(const std::string &oid, const Object &o, bool latest);
+    bool bind_locked_(FileEntry &e, bool take_name = true);
+    bool put_locked_(const std::string &path, const std::string &hex, int64_t size, size_t chunk_size,
+                     const std::vector<std::string> &chunks);
+    int open_blob_(const std::string &path, FileInfo &info) const;
+    static void object_tags_(const Object &o, FileInfo &info);
+    std::string shard_dir_(const std::string &id) const;
+    static std::string new_oid_();
+    static bool legacy_name_ok_(const std::string &name);
+
     std::string root_;
+    Durability durability_;
+    mutable std::mutex mu_;
+    BlobStore blobs_;
+    std::unordered_map<std::string, Object> objects_; // 对象 id -> 对象
+    std::map<std::string, std::string> names_;        // 名字 -> 最新的对象 id（有序，列表按它翻页）
+    std::unordered_map<std::string, int> refs_;       // 摘要 -> 引用它的对象数（归零即删掉）
+    std::unordered_map<std::string, std::deque<std::string>> history_; // 名字 -> 旧版本 oid，先旧后新
+    Retention retention_;
+    int names_fd_ = -1;                               // .names.log（O_APPEND）
+    int lock_fd_ = -1;                                // root/.lock
+    std::mutex compact_mu_;                           // 同时只跑一次压缩
+    bool dirty_ = false; // 加载时改过的内容（补发的 oid、丢掉的对象）还没进快照
 };
@@ -0,0 +1,216 @@
+#include "file/janitor.hpp"
+#include "common/logger.hpp"
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace
+{
+    // <linux/ioprio.h> 不一定装了，直接写常量
+    constexpr int IOPRIO_WHO_PROCESS = 1;
+    constexpr int IOPRIO_CLASS_IDLE = 3;
+    constexpr int IOPRIO_CLASS_SHIFT = 13;
+
+    std::vector<std::string> list_dir(const std::string &dir)
+    {
+        std::vector<std::string> out;
+        if (DIR *d = ::opendir(dir.c_str()))
+        {
+            while (dirent *e = ::readdir(d))
+                if (e->d_name[0] != '.')
+                    out.push_back(e->d_name);
+            ::closedir(d);
+        }
+        return out;
+    }
+
+    bool ends_with(const std::string &s, const std::string &suffix)
+    {
+        return s.size() > suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+} // namespace
+
+Janitor::Janitor(FileCatalog &catalog, UploadSessions &sessions, const Options &opt)
+    : catalog_(catalog), sessions_(sessions), opt_(opt) {}
+
+Janitor::~Janitor() { stop(); }
+
+void Janitor::start()
+{
+    th_ = std::thread([this] { loop_(); });
+}
+
+void Janitor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (th_.joinable())
+        th_.join();
+}
+
+Janitor::Stats Janitor::stats() const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return st_;
+}
+
+bool Janitor::stopping_()
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return stop_;
+}
+
+void Janitor::loop_()
+{
+    // 只影响本线程：磁盘空闲时才轮到它，CPU 也让着事件循环
+    pid_t tid = (pid_t)::syscall(SYS_gettid);
+    if (::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+        LOG_WARN("janitor: ioprio_set failed: %s", strerror(errno));
+    ::setpriority(PRIO_PROCESS, (id_t)tid, 19);
+
+    for (;;)
+    {
+        run_once();
+        std::unique_lock<std::mutex> lk(mu_);
+        if (cv_.wait_for(lk, std::chrono::seconds(opt_.interval_sec), [this] { return stop_; }))
+            break;
+    }
+}
+
+void Janitor::run_once()
+{
+    run_ = Stats{};
+    batch_n_ = 0;
+    batch_bytes_ = 0;
+    time_t cutoff = ::time(nullptr) - opt_.ttl_sec;
+
+    expire_sessions_(cutoff);
+    sweep_parts_(cutoff);
+    run_.versions += catalog_.expire_versions();
+    empty_trash_();
+    if (!stopping_() && catalog_.log_bytes() >= opt_.compact_log_bytes)
+        catalog_.compact();
+
+    std::lock_guard<std::mutex> lk(mu_);
+    ++st_.runs;
+    st_.expired += run_.expired;
+    st_.orphans += run_.orphans;
+    st_.versions += run_.versions;
+    st_.blobs += run_.blobs;
+    st_.reclaimed += run_.reclaimed;
+    if (run_.expired || run_.orphans || run_.versions || run_.blobs)
+        LOG_INFO("janitor: expired %llu upload(s) and %llu old version(s), removed %llu orphan file(s) and %llu "
+                 "blob(s), reclaimed %lld bytes (total %lld)",
+                 (unsigned long long)run_.expired, (unsigned long long)run_.versions,
+                 (unsigned long long)run_.orphans, (unsigned long long)run_.blobs, (long long)run_.reclaimed,
+                 (long long)st_.reclaimed);
+}
+
+// 先删进度日志再删 .part：中途停下时，重启也不会把它当成可续传的上传恢复回来
+void Janitor::expire_sessions_(time_t cutoff)
+{
+    for (const auto &id : sessions_.expire(cutoff))
+    {
+        LOG_INFO("janitor: upload %s idle for over %ds, expired", id.c_str(), opt_.ttl_sec);
+        remove_(catalog_.journal_path(id));
+        remove_(catalog_.temp_path(id));
+        ++run_.expired;
+    }
+}
+
+void Janitor::sweep_parts_(time_t cutoff)
+{
+    std::string parts = catalog_.root() + "/.parts";
+    unsigned dirs = 0;
+    for (const auto &a : list_dir(parts))
+        for (const auto &b : list_dir(parts + "/" + a))
+        {
+            if (stopping_())
+                return;
+            std::string dir = parts + "/" + a + "/" + b;
+            for (const auto &fn : list_dir(dir))
+            {
+                std::string id;
+                if (ends_with(fn, ".part"))
+                    id = fn.substr(0, fn.size() - 5);
+                else if (ends_with(fn, ".part.journal"))
+                    id = fn.substr(0, fn.size() - 13);
+                else
+                    continue;
+                struct stat st{};
+                if (::lstat((dir + "/" + fn).c_str(), &st) != 0 || st.st_mtime >= cutoff || sessions_.active(id))
+                    continue;
+                if (remove_(dir + "/" + fn))
+                    ++run_.orphans;
+            }
+            if (++dirs % opt_.dirs_per_pause == 0)
+                throttle_(opt_.batch_files, 0);
+        }
+}
+
+void Janitor::empty_trash_()
+{
+    run_.blobs += catalog_.retire_garbage();
+    std::string trash = catalog_.trash_dir();
+    for (const auto &fn : list_dir(trash))
+        remove_(trash + "/" + fn);
+}
+
+bool Janitor::remove_(const std::string &path)
+{
+    struct stat st{};
+    if (::lstat(path.c_str(), &st) != 0)
+        return errno == ENOENT;
+    int64_t used = (int64_t)st.st_blocks * 512;
+
+    // 大文件从尾部分步截断，每步释放 batch_bytes
+    if (S_ISREG(st.st_mode) && st.st_size > opt_.batch_bytes)
+    {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd >= 0)
+        {
+            for (off_t len = st.st_size; len > opt_.batch_bytes;)
+            {
+                len -= (off_t)opt_.batch_bytes;
+                if (::ftruncate(fd, len) != 0)
+                    break;
+                throttle_(0, opt_.batch_bytes);
+            }
+            ::close(fd);
+        }
+    }
+    if (::unlink(path.c_str()) != 0)
+    {
+        if (errno == ENOENT)
+            return true;
+        LOG_WARN("janitor: unlink %s failed: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    run_.reclaimed += used;
+    throttle_(1, std::min(used, opt_.batch_bytes));
+    return true;
+}
+
+// 累计到一批就停 pause_ms；收到 stop 时不再停，尽快跑完当前这一步退出
+void Janitor::throttle_(unsigned files, int64_t bytes)
+{
+    batch_n_ += files;
+    batch_bytes_ += bytes;
+    if (batch_n_ < opt_.batch_files && batch_bytes_ < opt_.batch_bytes)
+        return;
+    batch_n_ = 0;
+    batch_bytes_ = 0;
+    std::unique_lock<std::mutex> lk(mu_);
+    cv_.wait_for(lk, std::chrono::milliseconds(opt_.pause_ms), [this] { return stop_; });
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <sys/types.h>
+#include "common/noncopyable.hpp"
+#include "file/file_catalog.hpp"
+#include "file/upload_sessions.hpp"
+
+// 后台清理线程，每隔 interval 秒跑一轮：
+//  - 上传会话超过 ttl 秒没有动静：移出会话表，删掉 .part 与进度日志；
+//  - .parts 下没有会话认领、且同样超过 ttl 没改过的 .part / .part.journal（崩溃或坏日志留下的）；
+//  - 被顶替超过保留期的旧版本（FileCatalog::expire_versions）；
+//  - 没有对象引用的 blob：FileCatalog 在锁内挪进 .blobs/.trash，这里在锁外删；
+//  - 对象表日志超过 compact_log_bytes 时压缩一次。
+// 线程本身是 idle I/O 调度类 + nice 19；删除按批进行，每批（个数或字节数到上限）之后停一下，
+// 大文件先分步 ftruncate 再 unlink，一次释放的 extent 不会多到卡住正在进行的传输。
+class Janitor : NonCopyable
+{
+public:
+    struct Options
+    {
+        int interval_sec = 300;
+        int ttl_sec = 24 * 3600;
+        unsigned batch_files = 64;                  // 每批最多删几个文件
+        int64_t batch_bytes = 1LL << 30;            // 每批最多释放多少字节（也是分步截断的步长）
+        int pause_ms = 100;                         // 批与批之间停多久
+        unsigned dirs_per_pause = 256;              // 扫 .parts 时每扫这么多个目录停一下
+        int64_t compact_log_bytes = 64LL << 20;     // 对象表日志超过这么大就压缩
+    };
+
+    struct Stats
+    {
+        uint64_t runs = 0;
+        uint64_t expired = 0; // 过期的上传会话
+        uint64_t orphans = 0; // 无主的 .part / 进度日志
+        uint64_t versions = 0; // 过了保留期的旧版本对象
+        uint64_t blobs = 0;   // 无引用的 blob
+        int64_t reclaimed = 0; // 释放的磁盘空间（按实际占用的块算）
+    };
+
+    Janitor(FileCatalog &catalog, UploadSessions &sessions, const Options &opt);
+    ~Janitor();
+
+    void start();
+    void stop();
+    void run_once(); // 同步跑一轮（测试/工具用）
+    Stats stats() const;
+
+private:
+    void loop_();
+    void expire_sessions_(time_t cutoff);
+    void sweep_parts_(time_t cutoff);
+    void empty_trash_();
+    bool remove_(const std::string &path); // 限速删除；失败（ENOENT 除外）返回 false
+    void throttle_(unsigned files, int64_t bytes);
+    bool stopping_();
+
+    FileCatalog &catalog_;
+    UploadSessions &sessions_;
+    Options opt_;
+
+    std::thread th_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    Stats st_;
+
+    // 当前这一轮与当前批次（只在清理线程里用）
+    Stats run_;
+    unsigned batch_n_ = 0;
+    int64_t batch_bytes_ = 0;
+};
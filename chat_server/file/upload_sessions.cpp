@@ -0,0 +1,772 @@
+#include "file/upload_sessions.hpp"
+#include "common/logger.hpp"
+#include <nlohmann/json.hpp>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <random>
+
+UploadSessions::UploadSessions(FileCatalog &catalog, size_t max_open_fds)
+    : catalog_(catalog), max_open_fds_(max_open_fds ? max_open_fds : 1)
+{
+    bg_ = std::thread([this] { bg_loop_(); });
+}
+
+using json = nlohmann::json;
+
+UploadSessions::~UploadSessions()
+{
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        bg_stop_ = true;
+    }
+    bg_cv_.notify_one();
+    if (bg_.joinable())
+        bg_.join();
+    for (auto &kv : sessions_)
+    {
+        if (kv.second.fd >= 0)
+            ::close(kv.second.fd);
+        if (kv.second.jfd >= 0)
+            ::close(kv.second.jfd);
+    }
+    for (int fd : efds_)
+        ::close(fd);
+}
+
+std::string UploadSessions::new_id()
+{
+    // 简易 UUID；上传会话会跨重启保留，所以不能用未播种的 rand()，否则重启后 id 会重复。
+    // HTTP 线程和聊天线程都会调，各用各的生成器
+    static thread_local std::mt19937 rng{std::random_device{}()};
+    char s[37] = {0};
+    unsigned v[16];
+    for (int i = 0; i < 16; ++i)
+        v[i] = (unsigned)rng();
+    std::snprintf(s, sizeof(s),
+                  "%08x-%04x-%04x-%04x-%04x%08x",
+                  v[0], v[1] & 0xffffu, v[2] & 0xffffu, v[3] & 0xffffu, v[4] & 0xffffu, v[5]);
+    return s;
+}
+
+const char *UploadSessions::status_str(Status st)
+{
+    switch (st)
+    {
+    case OK:
+        return "ok";
+    case NOT_FOUND:
+        return "unknown upload id";
+    case BAD_SEQ:
+        return "bad seq";
+    case BAD_LENGTH:
+        return "chunk length mismatch";
+    case INCOMPLETE:
+        return "missing chunks";
+    case BUSY:
+        return "too many parallel chunks";
+    case IN_FLIGHT:
+        return "chunk already in flight";
+    case NO_SPACE:
+        return "insufficient storage";
+    case PENDING:
+        return "digest pending";
+    case IO_ERROR:
+        return "io error";
+    }
+    return "unknown";
+}
+
+UploadSessions::Status UploadSessions::create(const std::string &id, const std::string &name,
+                                              int64_t size, size_t chunk_size, int max_parallel,
+                                              const std::string &sha256)
+{
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (sessions_.count(id))
+            return IO_ERROR; // id 冲突，不覆盖已有会话
+    }
+    auto tmp = catalog_.temp_path(id);
+    int fd = catalog_.prepare_temp(id) ? ::open(tmp.c_str(), O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    if (fd < 0)
+    {
+        LOG_WARN("upload %s: open %s failed: %s", id.c_str(), tmp.c_str(), strerror(errno));
+        return IO_ERROR;
+    }
+    // 一次分到位：乱序/并行写入的分片不会把文件切成碎 extent，空间不够在 init 就失败，
+    // 而不是传到一半才 ENOSPC。文件系统不支持时（EOPNOTSUPP）照常上传。
+    if (::fallocate(fd, 0, 0, (off_t)size) != 0 && errno != EOPNOTSUPP)
+    {
+        int e = errno;
+        LOG_WARN("upload %s: fallocate %lld failed: %s", id.c_str(), (long long)size, strerror(e));
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        return (e == ENOSPC || e == EDQUOT || e == EFBIG) ? NO_SPACE : IO_ERROR;
+    }
+
+    time_t now = time(nullptr);
+    auto jpath = catalog_.journal_path(id);
+    int jfd = ::open(jpath.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    std::string head = json{{"v", 1}, {"name", name}, {"size", size},
+                            {"chunk_size", chunk_size}, {"parallel", max_parallel},
+                            {"sha256", sha256}, {"created", (long long)now}}.dump() + "\n";
+    if (jfd < 0 || ::write(jfd, head.data(), head.size()) != (ssize_t)head.size())
+    {
+        LOG_WARN("upload %s: write journal failed: %s", id.c_str(), strerror(errno));
+        if (jfd >= 0)
+            ::close(jfd);
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        ::unlink(jpath.c_str());
+        return IO_ERROR;
+    }
+
+    std::lock_guard<std::mutex> lk(mu_);
+    UploadSession &s = sessions_[id];
+    s.id = id;
+    s.name = name;
+    s.size = size;
+    s.chunk_size = chunk_size;
+    s.chunk_count = (uint64_t)((size + (int64_t)chunk_size - 1) / (int64_t)chunk_size);
+    s.bitmap.assign((size_t)((s.chunk_count + 63) / 64), 0);
+    s.received = 0;
+    s.sha256 = sha256;
+    s.max_parallel = max_parallel > 0 ? max_parallel : 1;
+    s.created = s.last_active = now;
+    s.fd = fd;
+    s.jfd = jfd;
+    ++open_fds_;
+    touch_lru_(s);
+    evict_();
+    return OK;
+}
+
+UploadSessions::Status UploadSessions::begin_chunk(const std::string &id, uint64_t seq, uint64_t len,
+                                                   int &fd, off_t &off)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end())
+        return NOT_FOUND;
+    UploadSession &s = it->second;
+    if (seq >= s.chunk_count)
+        return BAD_SEQ;
+    if (len != s.chunk_len(seq))
+        return BAD_LENGTH;
+    if (std::find(s.inflight.begin(), s.inflight.end(), seq) != s.inflight.end())
+        return IN_FLIGHT;
+    if ((int)s.inflight.size() >= s.max_parallel)
+        return BUSY;
+    if (s.fd < 0 && open_fd_(s) < 0)
+        return IO_ERROR;
+
+    s.inflight.push_back(seq);
+    s.inflight_bytes += len;
+    s.peak_inflight = std::max(s.peak_inflight, (int)s.inflight.size());
+    touch_lru_(s);
+    evict_();
+    s.last_active = time(nullptr);
+    fd = s.fd;
+    off = (off_t)(seq * s.chunk_size);
+    return OK;
+}
+
+UploadSessions::Status UploadSessions::end_chunk(const std::string &id, uint64_t seq, bool ok)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end())
+        return NOT_FOUND;
+    UploadSession &s = it->second;
+    auto f = std::find(s.inflight.begin(), s.inflight.end(), seq);
+    if (f == s.inflight.end())
+        return NOT_FOUND;
+    s.inflight.erase(f);
+    s.inflight_bytes -= s.chunk_len(seq);
+    s.last_active = time(nullptr);
+    Status st = OK;
+    if (ok && !s.has(seq))
+    {
+        if (!append_journal_(s, seq))
+            st = IO_ERROR; // 没记进日志就不算到齐，客户端重传
+        else
+        {
+            s.mark(seq);
+            ++s.received;
+            if (catalog_.durability() == Durability::WRITEBACK)
+                writeback_(s, seq);
+            notify_();
+        }
+    }
+    // 摘要交给后台线程接着算；上次读回失败而停在原地的也在这里重试（同一分片重传时 has(seq) 已为真）
+    if (ok && st == OK && s.hashed < s.chunk_count && s.has(s.hashed))
+    {
+        s.digest_failed = false;
+        schedule_(s);
+    }
+    evict_();
+    return st;
+}
+
+// copy_file_range 在支持 reflink 的文件系统上只改元数据；跨文件系统等情况退回 pread/pwrite
+static bool copy_range(int src, off_t src_off, int dst, off_t dst_off, uint64_t len)
+{
+    while (len > 0)
+    {
+        loff_t in = src_off, out = dst_off;
+        ssize_t n = ::copy_file_range(src, &in, dst, &out, len, 0);
+        if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL))
+        {
+            char buf[64 * 1024];
+            n = ::pread(src, buf, std::min<uint64_t>(len, sizeof(buf)), src_off);
+            if (n > 0 && ::pwrite(dst, buf, (size_t)n, dst_off) != n)
+                return false;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        src_off += n;
+        dst_off += n;
+        len -= (uint64_t)n;
+    }
+    return true;
+}
+
+uint64_t UploadSessions::prefill(const std::string &id, const std::vector<std::string> &chunk_digests)
+{
+    uint64_t reused = 0;
+    std::string src_path;
+    int src_fd = -1;
+    for (uint64_t seq = 0; seq < chunk_digests.size(); ++seq)
+    {
+        uint64_t len;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto it = sessions_.find(id);
+            if (it == sessions_.end() || seq >= it->second.chunk_count)
+                break;
+            if (it->second.has(seq))
+                continue;
+            len = it->second.chunk_len(seq);
+        }
+        std::string blob;
+        off_t src_off;
+        if (!catalog_.find_chunk(chunk_digests[seq], len, blob, src_off))
+            continue;
+        if (blob != src_path)
+        {
+            if (src_fd >= 0)
+                ::close(src_fd);
+            src_path = blob;
+            src_fd = ::open(blob.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        int fd;
+        off_t off;
+        if (src_fd < 0 || begin_chunk(id, seq, len, fd, off) != OK)
+            continue;
+        bool ok = copy_range(src_fd, src_off, fd, off, len);
+        if (end_chunk(id, seq, ok) == OK && ok)
+            ++reused;
+    }
+    if (src_fd >= 0)
+        ::close(src_fd);
+    return reused;
+}
+
+UploadSessions::Status UploadSessions::finish(const std::string &id, int64_t size, UploadResult &out, bool sync)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end())
+        return NOT_FOUND;
+    UploadSession &s = it->second;
+    if (s.size != size)
+        return BAD_LENGTH;
+    if (!s.complete() || !s.inflight.empty())
+        return INCOMPLETE;
+    // 摘要还差最后几片（后台线程还在算，或重启恢复的会话从头算）：等通知再来。
+    // 读回失败报一次 IO_ERROR，同时重新排上，客户端再 complete 时接着算
+    if (s.hashed < s.chunk_count)
+    {
+        Status st = s.digest_failed ? IO_ERROR : PENDING;
+        s.digest_failed = false;
+        schedule_(s);
+        return st;
+    }
+    if (sync && catalog_.durability() != Durability::NONE)
+    {
+        if (s.fd < 0 && open_fd_(s) < 0)
+            return IO_ERROR;
+        if (::fdatasync(s.fd) != 0)
+        {
+            LOG_WARN("upload %s: fdatasync failed: %s", id.c_str(), strerror(errno));
+            return IO_ERROR;
+        }
+    }
+
+    uint8_t d[Sha256::DIGEST_SIZE];
+    s.hasher.final(d);
+    out.sha256 = Sha256::to_hex(d);
+    out.chunk_digests = std::move(s.chunk_digests);
+    out.chunk_size = s.chunk_size;
+    out.claimed_sha256 = s.sha256;
+    drop_fd_(s);
+    out.part_path = catalog_.temp_path(id);
+    ::unlink(catalog_.journal_path(id).c_str());
+    finished_[id] = s.size;
+    finished_order_.push_back(id);
+    if (finished_order_.size() > MAX_FINISHED)
+    {
+        finished_.erase(finished_order_.front());
+        finished_order_.pop_front();
+    }
+    sessions_.erase(it);
+    notify_();
+    return OK;
+}
+
+UploadSessions::Status UploadSessions::tail(const std::string &id, int64_t &ready, int64_t &size, bool &done)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end())
+    {
+        auto f = finished_.find(id);
+        if (f == finished_.end())
+            return NOT_FOUND;
+        ready = size = f->second;
+        done = true;
+        return OK;
+    }
+    const UploadSession &s = it->second;
+    uint64_t seq = s.hashed; // hashed 之前的一定都到齐了
+    while (seq < s.chunk_count && s.has(seq))
+        ++seq;
+    size = s.size;
+    ready = std::min<int64_t>(s.size, (int64_t)(seq * s.chunk_size));
+    done = false;
+    return OK;
+}
+
+int UploadSessions::subscribe()
+{
+    int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_WARN("upload sessions: eventfd failed: %s", strerror(errno));
+        return -1;
+    }
+    std::lock_guard<std::mutex> lk(mu_);
+    efds_.push_back(fd);
+    return fd;
+}
+
+void UploadSessions::drain_notify(int fd)
+{
+    uint64_t v;
+    while (::read(fd, &v, sizeof(v)) > 0)
+    {
+        // 读到 EAGAIN 为止
+    }
+}
+
+// 调用方持有 mu_
+void UploadSessions::notify_()
+{
+    uint64_t one = 1;
+    for (int fd : efds_)
+        (void)::write(fd, &one, sizeof(one));
+}
+
+bool UploadSessions::writeback_behind(const std::string &id)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = sessions_.find(id);
+    return it != sessions_.end() && it->second.wb_pending > it->second.chunk_size;
+}
+
+UploadSessions::Status UploadSessions::query(const std::string &id, UploadStatus &out)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = sessions_.find(id);
+    if (it == sessions_.end())
+        return NOT_FOUND;
+    const UploadSession &s = it->second;
+    out.name = s.name;
+    out.size = s.size;
+    out.chunk_size = s.chunk_size;
+    out.chunk_count = s.chunk_count;
+    out.received = s.received;
+    out.max_parallel = s.max_parallel;
+    out.inflight = (int)s.inflight.size();
+    out.inflight_bytes = s.inflight_bytes;
+    out.peak_inflight = s.peak_inflight;
+    out.missing.clear();
+
+    // 按 64 位一组跳过已满的字，只在有缺口的字里逐位找
+    uint64_t seq = 0;
+    while (seq < s.chunk_count)
+    {
+        if ((seq & 63) == 0 && s.bitmap[seq >> 6] == ~uint64_t(0))
+        {
+            seq += 64;
+            continue;
+        }
+        if (s.has(seq))
+        {
+            ++seq;
+            continue;
+        }
+        uint64_t first = seq;
+        while (seq < s.chunk_count && !s.has(seq))
+            ++seq;
+        out.missing.emplace_back(first, seq - 1);
+    }
+    return OK;
+}
+
+size_t UploadSessions::recover()
+{
+    size_t n = 0;
+    for (const auto &id : catalog_.journal_ids())
+        if (load_journal_(id))
+            ++n;
+    if (n > 0)
+        LOG_INFO("recovered %zu upload session(s) from journals", n);
+    return n;
+}
+
+std::vector<std::string> UploadSessions::expire(time_t cutoff)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    std::vector<std::string> ids;
+    for (auto it = sessions_.begin(); it != sessions_.end();)
+    {
+        UploadSession &s = it->second;
+        if (s.last_active >= cutoff || !s.inflight.empty())
+        {
+            ++it;
+            continue;
+        }
+        drop_fd_(s);
+        ids.push_back(it->first);
+        it = sessions_.erase(it);
+    }
+    if (!ids.empty())
+        notify_(); // 边传边下的下载方据此断开
+    return ids;
+}
+
+bool UploadSessions::active(const std::string &id)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return sessions_.count(id) != 0;
+}
+
+size_t UploadSessions::count()
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    return sessions_.size();
+}
+
+bool UploadSessions::load_journal_(const std::string &id)
+{
+    auto jpath = catalog_.journal_path(id);
+    auto tmp = catalog_.temp_path(id);
+    int jfd = ::open(jpath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (jfd < 0)
+        return false;
+    std::string data;
+    char buf[64 * 1024];
+    ssize_t r;
+    while ((r = ::read(jfd, buf, sizeof(buf))) > 0)
+        data.append(buf, (size_t)r);
+    ::close(jfd);
+
+    auto nl = data.find('\n');
+    std::string name;
+    long long size = 0, created = 0;
+    size_t chunk_size = 0;
+    int parallel = 1;
+    std::string sha256;
+    try
+    {
+        if (nl == std::string::npos)
+            nl = data.size();
+        json head = json::parse(data.substr(0, nl));
+        name = head.value("name", "");
+        size = head.value("size", 0LL);
+        chunk_size = head.value("chunk_size", (size_t)0);
+        created = head.value("created", 0LL);
+        parallel = head.value("parallel", 1);
+        sha256 = head.value("sha256", "");
+    }
+    catch (...)
+    {
+        size = 0;
+    }
+    if (size <= 0 || chunk_size == 0)
+    {
+        LOG_WARN("upload %s: bad journal header, ignored", id.c_str());
+        return false;
+    }
+    struct stat st{};
+    if (::stat(tmp.c_str(), &st) != 0)
+    {
+        LOG_WARN("upload %s: journal without .part, ignored", id.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lk(mu_);
+    UploadSession &s = sessions_[id];
+    s.id = id;
+    s.name = name;
+    s.size = size;
+    s.chunk_size = chunk_size;
+    s.created = (time_t)created;
+    s.last_active = st.st_mtime;
+    s.max_parallel = parallel > 0 ? parallel : 1;
+    s.sha256 = sha256;
+    s.chunk_count = (uint64_t)((s.size + (int64_t)s.chunk_size - 1) / (int64_t)s.chunk_size);
+    s.bitmap.assign((size_t)((s.chunk_count + 63) / 64), 0);
+    s.received = 0;
+
+    // 末尾不足 8 字节的残缺记录（写到一半崩溃）直接丢弃
+    for (size_t p = nl + 1; p + 8 <= data.size(); p += 8)
+    {
+        uint64_t seq = 0;
+        for (int i = 7; i >= 0; --i)
+            seq = (seq << 8) | (unsigned char)data[p + (size_t)i];
+        if (seq < s.chunk_count && !s.has(seq))
+        {
+            s.mark(seq);
+            ++s.received;
+        }
+    }
+    if (s.received > 0)
+        schedule_(s); // 摘要从头算，趁客户端补分片的时候算
+    return true;
+}
+
+bool UploadSessions::append_journal_(UploadSession &s, uint64_t seq)
+{
+    if (s.jfd < 0)
+    {
+        auto jpath = catalog_.journal_path(s.id);
+        s.jfd = ::open(jpath.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    unsigned char rec[8];
+    for (int i = 0; i < 8; ++i)
+        rec[i] = (unsigned char)(seq >> (8 * i));
+    if (s.jfd < 0 || ::write(s.jfd, rec, sizeof(rec)) != (ssize_t)sizeof(rec))
+    {
+        LOG_WARN("upload %s: journal append failed: %s", s.id.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// 刚写完的分片交给后台线程回写：每个上传没落盘的不超过一两片，写入速度超过磁盘时调用方按
+// writeback_behind() 暂停收数据（反压到 TCP 窗口），而不是在 complete 时一次 fdatasync 几个 GB
+void UploadSessions::writeback_(UploadSession &s, uint64_t seq)
+{
+    off_t len = (off_t)s.chunk_len(seq);
+    s.wb_ranges.emplace_back((off_t)(seq * s.chunk_size), len);
+    s.wb_pending += (uint64_t)len;
+    schedule_(s);
+}
+
+void UploadSessions::schedule_(UploadSession &s)
+{
+    if (s.queued)
+        return;
+    s.queued = true;
+    bg_queue_.push_back(s.id);
+    bg_cv_.notify_one();
+}
+
+void UploadSessions::bg_loop_()
+{
+    std::unique_lock<std::mutex> lk(mu_);
+    for (;;)
+    {
+        bg_cv_.wait(lk, [this] { return bg_stop_ || !bg_queue_.empty(); });
+        if (bg_stop_)
+            return;
+        std::string id = std::move(bg_queue_.front());
+        bg_queue_.pop_front();
+        lk.unlock();
+        bg_run_(id);
+        lk.lock();
+    }
+}
+
+// 后台线程处理一个会话：先等回写，再把紧接着 hashed 的已到齐分片读回来算进摘要，直到遇到空洞。
+// 在锁里取走要做的活，放开锁做 I/O，再回锁里记结果；I/O 用自己 dup/open 的 fd：期间会话的 fd
+// 被淘汰、上传完成甚至会话被清掉都不影响，回来再按 id 查。摘要只有这个线程推进，不会有两份同时在算
+void UploadSessions::bg_run_(const std::string &id)
+{
+    std::vector<std::pair<off_t, off_t>> ranges;
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = sessions_.find(id);
+        if (it == sessions_.end())
+            return;
+        UploadSession &s = it->second;
+        s.queued = false;
+        ranges.swap(s.wb_ranges);
+        if (ranges.empty() && !(s.hashed < s.chunk_count && s.has(s.hashed)))
+            return;
+        if (s.fd >= 0)
+            fd = ::fcntl(s.fd, F_DUPFD_CLOEXEC, 0);
+    }
+    if (fd < 0)
+        fd = ::open(catalog_.temp_path(id).c_str(), O_RDWR | O_CLOEXEC);
+
+    if (!ranges.empty())
+    {
+        uint64_t bytes = 0;
+        for (const auto &r : ranges)
+        {
+            if (fd >= 0)
+                ::sync_file_range(fd, r.first, r.second, SYNC_FILE_RANGE_WRITE);
+            bytes += (uint64_t)r.second;
+        }
+        for (const auto &r : ranges)
+            if (fd >= 0)
+                ::sync_file_range(fd, r.first, r.second,
+                                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = sessions_.find(id);
+        if (it != sessions_.end())
+        {
+            it->second.wb_pending -= std::min(bytes, it->second.wb_pending);
+            notify_();
+        }
+    }
+
+    if (bg_buf_.empty())
+        bg_buf_.resize(1024 * 1024);
+    for (;;)
+    {
+        // 在副本上算，整片读完才替换 s.hasher：中途读失败时已读的部分不会留在摘要里，重试不会重复喂
+        Sha256 whole, piece;
+        uint64_t seq;
+        off_t off;
+        uint64_t left;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto it = sessions_.find(id);
+            if (it == sessions_.end())
+                break;
+            UploadSession &s = it->second;
+            if (!(s.hashed < s.chunk_count && s.has(s.hashed)))
+                break;
+            whole = s.hasher;
+            seq = s.hashed;
+            off = (off_t)(seq * s.chunk_size);
+            left = s.chunk_len(seq);
+        }
+        ssize_t r = fd < 0 ? -1 : 0;
+        while (left > 0 && fd >= 0)
+        {
+            r = ::pread(fd, bg_buf_.data(), std::min<uint64_t>(left, bg_buf_.size()), off);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                break;
+            whole.update(bg_buf_.data(), (size_t)r);
+            piece.update(bg_buf_.data(), (size_t)r);
+            off += r;
+            left -= (uint64_t)r;
+        }
+
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = sessions_.find(id);
+        if (it == sessions_.end())
+            break;
+        UploadSession &s = it->second;
+        if (left > 0)
+        {
+            LOG_WARN("upload %s: read back chunk %llu failed: %s", id.c_str(), (unsigned long long)seq,
+                     r == 0 ? "short file" : strerror(errno));
+            s.digest_failed = true; // 等分片重传或 finish 再排上
+            notify_();
+            break;
+        }
+        uint8_t d[Sha256::DIGEST_SIZE];
+        piece.final(d);
+        s.hasher = whole;
+        s.chunk_digests.emplace_back((const char *)d, sizeof(d));
+        ++s.hashed;
+        if (s.hashed == s.chunk_count)
+            notify_(); // 等着 finish 的一方可以来了
+    }
+    if (fd >= 0)
+        ::close(fd);
+}
+
+int UploadSessions::open_fd_(UploadSession &s)
+{
+    auto tmp = catalog_.temp_path(s.id);
+    s.fd = ::open(tmp.c_str(), O_RDWR | O_CLOEXEC);
+    if (s.fd < 0)
+    {
+        LOG_WARN("upload %s: reopen %s failed: %s", s.id.c_str(), tmp.c_str(), strerror(errno));
+        return -1;
+    }
+    ++open_fds_;
+    return s.fd;
+}
+
+void UploadSessions::touch_lru_(UploadSession &s)
+{
+    if (s.in_lru)
+        lru_.erase(s.lru_it);
+    lru_.push_front(&s);
+    s.lru_it = lru_.begin();
+    s.in_lru = true;
+}
+
+void UploadSessions::drop_fd_(UploadSession &s)
+{
+    if (s.in_lru)
+    {
+        lru_.erase(s.lru_it);
+        s.in_lru = false;
+    }
+    if (s.fd >= 0)
+    {
+        ::close(s.fd);
+        s.fd = -1;
+        --open_fds_;
+    }
+    if (s.jfd >= 0)
+    {
+        ::close(s.jfd);
+        s.jfd = -1;
+    }
+}
+
+// 打开的 fd 超过上限时，从最久未用的一端关掉没有在写的
+void UploadSessions::evict_()
+{
+    auto it = lru_.end();
+    while (open_fds_ > max_open_fds_ && it != lru_.begin())
+    {
+        --it;
+        UploadSession *s = *it;
+        if (!s->inflight.empty())
+            continue;
+        auto next = std::next(it);
+        drop_fd_(*s); // 会从 lru_ 中删掉 it
+        it = next;
+    }
+}
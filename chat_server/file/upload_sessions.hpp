@@ -0,0 +1,204 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <utility>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
+#include <ctime>
+#include <sys/types.h>
+#include "common/noncopyable.hpp"
+#include "common/sha256.hpp"
+#include "file/file_catalog.hpp"
+
+// 一次分片上传的服务端状态
+struct UploadSession
+{
+    std::string id;
+    std::string name;
+    int64_t size = 0;
+    size_t chunk_size = 0;
+    uint64_t chunk_count = 0;
+    std::vector<uint64_t> bitmap; // 已完整写入的分片
+    uint64_t received = 0;
+    std::string sha256; // 客户端在 init 时声明的整文件摘要（可空），完成时校验
+
+    // 整文件摘要随上传增量计算：连续到齐的前缀一长出来，后台线程就从 .part（多半还在页缓存里）
+    // 读回来算，并行/乱序到达的分片等前面的空洞补上再算，complete 时不用再整读一遍文件
+    Sha256 hasher;
+    uint64_t hashed = 0;                     // 已算进 hasher 的分片数（总是位图里的连续前缀）
+    bool digest_failed = false;              // 后台线程读回失败，停在 hashed 处等重试
+    std::vector<std::string> chunk_digests; // 每片的 SHA-256（二进制），给分片去重索引用
+
+    int fd = -1;   // 缓存的 .part 读写句柄；被 LRU 淘汰后为 -1，下次用时重新打开
+    int jfd = -1;  // 进度日志（O_APPEND），与 fd 一起打开/淘汰
+    // 并发写入：同一上传的多个分片可由不同连接同时 pwrite（偏移互不重叠）
+    int max_parallel = 1;
+    std::vector<uint64_t> inflight; // 正在写的 seq；非空时 fd 不能被淘汰
+    uint64_t inflight_bytes = 0;
+    int peak_inflight = 0;
+    // Durability::WRITEBACK：写完还没确认回写的分片区间，由后台线程发起回写并等它完成；
+    // wb_pending 超过一片时 writeback_behind() 为真，调用方暂停收这个上传的数据
+    std::vector<std::pair<off_t, off_t>> wb_ranges; // 还没交给后台线程的
+    uint64_t wb_pending = 0;                        // 还没回写完的字节（含交出去的）
+    bool queued = false;                            // 已在后台线程的队列里
+    std::list<UploadSession *>::iterator lru_it;
+    bool in_lru = false;
+
+    time_t created = 0;
+    time_t last_active = 0;
+
+    bool has(uint64_t seq) const { return (bitmap[seq >> 6] >> (seq & 63)) & 1u; }
+    void mark(uint64_t seq) { bitmap[seq >> 6] |= (uint64_t(1) << (seq & 63)); }
+    bool complete() const { return received == chunk_count; }
+    uint64_t chunk_len(uint64_t seq) const
+    {
+        int64_t off = (int64_t)(seq * chunk_size);
+        return (uint64_t)std::min<int64_t>((int64_t)chunk_size, size - off);
+    }
+};
+
+// 对外的进度快照（/upload/status）
+struct UploadStatus
+{
+    std::string name;
+    int64_t size = 0;
+    size_t chunk_size = 0;
+    uint64_t chunk_count = 0;
+    uint64_t received = 0;
+    int max_parallel = 1;
+    int inflight = 0;
+    uint64_t inflight_bytes = 0;
+    int peak_inflight = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> missing; // 缺失分片的闭区间 [first, last]（含正在写的）
+};
+
+// finish() 的结果
+struct UploadResult
+{
+    std::string part_path;
+    size_t chunk_size = 0;
+    std::string claimed_sha256;             // init 时客户端声明的（可空）
+    std::string sha256;                     // 按落盘内容算出的整文件摘要（hex）
+    std::vector<std::string> chunk_digests; // 每片的 SHA-256（二进制）
+};
+
+// 上传会话表：按 upload id 索引，缓存 .part 的 fd（LRU 限制同时打开的数量），
+// 并用位图记录哪些分片已到齐，完成时据此校验而不是只比文件大小。
+//
+// 每个会话在 .part 旁边有一个进度日志 <id>.part.journal：
+//   第一行是 JSON 头 {"v":1,"name":..,"size":..,"chunk_size":..,"sha256":..,"created":..}
+//   之后每写完一个分片追加 8 字节小端 seq。
+// 服务重启后 recover() 扫描日志重建会话，客户端通过 /upload/status 只补缺失的分片。
+//
+// 边传边下：tail() 给出已连续到齐的前缀长度；有分片到齐、回写完成、上传完成或会话被清掉时
+// subscribe() 给出的 eventfd 变为可读，等着的一方据此醒来再查。分片可能来自 HTTP 线程也可能来自
+// 聊天线程，两个事件循环各订阅一个。
+//
+// 会阻塞在磁盘上的活（等回写、读回分片算摘要）交给会话表自己的后台线程，不在事件循环里做，
+// 也不占着 mu_。
+class UploadSessions : NonCopyable
+{
+public:
+    enum Status
+    {
+        OK = 0,
+        NOT_FOUND,   // 未知 id
+        BAD_SEQ,     // seq 越界
+        BAD_LENGTH,  // 分片长度与声明不符
+        INCOMPLETE,  // 还有分片没到
+        BUSY,        // 该上传的并发分片数已达上限
+        IN_FLIGHT,   // 同一 seq 正在被另一个连接写入
+        NO_SPACE,    // 预分配失败：磁盘（或配额）放不下声明的大小
+        IO_ERROR,
+        PENDING      // 分片都到了，摘要还在后台算：等通知后再 finish
+    };
+
+    explicit UploadSessions(FileCatalog &catalog, size_t max_open_fds = 256);
+    ~UploadSessions();
+
+    // 登记新会话并按声明大小预分配 .part（fallocate，连续分配、提前发现 ENOSPC）；
+    // max_parallel 为允许同时写入的分片数
+    Status create(const std::string &id, const std::string &name, int64_t size, size_t chunk_size,
+                  int max_parallel = 1, const std::string &sha256 = "");
+
+    // 按客户端给出的分片摘要（二进制，第 i 个对应 seq i），把仓库里已有的分片在服务端直接
+    // 拷进 .part 并记入位图，返回复用的分片数
+    uint64_t prefill(const std::string &id, const std::vector<std::string> &chunk_digests);
+
+    // 开始写分片：校验 seq、长度与并发上限，返回已 pin 住的 fd 与写入偏移
+    Status begin_chunk(const std::string &id, uint64_t seq, uint64_t len, int &fd, off_t &off);
+    // 分片写完（ok=false 表示中途失败/断开），解除 pin；成功才记入位图，摘要交给后台线程。
+    // ok 但进度日志写失败（分片没记上）时返回 IO_ERROR，调用方应让客户端重传这一片
+    Status end_chunk(const std::string &id, uint64_t seq, bool ok);
+
+    // 完成提交：位图全满且大小一致才成功，返回 .part 路径与摘要并移除会话（fd 已关闭）。
+    // 摘要还没算完返回 PENDING（不阻塞），调用方等通知再调。
+    // sync=false 时不做 fdatasync，由调用方自己（异步）落盘
+    Status finish(const std::string &id, int64_t size, UploadResult &out, bool sync = true);
+
+    // 查询进度；缺失分片合并成区间返回
+    Status query(const std::string &id, UploadStatus &out);
+
+    // 边传边下：从头连续到齐的字节数。最近 finish 过的上传 done = true、ready = size；
+    // 没有这个会话（未知、被过期清掉）返回 NOT_FOUND
+    Status tail(const std::string &id, int64_t &ready, int64_t &size, bool &done);
+    // 给调用线程的事件循环建一个通知 eventfd（失败返回 -1），由会话表负责关闭
+    int subscribe();
+    void drain_notify(int fd);
+
+    // Durability::WRITEBACK 下这个上传写完的分片回写跟不上（超过一片没落盘）：调用方暂停收它的数据，
+    // 等通知再查，而不是在事件循环里等磁盘
+    bool writeback_behind(const std::string &id);
+
+    // 启动时从 root/.parts 下的 *.part.journal 重建会话，返回恢复的数量
+    size_t recover();
+
+    // 过期：last_active 早于 cutoff 且没有分片在写的会话，关掉 fd 并移出会话表，返回它们的 id。
+    // .part 与进度日志留给调用方删除
+    std::vector<std::string> expire(time_t cutoff);
+    bool active(const std::string &id);
+    size_t count();
+
+    static const char *status_str(Status st);
+    static std::string new_id(); // 随机的 UUID 形式 id（HTTP 与聊天连接上的上传共用）
+
+private:
+    int open_fd_(UploadSession &s);
+    bool append_journal_(UploadSession &s, uint64_t seq);
+    void writeback_(UploadSession &s, uint64_t seq);
+    void schedule_(UploadSession &s);
+    void bg_loop_();
+    void bg_run_(const std::string &id);
+    bool load_journal_(const std::string &id);
+    void touch_lru_(UploadSession &s);
+    void drop_fd_(UploadSession &s);
+    void evict_();
+    void notify_();
+
+    FileCatalog &catalog_;
+    size_t max_open_fds_;
+    size_t open_fds_ = 0;
+
+    std::mutex mu_;
+    std::unordered_map<std::string, UploadSession> sessions_;
+    std::list<UploadSession *> lru_; // 前端最近使用；只含 fd 已打开的会话
+
+    std::vector<int> efds_; // 各事件循环订阅的通知 eventfd
+
+    // 后台线程：按会话 id 排队，与会话表共用 mu_
+    std::thread bg_;
+    std::condition_variable bg_cv_;
+    std::deque<std::string> bg_queue_;
+    bool bg_stop_ = false;
+    std::vector<char> bg_buf_; // 读回分片算摘要用，只有后台线程碰
+
+    std::unordered_map<std::string, int64_t> finished_; // 最近完成的上传 -> 大小（tail 用）
+    std::deque<std::string> finished_order_;            // 最多留 MAX_FINISHED 个
+    static constexpr size_t MAX_FINISHED = 1024;
+};
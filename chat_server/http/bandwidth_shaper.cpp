@@ -0,0 +1,123 @@
+#include "http/bandwidth_shaper.hpp"
+#include <algorithm>
+#include <chrono>
+
+int64_t BandwidthShaper::now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void BandwidthShaper::Bucket::refill(int64_t now)
+{
+    if (now > last_ns)
+        tokens = std::min(burst, tokens + (double)rate * (double)(now - last_ns) / 1e9);
+    last_ns = now;
+}
+
+int64_t BandwidthShaper::Bucket::wait_ns(double n) const
+{
+    return tokens >= n ? 0 : (int64_t)((n - tokens) * 1e9 / (double)rate) + 1;
+}
+
+void BandwidthShaper::attach(Flow &f, const std::string &user, Dir dir)
+{
+    int64_t now = now_ns();
+    auto make = [&](int64_t rate) {
+        Bucket b;
+        b.rate = rate;
+        // 桶至少装得下一次放行的量，否则永远攒不够
+        b.burst = std::max((double)rate * opt_.burst_ms / 1000.0, (double)opt_.min_grant);
+        b.tokens = b.burst;
+        b.last_ns = now;
+        return b;
+    };
+    f.dir = dir;
+    f.deficit = 0;
+    std::lock_guard<std::mutex> lk(mu_);
+    f.user.reset();
+    if (opt_.user_rate > 0)
+    {
+        BucketPtr &u = users_[dir][user];
+        if (!u)
+            u = std::make_shared<Bucket>(make(opt_.user_rate));
+        f.user = u;
+    }
+    f.conn = make(opt_.conn_rate);
+    f.limited = f.user || opt_.conn_rate > 0;
+}
+
+size_t BandwidthShaper::grant(Flow &f, size_t want, int64_t now, int64_t &wait)
+{
+    wait = 0;
+    f.deficit = std::min(f.deficit + opt_.quantum, 2 * opt_.quantum);
+    size_t n = std::min(want, f.deficit);
+    if (!f.limited)
+        return n;
+
+    std::lock_guard<std::mutex> lk(mu_);
+    double avail = 1e300;
+    double need = (double)std::min(n, opt_.min_grant);
+    bool user_short = false;
+    if (f.conn.rate > 0)
+    {
+        f.conn.refill(now);
+        avail = f.conn.tokens;
+        wait = f.conn.wait_ns(need);
+    }
+    if (f.user)
+    {
+        f.user->refill(now);
+        if (f.user->tokens < avail)
+            avail = f.user->tokens;
+        int64_t w = f.user->wait_ns(need);
+        if (w > wait)
+        {
+            wait = w;
+            user_short = true;
+        }
+    }
+    if (wait > 0)
+    {
+        ++st_.throttled;
+        if (user_short)
+            ++st_.user_waits;
+        return 0;
+    }
+    return std::min(n, (size_t)avail);
+}
+
+void BandwidthShaper::consume(Flow &f, size_t n)
+{
+    f.deficit -= std::min(f.deficit, n);
+    if (!f.limited)
+        return;
+    std::lock_guard<std::mutex> lk(mu_);
+    if (f.conn.rate > 0)
+        f.conn.tokens -= (double)n;
+    if (f.user)
+        f.user->tokens -= (double)n;
+}
+
+void BandwidthShaper::prune(int64_t now)
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    for (auto &m : users_)
+        for (auto it = m.begin(); it != m.end();)
+        {
+            Bucket &b = *it->second;
+            b.refill(now);
+            if (it->second.use_count() == 1 && b.tokens >= b.burst)
+                it = m.erase(it);
+            else
+                ++it;
+        }
+}
+
+BandwidthShaper::Stats BandwidthShaper::stats() const
+{
+    std::lock_guard<std::mutex> lk(mu_);
+    Stats s = st_;
+    s.users = users_[UP].size() + users_[DOWN].size();
+    return s;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include "common/noncopyable.hpp"
+
+// 传输限速与公平调度。HTTP 与聊天（CFS1 文件帧）两个事件循环共用一份，同一用户在两边的流量
+// 扣同一个桶；桶表和统计由 mu_ 护着，每次只动几个数。Flow 归各自的连接，只在它所在的线程里碰。
+//  - 令牌桶：每个用户上行、下行各一个桶，每条连接再各一个；速率 0 表示不限。
+//    用户按对端 IP 区分（HTTP 上的用户名是客户端自报的，不可信），HTTP 和聊天连接用同一个键。
+//  - 赤字轮转（DRR）：每条正在传文件体的连接每被事件循环轮到一次，赤字加一个 quantum，
+//    这一轮最多传赤字那么多字节；传完或没东西可传时赤字清零。水平触发的 epoll 会把
+//    上次报告过、仍就绪的连接排到就绪队列末尾，轮到的顺序本身就是轮转的，
+//    一个大传输每轮只能前进一个 quantum，小文件不用排在它后面等整个管道 / 缓冲。
+class BandwidthShaper : NonCopyable
+{
+public:
+    enum Dir
+    {
+        UP = 0,
+        DOWN = 1
+    };
+
+    struct Options
+    {
+        int64_t user_rate = 0;    // 每个用户每个方向的字节/秒，0 不限
+        int64_t conn_rate = 0;    // 每条连接的字节/秒，0 不限
+        int burst_ms = 250;       // 桶容量 = 速率 × burst_ms
+        size_t quantum = 256 << 10;
+        size_t min_grant = 16 << 10; // 令牌攒够这么多（或剩下要传的）才放行，免得一字节一字节地系统调用
+    };
+
+    struct Bucket
+    {
+        int64_t rate = 0;
+        double tokens = 0;
+        double burst = 0;
+        int64_t last_ns = 0;
+
+        void refill(int64_t now_ns);
+        // 令牌攒到 n 还要等多久（纳秒）
+        int64_t wait_ns(double n) const;
+    };
+    using BucketPtr = std::shared_ptr<Bucket>;
+
+    // 每条连接上的调度状态
+    struct Flow
+    {
+        Dir dir = DOWN;
+        BucketPtr user;  // 限速关闭时为空
+        Bucket conn;
+        size_t deficit = 0;
+        bool limited = false; // 有任何一个桶在起作用
+    };
+
+    struct Stats
+    {
+        uint64_t throttled = 0;   // 因令牌不够暂停的次数
+        uint64_t user_waits = 0;  // 其中卡在用户桶上的
+        size_t users = 0;         // 当前有桶的用户数（每个方向算一个）
+    };
+
+    explicit BandwidthShaper(const Options &opt) : opt_(opt) {}
+
+    // 连接开始传文件体时调用：挂上用户桶、建连接桶、赤字清零
+    void attach(Flow &f, const std::string &user, Dir dir);
+    // 本轮最多可传多少字节（want 为还剩多少要传）；返回 0 时 wait 为要睡的纳秒数
+    size_t grant(Flow &f, size_t want, int64_t now_ns, int64_t &wait);
+    // 实际传了 n 字节
+    void consume(Flow &f, size_t n);
+    // 没东西可传（EAGAIN / 传完 / 等磁盘）：赤字不留到下次
+    static void idle(Flow &f) { f.deficit = 0; }
+    // 丢掉已没有连接在用、且已回满的用户桶
+    void prune(int64_t now_ns);
+    Stats stats() const;
+
+    static int64_t now_ns();
+
+private:
+    Options opt_;
+    mutable std::mutex mu_;
+    std::unordered_map<std::string, BucketPtr> users_[2];
+    Stats st_;
+};
@@ -0,0 +1,87 @@
+#include "http/file_cache.hpp"
+#include <sys/mman.h>
+#include <vector>
+
+FileCache::Entry::~Entry()
+{
+    if (pinned)
+        ::munlock(response.data(), response.size());
+}
+
+FileCache::FileCache(size_t capacity, size_t max_entry) : capacity_(capacity), max_entry_(max_entry)
+{
+    st_.capacity = capacity;
+    st_.max_entry = max_entry;
+}
+
+FileCache::Ptr FileCache::get(const std::string &key)
+{
+    auto it = index_.find(key);
+    if (it == index_.end())
+    {
+        ++st_.misses;
+        return nullptr;
+    }
+    ++st_.hits;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return *it->second;
+}
+
+void FileCache::put(std::shared_ptr<Entry> e)
+{
+    if (!e || e->response.size() > capacity_ || index_.count(e->key))
+        return;
+    // RLIMIT_MEMLOCK 不够时照样缓存，只是不钉住
+    e->pinned = ::mlock(e->response.data(), e->response.size()) == 0;
+    st_.bytes += e->response.size();
+    if (e->pinned)
+        st_.pinned_bytes += e->response.size();
+    ++st_.inserts;
+
+    by_name_.emplace(e->name, e->key);
+    lru_.push_front(std::move(e));
+    index_[lru_.front()->key] = lru_.begin();
+    while (st_.bytes > capacity_ && lru_.size() > 1)
+    {
+        erase_(std::prev(lru_.end()));
+        ++st_.evictions;
+    }
+    st_.entries = lru_.size();
+}
+
+void FileCache::invalidate_name(const std::string &name, const std::string &keep)
+{
+    auto range = by_name_.equal_range(name);
+    std::vector<std::string> keys;
+    for (auto it = range.first; it != range.second; ++it)
+        if (keep.empty() || it->second.compare(0, keep.size(), keep) != 0)
+            keys.push_back(it->second);
+    for (const auto &k : keys)
+    {
+        auto it = index_.find(k);
+        if (it == index_.end())
+            continue;
+        erase_(it->second);
+        ++st_.invalidations;
+    }
+    st_.entries = lru_.size();
+}
+
+void FileCache::erase_(List::iterator it)
+{
+    const Entry &e = **it;
+    st_.bytes -= e.response.size();
+    if (e.pinned)
+        st_.pinned_bytes -= e.response.size();
+    auto range = by_name_.equal_range(e.name);
+    for (auto n = range.first; n != range.second; ++n)
+        if (n->second == e.key)
+        {
+            by_name_.erase(n);
+            break;
+        }
+    index_.erase(e.key);
+    lru_.erase(it);
+}
+
+FileCache::Stats FileCache::stats() const { return st_; }
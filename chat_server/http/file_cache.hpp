@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+#include "common/noncopyable.hpp"
+
+// 热点小文件的下载缓存：按对象 id（gzip 表示为 "<id>+gzip"）存整份 200 响应（响应头 + 文件内容，一块连续内存），
+// 命中时不 open / fstat，直接从内存发。对象内容不可变，对象 id 本身就是版本；
+// 同名文件被新上传顶替时按名字把旧对象的条目清掉（按 id 的老链接之后再来就重新读盘）。
+// 按字节预算做 LRU；条目内存尽量 mlock，不会被换出。
+// 只在事件循环线程里使用，不加锁；发送中的连接持有条目的 shared_ptr，被淘汰也不影响它发完。
+class FileCache : NonCopyable
+{
+public:
+    struct Entry : NonCopyable
+    {
+        std::string key;      // 对象 id，gzip 表示带 "+gzip" 后缀
+        std::string name;
+        std::string response; // 响应头 + 内容
+        size_t head_len = 0;
+        bool pinned = false;
+        ~Entry();
+    };
+    using Ptr = std::shared_ptr<const Entry>;
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;     // 因预算被挤出
+        uint64_t invalidations = 0; // 因同名新上传被清掉
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t pinned_bytes = 0;
+        size_t capacity = 0;
+        size_t max_entry = 0;
+    };
+
+    FileCache(size_t capacity, size_t max_entry);
+
+    bool cacheable(int64_t size) const { return size > 0 && (size_t)size <= max_entry_ && max_entry_ <= capacity_; }
+    Ptr get(const std::string &key); // 计入命中 / 未命中
+    void put(std::shared_ptr<Entry> e); // 已有同 key 的条目时保留旧的
+    void invalidate_name(const std::string &name, const std::string &keep = ""); // 清掉该名字下对象 keep（含其 gzip 表示）以外的条目
+    Stats stats() const;
+
+private:
+    using List = std::list<Ptr>;
+    void erase_(List::iterator it);
+
+    size_t capacity_;
+    size_t max_entry_;
+    List lru_; // 前端最近使用
+    std::unordered_map<std::string, List::iterator> index_;
+    std::unordered_multimap<std::string, std::string> by_name_; // 名字 -> 键
+    Stats st_;
+};
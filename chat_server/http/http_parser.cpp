@@ -0,0 +1,349 @@
+#include "http/http_parser.hpp"
+#include <cstring>
+#include <string>
+
+namespace
+{
+    inline char lower(char c) { return (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c; }
+
+    inline std::string_view trim(std::string_view s)
+    {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    inline int hexval(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        c = lower(c);
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        return -1;
+    }
+} // namespace
+
+bool http_iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (lower(a[i]) != lower(b[i]))
+            return false;
+    return true;
+}
+
+std::string http_url_decode(std::string_view s)
+{
+    std::string o;
+    o.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        int hi, lo;
+        if (s[i] == '%' && i + 2 < s.size() && (hi = hexval(s[i + 1])) >= 0 && (lo = hexval(s[i + 2])) >= 0)
+        {
+            o.push_back(char(hi * 16 + lo));
+            i += 2;
+        }
+        else if (s[i] == '+')
+            o.push_back(' ');
+        else
+            o.push_back(s[i]);
+    }
+    return o;
+}
+
+std::string_view HttpRequest::header(std::string_view name) const
+{
+    for (size_t i = 0; i < header_count; ++i)
+        if (http_iequals(headers[i].name, name))
+            return headers[i].value;
+    return {};
+}
+
+bool HttpRequest::has_header(std::string_view name) const
+{
+    for (size_t i = 0; i < header_count; ++i)
+        if (http_iequals(headers[i].name, name))
+            return true;
+    return false;
+}
+
+std::string_view HttpRequest::param(std::string_view key) const
+{
+    for (size_t i = 0; i < param_count; ++i)
+        if (params[i].key == key)
+            return params[i].value;
+    return {};
+}
+
+void HttpParser::reset()
+{
+    req_ = HttpRequest{};
+    pos_ = 0;
+    have_start_ = false;
+    done_ = false;
+    err_ = nullptr;
+}
+
+bool HttpParser::bad_(const char *why)
+{
+    err_ = why;
+    return false;
+}
+
+HttpParser::Status HttpParser::feed(const char *buf, size_t len)
+{
+    if (err_)
+        return ERROR;
+    if (done_)
+        return DONE;
+
+    // 只从上次停下的行首往后找换行；已解析的行不会再扫
+    while (pos_ < len)
+    {
+        const char *start = buf + pos_;
+        const char *nl = static_cast<const char *>(std::memchr(start, '\n', len - pos_));
+        if (!nl)
+            return NEED_MORE;
+
+        size_t n = (size_t)(nl - start);
+        if (n > 0 && start[n - 1] == '\r')
+            --n;
+        pos_ = (size_t)(nl - buf) + 1;
+
+        if (!have_start_)
+        {
+            if (n == 0)
+                continue; // RFC 7230：容忍请求行前的空行
+            if (!parse_request_line_(start, n))
+                return ERROR;
+            have_start_ = true;
+            continue;
+        }
+        if (n == 0)
+        {
+            done_ = true;
+            parse_params_();
+            return DONE;
+        }
+        if (!parse_header_line_(start, n))
+            return ERROR;
+    }
+    return NEED_MORE;
+}
+
+bool HttpParser::parse_request_line_(const char *p, size_t n)
+{
+    std::string_view line(p, n);
+    auto s1 = line.find(' ');
+    if (s1 == std::string_view::npos || s1 == 0)
+        return bad_("bad request line");
+    auto s2 = line.find(' ', s1 + 1);
+    if (s2 == std::string_view::npos || s2 == s1 + 1)
+        return bad_("bad request line");
+    if (line.substr(s2 + 1, 5) != "HTTP/")
+        return bad_("bad http version");
+
+    req_.method = line.substr(0, s1);
+    req_.target = line.substr(s1 + 1, s2 - s1 - 1);
+    auto q = req_.target.find('?');
+    req_.path = req_.target.substr(0, q);
+    if (q != std::string_view::npos)
+        req_.query = req_.target.substr(q + 1);
+    return true;
+}
+
+bool HttpParser::parse_header_line_(const char *p, size_t n)
+{
+    std::string_view line(p, n);
+    if (line.front() == ' ' || line.front() == '\t')
+        return bad_("obsolete line folding");
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0)
+        return bad_("bad header line");
+    if (req_.header_count >= HttpRequest::MAX_HEADERS)
+        return bad_("too many headers");
+
+    HttpHeader &h = req_.headers[req_.header_count++];
+    h.name = line.substr(0, colon);
+    h.value = trim(line.substr(colon + 1));
+
+    if (http_iequals(h.name, "Content-Length"))
+    {
+        if (h.value.empty() || req_.has_content_length)
+            return bad_("bad content-length");
+        uint64_t v = 0;
+        for (char c : h.value)
+        {
+            if (c < '0' || c > '9' || v > (UINT64_MAX - 9) / 10)
+                return bad_("bad content-length");
+            v = v * 10 + uint64_t(c - '0');
+        }
+        req_.has_content_length = true;
+        req_.content_length = v;
+    }
+    else if (http_iequals(h.name, "Transfer-Encoding"))
+    {
+        return bad_("transfer-encoding not supported");
+    }
+    return true;
+}
+
+void HttpParser::parse_params_()
+{
+    std::string_view qs = req_.query;
+    while (!qs.empty() && req_.param_count < HttpRequest::MAX_PARAMS)
+    {
+        auto amp = qs.find('&');
+        std::string_view kv = qs.substr(0, amp);
+        qs = (amp == std::string_view::npos) ? std::string_view{} : qs.substr(amp + 1);
+        if (kv.empty())
+            continue;
+        auto eq = kv.find('=');
+        HttpParam &p = req_.params[req_.param_count++];
+        p.key = kv.substr(0, eq);
+        p.value = (eq == std::string_view::npos) ? std::string_view{} : kv.substr(eq + 1);
+    }
+}
+
+RangeResult http_parse_ranges(std::string_view spec, int64_t size, std::vector<ByteRange> &ranges)
+{
+    static constexpr size_t MAX_RANGES = 16; // 防止大量碎区间放大响应
+    ranges.clear();
+    spec = trim(spec);
+    if (spec.substr(0, 6) != "bytes=")
+        return RangeResult::IGNORE;
+    spec.remove_prefix(6);
+
+    bool any = false;
+    while (!spec.empty())
+    {
+        auto comma = spec.find(',');
+        std::string_view item = trim(spec.substr(0, comma));
+        spec = (comma == std::string_view::npos) ? std::string_view{} : spec.substr(comma + 1);
+        if (item.empty())
+            continue;
+
+        auto dash = item.find('-');
+        if (dash == std::string_view::npos)
+            return RangeResult::IGNORE;
+        std::string_view a = trim(item.substr(0, dash)), b = trim(item.substr(dash + 1));
+
+        auto num = [](std::string_view v, int64_t &out) {
+            if (v.empty() || v.size() > 18)
+                return false;
+            out = 0;
+            for (char c : v)
+            {
+                if (c < '0' || c > '9')
+                    return false;
+                out = out * 10 + (c - '0');
+            }
+            return true;
+        };
+
+        int64_t first, last;
+        if (a.empty())
+        {
+            // 后缀区间：bytes=-N 表示最后 N 字节
+            int64_t n;
+            if (!num(b, n))
+                return RangeResult::IGNORE;
+            any = true;
+            if (n == 0 || size == 0)
+                continue;
+            first = n >= size ? 0 : size - n;
+            last = size - 1;
+        }
+        else
+        {
+            if (!num(a, first))
+                return RangeResult::IGNORE;
+            if (b.empty())
+                last = size - 1;
+            else if (!num(b, last) || last < first)
+                return RangeResult::IGNORE;
+            any = true;
+            if (first >= size)
+                continue;
+            if (last >= size)
+                last = size - 1;
+        }
+        if (ranges.size() >= MAX_RANGES)
+            return RangeResult::IGNORE;
+        ranges.push_back({first, last});
+    }
+    if (!any)
+        return RangeResult::IGNORE;
+    return ranges.empty() ? RangeResult::UNSATISFIABLE : RangeResult::OK;
+}
+
+size_t http_format_date(time_t t, char *buf, size_t n)
+{
+    struct tm tm_buf;
+    gmtime_r(&t, &tm_buf);
+    return std::strftime(buf, n, "%a, %d %b %Y %H:%M:%S GMT", &tm_buf);
+}
+
+bool http_parse_date(std::string_view s, time_t &t)
+{
+    std::string tmp(trim(s));
+    struct tm tm_buf{};
+    const char *end = ::strptime(tmp.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm_buf);
+    if (!end || *end != '\0')
+        return false;
+    t = ::timegm(&tm_buf);
+    return true;
+}
+
+bool http_etag_match(std::string_view list, std::string_view etag)
+{
+    auto strip_weak = [](std::string_view t) { return t.substr(0, 2) == "W/" ? t.substr(2) : t; };
+    etag = strip_weak(etag);
+    while (!list.empty())
+    {
+        size_t comma = list.find(',');
+        std::string_view t = trim(list.substr(0, comma));
+        if (t == "*" || (!t.empty() && strip_weak(t) == etag))
+            return true;
+        if (comma == std::string_view::npos)
+            break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+bool http_accepts_encoding(std::string_view list, std::string_view coding)
+{
+    int named = -1, star = -1; // -1 没出现，0 被 q=0 拒绝，1 接受
+    while (!list.empty())
+    {
+        size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        size_t semi = item.find(';');
+        std::string_view c = trim(item.substr(0, semi));
+        int ok = 1;
+        if (semi != std::string_view::npos)
+        {
+            std::string_view q = trim(item.substr(semi + 1));
+            if (q.size() >= 2 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=')
+            {
+                // q 值里只要有非 0 数字就算接受
+                q.remove_prefix(2);
+                ok = q.find_first_of("123456789") != std::string_view::npos ? 1 : 0;
+            }
+        }
+        if (http_iequals(c, coding))
+            named = ok;
+        else if (c == "*")
+            star = ok;
+        if (comma == std::string_view::npos)
+            break;
+        list.remove_prefix(comma + 1);
+    }
+    return named >= 0 ? named == 1 : star == 1;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+// 请求头里的一项（视图指向连接的读缓冲，不拷贝）
+struct HttpHeader
+{
+    std::string_view name;
+    std::string_view value;
+};
+
+// 查询参数（value 仍是百分号编码，需要时再 http_url_decode）
+struct HttpParam
+{
+    std::string_view key;
+    std::string_view value;
+};
+
+struct HttpRequest
+{
+    static constexpr size_t MAX_HEADERS = 32;
+    static constexpr size_t MAX_PARAMS = 16;
+
+    std::string_view method;
+    std::string_view target; // 原始 URI（含 query）
+    std::string_view path;
+    std::string_view query;
+
+    HttpHeader headers[MAX_HEADERS];
+    size_t header_count = 0;
+    HttpParam params[MAX_PARAMS];
+    size_t param_count = 0;
+
+    bool has_content_length = false;
+    uint64_t content_length = 0;
+
+    // 大小写不敏感、按整行匹配；找不到返回空视图
+    std::string_view header(std::string_view name) const;
+    bool has_header(std::string_view name) const;
+    std::string_view param(std::string_view key) const;
+};
+
+// 增量请求头解析器：
+//  - 直接在连接的读缓冲上工作，每次 feed 传入缓冲起点和当前有效长度；
+//  - 已解析的行不会重复扫描，跨多次 recv 续解析；
+//  - 解析结果全是 string_view，不做任何堆分配（缓冲在请求处理完前不能移动）。
+class HttpParser
+{
+public:
+    enum Status
+    {
+        NEED_MORE = 0,
+        DONE,
+        ERROR
+    };
+
+    void reset();
+    Status feed(const char *buf, size_t len);
+
+    size_t header_bytes() const { return pos_; } // 请求头（含空行）占用的字节数
+    const HttpRequest &request() const { return req_; }
+    const char *error() const { return err_; }
+
+private:
+    bool bad_(const char *why);
+    bool parse_request_line_(const char *p, size_t n);
+    bool parse_header_line_(const char *p, size_t n);
+    void parse_params_();
+
+    HttpRequest req_;
+    size_t pos_ = 0;          // 下一行的起点
+    bool have_start_ = false; // 请求行是否已解析
+    bool done_ = false;
+    const char *err_ = nullptr;
+};
+
+bool http_iequals(std::string_view a, std::string_view b);
+std::string http_url_decode(std::string_view s);
+
+// Range: bytes=... 解析结果，闭区间 [first, last]
+struct ByteRange
+{
+    int64_t first;
+    int64_t last;
+};
+
+enum class RangeResult
+{
+    IGNORE = 0,    // 没有/不认识/不值得处理的 Range：按 200 整体发送
+    OK,            // ranges 非空且都已裁剪到文件范围内
+    UNSATISFIABLE  // 语法正确但没有任何区间落在文件内：416
+};
+
+RangeResult http_parse_ranges(std::string_view spec, int64_t size, std::vector<ByteRange> &ranges);
+
+// RFC 7231 IMF-fixdate，如 "Sun, 06 Nov 1994 08:49:37 GMT"
+size_t http_format_date(time_t t, char *buf, size_t n);
+bool http_parse_date(std::string_view s, time_t &t);
+
+// If-None-Match 的实体标签列表里有没有与 etag 弱比较相等的（"*" 匹配任何存在的文件）
+bool http_etag_match(std::string_view list, std::string_view etag);
+
+// Accept-Encoding 是否接受 coding（按 q 值；q=0 即拒绝，没点名时看 "*"）
+bool http_accepts_encoding(std::string_view list, std::string_view coding);
@@ -1,16 +1,23 @@
 #include "http/http_server.hpp"
 #include "common/logger.hpp"
+#include "common/sha256.hpp"
+#include "common/crc32c.hpp"
 #include <nlohmann/json.hpp>
 
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
+#include <vector>
 
 using json = nlohmann::json;
 
@@ -21,34 +28,39 @@ namespace
         int f = fcntl(fd, F_GETFL, 0);
         return (f >= 0 && fcntl(fd, F_SETFL, f | O_NONBLOCK) >= 0) ? 0 : -1;
     }
-    int set_block(int fd)
-    {
-        int f = fcntl(fd, F_GETFL, 0);
-        return (f >= 0 && fcntl(fd, F_SETFL, f & ~O_NONBLOCK) >= 0) ? 0 : -1;
-    }
-    ssize_t read_n(int fd, void *buf, size_t n)
+
+    int hex_val(char ch)
     {
-        size_t got = 0;
-        while (got < n)
-        {
-            ssize_t r = ::recv(fd, (char *)buf + got, n - got, 0);
-            if (r > 0)
-                got += (size_t)r;
-            else if (r == 0)
-                break;
-            else if (errno == EINTR)
-                continue;
-            else
-                return -1;
-        }
-        return (ssize_t)got;
+        if (ch >= '0' && ch <= '9')
+            return ch - '0';
+        if (ch >= 'a' && ch <= 'f')
+            return ch - 'a' + 10;
+        if (ch >= 'A' && ch <= 'F')
+            return ch - 'A' + 10;
+        return -1;
     }
 } // namespace
 
-HttpServer::HttpServer(std::string bind, int port, FileBus &bus, FileCatalog &catalog)
-    : bind_(std::move(bind)), port_(port), bus_(bus), catalog_(catalog) {}
+HttpServer::HttpServer(std::string bind, int port, FileBus &bus, FileCatalog &catalog,
+                       UploadSessions &sessions, AsyncFileIO &aio, FileCache &cache, Compressor &gzip,
+                       BandwidthShaper &shaper, FileBus &cache_bus)
+    : bind_(std::move(bind)), port_(port), bus_(bus), catalog_(catalog), sessions_(sessions), aio_(aio),
+      cache_(cache), gzip_(gzip), shaper_(shaper), cache_bus_(cache_bus) {}
 
-HttpServer::~HttpServer() { stop(); }
+HttpServer::~HttpServer()
+{
+    stop();
+    for (auto &kv : conns_)
+        ::close(kv.first);
+    conns_.clear();
+    for (auto &p : pipe_pool_)
+    {
+        ::close(p.first);
+        ::close(p.second);
+    }
+    if (epoll_fd_ >= 0)
+        ::close(epoll_fd_);
+}
 
 bool HttpServer::setup_listen_()
 {
@@ -86,6 +98,46 @@ bool HttpServer::setup_listen_()
         return false;
     }
     set_nonblock(listen_fd_);
+
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0)
+    {
+        LOG_ERROR("HTTP epoll_create1 failed: %s", strerror(errno));
+        return false;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd_;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0)
+    {
+        LOG_ERROR("HTTP epoll_ctl ADD listen failed: %s", strerror(errno));
+        return false;
+    }
+    // 文件 I/O 完成通知
+    ev.data.fd = aio_.event_fd();
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, aio_.event_fd(), &ev) < 0)
+    {
+        LOG_ERROR("HTTP epoll_ctl ADD aio eventfd failed: %s", strerror(errno));
+        return false;
+    }
+    // 聊天线程（CFS1）提交后的缓存作废
+    ev.data.fd = cache_bus_.fd();
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, cache_bus_.fd(), &ev) < 0)
+    {
+        LOG_ERROR("HTTP epoll_ctl ADD cache bus failed: %s", strerror(errno));
+        return false;
+    }
+    // 上传进度通知（边传边下、回写反压）；没有 eventfd 时 /download?upload= 一律 404，也不做回写反压
+    notify_fd_ = sessions_.subscribe();
+    if (notify_fd_ >= 0)
+    {
+        ev.data.fd = notify_fd_;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, notify_fd_, &ev) < 0)
+        {
+            LOG_ERROR("HTTP epoll_ctl ADD upload notify fd failed: %s", strerror(errno));
+            return false;
+        }
+    }
     return true;
 }
 
@@ -102,420 +154,2100 @@ void HttpServer::stop()
     }
 }
 
-static std::string url_decode(std::string s)
+std::string HttpServer::gen_uuid_() { return UploadSessions::new_id(); }
+
+void HttpServer::reply_(Conn &c, int code, const char *status,
+                        const std::string &body, const char *ctype, const char *extra_headers)
+{
+    char hdr[1024];
+    int n = std::snprintf(hdr, sizeof(hdr),
+                          "HTTP/1.1 %d %s\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Content-Type: %s\r\n"
+                          "%s"
+                          "Connection: close\r\n\r\n",
+                          code, status, body.size(), ctype, extra_headers);
+    c.wbuf.assign(hdr, (size_t)n);
+    c.wbuf.append(body);
+    arm_write_(c);
+}
+
+void HttpServer::arm_write_(Conn &c)
+{
+    c.woff = 0;
+    c.phase = Conn::WRITE;
+    watch_(c, EPOLLOUT | EPOLLRDHUP);
+}
+
+void HttpServer::watch_(Conn &c, uint32_t events)
+{
+    if (c.events == events)
+        return;
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = c.fd;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, c.fd, &ev);
+    c.events = events;
+}
+
+void HttpServer::handle_accept_()
 {
-    std::string o;
-    o.reserve(s.size());
-    for (size_t i = 0; i < s.size(); ++i)
+    while (!stopping_.load())
     {
-        if (s[i] == '%' && i + 2 < s.size())
+        sockaddr_in cli{};
+        socklen_t len = sizeof(cli);
+        int cfd = ::accept4(listen_fd_, (sockaddr *)&cli, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0)
         {
-            char h[3] = {s[i + 1], s[i + 2], 0};
-            char c = (char)strtol(h, nullptr, 16);
-            o.push_back(c);
-            i += 2;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            if (!stopping_.load())
+                LOG_WARN("HTTP accept error: %s", strerror(errno));
+            break;
         }
-        else if (s[i] == '+')
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = cfd;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, cfd, &ev) < 0)
         {
-            o.push_back(' ');
+            LOG_WARN("HTTP epoll_ctl ADD client failed: %s", strerror(errno));
+            ::close(cfd);
+            continue;
         }
-        else
-            o.push_back(s[i]);
+        auto c = std::make_unique<Conn>();
+        c->fd = cfd;
+        c->events = ev.events;
+        char ip[INET_ADDRSTRLEN] = {0};
+        ::inet_ntop(AF_INET, &cli.sin_addr, ip, sizeof(ip));
+        c->peer = ip;
+        c->last_active = time(nullptr);
+        conns_[cfd] = std::move(c);
     }
-    return o;
 }
 
-bool HttpServer::parse_query_(const std::string &uri, std::string &path,
-                              std::string &id, std::string &seq, std::string &name)
+// socket 立即关闭；还有文件 I/O 在途的连接挪进 draining_，文件/管道/缓冲等回调回来再释放
+void HttpServer::close_conn_(int fd)
 {
-    path.clear();
-    id.clear();
-    seq.clear();
-    name.clear();
-    auto qpos = uri.find('?');
-    path = (qpos == std::string::npos) ? uri : uri.substr(0, qpos);
-    if (qpos == std::string::npos)
-        return true;
-    std::string qs = uri.substr(qpos + 1);
-    while (!qs.empty())
+    auto it = conns_.find(fd);
+    if (it != conns_.end())
     {
-        auto amp = qs.find('&');
-        std::string kv = (amp == std::string::npos) ? qs : qs.substr(0, amp);
-        if (amp != std::string::npos)
-            qs.erase(0, amp + 1);
+        Conn &c = *it->second;
+        if (c.io_pending)
+        {
+            c.closed = true;
+            c.fd = -1;
+            draining_.push_back(std::move(it->second));
+        }
         else
-            qs.clear();
-        auto eq = kv.find('=');
-        std::string k = (eq == std::string::npos) ? kv : kv.substr(0, eq);
-        std::string v = (eq == std::string::npos) ? "" : url_decode(kv.substr(eq + 1));
-        if (k == "id")
-            id = v;
-        else if (k == "seq")
-            seq = v;
-        else if (k == "name")
-            name = v;
+            release_conn_(c);
     }
-    return true;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    conns_.erase(fd);
 }
 
-bool HttpServer::get_header_(const std::string &headers, const std::string &key, std::string &val)
+void HttpServer::release_conn_(Conn &c)
 {
-    val.clear();
-    auto pos = headers.find(key);
-    if (pos == std::string::npos)
-        return false;
-    auto end = headers.find("\r\n", pos);
-    if (end == std::string::npos)
-        return false;
-    auto colon = headers.find(':', pos);
-    if (colon == std::string::npos || colon > end)
-        return false;
-    size_t s = colon + 1;
-    while (s < end && (headers[s] == ' ' || headers[s] == '\t'))
-        ++s;
-    val = headers.substr(s, end - s);
-    return true;
+    aio_.release_file(c.file); // 先注销，fd 才能关（会话表也可能在 end_chunk 里关掉它）
+    c.file = -1;
+    if (c.file_fd >= 0)
+    {
+        sessions_.end_chunk(c.upload_id, c.upload_seq, false); // 分片没写完
+        c.file_fd = -1;
+    }
+    if (c.send_fd >= 0)
+    {
+        ::close(c.send_fd);
+        c.send_fd = -1;
+    }
+    release_pipe_(c);
+    aio_.put_buffer(c.buf);
+    if (c.batch)
+        end_batch_(c);
+    if (c.tail_wait)
+    {
+        tailing_.erase(std::remove(tailing_.begin(), tailing_.end(), c.fd), tailing_.end());
+        c.tail_wait = false;
+    }
+    if (c.wb_wait)
+    {
+        wb_waiting_.erase(std::remove(wb_waiting_.begin(), wb_waiting_.end(), c.fd), wb_waiting_.end());
+        c.wb_wait = false;
+    }
+    if (c.done_wait)
+    {
+        finishing_.erase(std::remove(finishing_.begin(), finishing_.end(), c.fd), finishing_.end());
+        c.done_wait = false;
+    }
 }
 
-bool HttpServer::parse_request_(int cfd, std::string &method, std::string &uri,
-                                std::string &headers, std::string &body)
+void HttpServer::reap_closed_(Conn &c)
 {
-    method.clear(); uri.clear(); headers.clear(); body.clear();
-    set_block(cfd);
-
-    // —— 读到包含 "\r\n\r\n" 的一批数据（可多次）——
-    std::string buf;
-    char tmp[4096];
-
-    for (;;) {
-        // 先窥探
-        ssize_t n = ::recv(cfd, tmp, sizeof(tmp), MSG_PEEK);
-        if (n <= 0) return false;
-
-        // 真正取出
-        std::string chunk(tmp, tmp + n);
-        if (::recv(cfd, tmp, n, 0) != n) return false; // 消费同样大小
-
-        buf.append(chunk);
-        size_t pos = buf.find("\r\n\r\n");
-        if (pos != std::string::npos) {
-            headers = buf.substr(0, pos + 4);
-            // —— 关键：保留已读数据里 header 之后的 body 前缀 —— //
-            body = buf.substr(pos + 4);
-            break;
+    release_conn_(c);
+    for (auto it = draining_.begin(); it != draining_.end(); ++it)
+        if (it->get() == &c)
+        {
+            draining_.erase(it);
+            return;
         }
+}
 
-        // 保护：请求头太大
-        if (buf.size() > 64 * 1024) return false;
+void HttpServer::sweep_idle_()
+{
+    time_t now = time(nullptr);
+    std::vector<int> idle;
+    for (auto &kv : conns_)
+    {
+        const Conn &c = *kv.second;
+        if (now - c.last_active > IDLE_TIMEOUT_SEC && !c.tail_wait && !c.wb_wait && !c.done_wait) // 等会话表的不算空闲
+            idle.push_back(kv.first);
     }
+    for (int fd : idle)
+        close_conn_(fd);
+    shaper_.prune(BandwidthShaper::now_ns());
+}
 
-    // 解析首行
-    size_t eol = headers.find("\r\n");
-    if (eol == std::string::npos) return false;
-    std::string first = headers.substr(0, eol);
+// 聊天连接上传的文件提交 / 秒传之后，和 HTTP 的提交路径一样清掉该名字下旧对象的缓存条目
+void HttpServer::drain_cache_bus_()
+{
+    cache_bus_.drain_eventfd();
+    std::string msg;
+    while (cache_bus_.try_pop(msg))
     {
-        auto p1 = first.find(' ');
-        auto p2 = first.find(' ', p1 + 1);
-        if (p1 == std::string::npos || p2 == std::string::npos) return false;
-        method = first.substr(0, p1);
-        uri    = first.substr(p1 + 1, p2 - p1 - 1);
+        json j = json::parse(msg, nullptr, false);
+        if (j.is_object())
+            cache_.invalidate_name(j.value("name", ""), j.value("oid", ""));
     }
+}
 
-    // Content-Length
-    std::string clen_s;
-    size_t clen = 0;
-    if (get_header_(headers, "Content-Length", clen_s)) {
-        clen = (size_t)std::strtoull(clen_s.c_str(), nullptr, 10);
-        if (clen > 256ull * 1024 * 1024) return false; // 简单保护
-    } else {
-        // GET 没 body 可以直接返回
-        if (method == "GET") return true;
-        // 没有 CL 的 POST/PUT 不支持
-        return false;
-    }
+// 限速按对端 IP 算用户：HTTP 上没有登录，X-User 之类的头是客户端自报的，换个名字就能多拿一份额度，
+// 只拿来显示（批量上传的 from）。与聊天连接上的文件帧用同一个键，同一台机器两条路扣同一个桶
+std::string HttpServer::user_key_(const Conn &c) const
+{
+    return c.peer;
+}
 
-    // —— 若首包已带 body 前缀，补读剩余的字节 —— //
-    if (body.size() < clen) {
-        size_t need = clen - body.size();
-        std::string more;
-        more.resize(need);
-        ssize_t r = read_n(cfd, (void*)more.data(), need);
-        if (r != (ssize_t)need) return false;
-        body.append(more);
-    } else if (body.size() > clen) {
-        // 极少见：pipeline 情况，截断到声明长度
-        body.resize(clen);
+size_t HttpServer::grant_(Conn &c, size_t want)
+{
+    int64_t now = BandwidthShaper::now_ns(), wait = 0;
+    size_t n = shaper_.grant(c.flow, want, now, wait);
+    if (n > 0 || wait == 0)
+    {
+        c.wake_ns = 0;
+        return n;
     }
-
-    return true;
+    if (c.wake_ns == 0)
+        throttled_.push_back(c.fd);
+    c.wake_ns = now + wait;
+    return 0;
 }
 
-
-bool HttpServer::send_simple_(int cfd, int code, const char *status,
-                              const std::string &body, const char *ctype)
+// 到点的连接直接接着传；处理中可能关掉别的连接，所以先挑出 fd 再逐个查
+void HttpServer::wake_throttled_()
 {
-    char hdr[512];
-    int n = std::snprintf(hdr, sizeof(hdr),
-                          "HTTP/1.1 %d %s\r\n"
-                          "Content-Length: %zu\r\n"
-                          "Content-Type: %s\r\n"
-                          "Connection: close\r\n\r\n",
-                          code, status, body.size(), ctype);
-    if (::send(cfd, hdr, n, MSG_NOSIGNAL) < 0)
-        return false;
-    if (!body.empty())
-        (void)::send(cfd, body.data(), body.size(), MSG_NOSIGNAL);
-    return true;
+    if (throttled_.empty())
+        return;
+    int64_t now = BandwidthShaper::now_ns();
+    std::vector<int> due;
+    for (size_t i = 0; i < throttled_.size();)
+    {
+        auto it = conns_.find(throttled_[i]);
+        int64_t w = it == conns_.end() ? 0 : it->second->wake_ns;
+        if (w != 0 && w > now)
+        {
+            ++i;
+            continue;
+        }
+        if (w != 0)
+            due.push_back(throttled_[i]);
+        throttled_[i] = throttled_.back();
+        throttled_.pop_back();
+    }
+    for (int fd : due)
+    {
+        auto it = conns_.find(fd);
+        if (it == conns_.end() || it->second->wake_ns == 0)
+            continue;
+        Conn &c = *it->second;
+        c.wake_ns = 0;
+        if (c.phase == Conn::STREAM_BODY)
+            stream_body_(c);
+        else if (c.phase == Conn::BATCH_BODY)
+            batch_body_(c);
+        else if (c.phase == Conn::WRITE)
+            handle_write_(c);
+    }
 }
 
-bool HttpServer::send_file_(int cfd, const std::string &path, const std::string &name)
+// 边传边下的连接发到了上传进度：停掉 EPOLLOUT 挂起，只留 EPOLLRDHUP 发现对端走掉
+void HttpServer::wait_tail_(Conn &c)
 {
-    int fd = ::open(path.c_str(), O_RDONLY);
-    if (fd < 0)
-        return send_simple_(cfd, 404, "Not Found", "NotFound", "text/plain");
-
-    struct stat st{};
-    if (::fstat(fd, &st) != 0)
+    BandwidthShaper::idle(c.flow);
+    if (!c.tail_wait)
     {
-        ::close(fd);
-        return send_simple_(cfd, 500, "Internal Error", "Err", "text/plain");
+        c.tail_wait = true;
+        tailing_.push_back(c.fd);
     }
+    watch_(c, EPOLLRDHUP);
+}
 
-    char hdr[512];
-    int n = std::snprintf(hdr, sizeof(hdr),
-                          "HTTP/1.1 200 OK\r\n"
-                          "Content-Length: %lld\r\n"
-                          "Content-Type: application/octet-stream\r\n"
-                          "Content-Disposition: attachment; filename=\"%s\"\r\n"
-                          "Connection: close\r\n\r\n",
-                          (long long)st.st_size, name.c_str());
-    (void)::send(cfd, hdr, n, MSG_NOSIGNAL);
-
-    char buf[64 * 1024];
-    ssize_t r;
-    while ((r = ::read(fd, buf, sizeof(buf))) > 0)
+// 上传有进展（notify_fd 可读）：重新取各自的进度，前进了的接着发；会话没了（被过期清掉）就断开，
+// 客户端按 Content-Length 知道没收全
+void HttpServer::wake_tailing_()
+{
+    std::vector<int> fds;
+    fds.swap(tailing_);
+    for (int fd : fds)
     {
-        if (::send(cfd, buf, (size_t)r, MSG_NOSIGNAL) < 0)
-            break;
+        auto it = conns_.find(fd);
+        if (it == conns_.end() || !it->second->tail_wait)
+            continue;
+        Conn &c = *it->second;
+        int64_t ready = 0, size = 0;
+        bool done = false;
+        if (sessions_.tail(c.tail_id, ready, size, done) != UploadSessions::OK)
+        {
+            LOG_INFO("HTTP upload %s went away, closing its download", c.tail_id.c_str());
+            close_conn_(fd);
+            continue;
+        }
+        if ((off_t)ready <= c.tail_ready)
+        {
+            tailing_.push_back(fd);
+            continue;
+        }
+        c.tail_ready = (off_t)ready;
+        c.tail_wait = false;
+        c.last_active = time(nullptr);
+        handle_write_(c);
     }
-    ::close(fd);
-    return true;
 }
 
-std::string HttpServer::gen_uuid_()
+// 会话表有回写完成：回写赶上来的上传连接接着收 body，还没赶上的留着等下一次
+void HttpServer::wake_writeback_()
 {
-    // 简易 UUID（够 demo 用）；生产建议用真正 UUID 库
-    char s[37] = {0};
-    unsigned v[16];
-    for (int i = 0; i < 16; ++i)
-        v[i] = (unsigned)rand();
-    std::snprintf(s, sizeof(s),
-                  "%08x-%04x-%04x-%04x-%04x%08x",
-                  v[0], v[1] & 0xffffu, v[2] & 0xffffu, v[3] & 0xffffu, v[4] & 0xffffu, v[5]);
-    return s;
+    std::vector<int> fds;
+    fds.swap(wb_waiting_);
+    for (int fd : fds)
+    {
+        auto it = conns_.find(fd);
+        if (it == conns_.end() || !it->second->wb_wait)
+            continue;
+        Conn &c = *it->second;
+        if (sessions_.writeback_behind(c.upload_id))
+        {
+            wb_waiting_.push_back(fd);
+            continue;
+        }
+        c.wb_wait = false;
+        stream_body_(c);
+    }
 }
 
-void HttpServer::serve_client_(int cfd)
+// 会话表有进展：等摘要的 complete 请求重新处理一遍，还没算完的会再挂回来
+void HttpServer::wake_finishing_()
 {
-    std::string method, uri, headers, body;
-    if (!parse_request_(cfd, method, uri, headers, body))
+    std::vector<int> fds;
+    fds.swap(finishing_);
+    for (int fd : fds)
     {
-        ::close(cfd);
-        return;
+        auto it = conns_.find(fd);
+        if (it == conns_.end() || !it->second->done_wait)
+            continue;
+        it->second->done_wait = false;
+        handle_upload_complete_(*it->second);
     }
+}
 
-    // 路由
-    std::string path, id, seq, name;
-    parse_query_(uri, path, id, seq, name);
-
-    // 1) 健康检查
-    if (method == "GET" && path == "/health")
+int HttpServer::next_wake_ms_(int cap) const
+{
+    int64_t now = BandwidthShaper::now_ns();
+    int ms = cap;
+    for (int fd : throttled_)
     {
-        send_simple_(cfd, 200, "OK", "OK", "text/plain");
-        ::close(cfd);
-        return;
+        auto it = conns_.find(fd);
+        if (it == conns_.end() || it->second->wake_ns == 0)
+            continue;
+        int64_t d = (it->second->wake_ns - now + 999999) / 1000000;
+        ms = (int)std::max<int64_t>(0, std::min<int64_t>(ms, d));
     }
+    return ms;
+}
 
-    // 2) 下载
-    if (method == "GET" && path == "/download")
+// 下载还剩多少文件字节没发（含已在管道里的）
+size_t HttpServer::send_left_(const Conn &c)
+{
+    size_t n = c.in_pipe;
+    for (size_t i = c.part_idx; i < c.parts.size(); ++i)
+        n += (size_t)(c.parts[i].end - c.parts[i].off);
+    return n;
+}
+
+// 请求头解析完成后：按路由决定请求体上限，并把 rbuf 里已读到的 body 前缀挪过去
+bool HttpServer::begin_body_(Conn &c)
+{
+    const HttpRequest &req = c.parser.request();
+    const size_t head = c.parser.header_bytes();
+
+    if (!req.has_content_length)
     {
-        if (name.empty())
+        if (req.method == "GET")
         {
-            send_simple_(cfd, 400, "Bad Request", "missing name", "text/plain");
-            ::close(cfd);
-            return;
+            c.body_need = 0;
+            c.body_got = 0;
+            return true;
         }
-        auto fpath = catalog_.final_path(name);
-        send_file_(cfd, fpath, name);
-        ::close(cfd);
-        return;
+        reply_(c, 411, "Length Required", "missing content-length", "text/plain");
+        return false;
     }
 
-    // 3) 上传初始化：POST /upload/init   body: {"name":"...", "size":12345}
-    if (method == "POST" && path == "/upload/init")
+    if (req.content_length > MAX_JSON_BODY)
     {
-        std::string id_new = gen_uuid_();
-        auto tmp = catalog_.temp_path(id_new);
-
-        // 预创建空的 .part
-        int fd = ::open(tmp.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
-        if (fd < 0)
-        {
-            send_simple_(cfd, 500, "Internal Error", "open temp failed", "text/plain");
-            ::close(cfd);
-            return;
-        }
-        ::close(fd);
-
-        json resp{
-            {"id", id_new},
-            {"chunk_size", (int)DEFAULT_CHUNK_SIZE}};
-        send_simple_(cfd, 200, "OK", resp.dump());
-        ::close(cfd);
-        return;
+        reply_(c, 413, "Payload Too Large", "body too large", "text/plain");
+        return false;
     }
+    c.body_need = (size_t)req.content_length;
+    c.body.resize(c.body_need);
+    c.body_got = std::min(c.rlen - head, c.body_need);
+    std::memcpy(&c.body[0], c.rbuf + head, c.body_got);
+    return true;
+}
 
-    // 4) 上传分片：PUT /upload/chunk?id=...&seq=...   (Body=二进制)
-    if (method == "PUT" && path == "/upload/chunk")
+void HttpServer::handle_read_(Conn &c)
+{
+    const int fd = c.fd;
+    for (;;)
     {
-        if (id.empty() || seq.empty())
+        char *dst;
+        size_t room;
+        if (c.phase == Conn::READ_HEAD)
         {
-            send_simple_(cfd, 400, "Bad Request", "missing id/seq", "text/plain");
-            ::close(cfd);
-            return;
+            dst = c.rbuf + c.rlen;
+            room = sizeof(c.rbuf) - c.rlen;
+            if (room == 0)
+            {
+                reply_(c, 431, "Request Header Fields Too Large", "header too large", "text/plain");
+                return;
+            }
         }
-
-        // 直接使用 parse_request_() 返回的 body
-        const std::string& data = body;
-        if (data.empty())
+        else if (c.phase == Conn::READ_BODY)
         {
-            send_simple_(cfd, 400, "Bad Request", "empty body", "text/plain");
-            ::close(cfd);
-            return;
+            dst = &c.body[c.body_got];
+            room = c.body_need - c.body_got;
         }
-
-        // 可选：限制单片大小（与 DEFAULT_CHUNK_SIZE 对齐）
-        if (data.size() > DEFAULT_CHUNK_SIZE)
-        {
-            send_simple_(cfd, 413, "Payload Too Large", "chunk too large", "text/plain");
-            ::close(cfd);
+        else
             return;
-        }
 
-        auto tmp = catalog_.temp_path(id);
-        int fd = ::open(tmp.c_str(), O_CREAT | O_RDWR, 0644);
-        if (fd < 0)
+        ssize_t n = ::recv(fd, dst, room, 0);
+        if (n == 0)
         {
-            send_simple_(cfd, 500, "Internal Error", "open temp failed", "text/plain");
-            ::close(cfd);
+            close_conn_(fd);
             return;
         }
-
-        long long iseq = std::strtoll(seq.c_str(), nullptr, 10);
-        off_t off = (off_t)(iseq * (long long)DEFAULT_CHUNK_SIZE);
-        ssize_t wr = ::pwrite(fd, data.data(), data.size(), off);
-        ::close(fd);
-
-        if (wr != (ssize_t)data.size())
+        if (n < 0)
         {
-            send_simple_(cfd, 500, "Internal Error", "pwrite fail", "text/plain");
-            ::close(cfd);
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                close_conn_(fd);
             return;
         }
+        c.last_active = time(nullptr);
 
-        send_simple_(cfd, 200, "OK", "{\"ok\":true}");
-        ::close(cfd);
-        return;
-    }
-
-    // 5) 完成提交：POST /upload/complete    body: {"id":"..","name":"..","size":123,"from":"Alice"}
-    if (method == "POST" && path == "/upload/complete")
-    {
-        json req;
-        try
+        if (c.phase == Conn::READ_HEAD)
         {
-            req = json::parse(body);
+            c.rlen += (size_t)n;
+            HttpParser::Status st = c.parser.feed(c.rbuf, c.rlen);
+            if (st == HttpParser::NEED_MORE)
+                continue;
+            if (st == HttpParser::ERROR)
+            {
+                reply_(c, 400, "Bad Request", c.parser.error(), "text/plain");
+                return;
+            }
+            const HttpRequest &req = c.parser.request();
+            if (req.method == "PUT" && req.path == "/upload/chunk")
+            {
+                if (begin_chunk_(c))
+                    stream_body_(c);
+                return;
+            }
+            if (req.method == "POST" && req.path == "/upload/batch")
+            {
+                if (begin_batch_(c))
+                    batch_body_(c);
+                return;
+            }
+            if (!begin_body_(c))
+                return;
+            c.phase = Conn::READ_BODY;
         }
-        catch (...)
+        else
         {
-            send_simple_(cfd, 400, "Bad Request", "bad json", "text/plain");
-            ::close(cfd);
-            return;
+            c.body_got += (size_t)n;
         }
-        std::string jid = req.value("id", "");
-        std::string jname = req.value("name", "");
-        long long jsize = req.value("size", 0LL);
-        std::string jfrom = req.value("from", "");
 
-        if (jid.empty() || jname.empty() || jsize <= 0)
+        if (c.body_got >= c.body_need)
         {
-            send_simple_(cfd, 400, "Bad Request", "missing fields", "text/plain");
-            ::close(cfd);
-            return;
-        }
-
-        auto tmp = catalog_.temp_path(jid);
-        
-        // 最终尺寸校验
-        struct stat st{};
-        if (::stat(tmp.c_str(), &st) != 0 || (long long)st.st_size != jsize) {
-            send_simple_(cfd, 400, "Bad Request", "size mismatch", "text/plain");
-            ::close(cfd);
+            dispatch_(c);
             return;
         }
+    }
+}
 
-        auto fin = catalog_.final_path(jname);
-        // 可根据 jsize 校验实际大小（略）
-        ::unlink(fin.c_str());
-        if (::rename(tmp.c_str(), fin.c_str()) != 0)
+bool HttpServer::acquire_pipe_(Conn &c)
+{
+    static constexpr int PIPE_SIZE = 1024 * 1024; // 一次异步 splice 最多搬这么多，减少提交次数
+    if (!pipe_pool_.empty())
+    {
+        c.pipe_r = pipe_pool_.back().first;
+        c.pipe_w = pipe_pool_.back().second;
+        pipe_pool_.pop_back();
+    }
+    else
+    {
+        int p[2];
+        if (::pipe2(p, O_NONBLOCK | O_CLOEXEC) != 0)
         {
-            send_simple_(cfd, 500, "Internal Error", "rename fail", "text/plain");
-            ::close(cfd);
-            return;
+            c.no_splice = true;
+            return false;
         }
+        ::fcntl(p[1], F_SETPIPE_SZ, PIPE_SIZE); // 超过 pipe-max-size 时保持默认的 64KB
+        c.pipe_r = p[0];
+        c.pipe_w = p[1];
+    }
+    int cap = ::fcntl(c.pipe_w, F_GETPIPE_SZ);
+    c.pipe_cap = cap > 0 ? (size_t)cap : 64 * 1024;
+    c.in_pipe = 0;
+    c.pipe_full = false;
+    return true;
+}
 
-        // 向聊天侧广播文件元信息
-        json meta{
-            {"action", "file_meta"},
-            {"from", jfrom},
-            {"name", jname},
-            {"size", jsize},
-            {"url", std::string("/download?name=") + jname}};
-        bus_.publish(meta.dump());
-
-        send_simple_(cfd, 200, "OK", "{\"ok\":true}");
-        ::close(cfd);
+// 只有排空的管道才会放回池；还有残留数据（出错、对端中断）的直接关掉
+void HttpServer::release_pipe_(Conn &c)
+{
+    if (c.pipe_r < 0)
         return;
+    if (c.in_pipe == 0 && pipe_pool_.size() < 32)
+        pipe_pool_.emplace_back(c.pipe_r, c.pipe_w);
+    else
+    {
+        ::close(c.pipe_r);
+        ::close(c.pipe_w);
     }
-
-    // 未匹配
-    send_simple_(cfd, 404, "Not Found", "NotFound", "text/plain");
-    ::close(cfd);
+    c.pipe_r = c.pipe_w = -1;
+    c.in_pipe = 0;
 }
 
-void HttpServer::run()
+// 分片请求：头部一到就校验参数、打开 .part，body 随后边收边写
+bool HttpServer::begin_chunk_(Conn &c)
 {
-    LOG_INFO("HTTP server listening at http://%s:%d", bind_.c_str(), port_);
-    while (!stopping_.load())
+    const HttpRequest &req = c.parser.request();
+    std::string id = http_url_decode(req.param("id"));
+    std::string seq = http_url_decode(req.param("seq"));
+    if (id.empty() || seq.empty())
     {
-        sockaddr_in cli{};
-        socklen_t len = sizeof(cli);
-        int cfd = ::accept4(listen_fd_, (sockaddr *)&cli, &len, SOCK_CLOEXEC);
-        if (cfd < 0)
+        reply_(c, 400, "Bad Request", "missing id/seq", "text/plain");
+        return false;
+    }
+    if (!req.has_content_length)
+    {
+        reply_(c, 411, "Length Required", "missing content-length", "text/plain");
+        return false;
+    }
+    if (req.content_length == 0)
+    {
+        reply_(c, 400, "Bad Request", "empty body", "text/plain");
+        return false;
+    }
+    // 限制单片大小（与 DEFAULT_CHUNK_SIZE 对齐）
+    if (req.content_length > DEFAULT_CHUNK_SIZE)
+    {
+        reply_(c, 413, "Payload Too Large", "chunk too large", "text/plain");
+        return false;
+    }
+    char *end = nullptr;
+    unsigned long long iseq = std::strtoull(seq.c_str(), &end, 10);
+    if (!end || *end != '\0' || seq[0] == '-')
+    {
+        reply_(c, 400, "Bad Request", "bad seq", "text/plain");
+        return false;
+    }
+    // 可选的分片校验：8 位十六进制 CRC32C。splice 路径数据不经过用户态没法算，改走 recv
+    std::string_view crc_hdr = req.header("X-Chunk-Crc32c");
+    if (!crc_hdr.empty())
+    {
+        std::string v(crc_hdr);
+        unsigned long cv = std::strtoul(v.c_str(), &end, 16);
+        if (v.size() != 8 || !end || *end != '\0')
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            reply_(c, 400, "Bad Request", "bad X-Chunk-Crc32c", "text/plain");
+            return false;
+        }
+        c.crc_check = true;
+        c.crc_expect = (uint32_t)cv;
+        c.no_splice = true;
+    }
+
+    int fd = -1;
+    off_t off = 0;
+    auto st = sessions_.begin_chunk(id, iseq, req.content_length, fd, off);
+    if (st != UploadSessions::OK)
+    {
+        if (st == UploadSessions::NOT_FOUND)
+            reply_(c, 404, "Not Found", UploadSessions::status_str(st), "text/plain");
+        else if (st == UploadSessions::BUSY) // 超过 init 时约定的并发数：让客户端稍后重试
+            reply_(c, 429, "Too Many Requests", UploadSessions::status_str(st), "text/plain",
+                   "Retry-After: 1\r\n");
+        else if (st == UploadSessions::IN_FLIGHT)
+            reply_(c, 409, "Conflict", UploadSessions::status_str(st), "text/plain");
+        else if (st == UploadSessions::IO_ERROR)
+            reply_(c, 500, "Internal Error", UploadSessions::status_str(st), "text/plain");
+        else
+            reply_(c, 400, "Bad Request", UploadSessions::status_str(st), "text/plain");
+        return false;
+    }
+    c.upload_id = std::move(id);
+    c.upload_seq = iseq;
+    shaper_.attach(c.flow, user_key_(c), BandwidthShaper::UP);
+    c.file_fd = fd;
+    c.file_off = off;
+    c.file = aio_.acquire_file(fd);
+    if (c.file < 0)
+    {
+        reply_(c, 500, "Internal Error", "register file fail", "text/plain");
+        return false;
+    }
+
+    // 和请求头一起读进 rbuf 的 body 前缀（不超过 rbuf 大小）先放进管道/缓冲，随后一起写盘
+    size_t head = c.parser.header_bytes();
+    size_t pre = std::min(c.rlen - head, (size_t)req.content_length);
+    if (!c.no_splice && acquire_pipe_(c))
+    {
+        if (pre > 0 && ::write(c.pipe_w, c.rbuf + head, pre) != (ssize_t)pre)
+        {
+            reply_(c, 500, "Internal Error", "pipe write fail", "text/plain");
+            return false;
+        }
+        c.in_pipe = pre;
+    }
+    else
+    {
+        c.buf = aio_.get_buffer();
+        if (!c.buf.data)
+        {
+            reply_(c, 500, "Internal Error", "no buffer", "text/plain");
+            return false;
+        }
+        std::memcpy(c.buf.data, c.rbuf + head, pre);
+        c.buf_len = pre;
+    }
+    if (c.crc_check)
+        c.crc = crc32c(0, c.rbuf + head, pre);
+    c.body_left = (size_t)req.content_length - pre;
+    c.phase = Conn::STREAM_BODY;
+    return true;
+}
+
+// socket -> .part：优先 splice(socket->pipe)，再异步 splice(pipe->file)，数据不进用户态；
+// 不支持 splice 时退化为 recv 到缓冲池 + 异步 write。每个连接的内存占用与分片大小无关。
+// 写盘在途时 socket 照样往管道里收，管道满（或 recv 路径缓冲在用）就暂停 EPOLLIN，
+// 写盘完成的回调再恢复；磁盘慢只会让这一个连接的 TCP 窗口收紧，不会卡住事件循环。
+// 每轮最多收 shaper 给的那么多；令牌不够时同样暂停 EPOLLIN，对端被 TCP 窗口压住。
+// 这个上传的回写跟不上时也一样，挂进 wb_waiting_ 等会话表通知。
+void HttpServer::stream_body_(Conn &c)
+{
+    const int fd = c.fd;
+    if (c.body_left > 0 && !c.wb_wait && notify_fd_ >= 0 && sessions_.writeback_behind(c.upload_id))
+    {
+        c.wb_wait = true;
+        wb_waiting_.push_back(fd);
+    }
+    size_t budget = c.body_left > 0 && !c.wb_wait ? grant_(c, c.body_left) : 0;
+
+    while (c.body_left > 0 && budget > 0)
+    {
+        ssize_t n;
+        if (!c.no_splice && (c.pipe_w >= 0 || acquire_pipe_(c)))
+        {
+            if (c.in_pipe >= c.pipe_cap)
+                break;
+            n = ::splice(fd, nullptr, c.pipe_w, nullptr,
+                         std::min({c.body_left, c.pipe_cap - c.in_pipe, budget}), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0)
             {
-                usleep(1000 * 10);
+                c.in_pipe += (size_t)n;
+                c.body_left -= (size_t)n;
+                budget -= (size_t)n;
+                shaper_.consume(c.flow, (size_t)n);
+                c.last_active = time(nullptr);
+                flush_upload_(c);
                 continue;
             }
-            if (errno == EINTR)
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+            {
+                c.no_splice = true; // 管道里已有的数据照常写完，之后走 recv
+                continue;
+            }
+        }
+        else
+        {
+            if (c.io_pending || c.in_pipe > 0)
+                break; // 中转缓冲（或管道里更早的数据）还在写盘，按顺序来
+            if (!c.buf.data && !(c.buf = aio_.get_buffer()).data)
+                return reply_(c, 500, "Internal Error", "no buffer", "text/plain");
+            n = ::recv(fd, c.buf.data + c.buf_len, std::min({c.body_left, c.buf.size - c.buf_len, budget}), 0);
+            if (n > 0)
+            {
+                if (c.crc_check)
+                    c.crc = crc32c(c.crc, c.buf.data + c.buf_len, (size_t)n);
+                c.buf_len += (size_t)n;
+                c.body_left -= (size_t)n;
+                budget -= (size_t)n;
+                shaper_.consume(c.flow, (size_t)n);
+                c.last_active = time(nullptr);
+                if (c.buf_len == c.buf.size || c.body_left == 0)
+                    flush_upload_(c);
                 continue;
-            if (stopping_.load())
+            }
+        }
+
+        if (n == 0)
+            return close_conn_(fd); // 分片没收全对端就断了
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return close_conn_(fd);
+        BandwidthShaper::idle(c.flow);
+        break; // socket 暂时没数据
+    }
+
+    flush_upload_(c);
+    if (c.io_pending || c.wake_ns != 0 || c.wb_wait)
+        return watch_(c, 0); // 等写盘回调 / 等令牌 / 等回写
+    if (c.body_left > 0)
+        return watch_(c, EPOLLIN | EPOLLRDHUP);
+    handle_upload_chunk_(c); // body 已全部落盘
+}
+
+// 没有写盘在途时，把管道（优先，保证顺序）或中转缓冲里攒下的数据提交给 AsyncFileIO
+void HttpServer::flush_upload_(Conn &c)
+{
+    if (c.io_pending || c.closed)
+        return;
+    Conn *cp = &c;
+    if (c.in_pipe > 0)
+    {
+        c.io_pending = true;
+        c.io_from_pipe = true;
+        aio_.splice_in(c.pipe_r, c.file, c.file_off, c.in_pipe, [this, cp](ssize_t r) { on_upload_io_(*cp, r); });
+    }
+    else if (c.buf_len > 0)
+    {
+        c.io_pending = true;
+        c.io_from_pipe = false;
+        aio_.write(c.file, c.buf.data, c.buf_len, c.file_off, c.buf.index,
+                   [this, cp](ssize_t r) { on_upload_io_(*cp, r); });
+    }
+}
+
+void HttpServer::on_upload_io_(Conn &c, ssize_t res)
+{
+    c.io_pending = false;
+    if (c.closed)
+        return reap_closed_(c);
+    if (res <= 0)
+    {
+        LOG_WARN("HTTP upload %s chunk %llu: write failed: %s", c.upload_id.c_str(),
+                 (unsigned long long)c.upload_seq, res == 0 ? "no progress" : strerror((int)-res));
+        return reply_(c, 500, "Internal Error", "write fail", "text/plain");
+    }
+    c.file_off += (off_t)res;
+    if (c.io_from_pipe)
+        c.in_pipe -= (size_t)res;
+    else
+    {
+        c.buf_len -= (size_t)res; // 短写：剩下的挪到缓冲开头再写
+        if (c.buf_len > 0)
+            std::memmove(c.buf.data, c.buf.data + res, c.buf_len);
+    }
+    stream_body_(c);
+}
+
+// POST /upload/batch[?from=]：一个请求带多个小文件，省掉每个文件 init + chunk + complete 三次往返
+// 和三条新连接。body 长度必须事先给出；单个文件不超过一片，摘要就是它唯一一片的摘要
+bool HttpServer::begin_batch_(Conn &c)
+{
+    const HttpRequest &req = c.parser.request();
+    if (!req.has_content_length)
+    {
+        reply_(c, 411, "Length Required", "missing content-length", "text/plain");
+        return false;
+    }
+    if (req.content_length == 0 || req.content_length > MAX_BATCH_BODY)
+    {
+        reply_(c, 413, "Payload Too Large", "batch too large", "text/plain");
+        return false;
+    }
+    c.buf = aio_.get_buffer();
+    if (!c.buf.data)
+    {
+        reply_(c, 500, "Internal Error", "no buffer", "text/plain");
+        return false;
+    }
+    c.batch = std::make_unique<Conn::Batch>();
+    c.batch->from = http_url_decode(req.param("from"));
+    if (c.batch->from.empty())
+        c.batch->from = http_url_decode(req.header("X-User"));
+
+    size_t head = c.parser.header_bytes();
+    size_t pre = std::min(c.rlen - head, (size_t)req.content_length);
+    std::memcpy(c.buf.data, c.rbuf + head, pre);
+    c.buf_len = pre;
+    c.body_left = (size_t)req.content_length - pre;
+    shaper_.attach(c.flow, user_key_(c), BandwidthShaper::UP);
+    c.phase = Conn::BATCH_BODY;
+    return true;
+}
+
+// 先消化 buf 里已收到的数据：记录头就地解析，文件内容异步写盘（回调里再回到这里）；
+// buf 消化完再从 socket 收下一块。同一时刻最多一个写盘在途，buf 在它完成前不动
+void HttpServer::batch_body_(Conn &c)
+{
+    Conn::Batch &b = *c.batch;
+    const int fd = c.fd;
+    size_t budget = 0;
+    bool granted = false;
+    for (;;)
+    {
+        while (b.off < c.buf_len)
+        {
+            if (b.in_file)
+            {
+                size_t n = (size_t)std::min<uint64_t>(c.buf_len - b.off, b.size - b.got);
+                Conn *cp = &c;
+                c.io_pending = true;
+                aio_.write(c.file, c.buf.data + b.off, n, (off_t)b.got, c.buf.index,
+                           [this, cp](ssize_t r) { on_batch_io_(*cp, r); });
+                return watch_(c, 0);
+            }
+            if (!take_batch_head_(c))
                 break;
-            LOG_WARN("HTTP accept error: %s", strerror(errno));
+            if (!open_batch_file_(c))
+                return;
+        }
+        c.buf_len = 0;
+        b.off = 0;
+        if (c.body_left == 0)
+            return finish_batch_(c);
+
+        if (!granted)
+        {
+            budget = grant_(c, c.body_left);
+            granted = true;
+        }
+        if (budget == 0)
+            return watch_(c, c.wake_ns != 0 ? 0 : EPOLLIN | EPOLLRDHUP);
+        ssize_t n = ::recv(fd, c.buf.data, std::min({c.body_left, c.buf.size, budget}), 0);
+        if (n > 0)
+        {
+            c.buf_len = (size_t)n;
+            c.body_left -= (size_t)n;
+            budget -= (size_t)n;
+            shaper_.consume(c.flow, (size_t)n);
+            c.last_active = time(nullptr);
+            continue;
+        }
+        if (n == 0)
+            return close_conn_(fd);
+        if (errno == EINTR)
             continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return close_conn_(fd);
+        BandwidthShaper::idle(c.flow);
+        return watch_(c, EPOLLIN | EPOLLRDHUP);
+    }
+}
+
+// 把 buf 里的字节攒进记录头；头凑齐（2 + 名字长 + 8）返回 true
+bool HttpServer::take_batch_head_(Conn &c)
+{
+    Conn::Batch &b = *c.batch;
+    for (;;)
+    {
+        size_t need = 2;
+        if (b.head.size() >= 2)
+            need += ((size_t)(unsigned char)b.head[0] | (size_t)(unsigned char)b.head[1] << 8) + 8;
+        if (b.head.size() >= need)
+            return true;
+        if (b.off == c.buf_len)
+            return false;
+        size_t n = std::min(need - b.head.size(), c.buf_len - b.off);
+        b.head.append(c.buf.data + b.off, n);
+        b.off += n;
+    }
+}
+
+// 记录头已凑齐：校验，建 .part；出错时已回复，返回 false
+bool HttpServer::open_batch_file_(Conn &c)
+{
+    Conn::Batch &b = *c.batch;
+    size_t len = b.head.size() - 10;
+    uint64_t size = 0;
+    for (int i = 7; i >= 0; --i)
+        size = (size << 8) | (unsigned char)b.head[2 + len + (size_t)i];
+    b.name = b.head.substr(2, len);
+    b.head.clear();
+
+    if (len == 0 || len > MAX_BATCH_NAME || b.name.find('\0') != std::string::npos)
+    {
+        reply_(c, 400, "Bad Request", "bad file name in batch", "text/plain");
+        return false;
+    }
+    if (++b.count > MAX_BATCH_FILES || size > MAX_BATCH_FILE)
+    {
+        reply_(c, 413, "Payload Too Large", "too many or too large files in batch", "text/plain");
+        return false;
+    }
+    if (size > c.body_left + (c.buf_len - b.off))
+    {
+        reply_(c, 400, "Bad Request", "truncated batch", "text/plain");
+        return false;
+    }
+    if (size == 0)
+    {
+        b.failed.emplace_back(b.name, "empty");
+        return true;
+    }
+
+    std::string id = gen_uuid_();
+    b.part = catalog_.temp_path(id);
+    c.send_fd = catalog_.prepare_temp(id)
+                    ? ::open(b.part.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644)
+                    : -1;
+    if (c.send_fd < 0 || (c.file = aio_.acquire_file(c.send_fd)) < 0)
+    {
+        LOG_WARN("HTTP batch: create %s failed: %s", b.part.c_str(), strerror(errno));
+        reply_(c, 500, "Internal Error", "create file fail", "text/plain");
+        return false;
+    }
+    b.size = size;
+    b.got = 0;
+    b.hasher.reset();
+    b.in_file = true;
+    return true;
+}
+
+void HttpServer::on_batch_io_(Conn &c, ssize_t res)
+{
+    c.io_pending = false;
+    if (c.closed)
+        return reap_closed_(c);
+    Conn::Batch &b = *c.batch;
+    if (res <= 0)
+    {
+        LOG_WARN("HTTP batch: write %s failed: %s", b.part.c_str(), res == 0 ? "no progress" : strerror((int)-res));
+        return reply_(c, 500, "Internal Error", "write fail", "text/plain");
+    }
+    b.hasher.update(c.buf.data + b.off, (size_t)res);
+    b.off += (size_t)res;
+    b.got += (uint64_t)res;
+    if (b.got == b.size)
+        return batch_file_done_(c);
+    batch_body_(c);
+}
+
+// 一个文件的内容全部写完：需要落盘时先 fdatasync，再提交
+void HttpServer::batch_file_done_(Conn &c)
+{
+    if (catalog_.durability() == Durability::NONE)
+        return commit_batch_file_(c);
+    Conn *cp = &c;
+    c.io_pending = true;
+    aio_.fdatasync(c.file, [this, cp](ssize_t r) {
+        Conn &c = *cp;
+        c.io_pending = false;
+        if (c.closed)
+            return reap_closed_(c);
+        if (r < 0)
+        {
+            LOG_WARN("HTTP batch: fdatasync %s failed: %s", c.batch->part.c_str(), strerror((int)-r));
+            return reply_(c, 500, "Internal Error", "sync fail", "text/plain");
+        }
+        commit_batch_file_(c);
+    });
+}
+
+// 提交（rename + 目录 fsync + 名字日志落盘）交给 AsyncFileIO 的工作线程：一个批量最多上千个文件，
+// 逐个在事件循环里提交的话别的传输都得等着。提交回来再接着解析下一条记录
+void HttpServer::commit_batch_file_(Conn &c)
+{
+    Conn::Batch &b = *c.batch;
+    aio_.release_file(c.file);
+    c.file = -1;
+    ::close(c.send_fd);
+    c.send_fd = -1;
+    b.in_file = false;
+
+    uint8_t dg[Sha256::DIGEST_SIZE];
+    b.hasher.final(dg);
+    auto e = std::make_shared<FileEntry>();
+    e->name = b.name;
+    e->sha256 = Sha256::to_hex(dg);
+    e->size = (int64_t)b.size;
+    e->from = b.from;
+    std::vector<std::string> chunks{std::string((const char *)dg, sizeof(dg))};
+    std::string part = std::move(b.part);
+    b.part.clear();
+    Conn *cp = &c;
+    c.io_pending = true;
+    aio_.call([this, e, part, chunks] { return catalog_.commit(part, *e, DEFAULT_CHUNK_SIZE, chunks) ? 0 : -EIO; },
+              [this, cp, e, part](ssize_t r) {
+                  Conn &c = *cp;
+                  c.io_pending = false;
+                  Conn::Batch &b = *c.batch;
+                  if (r >= 0)
+                  {
+                      cache_.invalidate_name(e->name, e->oid);
+                      gzip_.enqueue(e->sha256, e->name);
+                      b.done.push_back(std::move(*e)); // 连接已关也记上，end_batch_ 照样广播
+                  }
+                  else
+                  {
+                      ::unlink(part.c_str());
+                      b.failed.emplace_back(e->name, "commit failed");
+                  }
+                  if (c.closed)
+                      return reap_closed_(c);
+                  batch_body_(c);
+              });
+}
+
+void HttpServer::finish_batch_(Conn &c)
+{
+    Conn::Batch &b = *c.batch;
+    if (b.in_file || !b.head.empty())
+        return reply_(c, 400, "Bad Request", "truncated batch", "text/plain");
+    json files = json::array(), failed = json::array();
+    for (const auto &e : b.done)
+        files.push_back({{"name", e.name}, {"oid", e.oid}, {"sha256", e.sha256}, {"size", e.size}});
+    for (const auto &f : b.failed)
+        failed.push_back({{"name", f.first}, {"error", f.second}});
+    json resp{{"ok", b.failed.empty()}, {"files", files}, {"failed", failed}};
+    reply_(c, 200, "OK", resp.dump());
+}
+
+// 连接释放时：删掉写了一半的 .part；已提交的文件合成一条 file_meta_batch 广播
+// （出错或客户端中途断开也照样广播，它们已经在目录里了）
+void HttpServer::end_batch_(Conn &c)
+{
+    std::unique_ptr<Conn::Batch> b = std::move(c.batch);
+    if (b->in_file)
+        ::unlink(b->part.c_str());
+    if (b->done.empty())
+        return;
+    json files = json::array();
+    for (const auto &e : b->done)
+        files.push_back({{"name", e.name},
+                         {"size", e.size},
+                         {"sha256", e.sha256},
+                         {"oid", e.oid},
+                         {"url", std::string("/download?oid=") + e.oid}});
+    json meta{{"action", "file_meta_batch"}, {"from", b->from}, {"count", b->done.size()}, {"files", files}};
+    bus_.publish(meta.dump());
+}
+
+// 先发 wbuf（响应头），再按 parts 依次发送：每段的 prefix 走 send，文件区间先由 AsyncFileIO
+// 异步 splice 进管道（预读），再 splice 管道 -> socket，数据不进用户态，读盘也不阻塞事件循环；
+// 没有管道可用时退回同步 sendfile。
+// 每次可写事件最多推 shaper 给的字节数就让出（DRR 的一个 quantum，限速时还受令牌约束），
+// 多个大下载和上传在同一个循环里轮流前进；令牌不够时停掉 EPOLLOUT，到点由 wake_throttled_ 接着发。
+// 短写/EAGAIN 靠连接上记录的偏移续传，对端中断（EPIPE/ECONNRESET）直接回收连接。
+void HttpServer::handle_write_(Conn &c)
+{
+    const int fd = c.fd;
+
+    auto send_mem = [&](const std::string &buf, size_t &off, bool more) -> int {
+        while (off < buf.size())
+        {
+            ssize_t n = ::send(fd, buf.data() + off, buf.size() - off, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+            if (n > 0)
+            {
+                off += (size_t)n;
+                c.last_active = time(nullptr);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+            return -1;
+        }
+        return 1;
+    };
+
+    int r = send_mem(c.cached ? c.cached->response : c.wbuf, c.woff, c.part_idx < c.parts.size());
+    if (r < 0)
+        return close_conn_(fd);
+    if (r == 0)
+        return;
+
+    size_t left = send_left_(c);
+    size_t budget = left > 0 ? grant_(c, left) : 0;
+    if (c.wake_ns != 0)
+    {
+        read_ahead_(c); // 等令牌的时候顺便把管道预读满
+        return watch_(c, 0);
+    }
+    while (c.part_idx < c.parts.size())
+    {
+        auto &p = c.parts[c.part_idx];
+        r = send_mem(p.prefix, c.prefix_off, p.off < p.end || c.part_idx + 1 < c.parts.size());
+        if (r < 0)
+            return close_conn_(fd);
+        if (r == 0)
+            return;
+
+        while (c.pipe_r >= 0 && (p.off < p.end || c.in_pipe > 0 || c.io_pending))
+        {
+            read_ahead_(c);
+            if (c.in_pipe == 0)
+            {
+                if (!c.io_pending && c.tail_ready >= 0)
+                    return wait_tail_(c); // 只有边传边下会这样：已发到上传进度
+                BandwidthShaper::idle(c.flow);
+                return watch_(c, 0); // 等读盘回调
+            }
+            watch_(c, EPOLLOUT | EPOLLRDHUP);
+            if (budget == 0)
+                return;
+            ssize_t n = ::splice(c.pipe_r, nullptr, fd, nullptr, std::min(c.in_pipe, budget),
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0)
+            {
+                c.in_pipe -= (size_t)n;
+                c.pipe_full = false;
+                budget -= (size_t)n;
+                shaper_.consume(c.flow, (size_t)n);
+                c.last_active = time(nullptr);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return BandwidthShaper::idle(c.flow);
+            if (n < 0 && errno != EPIPE && errno != ECONNRESET)
+                LOG_WARN("HTTP splice to socket failed: %s", strerror(errno));
+            return close_conn_(fd);
+        }
+        while (p.off < p.end)
+        {
+            off_t end = c.tail_ready >= 0 ? std::min(p.end, c.tail_ready) : p.end;
+            if (p.off >= end)
+                return wait_tail_(c);
+            if (budget == 0)
+                return; // 预算用完，等下一轮 EPOLLOUT
+            size_t want = (size_t)std::min<off_t>(end - p.off, (off_t)budget);
+            ssize_t n = ::sendfile(fd, c.send_fd, &p.off, want);
+            if (n > 0)
+            {
+                budget -= (size_t)n;
+                shaper_.consume(c.flow, (size_t)n);
+                c.last_active = time(nullptr);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return BandwidthShaper::idle(c.flow);
+            if (n < 0 && errno != EPIPE && errno != ECONNRESET)
+                LOG_WARN("HTTP sendfile failed: %s", strerror(errno));
+            return close_conn_(fd); // n == 0：文件被截断；其他：对端已断开
+        }
+        ++c.part_idx;
+        c.prefix_off = 0;
+    }
+
+    close_conn_(fd); // Connection: close
+}
+
+// 管道空出一半以上、当前段还有没读的文件内容且没有读盘在途时，提交一次 文件 -> 管道 的异步 splice
+void HttpServer::read_ahead_(Conn &c)
+{
+    if (c.io_pending || c.pipe_full || c.part_idx >= c.parts.size())
+        return;
+    const auto &p = c.parts[c.part_idx];
+    off_t end = c.tail_ready >= 0 ? std::min(p.end, c.tail_ready) : p.end; // 边传边下不越过已到齐的前缀
+    if (p.off >= end || c.in_pipe > c.pipe_cap / 2)
+        return;
+    size_t want = (size_t)std::min<off_t>(end - p.off, (off_t)(c.pipe_cap - c.in_pipe));
+    Conn *cp = &c;
+    c.io_pending = true;
+    aio_.splice_out(c.file, p.off, c.pipe_w, want, [this, cp](ssize_t r) { on_download_io_(*cp, r); });
+}
+
+void HttpServer::on_download_io_(Conn &c, ssize_t res)
+{
+    c.io_pending = false;
+    if (c.closed)
+        return reap_closed_(c);
+    if (res == -EAGAIN)
+        c.pipe_full = c.in_pipe > 0; // 管道按页占槽位，非对齐的区间可能提前占满；发走一些再读
+    else if (res <= 0)
+    {
+        if (res < 0)
+            LOG_WARN("HTTP read for download failed: %s", strerror((int)-res));
+        return close_conn_(c.fd); // res == 0：文件被截断
+    }
+    else
+    {
+        c.parts[c.part_idx].off += res;
+        c.in_pipe += (size_t)res;
+    }
+    handle_write_(c);
+}
+
+void HttpServer::dispatch_(Conn &c)
+{
+    const HttpRequest &req = c.parser.request();
+    LOG_DEBUG("http: fd=%d %s %s", c.fd, std::string(req.method), std::string(req.path));
+
+    // 1) 健康检查
+    if (req.method == "GET" && req.path == "/health")
+        return reply_(c, 200, "OK", "OK", "text/plain");
+
+    // 2) 下载
+    if (req.method == "GET" && req.path == "/download")
+        return handle_download_(c);
+
+    // 3) 上传初始化：POST /upload/init   body: {"name":"...", "size":12345[, "sha256":"..", "chunk_sha256":[..]]}
+    if (req.method == "POST" && req.path == "/upload/init")
+        return handle_upload_init_(c);
+
+    // 4) 上传分片：PUT /upload/chunk?id=...&seq=...   (Body=二进制)
+    if (req.method == "PUT" && req.path == "/upload/chunk")
+        return handle_upload_chunk_(c);
+
+    // 5) 完成提交：POST /upload/complete    body: {"id":"..","name":"..","size":123,"from":"Alice"}
+    if (req.method == "POST" && req.path == "/upload/complete")
+        return handle_upload_complete_(c);
+
+    // 6) 断点续传：GET /upload/status?id=...  返回缺失的分片区间
+    if (req.method == "GET" && req.path == "/upload/status")
+        return handle_upload_status_(c);
+
+    // 7) 文件列表：GET /files?prefix=..&cursor=..&limit=..  按名字排序，每个名字取最新的一份
+    if (req.method == "GET" && req.path == "/files")
+        return handle_list_files_(c);
+
+    // 8) 运行状态：下载缓存、文件 I/O、上传会话
+    if (req.method == "GET" && req.path == "/stats")
+        return handle_stats_(c);
+
+    // 9) 日志等级：GET 查看，POST 修改（body: {"all":"info","http":"debug"}），立即生效
+    if (req.path == "/log/level" && (req.method == "GET" || req.method == "POST"))
+        return handle_log_level_(c);
+
+    // 未匹配
+    reply_(c, 404, "Not Found", "NotFound", "text/plain");
+}
+
+void HttpServer::serve_cached_(Conn &c, FileCache::Ptr e)
+{
+    c.cached = std::move(e);
+    c.wbuf.clear();
+    c.parts.clear();
+    arm_write_(c);
+}
+
+// 整个文件读进 head 后面（可能要读几次），期间同一键的请求都挂在 filling_ 上
+void HttpServer::fill_cache_(Conn &c, const std::string &key, const FileInfo &info, std::string head)
+{
+    auto e = std::make_shared<FileCache::Entry>();
+    e->key = key;
+    e->name = info.name;
+    e->head_len = head.size();
+    e->response = std::move(head);
+    e->response.resize(e->head_len + (size_t)info.size);
+    c.fill = std::move(e);
+    c.fill_got = 0;
+    filling_[key];
+    watch_(c, 0);
+    read_fill_(c);
+}
+
+void HttpServer::read_fill_(Conn &c)
+{
+    FileCache::Entry &e = *c.fill;
+    size_t off = e.head_len + c.fill_got;
+    Conn *cp = &c;
+    c.io_pending = true;
+    aio_.read(c.file, &e.response[off], e.response.size() - off, (off_t)c.fill_got, -1,
+              [this, cp](ssize_t r) { on_fill_io_(*cp, r); });
+}
+
+// 发起的连接中途断开也读完，排队的连接还等着
+void HttpServer::on_fill_io_(Conn &c, ssize_t res)
+{
+    c.io_pending = false;
+    std::shared_ptr<FileCache::Entry> e = c.fill;
+    if (res > 0)
+    {
+        c.fill_got += (size_t)res;
+        if (e->head_len + c.fill_got < e->response.size())
+            return read_fill_(c);
+    }
+    else
+        LOG_WARN("HTTP read %s for cache failed: %s", e->key.c_str(), res < 0 ? strerror((int)-res) : "truncated");
+    c.fill.reset();
+    aio_.release_file(c.file);
+    c.file = -1;
+    ::close(c.send_fd);
+    c.send_fd = -1;
+
+    FileCache::Ptr done;
+    if (res > 0)
+    {
+        cache_.put(e);
+        done = e;
+    }
+    std::vector<Conn *> waiters = std::move(filling_[e->key]);
+    filling_.erase(e->key);
+    waiters.push_back(&c);
+    for (Conn *w : waiters)
+    {
+        w->io_pending = false;
+        if (w->closed)
+            reap_closed_(*w);
+        else if (done)
+            serve_cached_(*w, done);
+        else
+            reply_(*w, 500, "Internal Error", "Err", "text/plain");
+    }
+}
+
+// RFC 9110 13.2.2：有 If-None-Match 就只看它（弱比较），没有才看 If-Modified-Since（精确到秒）
+bool HttpServer::not_modified_(const HttpRequest &req, const FileInfo &info) const
+{
+    std::string_view inm = req.header("If-None-Match");
+    if (!inm.empty())
+        return !info.etag.empty() && http_etag_match(inm, info.etag);
+    std::string_view ims = req.header("If-Modified-Since");
+    time_t t;
+    return !ims.empty() && info.mtime > 0 && http_parse_date(ims, t) && info.mtime <= t;
+}
+
+void HttpServer::reply_not_modified_(Conn &c, const FileInfo &info)
+{
+    char lm[64];
+    http_format_date(info.mtime, lm, sizeof(lm));
+    char hdr[512];
+    int n = std::snprintf(hdr, sizeof(hdr),
+                          "HTTP/1.1 304 Not Modified\r\n"
+                          "ETag: %s\r\n"
+                          "%s%s%s"
+                          "%s"
+                          "Connection: close\r\n\r\n",
+                          info.etag.c_str(), info.mtime > 0 ? "Last-Modified: " : "", info.mtime > 0 ? lm : "",
+                          info.mtime > 0 ? "\r\n" : "", info.gz_size >= 0 ? "Vary: Accept-Encoding\r\n" : "");
+    c.wbuf.assign(hdr, (size_t)std::min(n, (int)sizeof(hdr) - 1));
+    c.parts.clear();
+    arm_write_(c);
+}
+
+// If-Range：ETag 用强比较，日期必须与 Last-Modified 完全一致；不匹配就回退到整文件 200
+bool HttpServer::if_range_matches_(const HttpRequest &req, const FileInfo &info) const
+{
+    std::string_view v = req.header("If-Range");
+    if (v.empty())
+        return true;
+    if (v.front() == '"' || v.substr(0, 2) == "W/")
+        return v == info.etag;
+    time_t t;
+    return http_parse_date(v, t) && t == info.mtime;
+}
+
+void HttpServer::handle_download_(Conn &c)
+{
+    // ?oid= 指定某一次上传的对象（聊天里广播的链接）；?name= 取该名字最新的对象
+    const HttpRequest &req = c.parser.request();
+    std::string oid = http_url_decode(req.param("oid"));
+    std::string name = http_url_decode(req.param("name"));
+    std::string upload = http_url_decode(req.param("upload"));
+    if (!upload.empty())
+        return handle_tail_download_(c, upload);
+    if (oid.empty() && name.empty())
+        return reply_(c, 400, "Bad Request", "missing name", "text/plain");
+
+    // 对象的 ETag / 上传时间在内存里就有：客户端手上已是这一份的，不开文件直接 304。
+    // 有 gzip 副本、整文件请求且客户端接受 gzip 时选副本这个表示（ETag、大小都是它的）
+    FileInfo info;
+    bool known = catalog_.lookup(oid, name, info);
+    bool gzip = known && info.gz_size >= 0 && !req.has_header("Range") &&
+                http_accepts_encoding(req.header("Accept-Encoding"), "gzip");
+    if (gzip)
+        FileCatalog::select_gzip(info);
+    if (known && not_modified_(req, info))
+        return reply_not_modified_(c, info);
+
+    // 热点小文件：命中缓存直接从内存发，不开文件；同一对象正在读盘的，等那一次读完
+    std::string key = gzip ? info.oid + "+gzip" : info.oid;
+    if (known && !req.has_header("Range") && cache_.cacheable(info.size))
+    {
+        if (FileCache::Ptr e = cache_.get(key))
+            return serve_cached_(c, std::move(e));
+        auto w = filling_.find(key);
+        if (w != filling_.end())
+        {
+            w->second.push_back(&c);
+            c.io_pending = true;
+            return watch_(c, 0);
+        }
+    }
+
+    // 副本和原样一样按普通文件发（splice / 缓存），只是多一个 Content-Encoding
+    int fd = -1;
+    if (gzip && (fd = catalog_.open_gzip(info.digest)) < 0)
+    {
+        LOG_WARN("HTTP open gzip copy of %s failed: %s, sending identity", info.digest.c_str(), strerror(errno));
+        gzip = false;
+        info.encoding.clear();
+        key = info.oid;
+    }
+    if (gzip)
+        name = info.name;
+    else if (!oid.empty())
+    {
+        fd = catalog_.open_object(oid, info);
+        name = info.name;
+    }
+    else
+        fd = catalog_.open_final(name, info);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+            return reply_(c, 404, "Not Found", "NotFound", "text/plain");
+        return reply_(c, 500, "Internal Error", "Err", "text/plain");
+    }
+
+    if (not_modified_(req, info)) // 旧版平铺的文件要 fstat 过才有 ETag
+    {
+        ::close(fd);
+        return reply_not_modified_(c, info);
+    }
+
+    std::vector<ByteRange> ranges;
+    RangeResult rr = RangeResult::IGNORE;
+    if (req.has_header("Range") && if_range_matches_(req, info))
+        rr = http_parse_ranges(req.header("Range"), info.size, ranges);
+
+    char lm[64];
+    http_format_date(info.mtime, lm, sizeof(lm));
+    // RFC 9530：整份内容的 SHA-256（对 206 也是整文件的，不是本段的）。它是原样内容的摘要，
+    // 发 gzip 副本时不带（Repr-Digest 针对编码后的表示）；有副本的对象都要带 Vary
+    std::string rep_hdr;
+    uint8_t dg[Sha256::DIGEST_SIZE];
+    if (gzip)
+        rep_hdr = "Content-Encoding: gzip\r\n";
+    else if (!info.digest.empty() && Sha256::from_hex(info.digest, dg))
+        rep_hdr = "Repr-Digest: sha-256=:" + Sha256::to_base64(dg) + ":\r\n";
+    if (info.gz_size >= 0)
+        rep_hdr += "Vary: Accept-Encoding\r\n";
+
+    if (rr == RangeResult::UNSATISFIABLE)
+    {
+        ::close(fd);
+        char hdr[256];
+        int n = std::snprintf(hdr, sizeof(hdr),
+                              "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                              "Content-Range: bytes */%lld\r\n"
+                              "Content-Length: 0\r\n"
+                              "Connection: close\r\n\r\n",
+                              (long long)info.size);
+        c.wbuf.assign(hdr, (size_t)n);
+        return arm_write_(c);
+    }
+    if (ranges.size() == 1 || rr == RangeResult::IGNORE)
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char hdr[1024];
+    int n;
+    c.parts.clear();
+    if (rr == RangeResult::IGNORE)
+    {
+        n = std::snprintf(hdr, sizeof(hdr),
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Length: %lld\r\n"
+                          "Content-Type: application/octet-stream\r\n"
+                          "Content-Disposition: attachment; filename=\"%s\"\r\n"
+                          "Accept-Ranges: bytes\r\n"
+                          "ETag: %s\r\n"
+                          "Last-Modified: %s\r\n"
+                          "%s"
+                          "Connection: close\r\n\r\n",
+                          (long long)info.size, name.c_str(), info.etag.c_str(), lm, rep_hdr.c_str());
+        c.parts.push_back({std::string(), 0, (off_t)info.size});
+    }
+    else if (ranges.size() == 1)
+    {
+        const ByteRange &r = ranges[0];
+        n = std::snprintf(hdr, sizeof(hdr),
+                          "HTTP/1.1 206 Partial Content\r\n"
+                          "Content-Length: %lld\r\n"
+                          "Content-Range: bytes %lld-%lld/%lld\r\n"
+                          "Content-Type: application/octet-stream\r\n"
+                          "Content-Disposition: attachment; filename=\"%s\"\r\n"
+                          "Accept-Ranges: bytes\r\n"
+                          "ETag: %s\r\n"
+                          "Last-Modified: %s\r\n"
+                          "%s"
+                          "Connection: close\r\n\r\n",
+                          (long long)(r.last - r.first + 1), (long long)r.first, (long long)r.last,
+                          (long long)info.size, name.c_str(), info.etag.c_str(), lm, rep_hdr.c_str());
+        c.parts.push_back({std::string(), (off_t)r.first, (off_t)(r.last + 1)});
+    }
+    else
+    {
+        // multipart/byteranges：每段前面是边界和本段的 Content-Range
+        std::string boundary = "CHATSRV" + gen_uuid_();
+        long long total = 0;
+        for (const auto &r : ranges)
+        {
+            char ph[256];
+            int pn = std::snprintf(ph, sizeof(ph),
+                                   "\r\n--%s\r\n"
+                                   "Content-Type: application/octet-stream\r\n"
+                                   "Content-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                                   boundary.c_str(), (long long)r.first, (long long)r.last,
+                                   (long long)info.size);
+            c.parts.push_back({std::string(ph, (size_t)pn), (off_t)r.first, (off_t)(r.last + 1)});
+            total += pn + (r.last - r.first + 1);
+        }
+        std::string tail = "\r\n--" + boundary + "--\r\n";
+        total += (long long)tail.size();
+        c.parts.push_back({std::move(tail), 0, 0});
+
+        n = std::snprintf(hdr, sizeof(hdr),
+                          "HTTP/1.1 206 Partial Content\r\n"
+                          "Content-Length: %lld\r\n"
+                          "Content-Type: multipart/byteranges; boundary=%s\r\n"
+                          "Content-Disposition: attachment; filename=\"%s\"\r\n"
+                          "Accept-Ranges: bytes\r\n"
+                          "ETag: %s\r\n"
+                          "Last-Modified: %s\r\n"
+                          "%s"
+                          "Connection: close\r\n\r\n",
+                          total, boundary.c_str(), name.c_str(), info.etag.c_str(), lm, rep_hdr.c_str());
+    }
+    c.wbuf.assign(hdr, (size_t)std::min(n, (int)sizeof(hdr) - 1));
+    c.send_fd = fd;
+
+    if (rr == RangeResult::IGNORE && !info.oid.empty() && cache_.cacheable(info.size) &&
+        (c.file = aio_.acquire_file(fd)) >= 0)
+    {
+        c.parts.clear();
+        return fill_cache_(c, key, info, std::move(c.wbuf));
+    }
+
+    // 文件体由 handle_write_ 分批推送，偏移记在连接上；登记失败或没有管道就用 sendfile
+    shaper_.attach(c.flow, user_key_(c), BandwidthShaper::DOWN);
+    if (info.size > 0 && (c.file = aio_.acquire_file(fd)) >= 0)
+        acquire_pipe_(c);
+    arm_write_(c);
+}
+
+// GET /download?upload=<id>：边传边下。从 .part 发已经从头连续到齐的部分，发到头就挂起，
+// 等后面的分片到齐再接着发，上传完成时正好发完。内容还没定下来，不带 ETag / Repr-Digest，
+// 不支持 Range 和缓存；提交后 .part 被改名或删掉也不影响，已打开的 fd 照样能读
+void HttpServer::handle_tail_download_(Conn &c, const std::string &id)
+{
+    UploadStatus us;
+    if (notify_fd_ < 0 || sessions_.query(id, us) != UploadSessions::OK)
+        return reply_(c, 404, "Not Found", "NotFound", "text/plain");
+    int fd = ::open(catalog_.temp_path(id).c_str(), O_RDONLY | O_CLOEXEC);
+    int64_t ready = 0, size = 0;
+    bool done = false;
+    if (fd >= 0 && sessions_.tail(id, ready, size, done) != UploadSessions::OK)
+    {
+        ::close(fd); // 刚好被清掉
+        fd = -1;
+        errno = ENOENT;
+    }
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+            return reply_(c, 404, "Not Found", "NotFound", "text/plain");
+        return reply_(c, 500, "Internal Error", "Err", "text/plain");
+    }
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char hdr[1024];
+    int n = std::snprintf(hdr, sizeof(hdr),
+                          "HTTP/1.1 200 OK\r\n"
+                          "Content-Length: %lld\r\n"
+                          "Content-Type: application/octet-stream\r\n"
+                          "Content-Disposition: attachment; filename=\"%s\"\r\n"
+                          "Cache-Control: no-store\r\n"
+                          "Connection: close\r\n\r\n",
+                          (long long)size, us.name.c_str());
+    c.wbuf.assign(hdr, (size_t)std::min(n, (int)sizeof(hdr) - 1));
+    c.send_fd = fd;
+    c.parts.clear();
+    c.parts.push_back({std::string(), 0, (off_t)size});
+    c.tail_id = id;
+    c.tail_ready = (off_t)ready;
+
+    shaper_.attach(c.flow, user_key_(c), BandwidthShaper::DOWN);
+    if ((c.file = aio_.acquire_file(fd)) >= 0)
+        acquire_pipe_(c);
+    arm_write_(c);
+}
+
+void HttpServer::handle_upload_init_(Conn &c)
+{
+    json req;
+    try
+    {
+        req = json::parse(c.body);
+    }
+    catch (...)
+    {
+        return reply_(c, 400, "Bad Request", "bad json", "text/plain");
+    }
+    std::string jname = req.value("name", "");
+    long long jsize = req.value("size", 0LL);
+    int jparallel = req.value("parallel", DEFAULT_PARALLEL); // 客户端可请求并发数，服务端裁剪
+    std::string jfrom = req.value("from", "");
+    std::string jsha = req.value("sha256", ""); // 可选：整文件摘要
+    bool jearly = req.value("early", false);    // 可选：现在就广播，别人可以边传边下
+    if (jname.empty() || jsize <= 0)
+        return reply_(c, 400, "Bad Request", "missing fields", "text/plain");
+    if (!jsha.empty() && !BlobStore::valid_hex(jsha))
+        return reply_(c, 400, "Bad Request", "bad sha256", "text/plain");
+    jparallel = std::max(1, std::min(jparallel, MAX_PARALLEL));
+
+    // 仓库里已有同样的内容：直接把名字指过去，一个字节都不用传。名字日志要落盘，交给 AsyncFileIO 的
+    // 工作线程，回来再广播、回复；连接在此期间被关掉的话照常绑定
+    if (!jsha.empty() && catalog_.has_blob(jsha, jsize))
+    {
+        auto e = std::make_shared<FileEntry>();
+        e->name = jname;
+        e->sha256 = jsha;
+        e->size = jsize;
+        e->from = jfrom;
+        Conn *cp = &c;
+        c.io_pending = true;
+        c.phase = Conn::WAIT_IO;
+        watch_(c, 0);
+        aio_.call([this, e] { return catalog_.bind(*e) ? 0 : -EIO; },
+                  [this, cp, e](ssize_t r) {
+                      Conn &c = *cp;
+                      c.io_pending = false;
+                      if (r >= 0)
+                      {
+                          cache_.invalidate_name(e->name, e->oid);
+                          gzip_.enqueue(e->sha256, e->name);
+                          publish_file_meta_(e->from, e->name, e->size, e->sha256, e->oid);
+                      }
+                      if (c.closed)
+                          return reap_closed_(c);
+                      if (r < 0)
+                          return reply_(c, 500, "Internal Error", "bind failed", "text/plain");
+                      json resp{{"exists", true}, {"oid", e->oid}, {"name", e->name}, {"size", e->size},
+                                {"sha256", e->sha256}};
+                      reply_(c, 200, "OK", resp.dump());
+                  });
+        return;
+    }
+
+    // 可选：按服务端分片大小切分的分片摘要，用来跳过仓库里已有的分片
+    std::vector<std::string> chunk_digests;
+    if (req.contains("chunk_sha256") && req.value("chunk_size", (size_t)DEFAULT_CHUNK_SIZE) == DEFAULT_CHUNK_SIZE)
+    {
+        try
+        {
+            for (const auto &h : req.at("chunk_sha256"))
+            {
+                uint8_t d[Sha256::DIGEST_SIZE];
+                if (!Sha256::from_hex(h.get<std::string>(), d))
+                    return reply_(c, 400, "Bad Request", "bad chunk_sha256", "text/plain");
+                chunk_digests.emplace_back((const char *)d, sizeof(d));
+            }
+        }
+        catch (...)
+        {
+            return reply_(c, 400, "Bad Request", "bad chunk_sha256", "text/plain");
+        }
+    }
+
+    // 登记会话并预创建空的 .part
+    std::string id_new = gen_uuid_();
+    auto st = sessions_.create(id_new, jname, jsize, DEFAULT_CHUNK_SIZE, jparallel, jsha);
+    if (st == UploadSessions::NO_SPACE)
+        return reply_(c, 507, "Insufficient Storage", UploadSessions::status_str(st), "text/plain");
+    if (st != UploadSessions::OK)
+        return reply_(c, 500, "Internal Error", "open temp failed", "text/plain");
+
+    json resp{
+        {"id", id_new},
+        {"chunk_size", (int)DEFAULT_CHUNK_SIZE},
+        {"parallel", jparallel}};
+    if (jearly)
+        publish_upload_meta_(jfrom, jname, jsize, id_new);
+    if (chunk_digests.empty())
+        return reply_(c, 200, "OK", resp.dump());
+
+    // 仓库里已有的分片在服务端拷进 .part：拷贝（copy_file_range，可能退回读写）交给 AsyncFileIO 的
+    // 工作线程，拷完再回复 init，回复里的 missing 已经扣掉复用的分片。连接在此期间被关掉的话照常拷完
+    Conn *cp = &c;
+    c.io_pending = true;
+    c.phase = Conn::WAIT_IO;
+    watch_(c, 0);
+    aio_.call([this, id_new, digests = std::move(chunk_digests)] { return (ssize_t)sessions_.prefill(id_new, digests); },
+              [this, cp, id_new, resp](ssize_t reused) mutable {
+                  Conn &c = *cp;
+                  c.io_pending = false;
+                  if (c.closed)
+                      return reap_closed_(c);
+                  UploadStatus us;
+                  sessions_.query(id_new, us);
+                  json missing = json::array();
+                  for (const auto &r : us.missing)
+                      missing.push_back({r.first, r.second});
+                  resp["reused"] = reused;
+                  resp["missing"] = missing;
+                  reply_(c, 200, "OK", resp.dump());
+              });
+}
+
+void HttpServer::handle_upload_chunk_(Conn &c)
+{
+    // body 已在 stream_body_ 中全部写入 .part；校验不过的分片不记入位图，客户端重传即可
+    bool ok = !c.crc_check || c.crc == c.crc_expect;
+    aio_.release_file(c.file);
+    c.file = -1;
+    auto st = sessions_.end_chunk(c.upload_id, c.upload_seq, ok);
+    c.file_fd = -1;
+    if (ok && st == UploadSessions::NOT_FOUND) // 写的过程中会话被过期清掉了
+        return reply_(c, 404, "Not Found", UploadSessions::status_str(st), "text/plain");
+    if (ok && st != UploadSessions::OK) // 没记进位图，客户端重传这一片
+        return reply_(c, 500, "Internal Error", UploadSessions::status_str(st), "text/plain");
+    if (!c.crc_check)
+        return reply_(c, 200, "OK", "{\"ok\":true}");
+
+    char crc[9];
+    std::snprintf(crc, sizeof(crc), "%08x", c.crc);
+    if (!ok)
+    {
+        LOG_WARN("upload %s: chunk %llu crc32c mismatch, expect %08x got %s", c.upload_id.c_str(),
+                 (unsigned long long)c.upload_seq, c.crc_expect, crc);
+        return reply_(c, 422, "Unprocessable Entity", "crc32c mismatch", "text/plain");
+    }
+    reply_(c, 200, "OK", std::string("{\"ok\":true,\"crc32c\":\"") + crc + "\"}");
+}
+
+void HttpServer::handle_upload_complete_(Conn &c)
+{
+    json req;
+    try
+    {
+        req = json::parse(c.body);
+    }
+    catch (...)
+    {
+        return reply_(c, 400, "Bad Request", "bad json", "text/plain");
+    }
+    std::string jid = req.value("id", "");
+    std::string jname = req.value("name", "");
+    long long jsize = req.value("size", 0LL);
+    std::string jfrom = req.value("from", "");
+
+    if (jid.empty() || jname.empty() || jsize <= 0)
+        return reply_(c, 400, "Bad Request", "missing fields", "text/plain");
+
+    // 按位图校验：所有分片都已完整写入，且大小与 init 时声明的一致；
+    // 摘要在分片到齐的过程中由会话表的后台线程按落盘内容算，仓库只认服务端自己算出来的值，
+    // 还差几片没算完就挂起这个请求等通知。需要落盘时 fdatasync 交给 AsyncFileIO，事件循环不等它
+    bool durable = catalog_.durability() != Durability::NONE;
+    UploadResult res;
+    auto st = sessions_.finish(jid, jsize, res, !durable);
+    if (st == UploadSessions::PENDING && notify_fd_ >= 0)
+    {
+        c.done_wait = true;
+        finishing_.push_back(c.fd);
+        c.phase = Conn::WAIT_IO;
+        return watch_(c, 0);
+    }
+    if (st == UploadSessions::PENDING) // 没有通知可等：让客户端稍后再来
+        return reply_(c, 503, "Service Unavailable", UploadSessions::status_str(st), "text/plain",
+                      "Retry-After: 1\r\n");
+    if (st == UploadSessions::NOT_FOUND)
+        return reply_(c, 404, "Not Found", UploadSessions::status_str(st), "text/plain");
+    if (st == UploadSessions::BAD_LENGTH)
+        return reply_(c, 400, "Bad Request", "size mismatch", "text/plain");
+    if (st == UploadSessions::IO_ERROR)
+        return reply_(c, 500, "Internal Error", UploadSessions::status_str(st), "text/plain");
+    if (st != UploadSessions::OK)
+        return reply_(c, 409, "Conflict", UploadSessions::status_str(st), "text/plain");
+
+    if (!res.claimed_sha256.empty() && res.claimed_sha256 != res.sha256)
+    {
+        LOG_WARN("upload %s: sha256 mismatch, claimed %s got %s", jid.c_str(), res.claimed_sha256.c_str(),
+                 res.sha256.c_str());
+        ::unlink(res.part_path.c_str());
+        return reply_(c, 422, "Unprocessable Entity", "sha256 mismatch", "text/plain");
+    }
+    if (!durable)
+        return commit_upload_(c, res, jname, jsize, jfrom);
+
+    c.send_fd = ::open(res.part_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (c.send_fd < 0 || (c.file = aio_.acquire_file(c.send_fd)) < 0)
+    {
+        LOG_WARN("upload %s: reopen %s failed: %s", jid.c_str(), res.part_path.c_str(), strerror(errno));
+        ::unlink(res.part_path.c_str());
+        return reply_(c, 500, "Internal Error", UploadSessions::status_str(UploadSessions::IO_ERROR),
+                      "text/plain");
+    }
+    Conn *cp = &c;
+    c.phase = Conn::WAIT_IO;
+    c.io_pending = true;
+    watch_(c, 0);
+    aio_.fdatasync(c.file, [this, cp, res, jname, jsize, jfrom](ssize_t r) {
+        Conn &c = *cp;
+        c.io_pending = false;
+        aio_.release_file(c.file);
+        c.file = -1;
+        ::close(c.send_fd);
+        c.send_fd = -1;
+        if (r < 0)
+        {
+            LOG_WARN("upload %s: fdatasync failed: %s", res.part_path.c_str(), strerror((int)-r));
+            ::unlink(res.part_path.c_str());
+            if (c.closed)
+                return reap_closed_(c);
+            return reply_(c, 500, "Internal Error", UploadSessions::status_str(UploadSessions::IO_ERROR),
+                          "text/plain");
+        }
+        commit_upload_(c, res, jname, jsize, jfrom); // 客户端已断开也照样提交，会话已经没了
+    });
+}
+
+// 提交（rename 进仓库 + 目录 fsync + 名字日志落盘）交给 AsyncFileIO 的工作线程，事件循环不等；
+// 期间连接停在 WAIT_IO，io_pending 留到回调。客户端已断开也照样提交
+void HttpServer::commit_upload_(Conn &c, const UploadResult &res, const std::string &name, long long size,
+                                const std::string &from)
+{
+    auto e = std::make_shared<FileEntry>();
+    e->name = name;
+    e->sha256 = res.sha256;
+    e->size = size;
+    e->from = from;
+    Conn *cp = &c;
+    c.io_pending = true;
+    c.phase = Conn::WAIT_IO;
+    if (!c.closed) // 从落盘回调进来时连接可能已在 draining_ 里
+        watch_(c, 0);
+    aio_.call([this, e, res] { return catalog_.commit(res.part_path, *e, res.chunk_size, res.chunk_digests) ? 0 : -EIO; },
+              [this, cp, e, res](ssize_t r) {
+                  Conn &c = *cp;
+                  c.io_pending = false;
+                  if (r < 0)
+                      ::unlink(res.part_path.c_str());
+                  else
+                  {
+                      cache_.invalidate_name(e->name, e->oid); // 名字改指向新对象，旧对象的条目不再热
+                      gzip_.enqueue(res.sha256, e->name);
+                      publish_file_meta_(e->from, e->name, e->size, res.sha256, e->oid);
+                  }
+                  if (c.closed)
+                      return reap_closed_(c);
+                  if (r < 0)
+                      return reply_(c, 500, "Internal Error", "commit failed", "text/plain");
+                  json resp{{"ok", true}, {"oid", e->oid}, {"sha256", res.sha256}};
+                  reply_(c, 200, "OK", resp.dump());
+              });
+}
+
+// 向聊天侧广播文件元信息；链接按对象 id，之后再有同名上传也还是这一份
+void HttpServer::publish_file_meta_(const std::string &from, const std::string &name, long long size,
+                                    const std::string &sha256, const std::string &oid)
+{
+    json meta{
+        {"action", "file_meta"},
+        {"from", from},
+        {"name", name},
+        {"size", size},
+        {"sha256", sha256},
+        {"oid", oid},
+        {"url", std::string("/download?oid=") + oid}};
+    bus_.publish(meta.dump());
+}
+
+// 上传刚开始就广播（state = uploading），链接指向边传边下；传完后照常再广播一条带 oid 的
+void HttpServer::publish_upload_meta_(const std::string &from, const std::string &name, long long size,
+                                      const std::string &id)
+{
+    json meta{
+        {"action", "file_meta"},
+        {"state", "uploading"},
+        {"from", from},
+        {"name", name},
+        {"size", size},
+        {"id", id},
+        {"url", std::string("/download?upload=") + id}};
+    bus_.publish(meta.dump());
+}
+
+// 游标是上一页最后一个名字的 hex 编码：不透明，也不用操心名字里的特殊字符
+void HttpServer::handle_list_files_(Conn &c)
+{
+    const HttpRequest &req = c.parser.request();
+    std::string prefix = http_url_decode(req.param("prefix"));
+    std::string cursor = http_url_decode(req.param("cursor"));
+    std::string slimit = http_url_decode(req.param("limit"));
+
+    size_t limit = DEFAULT_LIST_LIMIT;
+    if (!slimit.empty())
+    {
+        char *end = nullptr;
+        unsigned long long v = std::strtoull(slimit.c_str(), &end, 10);
+        if (!end || *end != '\0' || slimit[0] == '-' || v == 0)
+            return reply_(c, 400, "Bad Request", "bad limit", "text/plain");
+        limit = (size_t)std::min<unsigned long long>(v, MAX_LIST_LIMIT);
+    }
+    std::string after;
+    if (cursor.size() % 2 != 0)
+        return reply_(c, 400, "Bad Request", "bad cursor", "text/plain");
+    for (size_t i = 0; i < cursor.size(); i += 2)
+    {
+        int hi = hex_val(cursor[i]), lo = hex_val(cursor[i + 1]);
+        if (hi < 0 || lo < 0)
+            return reply_(c, 400, "Bad Request", "bad cursor", "text/plain");
+        after.push_back((char)(hi << 4 | lo));
+    }
+
+    std::vector<FileEntry> entries;
+    bool more = false;
+    catalog_.list(prefix, after, limit, entries, more);
+
+    json files = json::array();
+    for (const auto &e : entries)
+        files.push_back({{"name", e.name},
+                         {"oid", e.oid},
+                         {"size", e.size},
+                         {"sha256", e.sha256},
+                         {"from", e.from},
+                         {"time", (int64_t)e.created}});
+    json resp{{"files", std::move(files)}, {"next_cursor", nullptr}};
+    if (more)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string next;
+        for (unsigned char ch : entries.back().name)
+        {
+            next.push_back(digits[ch >> 4]);
+            next.push_back(digits[ch & 0xf]);
+        }
+        resp["next_cursor"] = next;
+    }
+    reply_(c, 200, "OK", resp.dump(-1, ' ', false, json::error_handler_t::replace));
+}
+
+void HttpServer::handle_stats_(Conn &c)
+{
+    FileCache::Stats cs = cache_.stats();
+    AsyncFileIO::Stats as = aio_.stats();
+    Compressor::Stats gs = gzip_.stats();
+    BandwidthShaper::Stats ss = shaper_.stats();
+    uint64_t lookups = cs.hits + cs.misses;
+    json resp{
+        {"cache",
+         {{"hits", cs.hits},
+          {"misses", cs.misses},
+          {"hit_ratio", lookups ? (double)cs.hits / (double)lookups : 0.0},
+          {"inserts", cs.inserts},
+          {"evictions", cs.evictions},
+          {"invalidations", cs.invalidations},
+          {"entries", cs.entries},
+          {"bytes", cs.bytes},
+          {"pinned_bytes", cs.pinned_bytes},
+          {"capacity", cs.capacity},
+          {"max_entry", cs.max_entry}}},
+        {"file_io",
+         {{"backend", aio_.backend()},
+          {"submitted", as.submitted},
+          {"completed", as.completed},
+          {"throttled", as.throttled},
+          {"inflight", as.inflight},
+          {"queued", as.queued}}},
+        {"gzip",
+         {{"queued", gs.queued},
+          {"compressed", gs.compressed},
+          {"skipped", gs.skipped},
+          {"failed", gs.failed},
+          {"dropped", gs.dropped},
+          {"bytes_in", gs.bytes_in},
+          {"bytes_out", gs.bytes_out},
+          {"pending", gs.pending}}},
+        {"shaper",
+         {{"throttled", ss.throttled},
+          {"user_waits", ss.user_waits},
+          {"users", ss.users},
+          {"paused", throttled_.size()}}},
+        {"uploads", {{"sessions", sessions_.count()}}},
+        {"connections", conns_.size()}};
+    reply_(c, 200, "OK", resp.dump());
+}
+
+void HttpServer::handle_log_level_(Conn &c)
+{
+    if (c.parser.request().method == "POST")
+    {
+        json req = json::parse(c.body, nullptr, false);
+        if (!req.is_object())
+            return reply_(c, 400, "Bad Request", "bad json", "text/plain");
+        // 先全部校验，有一项不对就都不改；all 先于各模块
+        std::string spec;
+        for (auto it = req.begin(); it != req.end(); ++it)
+        {
+            LogModule mod;
+            if (!it.value().is_string() || (it.key() != "all" && !Logger::parse_module(it.key(), mod)))
+                return reply_(c, 400, "Bad Request", "bad module or level", "text/plain");
+            std::string item = it.value().get<std::string>();
+            if (it.key() == "all")
+                spec = item + (spec.empty() ? "" : "," + spec);
+            else
+                spec += (spec.empty() ? "" : ",") + it.key() + "=" + item;
+        }
+        if (!Logger::set_levels(spec))
+            return reply_(c, 400, "Bad Request", "bad module or level", "text/plain");
+        LOG_INFO("log levels changed: %s", spec);
+    }
+
+    json modules = json::object();
+    for (size_t i = 0; i < LOG_MODULES; ++i)
+    {
+        auto mod = static_cast<LogModule>(i);
+        modules[Logger::module_name(mod)] = Logger::level_str(Logger::level(mod));
+    }
+    json resp{{"compiled_min", Logger::level_str(LOG_COMPILED_MIN)}, {"modules", modules}};
+    reply_(c, 200, "OK", resp.dump());
+}
+
+void HttpServer::handle_upload_status_(Conn &c)
+{
+    std::string id = http_url_decode(c.parser.request().param("id"));
+    if (id.empty())
+        return reply_(c, 400, "Bad Request", "missing id", "text/plain");
+
+    UploadStatus us;
+    if (sessions_.query(id, us) != UploadSessions::OK)
+        return reply_(c, 404, "Not Found", UploadSessions::status_str(UploadSessions::NOT_FOUND), "text/plain");
+
+    json missing = json::array();
+    for (const auto &r : us.missing)
+        missing.push_back({r.first, r.second});
+    json resp{
+        {"id", id},
+        {"name", us.name},
+        {"size", us.size},
+        {"chunk_size", us.chunk_size},
+        {"chunks", us.chunk_count},
+        {"received", us.received},
+        {"parallel", us.max_parallel},
+        {"inflight", us.inflight},
+        {"inflight_bytes", us.inflight_bytes},
+        {"peak_inflight", us.peak_inflight},
+        {"missing", missing}};
+    reply_(c, 200, "OK", resp.dump());
+}
+
+void HttpServer::run()
+{
+    LOG_INFO("HTTP server listening at http://%s:%d", bind_.c_str(), port_);
+    std::vector<epoll_event> evs(256);
+    time_t last_sweep = time(nullptr);
+    while (!stopping_.load())
+    {
+        int n = ::epoll_wait(epoll_fd_, evs.data(), (int)evs.size(), next_wake_ms_(500));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("HTTP epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n && !stopping_.load(); ++i)
+        {
+            int fd = evs[i].data.fd;
+            uint32_t ev = evs[i].events;
+            if (fd == listen_fd_)
+            {
+                handle_accept_();
+                continue;
+            }
+            if (fd == aio_.event_fd())
+            {
+                aio_.poll();
+                continue;
+            }
+            if (fd == cache_bus_.fd())
+            {
+                drain_cache_bus_();
+                continue;
+            }
+            if (fd == notify_fd_)
+            {
+                sessions_.drain_notify(notify_fd_);
+                wake_tailing_();
+                wake_writeback_();
+                wake_finishing_();
+                continue;
+            }
+            auto it = conns_.find(fd);
+            if (it == conns_.end())
+                continue;
+            Conn &c = *it->second;
+            if (ev & (EPOLLERR | EPOLLHUP))
+            {
+                close_conn_(fd);
+                continue;
+            }
+            if (c.phase == Conn::WRITE)
+            {
+                if (c.tail_wait && (ev & EPOLLRDHUP))
+                    close_conn_(fd); // 等上传的时候对端走了
+                else if (ev & EPOLLOUT)
+                    handle_write_(c);
+                continue;
+            }
+            if (c.phase == Conn::STREAM_BODY)
+            {
+                if (ev & (EPOLLIN | EPOLLRDHUP))
+                    stream_body_(c);
+                continue;
+            }
+            if (c.phase == Conn::BATCH_BODY)
+            {
+                if (ev & (EPOLLIN | EPOLLRDHUP))
+                    batch_body_(c);
+                continue;
+            }
+            if (c.phase == Conn::WAIT_IO)
+                continue;
+            if (ev & (EPOLLIN | EPOLLRDHUP))
+                handle_read_(c);
+        }
+        wake_throttled_();
+
+        time_t now = time(nullptr);
+        if (now != last_sweep)
+        {
+            last_sweep = now;
+            sweep_idle_();
         }
-        serve_client_(cfd);
     }
     LOG_INFO("HTTP server stopped.");
 }
@@ -1,40 +1,249 @@
 #pragma once
 #include <string>
 #include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <sys/types.h>
+#include <ctime>
 #include "common/file_bus.hpp"
+#include "common/sha256.hpp"
+#include "file/async_io.hpp"
+#include "file/compressor.hpp"
 #include "file/file_catalog.hpp"
+#include "file/upload_sessions.hpp"
+#include "http/http_parser.hpp"
+#include "http/file_cache.hpp"
+#include "http/bandwidth_shaper.hpp"
 
 class HttpServer {
 public:
-    static constexpr size_t DEFAULT_CHUNK_SIZE = 256 * 1024; // 256KB
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024; // 4MB（分片直接流式落盘，不占内存）
+    static constexpr int DEFAULT_PARALLEL = 4;              // /upload/init 建议的并发分片数
+    static constexpr int MAX_PARALLEL = 16;                 // 单个上传允许的最大并发分片数
+    static constexpr size_t MAX_HEADER_BYTES = 16 * 1024;    // 连接读缓冲 = 请求头上限
+    static constexpr size_t MAX_JSON_BODY = 64 * 1024;       // init/complete 等 JSON 请求体上限
+    static constexpr int IDLE_TIMEOUT_SEC = 60;
+    static constexpr size_t DEFAULT_LIST_LIMIT = 100;       // GET /files 每页条数
+    static constexpr size_t MAX_LIST_LIMIT = 1000;
+    static constexpr size_t MAX_BATCH_BODY = 512ull * 1024 * 1024; // POST /upload/batch 的 body 上限
+    static constexpr size_t MAX_BATCH_FILES = 1000;
+    static constexpr size_t MAX_BATCH_NAME = 1024;
+    static constexpr uint64_t MAX_BATCH_FILE = DEFAULT_CHUNK_SIZE; // 批量里单个文件的上限（恰好一片）
 
-    HttpServer(std::string bind, int port, FileBus& bus, FileCatalog& catalog);
+    HttpServer(std::string bind, int port, FileBus& bus, FileCatalog& catalog,
+               UploadSessions& sessions, AsyncFileIO& aio, FileCache& cache, Compressor& gzip,
+               BandwidthShaper& shaper, FileBus& cache_bus);
     ~HttpServer();
 
-    bool start();   // bind + listen
-    void run();     // accept/serve loop（阻塞）
+    bool start();   // bind + listen + epoll
+    void run();     // epoll 事件循环（阻塞）
     void stop();    // 请求退出（关闭监听套接字）
 
 private:
+    // 每个连接的状态：请求头直接读进固定大小的 rbuf，解析器在其上增量工作
+    struct Conn {
+        enum Phase { READ_HEAD, READ_BODY, STREAM_BODY, BATCH_BODY, WAIT_IO, WRITE };
+
+        int fd = -1;
+        Phase phase = READ_HEAD;
+        time_t last_active = 0;
+        std::string peer;     // 对端 IP（按它限速）
+        uint32_t events = 0;  // 当前向 epoll 登记的事件；等磁盘时置 0，免得水平触发空转
+
+        // 每个连接同时最多一个异步文件 I/O；在途时连接被关掉的话先挪进 draining_，
+        // 等回调回来再释放（回调里拿的是 Conn*）
+        bool io_pending = false;
+        bool closed = false;
+        int file = -1;        // file_fd / send_fd 在 AsyncFileIO 里的句柄
+
+        char rbuf[MAX_HEADER_BYTES];
+        size_t rlen = 0;
+        HttpParser parser;
+
+        size_t body_need = 0; // 声明的 Content-Length
+        size_t body_got = 0;
+        std::string body;     // 按 body_need 预先分配
+
+        // STREAM_BODY：/upload/chunk 的 body 边读边异步写进 .part，不在内存中攒：
+        // socket 先 splice 进管道，再由 AsyncFileIO 把管道 splice 进文件；
+        // 不能 splice 时 recv 进缓冲池里的一块，再异步 write。
+        // file_fd 属于上传会话表（已 pin），连接不负责关闭，结束时 end_chunk 释放。
+        std::string upload_id;
+        uint64_t upload_seq = 0;
+        int file_fd = -1;
+        off_t file_off = 0;   // 下一次写盘的位置
+        size_t body_left = 0; // 还没从 socket 取出的 body 字节
+        int pipe_r = -1;      // splice 用的管道，来自 pipe_pool_（上传、下载共用）
+        int pipe_w = -1;
+        size_t pipe_cap = 0;
+        size_t in_pipe = 0;   // 管道里还没写盘 / 还没发出去的字节
+        bool pipe_full = false; // 下载：管道槽位已满（按页计），发走一些再预读
+        bool io_from_pipe = false;
+        bool no_splice = false;
+        AsyncFileIO::Buffer buf; // recv 路径的中转缓冲
+        size_t buf_len = 0;
+        // 带 X-Chunk-Crc32c 的分片走 recv 路径，边收边算 CRC32C，写完比对
+        bool crc_check = false;
+        uint32_t crc_expect = 0;
+        uint32_t crc = 0;
+
+        std::string wbuf;     // 待发送的响应
+        size_t woff = 0;
+
+        // WRITE 阶段在 wbuf 之后依次发送的片段：先发 prefix（内存），再发文件区间 [off, end)
+        // （异步 splice 文件->管道，再 splice 管道->socket；没有管道时退回 sendfile）。
+        // 整文件/单区间只有一段；multipart/byteranges 每个区间一段，外加结尾边界。
+        // off 是下一个要读进管道的文件位置。send_fd 由连接打开、负责关闭（complete 时
+        // 也用它放等待 fdatasync 的 .part）。
+        struct SendPart {
+            std::string prefix;
+            off_t off = 0;
+            off_t end = 0;
+        };
+        int send_fd = -1;
+        std::vector<SendPart> parts;
+        size_t part_idx = 0;
+        size_t prefix_off = 0;
+
+        // BATCH_BODY：/upload/batch 的 body 是一串「u16 名字长 | 名字 | u64 大小 | 内容」记录（小端），
+        // 收进 buf 后就地解析，每个文件的内容异步写进自己的 .part（send_fd），写完一个提交一个
+        struct Batch {
+            std::string from;
+            std::string head;    // 还没凑齐的记录头
+            std::string name;    // 当前文件
+            uint64_t size = 0;
+            uint64_t got = 0;    // 当前文件已写盘的字节
+            bool in_file = false;
+            std::string part;    // 当前文件的 .part
+            Sha256 hasher;       // 按写盘完成的顺序算
+            size_t off = 0;      // buf 里已消化到的位置
+            size_t count = 0;    // 已解析出的记录数
+            std::vector<FileEntry> done;
+            std::vector<std::pair<std::string, std::string>> failed; // 名字，原因
+        };
+        std::unique_ptr<Batch> batch;
+
+        // 命中缓存：整个响应就是 cached->response，代替 wbuf 发送
+        FileCache::Ptr cached;
+        // 未命中、正在把文件整读进 fill（响应头已在前面），读完放进缓存
+        std::shared_ptr<FileCache::Entry> fill;
+        size_t fill_got = 0;
+
+        // 文件体（上传分片的 body、下载的文件区间）的限速与轮转状态；令牌不够时
+        // 暂停监听，到 wake_ns（steady_clock 纳秒）再继续，0 表示没在暂停
+        BandwidthShaper::Flow flow;
+        int64_t wake_ns = 0;
+
+        // 边传边下（/download?upload=<id>）：tail_id 是正在上传的会话，tail_ready 是 .part 里
+        // 已连续到齐的前缀长度，发送不越过它；发到头就挂进 tailing_（tail_wait），等新分片到齐
+        std::string tail_id;
+        off_t tail_ready = -1; // -1：普通下载
+        bool tail_wait = false;
+
+        // 这个上传写完的分片回写跟不上（Durability::WRITEBACK）：暂停收 body，挂进 wb_waiting_ 等通知
+        bool wb_wait = false;
+        // /upload/complete 时摘要还在后台算：挂进 finishing_，等通知后重新处理这个请求
+        bool done_wait = false;
+    };
+
     int listen_fd_ = -1;
+    int epoll_fd_ = -1;
     std::string bind_;
     int port_;
     std::atomic<bool> stopping_{false};
 
     FileBus& bus_;
     FileCatalog& catalog_;
+    UploadSessions& sessions_;
+    AsyncFileIO& aio_;
+    FileCache& cache_;
+    Compressor& gzip_;
+    BandwidthShaper& shaper_;
+    FileBus& cache_bus_;         // 聊天线程提交的文件：{"name","oid"}，作废该名字下其他对象的缓存
+    std::vector<int> throttled_; // 因令牌不够暂停的连接 fd（唤醒时按 wake_ns 核对，连接换了就丢掉）
+    std::vector<int> tailing_;   // 边传边下、已发到上传进度的连接 fd（唤醒时按 tail_wait 核对）
+    std::vector<int> wb_waiting_; // 等回写的上传连接 fd（唤醒时按 wb_wait 核对）
+    std::vector<int> finishing_;  // 等摘要算完的 complete 请求 fd（唤醒时按 done_wait 核对）
+    int notify_fd_ = -1;          // 会话表给本线程的通知 eventfd
+    std::unordered_map<std::string, std::vector<Conn*>> filling_; // 缓存键 -> 等这次读盘的其他连接
+
+    std::unordered_map<int, std::unique_ptr<Conn>> conns_;
+    std::vector<std::unique_ptr<Conn>> draining_; // 已关闭、还在等文件 I/O 回调的连接
+    std::vector<std::pair<int, int>> pipe_pool_; // 空闲管道 (r, w)，每个分片都是新连接，复用免得反复 pipe2/close
 
     bool setup_listen_();
-    void serve_client_(int cfd);
+
+    // 事件分发
+    void handle_accept_();
+    void handle_read_(Conn& c);
+    void handle_write_(Conn& c);
+    void close_conn_(int fd);
+    void release_conn_(Conn& c);
+    void reap_closed_(Conn& c);
+    void watch_(Conn& c, uint32_t events);
+    void sweep_idle_();
+    void drain_cache_bus_();
+    std::string user_key_(const Conn& c) const;
+    size_t grant_(Conn& c, size_t want); // 本轮可传的字节数；令牌不够时登记暂停并返回 0
+    void wake_throttled_();
+    void wait_tail_(Conn& c);
+    void wake_tailing_();
+    void wake_writeback_();
+    void wake_finishing_();
+    int next_wake_ms_(int cap) const;
+    static size_t send_left_(const Conn& c);
+    bool begin_body_(Conn& c);
+    bool begin_chunk_(Conn& c);
+    void stream_body_(Conn& c);
+    void flush_upload_(Conn& c);
+    void on_upload_io_(Conn& c, ssize_t res);
+    void read_ahead_(Conn& c);
+    void on_download_io_(Conn& c, ssize_t res);
+    bool acquire_pipe_(Conn& c);
+    void release_pipe_(Conn& c);
+    void dispatch_(Conn& c);
+    bool begin_batch_(Conn& c);
+    void batch_body_(Conn& c);
+    bool take_batch_head_(Conn& c);
+    bool open_batch_file_(Conn& c);
+    void on_batch_io_(Conn& c, ssize_t res);
+    void batch_file_done_(Conn& c);
+    void commit_batch_file_(Conn& c);
+    void finish_batch_(Conn& c);
+    void end_batch_(Conn& c);
+
+    // 路由
+    void handle_download_(Conn& c);
+    void handle_tail_download_(Conn& c, const std::string& id);
+    bool if_range_matches_(const HttpRequest& req, const FileInfo& info) const;
+    bool not_modified_(const HttpRequest& req, const FileInfo& info) const;
+    void reply_not_modified_(Conn& c, const FileInfo& info);
+    void handle_upload_init_(Conn& c);
+    void handle_upload_chunk_(Conn& c);
+    void handle_upload_complete_(Conn& c);
+    void commit_upload_(Conn& c, const UploadResult& res, const std::string& name, long long size,
+                        const std::string& from);
+    void handle_upload_status_(Conn& c);
+    void handle_list_files_(Conn& c);
+    void handle_stats_(Conn& c);
+    void handle_log_level_(Conn& c);
+    void serve_cached_(Conn& c, FileCache::Ptr e);
+    void fill_cache_(Conn& c, const std::string& key, const FileInfo& info, std::string head);
+    void read_fill_(Conn& c);
+    void on_fill_io_(Conn& c, ssize_t res);
+    void publish_file_meta_(const std::string& from, const std::string& name, long long size,
+                            const std::string& sha256, const std::string& oid);
+    void publish_upload_meta_(const std::string& from, const std::string& name, long long size,
+                              const std::string& id);
+
+    // 响应：拼到 wbuf，随后由 EPOLLOUT 驱动发送
+    void reply_(Conn& c, int code, const char* status,
+                const std::string& body, const char* ctype="application/json",
+                const char* extra_headers="");
+    void arm_write_(Conn& c);
 
     // 工具
     static std::string gen_uuid_();
-    static bool parse_request_(int cfd, std::string& method, std::string& uri,
-                               std::string& headers, std::string& body);
-    static bool get_header_(const std::string& headers, const std::string& key, std::string& val);
-    static bool parse_query_(const std::string& uri, std::string& path,
-                             std::string& id, std::string& seq, std::string& name);
-    static bool send_simple_(int cfd, int code, const char* status,
-                             const std::string& body, const char* ctype="application/json");
-    static bool send_file_(int cfd, const std::string& path, const std::string& name);
 };
@@ -0,0 +1,204 @@
+#include "common/crc32c.hpp"
+#include <cstring>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    constexpr uint32_t POLY = 0x82f63b78; // 反射后的 Castagnoli 多项式
+
+    // ---- 查表实现（slicing-by-8） ----
+    struct Tables
+    {
+        uint32_t t[8][256];
+        Tables()
+        {
+            for (uint32_t n = 0; n < 256; ++n)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+                t[0][n] = c;
+            }
+            for (uint32_t n = 0; n < 256; ++n)
+                for (int k = 1; k < 8; ++k)
+                    t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xff];
+        }
+    };
+    const Tables g_tab;
+
+    uint32_t crc32c_portable(uint32_t crc, const uint8_t *p, size_t len)
+    {
+        const auto &t = g_tab.t;
+        crc = ~crc;
+        while (len > 0 && ((uintptr_t)p & 7) != 0)
+        {
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+            --len;
+        }
+        while (len >= 8)
+        {
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            w ^= crc;
+            crc = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^ t[5][(w >> 16) & 0xff] ^ t[4][(w >> 24) & 0xff] ^
+                  t[3][(w >> 32) & 0xff] ^ t[2][(w >> 40) & 0xff] ^ t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+            p += 8;
+            len -= 8;
+        }
+        while (len-- > 0)
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+        return ~crc;
+    }
+
+#if defined(__x86_64__)
+    // ---- 硬件实现 ----
+    // crc32 指令延迟 3 周期、吞吐 1 周期，单条依赖链只能跑到 1/3 峰值；
+    // 把数据切成相邻三段各算一条链，最后用「追加 N 个零字节」的线性算子把三段拼起来。
+    constexpr size_t LONG = 8192;
+    constexpr size_t SHORT = 256;
+
+    uint32_t gf2_times(const uint32_t *mat, uint32_t vec)
+    {
+        uint32_t sum = 0;
+        while (vec)
+        {
+            if (vec & 1)
+                sum ^= *mat;
+            vec >>= 1;
+            ++mat;
+        }
+        return sum;
+    }
+
+    void gf2_square(uint32_t *square, const uint32_t *mat)
+    {
+        for (int n = 0; n < 32; ++n)
+            square[n] = gf2_times(mat, mat[n]);
+    }
+
+    // 追加 len 个零字节对 crc 寄存器的作用（len 须为 2 的幂），展开成 4 张按字节查的表
+    struct Zeros
+    {
+        uint32_t t[4][256];
+        explicit Zeros(size_t len)
+        {
+            uint32_t even[32], odd[32];
+            odd[0] = POLY;
+            uint32_t row = 1;
+            for (int n = 1; n < 32; ++n)
+            {
+                odd[n] = row;
+                row <<= 1;
+            }
+            gf2_square(even, odd); // 2 个零比特
+            gf2_square(odd, even); // 4 个零比特
+            const uint32_t *op = odd;
+            do
+            {
+                gf2_square(even, odd); // 第一次得到 1 字节
+                len >>= 1;
+                op = even;
+                if (len == 0)
+                    break;
+                gf2_square(odd, even);
+                len >>= 1;
+                op = odd;
+            } while (len);
+            for (uint32_t n = 0; n < 256; ++n)
+            {
+                t[0][n] = gf2_times(op, n);
+                t[1][n] = gf2_times(op, n << 8);
+                t[2][n] = gf2_times(op, n << 16);
+                t[3][n] = gf2_times(op, n << 24);
+            }
+        }
+        uint32_t shift(uint32_t crc) const
+        {
+            return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^ t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+        }
+    };
+    const Zeros g_long(LONG);
+    const Zeros g_short(SHORT);
+
+    // 三条链分别处理 [p, p+n)、[p+n, p+2n)、[p+2n, p+3n)
+    __attribute__((target("sse4.2"))) void stripe(uint64_t &c0, uint64_t &c1, uint64_t &c2,
+                                                  const uint8_t *p, size_t n)
+    {
+        const uint8_t *end = p + n;
+        do
+        {
+            uint64_t a, b, d;
+            std::memcpy(&a, p, 8);
+            std::memcpy(&b, p + n, 8);
+            std::memcpy(&d, p + 2 * n, 8);
+            c0 = _mm_crc32_u64(c0, a);
+            c1 = _mm_crc32_u64(c1, b);
+            c2 = _mm_crc32_u64(c2, d);
+            p += 8;
+        } while (p < end);
+    }
+
+    __attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+    {
+        uint64_t c0 = ~crc;
+        while (len > 0 && ((uintptr_t)p & 7) != 0)
+        {
+            c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+            --len;
+        }
+        while (len >= LONG * 3)
+        {
+            uint64_t c1 = 0, c2 = 0;
+            stripe(c0, c1, c2, p, LONG);
+            c0 = g_long.shift((uint32_t)c0) ^ c1;
+            c0 = g_long.shift((uint32_t)c0) ^ c2;
+            p += LONG * 3;
+            len -= LONG * 3;
+        }
+        while (len >= SHORT * 3)
+        {
+            uint64_t c1 = 0, c2 = 0;
+            stripe(c0, c1, c2, p, SHORT);
+            c0 = g_short.shift((uint32_t)c0) ^ c1;
+            c0 = g_short.shift((uint32_t)c0) ^ c2;
+            p += SHORT * 3;
+            len -= SHORT * 3;
+        }
+        while (len >= 8)
+        {
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            c0 = _mm_crc32_u64(c0, w);
+            p += 8;
+            len -= 8;
+        }
+        while (len-- > 0)
+            c0 = _mm_crc32_u8((uint32_t)c0, *p++);
+        return ~(uint32_t)c0;
+    }
+
+    bool cpu_has_sse42()
+    {
+        unsigned a, b, c, d;
+        return __get_cpuid(1, &a, &b, &c, &d) && ((c >> 20) & 1);
+    }
+    const bool g_hw = cpu_has_sse42();
+#else
+    const bool g_hw = false;
+#endif
+} // namespace
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+#if defined(__x86_64__)
+    if (g_hw)
+        return crc32c_sse42(crc, p, len);
+#endif
+    return crc32c_portable(crc, p, len);
+}
+
+const char *crc32c_impl() { return g_hw ? "sse4.2" : "portable"; }
@@ -0,0 +1,450 @@
+#include "common/log_file.hpp"
+#include "common/logger.hpp"
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    constexpr int IOPRIO_WHO_PROCESS = 1;
+    constexpr int IOPRIO_CLASS_IDLE = 3;
+    constexpr int IOPRIO_CLASS_SHIFT = 13;
+    constexpr size_t BLOCK = 256 * 1024;
+    constexpr size_t PAGE = 4096;
+
+    bool ends_with(const std::string &s, const char *suffix)
+    {
+        size_t n = std::strlen(suffix);
+        return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+    }
+
+    // 段名 <base>.YYYYmmdd-HHMMSS[-N][.gz] 按（时间，N）排就是写的先后
+    bool older(const std::string &a, const std::string &b)
+    {
+        auto key = [](const std::string &name) {
+            std::string s = ends_with(name, ".gz") ? name.substr(0, name.size() - 3) : name;
+            size_t dot = s.rfind('.');
+            size_t dash = s.find('-', s.find('-', dot) + 1);
+            long n = dash == std::string::npos ? 0 : std::atol(s.c_str() + dash + 1);
+            return std::make_pair(s.substr(0, dash), n);
+        };
+        return key(a) < key(b);
+    }
+
+    bool write_all(int fd, const char *p, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            p += w;
+            n -= (size_t)w;
+        }
+        return true;
+    }
+
+    // 崩溃留下的段：末尾是预分配的零，截到最后一个非零字节。
+    // 二进制日志（以 BIN_MAGIC 开头）的最后一个参数可能本身就是 0，不截，log_decode 会跳过零尾
+    void trim_zero_tail(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            return;
+        struct stat st{};
+        char magic[sizeof(logdetail::BIN_MAGIC)] = {};
+        if (::fstat(fd, &st) != 0 ||
+            (::pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+             std::memcmp(magic, logdetail::BIN_MAGIC, sizeof(magic)) == 0))
+        {
+            ::close(fd);
+            return;
+        }
+        std::vector<char> buf(BLOCK);
+        off_t end = st.st_size;
+        while (end > 0)
+        {
+            off_t from = std::max<off_t>(0, end - (off_t)buf.size());
+            ssize_t n = ::pread(fd, buf.data(), (size_t)(end - from), from);
+            if (n != end - from)
+                break;
+            ssize_t i = n;
+            while (i > 0 && buf[(size_t)i - 1] == 0)
+                --i;
+            end = from + i;
+            if (i > 0)
+                break;
+        }
+        if (end < st.st_size)
+            (void)::ftruncate(fd, end);
+        ::close(fd);
+    }
+} // namespace
+
+LogFile::LogFile(const LogFileOptions &opt) : opt_(opt)
+{
+    size_t slash = opt_.path.rfind('/');
+    dir_ = slash == std::string::npos ? "." : opt_.path.substr(0, slash);
+    base_ = slash == std::string::npos ? opt_.path : opt_.path.substr(slash + 1);
+    opt_.segment_bytes = std::max<size_t>(opt_.segment_bytes, 64 * 1024);
+}
+
+LogFile::~LogFile()
+{
+    close();
+}
+
+bool LogFile::open()
+{
+    if (base_.empty())
+        return false;
+    if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        std::fprintf(stderr, "logger: mkdir %s failed: %s\n", dir_.c_str(), strerror(errno));
+        return false;
+    }
+    recover_();
+    if (!open_segment_(opt_.segment_bytes))
+        return false;
+    bg_stop_ = false;
+    bg_ = std::thread([this] { bg_loop_(); });
+    enqueue_(""); // 上次留下的旧段也压缩、清理
+    return true;
+}
+
+// 先停后台线程：最后一段不压，<path> 仍指向它；它和压了一半的段都留到下次启动再压
+void LogFile::close()
+{
+    {
+        std::lock_guard<std::mutex> lk(bg_mu_);
+        bg_stop_ = true;
+    }
+    bg_cv_.notify_one();
+    if (bg_.joinable())
+        bg_.join();
+    close_segment_();
+}
+
+bool LogFile::make_room(size_t n)
+{
+    if (!map_ptr_)
+        return open_segment_(std::max(opt_.segment_bytes, n));
+    bool expired = opt_.max_age_sec > 0 && used_ > 0 && std::time(nullptr) - opened_at_ >= opt_.max_age_sec;
+    if (used_ + n <= map_size_ && !expired)
+        return false;
+    if (used_ == 0)
+    {
+        // 还没写过的段直接扩大：调用方已经按新段准备好了内容（二进制日志的文件头）
+        if (!map_(n))
+            close_segment_();
+        return false;
+    }
+    close_segment_();
+    return open_segment_(std::max(opt_.segment_bytes, n));
+}
+
+bool LogFile::write(const char *p, size_t n)
+{
+    // 不按时间换段：调用方 make_room 之后分几次写的内容要落在同一段
+    if (!map_ptr_ || used_ + n > map_size_)
+        make_room(n);
+    if (!map_ptr_ || used_ + n > map_size_)
+        return false;
+    std::memcpy(map_ptr_ + used_, p, n);
+    used_ += n;
+    return true;
+}
+
+// 同一秒里换了几次段就加 -1、-2…
+std::string LogFile::segment_name_(std::time_t t) const
+{
+    std::tm tm_buf;
+    localtime_r(&t, &tm_buf);
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_buf);
+    std::string name = base_ + "." + stamp;
+    auto taken = [this](const std::string &n) {
+        struct stat st{};
+        return ::stat((dir_ + "/" + n).c_str(), &st) == 0 || ::stat((dir_ + "/" + n + ".gz").c_str(), &st) == 0;
+    };
+    for (int i = 1; taken(name); ++i)
+        name = base_ + "." + stamp + "-" + std::to_string(i);
+    return name;
+}
+
+bool LogFile::open_segment_(size_t bytes)
+{
+    std::time_t now = std::time(nullptr);
+    std::string name = segment_name_(now);
+    std::string path = dir_ + "/" + name;
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        std::fprintf(stderr, "logger: open %s failed: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    cur_path_ = path;
+    used_ = 0;
+    opened_at_ = now;
+    if (!map_(bytes))
+    {
+        ::close(fd_);
+        fd_ = -1;
+        ::unlink(path.c_str());
+        cur_path_.clear();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(bg_mu_);
+        bg_current_ = name;
+    }
+
+    // 先把链接建在临时名上，再 rename 覆盖 <path>：任何时候 <path> 都指向一个完整的段
+    std::string tmp = dir_ + "/." + base_ + ".link";
+    ::unlink(tmp.c_str());
+    if (::symlink(name.c_str(), tmp.c_str()) != 0 || ::rename(tmp.c_str(), opt_.path.c_str()) != 0)
+        std::fprintf(stderr, "logger: cannot point %s to %s: %s\n", opt_.path.c_str(), name.c_str(), strerror(errno));
+    return true;
+}
+
+// 磁盘空间先 fallocate 占住：稀疏文件写 mmap 时磁盘满了会是 SIGBUS，这里失败还能退回别处
+bool LogFile::map_(size_t bytes)
+{
+    bytes = (bytes + PAGE - 1) & ~(PAGE - 1);
+    if (map_ptr_)
+    {
+        ::munmap(map_ptr_, map_size_);
+        map_ptr_ = nullptr;
+        map_size_ = 0;
+    }
+    int err = ::posix_fallocate(fd_, 0, (off_t)bytes);
+    if (err != 0)
+    {
+        std::fprintf(stderr, "logger: fallocate %s (%zu bytes) failed: %s\n", cur_path_.c_str(), bytes, strerror(err));
+        return false;
+    }
+    void *p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED)
+    {
+        std::fprintf(stderr, "logger: mmap %s failed: %s\n", cur_path_.c_str(), strerror(errno));
+        return false;
+    }
+    map_ptr_ = static_cast<char *>(p);
+    map_size_ = bytes;
+    return true;
+}
+
+// 截掉没写到的部分；数据已经在页缓存里，由内核回写，不 msync
+void LogFile::close_segment_()
+{
+    if (fd_ < 0)
+        return;
+    if (map_ptr_)
+        ::munmap(map_ptr_, map_size_);
+    (void)::ftruncate(fd_, (off_t)used_);
+    ::close(fd_);
+    fd_ = -1;
+    map_ptr_ = nullptr;
+    map_size_ = 0;
+    used_ = 0;
+    enqueue_(cur_path_);
+    cur_path_.clear();
+}
+
+// 上次的当前段没正常关（零尾还在）；<path> 是普通文件的话是以前不分段时写的，改名当作一个旧段
+void LogFile::recover_()
+{
+    struct stat st{};
+    if (::lstat(opt_.path.c_str(), &st) != 0)
+        return;
+    if (S_ISLNK(st.st_mode))
+    {
+        char target[PATH_MAX];
+        ssize_t n = ::readlink(opt_.path.c_str(), target, sizeof(target) - 1);
+        if (n > 0)
+        {
+            target[n] = '\0';
+            trim_zero_tail(dir_ + "/" + target);
+        }
+        return;
+    }
+    if (S_ISREG(st.st_mode))
+    {
+        std::string to = dir_ + "/" + segment_name_(st.st_mtime);
+        if (::rename(opt_.path.c_str(), to.c_str()) != 0)
+            std::fprintf(stderr, "logger: rename %s failed: %s\n", opt_.path.c_str(), strerror(errno));
+    }
+}
+
+void LogFile::enqueue_(const std::string &path)
+{
+    {
+        std::lock_guard<std::mutex> lk(bg_mu_);
+        if (!bg_.joinable())
+            return;
+        bg_queue_.push_back(path);
+    }
+    bg_cv_.notify_one();
+}
+
+std::string LogFile::current_name_()
+{
+    std::lock_guard<std::mutex> lk(bg_mu_);
+    return bg_current_;
+}
+
+bool LogFile::stopping_()
+{
+    std::lock_guard<std::mutex> lk(bg_mu_);
+    return bg_stop_;
+}
+
+void LogFile::bg_loop_()
+{
+    // 和 gzip 副本一样只在空闲时占用磁盘和 CPU
+    pid_t tid = (pid_t)::syscall(SYS_gettid);
+    (void)::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    ::setpriority(PRIO_PROCESS, (id_t)tid, 19);
+
+    for (;;)
+    {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lk(bg_mu_);
+            bg_cv_.wait(lk, [this] { return bg_stop_ || !bg_queue_.empty(); });
+            if (bg_stop_)
+                break;
+            path = std::move(bg_queue_.front());
+            bg_queue_.pop_front();
+        }
+        if (path.empty())
+        {
+            // 启动时：上次没压完的旧段补上
+            std::vector<std::string> old;
+            if (DIR *d = ::opendir(dir_.c_str()))
+            {
+                while (dirent *e = ::readdir(d))
+                {
+                    std::string name = e->d_name;
+                    if (name.compare(0, base_.size() + 1, base_ + ".") != 0)
+                        continue;
+                    if (ends_with(name, ".tmp"))
+                        ::unlink((dir_ + "/" + name).c_str()); // 上次压到一半
+                    else if (!ends_with(name, ".gz") && name != current_name_())
+                        old.push_back(dir_ + "/" + name);
+                }
+                ::closedir(d);
+            }
+            for (const auto &p : old)
+                if (opt_.compress && !stopping_())
+                    compress_file_(p);
+        }
+        else if (opt_.compress)
+            compress_file_(path);
+        enforce_keep_();
+    }
+}
+
+// <段>.gz.tmp 写完再改名，最后删原段；中途停下就删掉临时文件，原段留着
+bool LogFile::compress_file_(const std::string &path)
+{
+    int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+        return false;
+    std::string tmp = path + ".gz.tmp";
+    int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0)
+    {
+        ::close(in);
+        return false;
+    }
+    z_stream zs{};
+    bool ok = ::deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    std::vector<char> ibuf(BLOCK), obuf(BLOCK);
+    for (int flush = Z_NO_FLUSH; ok && flush != Z_FINISH;)
+    {
+        if (stopping_())
+        {
+            ok = false;
+            break;
+        }
+        ssize_t n = ::read(in, ibuf.data(), ibuf.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            ok = false;
+            break;
+        }
+        flush = n == 0 ? Z_FINISH : Z_NO_FLUSH;
+        zs.next_in = (Bytef *)ibuf.data();
+        zs.avail_in = (uInt)n;
+        do
+        {
+            zs.next_out = (Bytef *)obuf.data();
+            zs.avail_out = (uInt)obuf.size();
+            ::deflate(&zs, flush);
+            size_t have = obuf.size() - zs.avail_out;
+            if (have > 0 && !write_all(out, obuf.data(), have))
+            {
+                ok = false;
+                break;
+            }
+        } while (zs.avail_out == 0);
+    }
+    ::deflateEnd(&zs);
+    ::close(in);
+    ok = ::close(out) == 0 && ok;
+    if (ok && ::rename(tmp.c_str(), (path + ".gz").c_str()) == 0)
+    {
+        ::unlink(path.c_str());
+        return true;
+    }
+    ::unlink(tmp.c_str());
+    if (!stopping_())
+        LOG_WARN("logger: compress %s failed", path.c_str());
+    return false;
+}
+
+// 当前段之外最多留 keep 段，按段名里的时间删最旧的
+void LogFile::enforce_keep_()
+{
+    if (opt_.keep <= 0)
+        return;
+    const std::string current = current_name_();
+    std::vector<std::string> names;
+    if (DIR *d = ::opendir(dir_.c_str()))
+    {
+        while (dirent *e = ::readdir(d))
+        {
+            std::string name = e->d_name;
+            if (name.compare(0, base_.size() + 1, base_ + ".") == 0 && !ends_with(name, ".tmp") &&
+                name != current)
+                names.push_back(name);
+        }
+        ::closedir(d);
+    }
+    if (names.size() <= (size_t)opt_.keep)
+        return;
+    std::sort(names.begin(), names.end(), older);
+    for (size_t i = 0; i + (size_t)opt_.keep < names.size(); ++i)
+    {
+        if (::unlink((dir_ + "/" + names[i]).c_str()) != 0)
+            LOG_WARN("logger: remove %s failed: %s", names[i].c_str(), strerror(errno));
+    }
+}
@@ -1,10 +1,20 @@
 #include "common/logger.hpp"
+#include "common/log_file.hpp"
 #include <mutex>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
 #include <ctime>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <string>
 #include <thread>
+#include <vector>
+#include <strings.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
@@ -12,15 +22,30 @@ namespace
 {
 
     // 全局状态
-    static std::mutex g_mu;
-    static LogLevel g_level = LogLevel::INFO;
+    static std::mutex g_mu; // 保护 g_out、g_file 和往它们写
     static FILE *g_out = stdout;
-    static bool g_color = true;
+    static std::unique_ptr<LogFile> g_file; // set_file 之后写这里，不再写 g_out
 
-    // 取线程ID
+    // 在 g_mu 里调用。分段文件写不进去（建段失败）时退回 g_out，不丢
+    void out_write(const char *p, size_t n)
+    {
+        if (g_file && g_file->write(p, n))
+            return;
+        std::fwrite(p, 1, n, g_out);
+    }
+
+    void out_flush()
+    {
+        if (!g_file)
+            std::fflush(g_out);
+    }
+    static std::atomic<bool> g_color{true}; // 格式化在锁外做
+
+    // 取线程ID（gettid 是系统调用，每个线程只取一次）
     inline unsigned long get_tid()
     {
-        return static_cast<unsigned long>(gettid());
+        thread_local unsigned long tid = static_cast<unsigned long>(gettid());
+        return tid;
     }
 
     // 取文件名
@@ -32,20 +57,350 @@ namespace
         return p ? (p + 1) : path;
     }
 
-    // 格式化时间到 yyyy-mm-dd HH:MM:SS.mmm
-    inline void format_timestamp(char *buf, size_t n)
+    // 写 yyyy-mm-dd HH:MM:SS.mmm（23 字节）；秒以上的部分每个线程缓存，一秒只做一次 localtime_r
+    inline size_t format_timestamp(char *out)
     {
         using namespace std::chrono;
+        thread_local std::time_t last_sec = -1;
+        thread_local char sec_buf[48];
         auto now = system_clock::now();
         auto secs = time_point_cast<seconds>(now);
-        auto ms = duration_cast<milliseconds>(now - secs).count();
+        auto ms = static_cast<int>(duration_cast<milliseconds>(now - secs).count());
 
         std::time_t t = system_clock::to_time_t(secs);
-        std::tm tm_buf;
-        localtime_r(&t, &tm_buf);
-        std::snprintf(buf, n, "%04d-%02d-%02d %02d:%02d:%02d.%03ld",
-                      tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-                      tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec, static_cast<long>(ms));
+        if (t != last_sec)
+        {
+            std::tm tm_buf;
+            localtime_r(&t, &tm_buf);
+            std::snprintf(sec_buf, sizeof(sec_buf), "%04d-%02d-%02d %02d:%02d:%02d",
+                          tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
+                          tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec);
+            last_sec = t;
+        }
+        std::memcpy(out, sec_buf, 19);
+        out[19] = '.';
+        out[20] = (char)('0' + ms / 100);
+        out[21] = (char)('0' + ms / 10 % 10);
+        out[22] = (char)('0' + ms % 10);
+        return 23;
+    }
+
+    // "[tid:N]"，每个线程拼一次
+    inline const std::string &tid_tag()
+    {
+        thread_local std::string tag = "[tid:" + std::to_string(get_tid()) + "]";
+        return tag;
+    }
+
+    // ---- 异步模式 ----
+
+    // 每个线程一个：生产者是该线程，消费者是后台写线程。head / tail 是一直增长的字节序号，
+    // 取模落到 buf。每条记录是 u32 长度 + 内容（文本模式是一整行，二进制模式是一条记录），
+    // 按 4 字节对齐、在 buf 里连续存放，生产者可以直接往里写：放不到末尾时写一个 WRAP，从开头接着放
+    struct Ring
+    {
+        static constexpr uint32_t WRAP = 0xffffffffu;
+
+        explicit Ring(size_t cap) : buf(cap), mask(cap - 1), tid(get_tid()) {}
+
+        std::vector<char> buf;
+        const size_t mask;
+        const unsigned long tid;
+        alignas(64) std::atomic<uint64_t> head{0}; // 生产者写
+        uint64_t tail_seen = 0;                     // 生产者上次读到的 tail，空间不够时才重读
+        uint64_t reserved_end = 0;                  // reserve 之后、commit 时的新 head
+        alignas(64) std::atomic<uint64_t> tail{0}; // 消费者写
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> retired{false}; // 线程已退出，写空后移除
+    };
+
+    inline uint64_t rec_size(size_t n) { return (4 + n + 3) & ~(uint64_t)3; }
+
+    constexpr uint32_t TEXT_RECORD = 0; // 二进制模式下直接调 Logger::log 的：格式 id 位置放它，后面是整行文本
+
+    static std::atomic<bool> g_async{false};
+    static LogAsyncOptions g_async_opt; // g_async 置位前写好
+    static size_t g_ring_cap = 0;
+    static std::mutex g_ctl_mu; // start_async / stop_async
+    static std::mutex g_rings_mu;
+    static std::vector<std::shared_ptr<Ring>> g_rings;
+    static std::thread g_writer;
+    static std::atomic<uint64_t> g_dropped{0};
+    static uint64_t g_ticks_hz = 0;    // 二进制模式：TSC 每秒的 tick 数，start_async 时测
+    static bool g_need_header = false; // 二进制模式：下次写出前先写文件头（g_mu 保护）
+    static std::mutex g_sites_mu;
+    static std::vector<const LogSite *> g_sites; // 下标 + 1 是格式 id
+
+    // 唤醒后台线程：生产者只置标志、不拿锁，标志本来就是置位的就连 notify 都省了。
+    // 正好赶在后台线程检查完标志、还没睡下时的唤醒会丢，最多晚一个 flush_interval
+    static std::mutex g_wake_mu;
+    static std::condition_variable g_wake_cv;
+    static std::atomic<bool> g_wake{false};
+    static bool g_stopping = false; // g_wake_mu 保护
+
+    void wake_writer()
+    {
+        if (!g_wake.exchange(true, std::memory_order_acq_rel))
+            g_wake_cv.notify_one();
+    }
+
+    struct LocalRing
+    {
+        std::shared_ptr<Ring> ring;
+        ~LocalRing()
+        {
+            if (ring)
+                ring->retired.store(true, std::memory_order_release);
+        }
+    };
+    thread_local LocalRing t_ring;
+
+    Ring &local_ring()
+    {
+        if (!t_ring.ring)
+        {
+            auto r = std::make_shared<Ring>(g_ring_cap);
+            std::lock_guard<std::mutex> lk(g_rings_mu);
+            g_rings.push_back(r);
+            t_ring.ring = std::move(r);
+        }
+        return *t_ring.ring;
+    }
+
+    // 在本线程的缓冲里预留 n 字节连续空间，返回写内容的位置；满了按溢出策略等，或者丢掉返回 nullptr
+    char *reserve(size_t n)
+    {
+        Ring &r = local_ring();
+        const uint64_t cap = r.mask + 1;
+        const uint64_t rec = rec_size(n);
+        if (rec > cap / 2)
+        {
+            r.dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        uint64_t h = r.head.load(std::memory_order_relaxed);
+        const uint64_t room = cap - (h & r.mask);
+        const uint64_t skip = room < rec ? room : 0;
+        while (h + skip + rec - r.tail_seen > cap)
+        {
+            r.tail_seen = r.tail.load(std::memory_order_acquire);
+            if (h + skip + rec - r.tail_seen <= cap)
+                break;
+            wake_writer();
+            if (g_async_opt.overflow == LogOverflow::DROP || !g_async.load(std::memory_order_acquire))
+            {
+                r.dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        if (skip)
+        {
+            std::memcpy(&r.buf[h & r.mask], &Ring::WRAP, 4);
+            h += skip;
+        }
+        char *p = &r.buf[h & r.mask];
+        uint32_t len = (uint32_t)n;
+        std::memcpy(p, &len, 4);
+        r.reserved_end = h + rec;
+        return p + 4;
+    }
+
+    void commit(bool urgent)
+    {
+        Ring &r = *t_ring.ring;
+        const uint64_t cap = r.mask + 1, h = r.reserved_end;
+        r.head.store(h, std::memory_order_release);
+
+        // 过半才叫醒后台线程，平时靠它按 flush_interval 自己醒
+        if (!urgent && h - r.tail_seen > cap / 2)
+            r.tail_seen = r.tail.load(std::memory_order_acquire);
+        if (urgent || h - r.tail_seen > cap / 2)
+            wake_writer();
+    }
+
+    // 把 r 里已提交的记录依次交给 fn(内容, 长度)，然后释放
+    template <typename Fn>
+    void drain(Ring &r, Fn &&fn)
+    {
+        uint64_t t = r.tail.load(std::memory_order_relaxed);
+        const uint64_t h = r.head.load(std::memory_order_acquire);
+        while (t < h)
+        {
+            const char *p = &r.buf[t & r.mask];
+            uint32_t len;
+            std::memcpy(&len, p, 4);
+            if (len == Ring::WRAP)
+            {
+                t += r.mask + 1 - (t & r.mask);
+                continue;
+            }
+            fn(p + 4, (size_t)len);
+            t += rec_size(len);
+        }
+        r.tail.store(t, std::memory_order_release);
+    }
+
+    inline void put_le(std::string &out, uint64_t v, int bytes)
+    {
+        for (int i = 0; i < bytes; ++i)
+            out.push_back((char)(uint8_t)(v >> (i * 8)));
+    }
+
+    inline uint64_t realtime_ns()
+    {
+        using namespace std::chrono;
+        return (uint64_t)duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    // TSC 频率：对着 steady_clock 量 20ms
+    uint64_t calibrate_ticks_hz()
+    {
+        using namespace std::chrono;
+        auto t0 = steady_clock::now();
+        uint64_t c0 = logdetail::ticks();
+        std::this_thread::sleep_for(milliseconds(20));
+        uint64_t c1 = logdetail::ticks();
+        auto ns = duration_cast<nanoseconds>(steady_clock::now() - t0).count();
+        return ns > 0 ? (uint64_t)((double)(c1 - c0) * 1e9 / (double)ns) : 1000000000ull;
+    }
+
+    // 调用点 [from, 已登记的末尾) 拼成一个 BIN_SITES 块，返回新的末尾
+    size_t append_sites(std::string &out, size_t from)
+    {
+        std::lock_guard<std::mutex> lk(g_sites_mu);
+        if (from >= g_sites.size())
+            return from;
+        out.push_back((char)logdetail::BIN_SITES);
+        put_le(out, from + 1, 4);
+        put_le(out, g_sites.size() - from, 4);
+        for (size_t i = from; i < g_sites.size(); ++i)
+        {
+            const LogSite &s = *g_sites[i];
+            size_t fl = std::min<size_t>(std::strlen(s.file), 0xffff);
+            size_t ml = std::min<size_t>(std::strlen(s.fmt), 0xffff);
+            size_t tl = std::min<size_t>(std::strlen(s.types), 0xff);
+            put_le(out, (uint64_t)s.level, 1);
+            put_le(out, (uint64_t)s.line, 4);
+            put_le(out, fl, 2);
+            out.append(s.file, fl);
+            put_le(out, ml, 2);
+            out.append(s.fmt, ml);
+            put_le(out, tl, 1);
+            out.append(s.types, tl);
+        }
+        return g_sites.size();
+    }
+
+    void writer_loop()
+    {
+        const bool binary = g_async_opt.binary;
+        size_t sites_written = 0; // 当前输出里已经写过的调用点
+        std::string out, meta;
+        out.reserve(256 * 1024);
+        for (;;)
+        {
+            bool stopping;
+            {
+                std::unique_lock<std::mutex> lk(g_wake_mu);
+                g_wake_cv.wait_for(lk, std::chrono::milliseconds(g_async_opt.flush_interval_ms),
+                                   [] { return g_wake.load(std::memory_order_acquire) || g_stopping; });
+                g_wake.store(false, std::memory_order_release);
+                stopping = g_stopping;
+            }
+
+            std::vector<std::shared_ptr<Ring>> rings;
+            {
+                std::lock_guard<std::mutex> lk(g_rings_mu);
+                rings = g_rings;
+            }
+            uint64_t dropped = 0;
+            for (auto &r : rings)
+            {
+                if (!binary)
+                    drain(*r, [&](const char *p, size_t n) { out.append(p, n); });
+                else
+                {
+                    // 数据块头：线程号 + 同步点（此刻之前的记录都已提交），长度最后补
+                    const size_t at = out.size();
+                    out.push_back((char)logdetail::BIN_RECORDS);
+                    put_le(out, r->tid, 4);
+                    put_le(out, logdetail::ticks(), 8);
+                    put_le(out, realtime_ns(), 8);
+                    put_le(out, 0, 4);
+                    drain(*r, [&](const char *p, size_t n) {
+                        put_le(out, n, 4);
+                        out.append(p, n);
+                    });
+                    uint64_t body = out.size() - at - 25;
+                    if (body == 0)
+                        out.resize(at);
+                    else
+                        for (int i = 0; i < 4; ++i)
+                            out[at + 21 + (size_t)i] = (char)(uint8_t)(body >> (i * 8));
+                }
+                dropped += r->dropped.exchange(0, std::memory_order_relaxed);
+            }
+            {
+                std::lock_guard<std::mutex> lk(g_mu);
+                if (binary)
+                {
+                    // 记录里用到的调用点都在取出记录之前登记过，这时拼出来的一定包含它们。
+                    // 分段文件换了段就按新文件重拼：文件头 + 全部调用点
+                    auto build_meta = [&] {
+                        meta.clear();
+                        if (g_need_header)
+                        {
+                            meta.assign(logdetail::BIN_MAGIC, sizeof(logdetail::BIN_MAGIC));
+                            put_le(meta, g_ticks_hz, 8);
+                            sites_written = 0;
+                            g_need_header = false;
+                        }
+                        sites_written = append_sites(meta, sites_written);
+                    };
+                    build_meta();
+                    if (g_file && (!out.empty() || !meta.empty()) && g_file->make_room(meta.size() + out.size()))
+                    {
+                        g_need_header = true;
+                        build_meta();
+                        g_file->make_room(meta.size() + out.size());
+                    }
+                    out_write(meta.data(), meta.size());
+                }
+                else if (g_file && !out.empty())
+                    g_file->make_room(out.size());
+                if (!out.empty() || !meta.empty())
+                {
+                    out_write(out.data(), out.size());
+                    out_flush();
+                    out.clear();
+                }
+            }
+            if (dropped)
+            {
+                g_dropped.fetch_add(dropped, std::memory_order_relaxed);
+                // 进的是本线程自己的缓冲，下一轮写出
+                LOG_WARN("logger: dropped %llu records, ring full", (unsigned long long)dropped);
+            }
+
+            {
+                std::lock_guard<std::mutex> lk(g_rings_mu);
+                for (size_t i = 0; i < g_rings.size();)
+                {
+                    Ring &r = *g_rings[i];
+                    if (r.retired.load(std::memory_order_acquire) &&
+                        r.tail.load(std::memory_order_relaxed) == r.head.load(std::memory_order_acquire))
+                    {
+                        g_rings[i] = std::move(g_rings.back());
+                        g_rings.pop_back();
+                    }
+                    else
+                        ++i;
+                }
+            }
+            if (stopping)
+                break;
+        }
     }
 
 } // namespace
@@ -53,35 +408,242 @@ namespace
 void Logger::init(LogLevel lvl, FILE *out, bool enable_color)
 {
     std::lock_guard<std::mutex> lock(g_mu);
-    g_level = lvl;
+    set_level(lvl);
     g_out = out ? out : stdout;
     g_color = enable_color;
 }
 
 void Logger::set_level(LogLevel lvl)
 {
-    std::lock_guard<std::mutex> lock(g_mu);
-    g_level = lvl;
+    for (auto &l : module_level_)
+        l.store(static_cast<int>(lvl), std::memory_order_relaxed);
+    update_min_level_();
+}
+
+void Logger::set_level(LogModule mod, LogLevel lvl)
+{
+    module_level_[static_cast<size_t>(mod)].store(static_cast<int>(lvl), std::memory_order_relaxed);
+    update_min_level_();
 }
 
 LogLevel Logger::level()
 {
-    std::lock_guard<std::mutex> lock(g_mu);
-    return g_level;
+    return static_cast<LogLevel>(level_.load());
+}
+
+LogLevel Logger::level(LogModule mod)
+{
+    return static_cast<LogLevel>(module_level_[static_cast<size_t>(mod)].load());
+}
+
+// 几个线程同时改等级时各自算一遍，最后一次写入的为准；只用来给 log() 先挡一下
+void Logger::update_min_level_()
+{
+    int lo = static_cast<int>(LogLevel::ERROR);
+    for (const auto &l : module_level_)
+        lo = std::min(lo, l.load(std::memory_order_relaxed));
+    level_.store(lo, std::memory_order_relaxed);
+}
+
+bool Logger::set_levels(const std::string &spec)
+{
+    std::vector<std::pair<int, LogLevel>> todo; // 模块下标，-1 表示全部
+    size_t pos = 0;
+    while (pos <= spec.size())
+    {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos)
+            end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        LogLevel lvl;
+        if (eq == std::string::npos)
+        {
+            if (!parse_level(item, lvl))
+                return false;
+            todo.emplace_back(-1, lvl);
+            continue;
+        }
+        LogModule mod;
+        if (!parse_module(item.substr(0, eq), mod) || !parse_level(item.substr(eq + 1), lvl))
+            return false;
+        todo.emplace_back(static_cast<int>(mod), lvl);
+    }
+    for (const auto &t : todo)
+    {
+        if (t.first < 0)
+            set_level(t.second);
+        else
+            set_level(static_cast<LogModule>(t.first), t.second);
+    }
+    return true;
+}
+
+const char *Logger::module_name(LogModule mod)
+{
+    switch (mod)
+    {
+    case LogModule::CHAT:
+        return "chat";
+    case LogModule::HTTP:
+        return "http";
+    case LogModule::FILE:
+        return "file";
+    case LogModule::BUS:
+        return "bus";
+    }
+    return "unknown";
+}
+
+bool Logger::parse_level(const std::string &name, LogLevel &out)
+{
+    static const char *names[] = {"debug", "info", "warn", "error"};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (strcasecmp(name.c_str(), names[i]) == 0)
+        {
+            out = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Logger::parse_module(const std::string &name, LogModule &out)
+{
+    for (size_t i = 0; i < LOG_MODULES; ++i)
+    {
+        if (strcasecmp(name.c_str(), module_name(static_cast<LogModule>(i))) == 0)
+        {
+            out = static_cast<LogModule>(i);
+            return true;
+        }
+    }
+    return false;
 }
 
 void Logger::set_output(FILE *out)
 {
-    std::lock_guard<std::mutex> lock(g_mu);
-    g_out = out ? out : stdout;
+    std::unique_ptr<LogFile> old;
+    {
+        std::lock_guard<std::mutex> lock(g_mu);
+        old = std::move(g_file);
+        g_out = out ? out : stdout;
+        g_need_header = binary_.load(); // 新文件也要能单独解码
+    }
+    // 在锁外关：要等它的后台线程，那个线程自己也可能在打日志
+}
+
+bool Logger::set_file(const LogFileOptions &opt)
+{
+    auto file = std::make_unique<LogFile>(opt);
+    if (!file->open())
+        return false;
+    std::unique_ptr<LogFile> old;
+    {
+        std::lock_guard<std::mutex> lock(g_mu);
+        old = std::move(g_file);
+        g_file = std::move(file);
+        g_need_header = binary_.load();
+    }
+    // 退出时先把异步缓冲写完，再截掉当前段的零尾
+    static bool registered = (std::atexit([] {
+                                  Logger::stop_async();
+                                  Logger::set_output(stdout);
+                              }),
+                              true);
+    (void)registered;
+    return true;
 }
 
 void Logger::set_color(bool enable)
 {
-    std::lock_guard<std::mutex> lock(g_mu);
     g_color = enable;
 }
 
+bool Logger::start_async(const LogAsyncOptions &opt)
+{
+    std::lock_guard<std::mutex> lk(g_ctl_mu);
+    if (g_async.load())
+        return true;
+    g_async_opt = opt;
+    g_async_opt.flush_interval_ms = std::max(1, opt.flush_interval_ms);
+    size_t cap = 64 * 1024; // 至少放得下两条最长的文本行
+    while (cap < opt.ring_bytes)
+        cap <<= 1;
+    g_ring_cap = cap; // 已经建好的缓冲保持原来的大小
+    if (opt.binary)
+    {
+        if (g_ticks_hz == 0)
+            g_ticks_hz = calibrate_ticks_hz();
+        std::lock_guard<std::mutex> ol(g_mu);
+        g_need_header = true;
+    }
+    {
+        std::lock_guard<std::mutex> wl(g_wake_mu);
+        g_stopping = false;
+    }
+    try
+    {
+        g_writer = std::thread(writer_loop);
+    }
+    catch (...)
+    {
+        return false;
+    }
+    g_async.store(true, std::memory_order_release);
+    binary_.store(opt.binary, std::memory_order_release);
+
+    static bool registered = (std::atexit([] { Logger::stop_async(); }), true);
+    (void)registered;
+    return true;
+}
+
+void Logger::stop_async()
+{
+    std::lock_guard<std::mutex> lk(g_ctl_mu);
+    if (!g_async.exchange(false))
+        return;
+    binary_.store(false, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> wl(g_wake_mu);
+        g_stopping = true;
+    }
+    g_wake_cv.notify_one();
+    g_writer.join(); // 退出前最后一轮把各缓冲写空
+}
+
+uint64_t Logger::dropped()
+{
+    return g_dropped.load(std::memory_order_relaxed);
+}
+
+char *Logger::bin_reserve_(size_t n)
+{
+    return reserve(n);
+}
+
+void Logger::bin_commit_(bool urgent)
+{
+    commit(urgent);
+}
+
+uint32_t Logger::register_site_(const LogSite &site)
+{
+    std::lock_guard<std::mutex> lk(g_sites_mu);
+    uint32_t id = site.id.load(std::memory_order_relaxed);
+    if (id == 0) // 别的线程可能刚登记过
+    {
+        g_sites.push_back(&site);
+        id = (uint32_t)g_sites.size();
+        site.id.store(id, std::memory_order_release);
+    }
+    return id;
+}
+
 const char *Logger::level_str(LogLevel lvl)
 {
     switch (lvl)
@@ -119,52 +681,87 @@ const char *Logger::level_color(LogLevel lvl)
 
 void Logger::log(LogLevel lvl, const char *file, int line, const char *fmt, ...)
 {
-    if (static_cast<int>(lvl) < static_cast<int>(g_level))
+    if (static_cast<int>(lvl) < level_.load(std::memory_order_relaxed))
         return;
 
-    std::lock_guard<std::mutex> lk(g_mu);
-
-    // 统一拼接到栈缓冲，减少多线程交叉
-    std::array<char, 2048> buf{};
+    // 统一拼接到栈缓冲，减少多线程交叉；留一个字节给换行。
+    // 前缀是热路径：直接拷贝拼出来，只有正文走 vsnprintf
+    std::array<char, 2048> buf;
+    const size_t cap = buf.size() - 1;
     size_t pos = 0;
+    auto append = [&](const char *s, size_t n) {
+        n = std::min(n, cap - pos);
+        std::memcpy(buf.data() + pos, s, n);
+        pos += n;
+    };
+    auto append_str = [&](const char *s) { append(s, std::strlen(s)); };
 
     // 1) 时间戳
-    char ts[64];
-    format_timestamp(ts, sizeof(ts));
-    pos += std::snprintf(buf.data() + pos, buf.size() - pos, "[%s]", ts);
+    char ts[32];
+    ts[0] = '[';
+    size_t tn = 1 + format_timestamp(ts + 1);
+    ts[tn++] = ']';
+    append(ts, tn);
 
     // 2) 等级 + 颜色
-    const char *c = level_color(lvl);
-    const char *r = g_color ? "\033[0m" : "";
-    pos += std::snprintf(buf.data() + pos, buf.size() - pos, "%s[%s]%s", c, level_str(lvl), r);
+    append_str(level_color(lvl));
+    append("[", 1);
+    append_str(level_str(lvl));
+    append("]", 1);
+    if (g_color)
+        append("\033[0m", 4);
 
     // 3) 线程号
-    pos += std::snprintf(buf.data() + pos, buf.size() - pos, "[tid:%lu]", get_tid());
+    const std::string &tid = tid_tag();
+    append(tid.data(), tid.size());
 
     // 4) 源文件:行号
-    pos += std::snprintf(buf.data() + pos, buf.size() - pos, "[%s:%d] ", basename2(file), line);
+    char ln[24];
+    ln[0] = ':';
+    char *le = std::to_chars(ln + 1, ln + sizeof(ln) - 2, line).ptr;
+    *le++ = ']';
+    *le++ = ' ';
+    append("[", 1);
+    append_str(basename2(file));
+    append(ln, (size_t)(le - ln));
 
     // 5) 正文（printf 风格）
     va_list ap;
     va_start(ap, fmt);
-    pos += std::vsnprintf(buf.data() + pos, buf.size() - pos, fmt, ap);
+    int n = std::vsnprintf(buf.data() + pos, cap - pos, fmt, ap);
+    if (n > 0)
+        pos = std::min(cap, pos + (size_t)n);
     va_end(ap);
 
-    // 6) 结尾换行（保证每条一行）
-    if (pos < buf.size() - 1)
-    {
-        buf[pos++] = '\n';
-        buf[pos] = '\0';
-    }
-    else
+    // 6) 结尾换行（保证每条一行；缓冲不够时截断正文）
+    if (pos >= cap)
+        pos = cap - 1;
+    buf[pos++] = '\n';
+
+    if (g_async.load(std::memory_order_acquire))
     {
-        // 缓冲不够也强行结尾
-        buf[buf.size() - 2] = '\n';
-        buf[buf.size() - 1] = '\0';
+        // 二进制模式下整行作为一条文本记录（格式 id 为 TEXT_RECORD）
+        const bool bin = binary_.load(std::memory_order_relaxed);
+        const size_t n = bin ? 12 + pos : pos;
+        char *p = reserve(n);
+        if (!p)
+            return;
+        if (bin)
+        {
+            uint64_t t = logdetail::ticks();
+            std::memcpy(p, &TEXT_RECORD, 4);
+            std::memcpy(p + 4, &t, 8);
+            p += 12;
+        }
+        std::memcpy(p, buf.data(), pos);
+        return commit(lvl >= LogLevel::ERROR);
     }
 
-    std::fwrite(buf.data(), 1, std::strlen(buf.data()), g_out);
-    std::fflush(g_out); // 需要实时可见时打开；追求性能可去掉
+    std::lock_guard<std::mutex> lk(g_mu);
+    if (g_file)
+        g_file->make_room(pos);
+    out_write(buf.data(), pos);
+    out_flush(); // 同步模式每行都刷，进程崩了也不丢（分段文件写进映射就在页缓存里了）
 }
 
 // void Logger::vlog(LogLevel lvl, std::string_view file, int line, const char* fmt, va_list ap) {
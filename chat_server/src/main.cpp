@@ -46,12 +46,20 @@
 // }
 
 #include <csignal>
+#include <cstdlib>
+#include <algorithm>
 #include <atomic>
 #include <thread>
 
 #include "common/logger.hpp"
+#include "common/log_file.hpp"
 #include "common/file_bus.hpp"
+#include "file/async_io.hpp"
+#include "file/compressor.hpp"
 #include "file/file_catalog.hpp"
+#include "file/janitor.hpp"
+#include "file/upload_sessions.hpp"
+#include "http/bandwidth_shaper.hpp"
 #include "http/http_server.hpp"
 #include "core/server.hpp"
 
@@ -71,17 +79,129 @@ int main() {
     const std::string http_bind = "0.0.0.0";
     const int         http_port = 9080;
     const std::string upload_root = "uploads";
+    // 上传落盘策略：none / fdatasync / writeback，可用环境变量 UPLOAD_DURABILITY 覆盖
+    Durability durability = Durability::FDATASYNC;
 
     Logger::init(LogLevel::INFO);
+    // 日志等级：LOG_LEVEL=info,http=debug,file=warn（模块 chat/http/file/bus）；
+    // 运行中可用 POST /log/level 修改。低于编译期下限（LOG_MIN_LEVEL）的调用点已经不在了
+    if (const char* env = std::getenv("LOG_LEVEL")) {
+        if (!Logger::set_levels(env))
+            LOG_WARN("bad LOG_LEVEL=%s, using info", env);
+    }
+    // 日志默认异步：各线程写自己的环形缓冲（LOG_RING_KB，默认 256），后台线程每 LOG_FLUSH_MS
+    // （默认 100）写出一次；缓冲满时 LOG_OVERFLOW=drop（默认，计数）或 block。LOG_ASYNC=0 回到逐行同步写。
+    // LOG_FORMAT=binary 只记格式 id 和参数原值，不在线程里格式化，用 log_decode 转成文本
+    if (const char* env = std::getenv("LOG_ASYNC"); !env || std::atoi(env) != 0) {
+        LogAsyncOptions log_opt;
+        if (const char* e = std::getenv("LOG_RING_KB"))
+            log_opt.ring_bytes = (size_t)std::max(4, std::atoi(e)) << 10;
+        if (const char* e = std::getenv("LOG_FLUSH_MS"))
+            log_opt.flush_interval_ms = std::max(1, std::atoi(e));
+        if (const char* e = std::getenv("LOG_OVERFLOW"))
+            log_opt.overflow = std::string(e) == "block" ? LogOverflow::BLOCK : LogOverflow::DROP;
+        if (const char* e = std::getenv("LOG_FORMAT"))
+            log_opt.binary = std::string(e) == "binary";
+        if (!Logger::start_async(log_opt))
+            LOG_WARN("async logging unavailable, writing synchronously");
+    }
+    // LOG_FILE=logs/chat_server.log：写分段文件，不再写 stdout。每段 LOG_ROTATE_MB（默认 64）
+    // 或 LOG_ROTATE_SEC（默认一天，0 不按时间）换一次，旧段后台压成 .gz（LOG_COMPRESS=0 不压），
+    // 留最近 LOG_KEEP（默认 10）段
+    if (const char* env = std::getenv("LOG_FILE")) {
+        LogFileOptions file_opt;
+        file_opt.path = env;
+        if (const char* e = std::getenv("LOG_ROTATE_MB"))
+            file_opt.segment_bytes = (size_t)std::max(1, std::atoi(e)) << 20;
+        if (const char* e = std::getenv("LOG_ROTATE_SEC"))
+            file_opt.max_age_sec = std::max(0, std::atoi(e));
+        if (const char* e = std::getenv("LOG_KEEP"))
+            file_opt.keep = std::max(0, std::atoi(e));
+        if (const char* e = std::getenv("LOG_COMPRESS"))
+            file_opt.compress = std::atoi(e) != 0;
+        Logger::set_color(false);
+        if (!Logger::set_file(file_opt)) {
+            Logger::set_color(true);
+            LOG_WARN("cannot open log file %s, logging to stdout", env);
+        }
+    }
 
-    FileCatalog catalog(upload_root);
+    if (const char* env = std::getenv("UPLOAD_DURABILITY")) {
+        if (!parse_durability(env, durability))
+            LOG_WARN("unknown UPLOAD_DURABILITY=%s, using %s", env, durability_str(durability));
+    }
+    LOG_INFO("upload durability: %s", durability_str(durability));
+
+    FileCatalog catalog(upload_root, durability);
+    // 同名文件的旧版本默认全留，聊天里发过的 /download?oid= 链接一直能下。要回收空间时可设
+    // FILE_KEEP_VERSIONS（每个名字留几个旧版本）、FILE_VERSION_TTL_DAYS（被顶替后留几天），0 表示不限；
+    // 被删掉的旧版本，它的链接随之 404
+    FileCatalog::Retention retention;
+    if (const char* env = std::getenv("FILE_KEEP_VERSIONS"))
+        retention.keep_versions = std::max(0, std::atoi(env));
+    if (const char* env = std::getenv("FILE_VERSION_TTL_DAYS"))
+        retention.max_age_sec = std::min(std::max(0, std::atoi(env)), 10000) * 24 * 3600;
+    catalog.set_retention(retention);
     if (!catalog.init()) { LOG_ERROR("FileCatalog init failed"); return 1; }
 
-    FileBus bus;
+    FileBus bus;       // HTTP -> 聊天：文件元数据广播
     if (!bus.init()) { LOG_ERROR("FileBus init failed"); return 1; }
+    FileBus cache_bus; // 聊天 -> HTTP：CFS1 提交后作废下载缓存
+    if (!cache_bus.init()) { LOG_ERROR("FileBus init failed"); return 1; }
+
+    UploadSessions uploads(catalog);
+    uploads.recover(); // 重启前未完成的上传可继续续传
+
+    // 后台清理：超过 UPLOAD_TTL 秒（默认一天）没动静的上传、无主的 .part、无引用的 blob
+    Janitor::Options jan_opt;
+    if (const char* env = std::getenv("UPLOAD_TTL"))
+        jan_opt.ttl_sec = std::max(60, std::atoi(env));
+    if (const char* env = std::getenv("JANITOR_INTERVAL"))
+        jan_opt.interval_sec = std::max(1, std::atoi(env));
+    Janitor janitor(catalog, uploads, jan_opt);
+    janitor.start();
+
+    // HTTP 的文件读写：默认 io_uring，FILE_IO_BACKEND=threads 强制用线程池
+    AsyncFileIO::Options aio_opt;
+    if (const char* env = std::getenv("FILE_IO_BACKEND"))
+        aio_opt.force_threads = std::string(env) == "threads";
+    AsyncFileIO aio(aio_opt);
+    if (!aio.init()) { LOG_ERROR("AsyncFileIO init failed"); return 1; }
+    // 聊天连接上的文件帧（CFS1）用自己的一份，完成事件在聊天线程里收
+    AsyncFileIO::Options chat_aio_opt = aio_opt;
+    chat_aio_opt.buffers = 16;
+    chat_aio_opt.fixed_files = 256;
+    chat_aio_opt.threads = 2;
+    AsyncFileIO chat_aio(chat_aio_opt);
+    if (!chat_aio.init()) { LOG_ERROR("AsyncFileIO init failed"); return 1; }
+
+    // 热点小文件的下载缓存：总预算 FILE_CACHE_MB（默认 64MB，0 关闭）。
+    // 单个文件不超过 256KB：再大的话从内存 send 的拷贝比 splice 页缓存还慢
+    size_t cache_mb = 64;
+    if (const char* env = std::getenv("FILE_CACHE_MB"))
+        cache_mb = (size_t)std::max(0, std::atoi(env));
+    FileCache cache(cache_mb << 20, 256 << 10);
+
+    // 上传完成后在后台生成 gzip 副本，下载时按 Accept-Encoding 发；GZIP_LEVEL=0 关闭
+    Compressor::Options gz_opt;
+    if (const char* env = std::getenv("GZIP_LEVEL"))
+        gz_opt.level = std::max(0, std::min(9, std::atoi(env)));
+    Compressor gzip(catalog, gz_opt);
+    gzip.start();
+
+    // 传输限速：USER_RATE_KBPS 每个用户（对端 IP）每个方向、CONN_RATE_KBPS 每条连接（KB/s，默认 0 不限）；
+    // 各传输每轮最多前进 DRR_QUANTUM_KB（默认 256）。HTTP 和聊天连接上的文件数据共用这一份
+    BandwidthShaper::Options shape_opt;
+    if (const char* env = std::getenv("USER_RATE_KBPS"))
+        shape_opt.user_rate = (int64_t)std::max(0, std::atoi(env)) << 10;
+    if (const char* env = std::getenv("CONN_RATE_KBPS"))
+        shape_opt.conn_rate = (int64_t)std::max(0, std::atoi(env)) << 10;
+    if (const char* env = std::getenv("DRR_QUANTUM_KB"))
+        shape_opt.quantum = (size_t)std::max(16, std::atoi(env)) << 10;
+    BandwidthShaper shaper(shape_opt);
 
     // HTTP 线程
-    HttpServer http(http_bind, http_port, bus, catalog);
+    HttpServer http(http_bind, http_port, bus, catalog, uploads, aio, cache, gzip, shaper, cache_bus);
     g_http = &http;
     std::thread th_http([&]{
         if (!http.start()) { LOG_ERROR("HTTP start failed"); return; }
@@ -89,7 +209,7 @@ int main() {
     });
 
     // 聊天（主线程）
-    EpollChatServer chat(chat_cfg, &bus, &catalog);
+    EpollChatServer chat(chat_cfg, &bus, &catalog, &uploads, &chat_aio, &gzip, &shaper, &cache_bus);
     g_chat = &chat;
 
     std::signal(SIGINT,  handle_signal);
@@ -105,6 +225,8 @@ int main() {
 
     http.stop();
     if (th_http.joinable()) th_http.join();
+    gzip.stop();
+    janitor.stop();
     LOG_INFO("Server exited. Bye.");
     return 0;
 }
@@ -0,0 +1,106 @@
+// 日志调用点在热路径上的耗时：同一条 LOG_INFO（一个字符串、两个整数）分别在
+//   off     运行期等级关掉（只查一下模块等级）
+//   sync    同步文本（调用线程里格式化、写 FILE*）
+//   async   异步文本（调用线程里格式化进环形缓冲，后台线程写出）
+//   binary  异步二进制（只拷格式 id 和参数原值）
+// 几种模式下各调 N 次，输出写到 /dev/null。先整段计时给平均值，再逐次计时给 p50 / p99
+// （逐次计时含一次 steady_clock 读数的开销，单独列出）。缓冲开得够大，正常不会丢。
+//
+// 用法：bench_log [N，默认 200000]
+
+#include "common/logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    int64_t ns_between(Clock::time_point a, Clock::time_point b)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(b - a).count();
+    }
+
+    void one_call(size_t i)
+    {
+        LOG_INFO("upload %s chunk %zu done, %lld bytes", "3f2a9c0e5b7d4e61", i, (long long)(4 << 20));
+    }
+
+    void run(const char *mode, size_t n)
+    {
+        for (size_t i = 0; i < 1000; ++i) // 预热：缓冲、调用点登记
+            one_call(i);
+
+        Clock::time_point t0 = Clock::now();
+        for (size_t i = 0; i < n; ++i)
+            one_call(i);
+        double mean = (double)ns_between(t0, Clock::now()) / (double)n;
+
+        std::vector<int64_t> lat(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            Clock::time_point a = Clock::now();
+            one_call(i);
+            lat[i] = ns_between(a, Clock::now());
+        }
+        std::sort(lat.begin(), lat.end());
+        std::printf("%-7s mean %7.1f ns  p50 %6lld ns  p99 %6lld ns\n", mode, mean, (long long)lat[n / 2],
+                    (long long)lat[n * 99 / 100]);
+    }
+
+    // 相邻两次 Clock::now() 的间隔：逐次计时的数字里都含着它
+    int64_t clock_overhead()
+    {
+        std::vector<int64_t> d(100000);
+        for (auto &x : d)
+        {
+            Clock::time_point a = Clock::now();
+            x = ns_between(a, Clock::now());
+        }
+        std::sort(d.begin(), d.end());
+        return d[d.size() / 2];
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t n = argc > 1 ? (size_t)std::max(1000, std::atoi(argv[1])) : 200000;
+    FILE *null = std::fopen("/dev/null", "w");
+    if (!null)
+    {
+        std::perror("/dev/null");
+        return 1;
+    }
+    std::printf("%zu calls per mode, clock read %lld ns\n", n, (long long)clock_overhead());
+
+    Logger::init(LogLevel::INFO, null, false);
+    Logger::set_level(LogLevel::WARN);
+    run("off", n);
+    Logger::set_level(LogLevel::INFO);
+    run("sync", n);
+
+    LogAsyncOptions opt;
+    opt.ring_bytes = 64u << 20; // 两遍 N 条都放得下，量的是调用线程，不是写出
+    if (!Logger::start_async(opt))
+    {
+        std::fprintf(stderr, "start_async failed\n");
+        return 1;
+    }
+    run("async", n);
+    Logger::stop_async();
+    opt.binary = true;
+    if (!Logger::start_async(opt))
+    {
+        std::fprintf(stderr, "start_async failed\n");
+        return 1;
+    }
+    run("binary", n);
+    Logger::stop_async();
+
+    std::printf("dropped %llu\n", (unsigned long long)Logger::dropped());
+    return 0;
+}
@@ -0,0 +1,109 @@
+// HttpParser 的解析吞吐：几种典型请求头，分别整段喂一次、按 16 字节一段一段喂
+// （模拟请求头跨多次 recv 到达，看续解析有没有重复扫描），报每个请求的耗时和 MB/s。
+// 每轮都 reset 后重新解析，并取一次 header / param，和服务里处理一个请求时一样。
+//
+// 用法：bench_parse [每种情形的请求数（万），默认 100]
+
+#include "http/http_parser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+    struct Case
+    {
+        const char *name;
+        std::string text;
+    };
+
+    // 分片 PUT（Qt 客户端 / upload_large.sh 发的样子）、浏览器下载、小 JSON POST
+    const Case CASES[] = {
+        {"chunk-put",
+         "PUT /upload/chunk?id=3f2a9c0e-5b7d-4e61-8a0f-1c2d3e4f5a6b&seq=17 HTTP/1.1\r\n"
+         "Host: 127.0.0.1:9080\r\n"
+         "Content-Type: application/octet-stream\r\n"
+         "Content-Length: 4194304\r\n"
+         "X-Chunk-Crc32c: 9a3f01c7\r\n"
+         "\r\n"},
+        {"download",
+         "GET /download?oid=a358d3a5d25f9d8bc5a14c770fba4931 HTTP/1.1\r\n"
+         "Host: 192.168.1.20:9080\r\n"
+         "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+         "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+         "Accept-Language: zh-CN,zh;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+         "Accept-Encoding: gzip, deflate, br\r\n"
+         "Connection: keep-alive\r\n"
+         "Range: bytes=1048576-\r\n"
+         "If-None-Match: \"2d27fbdf4e8ca207\"\r\n"
+         "\r\n"},
+        {"init-post",
+         "POST /upload/init HTTP/1.1\r\n"
+         "Host: 127.0.0.1:9080\r\n"
+         "Content-Type: application/json\r\n"
+         "Content-Length: 58\r\n"
+         "\r\n"},
+    };
+
+    volatile size_t g_sink; // 别让编译器把结果没用的循环整个删掉
+
+    double now_sec()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // step 为 0 表示整段一次喂进去
+    bool run(const Case &c, size_t step, size_t reqs, bool quiet = false)
+    {
+        const char *buf = c.text.data();
+        size_t len = c.text.size();
+        HttpParser p;
+        size_t sink = 0;
+        double t0 = now_sec();
+        for (size_t i = 0; i < reqs; ++i)
+        {
+            p.reset();
+            HttpParser::Status st;
+            for (size_t have = step ? std::min(step, len) : len;; have = std::min(have + step, len))
+            {
+                st = p.feed(buf, have);
+                if (st != HttpParser::NEED_MORE || have == len)
+                    break;
+            }
+            if (st != HttpParser::DONE)
+            {
+                std::fprintf(stderr, "%s: parse failed: %s\n", c.name, p.error() ? p.error() : "need more");
+                return false;
+            }
+            sink += p.request().header("Content-Length").size() + p.request().param("id").size() + p.header_bytes();
+        }
+        double sec = now_sec() - t0;
+        g_sink = sink;
+        if (quiet)
+            return true;
+        char how[16] = "whole";
+        if (step)
+            std::snprintf(how, sizeof(how), "/%zu", step);
+        std::printf("%-10s %4zu B  %-6s %8.1f ns/req  %8.1f MB/s\n", c.name, len, how, sec * 1e9 / (double)reqs,
+                    (double)(len * reqs) / sec / 1e6);
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t reqs = (argc > 1 ? (size_t)std::max(1, std::atoi(argv[1])) : 100) * 10000;
+
+    // 先跑一遍热身，频率升上来再计时
+    for (const auto &c : CASES)
+        if (!run(c, 0, reqs / 10, true))
+            return 1;
+    std::printf("HttpParser, %zu requests per case\n", reqs);
+    for (const auto &c : CASES)
+        if (!run(c, 0, reqs) || !run(c, 16, reqs))
+            return 1;
+    return 0;
+}
@@ -0,0 +1,262 @@
+// 通过聊天连接（CFS1 帧）上传一个文件，不为分片另开 HTTP 连接：
+//   注册（已存在就忽略）并登录 -> FILE_BEGIN -> 缺失的分片按帧发出 -> 收齐 FILE_ACK -> FILE_END。
+// 分片按服务端给的 chunk_size 切，每片再拆成不超过 --frame KB 的帧；帧越小，
+// 同一连接上插进来的聊天等得越短。协议见 core/cfs1.hpp。
+//
+// --early：一开始就广播，别人可以边传边下（/download?upload=<id>）。
+//
+// 用法：cfs_upload [--host 127.0.0.1] [--port 9000] [--frame 64] [--name 名字] [--early] user password file
+
+#include "core/cfs1.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+
+namespace
+{
+    int g_fd = -1;
+    std::string g_in; // 收到还没解析的字节
+
+    bool send_all(const std::string &data)
+    {
+        for (size_t off = 0; off < data.size();)
+        {
+            ssize_t n = ::send(g_fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            off += (size_t)n;
+        }
+        return true;
+    }
+
+    // 读下一条消息：按行的 JSON 返回 type 0，CFS1 帧返回帧类型
+    bool next_message(uint16_t &type, std::string &payload)
+    {
+        for (;;)
+        {
+            if (g_in.size() >= 4 && g_in.compare(0, 4, "CFS1") == 0)
+            {
+                if (g_in.size() >= cfs1::HEADER_SIZE)
+                {
+                    size_t len = cfs1::get_be32(g_in.data() + 8);
+                    if (g_in.size() >= cfs1::HEADER_SIZE + len)
+                    {
+                        type = cfs1::get_be16(g_in.data() + 4);
+                        payload = g_in.substr(cfs1::HEADER_SIZE, len);
+                        g_in.erase(0, cfs1::HEADER_SIZE + len);
+                        return true;
+                    }
+                }
+            }
+            else if (!g_in.empty() && g_in.compare(0, std::min<size_t>(g_in.size(), 4), "CFS1", 0,
+                                                   std::min<size_t>(g_in.size(), 4)) != 0)
+            {
+                size_t nl = g_in.find('\n');
+                if (nl != std::string::npos)
+                {
+                    type = 0;
+                    payload = g_in.substr(0, nl);
+                    g_in.erase(0, nl + 1);
+                    return true;
+                }
+            }
+            char buf[65536];
+            ssize_t n = ::recv(g_fd, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            g_in.append(buf, (size_t)n);
+        }
+    }
+
+    // 等某一类回复；中间的聊天广播等消息跳过
+    bool wait_for(uint16_t want, json &out)
+    {
+        uint16_t type;
+        std::string payload;
+        while (next_message(type, payload))
+        {
+            if (type != want)
+                continue;
+            try
+            {
+                out = json::parse(payload);
+                return true;
+            }
+            catch (...)
+            {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool send_line(const json &j) { return send_all(j.dump() + "\n"); }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::string host = "127.0.0.1", name;
+    int port = 9000;
+    size_t frame_kb = 64;
+    bool early = false;
+    std::vector<std::string> pos;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        if (a == "--host" && i + 1 < argc)
+            host = argv[++i];
+        else if (a == "--port" && i + 1 < argc)
+            port = std::atoi(argv[++i]);
+        else if (a == "--frame" && i + 1 < argc)
+            frame_kb = (size_t)std::max(1, std::atoi(argv[++i]));
+        else if (a == "--name" && i + 1 < argc)
+            name = argv[++i];
+        else if (a == "--early")
+            early = true;
+        else
+            pos.push_back(a);
+    }
+    if (pos.size() != 3)
+    {
+        std::fprintf(stderr, "usage: %s [--host h] [--port p] [--frame KB] [--name name] [--early] user password file\n",
+                     argv[0]);
+        return 2;
+    }
+    const std::string &user = pos[0], &pass = pos[1], &path = pos[2];
+    if (name.empty())
+        name = path.substr(path.find_last_of('/') + 1);
+    size_t frame_data = std::min(frame_kb * 1024, cfs1::MAX_PAYLOAD - cfs1::CHUNK_HEAD);
+
+    int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (file < 0 || ::fstat(file, &st) != 0 || st.st_size <= 0)
+    {
+        std::fprintf(stderr, "cannot read %s\n", path.c_str());
+        return 1;
+    }
+
+    g_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+        ::connect(g_fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        std::fprintf(stderr, "connect %s:%d failed: %s\n", host.c_str(), port, strerror(errno));
+        return 1;
+    }
+    int one = 1;
+    ::setsockopt(g_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // 注册的回复（成功或 user exists）都不关心，只看登录
+    uint16_t type;
+    std::string payload;
+    send_line({{"action", "register"}, {"username", user}, {"password", pass}});
+    send_line({{"action", "login"}, {"username", user}, {"password", pass}});
+    bool logged_in = false;
+    while (!logged_in && next_message(type, payload))
+    {
+        json j = json::parse(payload, nullptr, false);
+        if (type == 0 && j.is_object() && j.value("message", "") == "Login successful")
+            logged_in = true;
+        else if (type == 0 && j.is_object() && j.value("reason", "") == "login failed")
+            break;
+    }
+    if (!logged_in)
+    {
+        std::fprintf(stderr, "login failed\n");
+        return 1;
+    }
+
+    json begin{{"sid", 1}, {"name", name}, {"size", (long long)st.st_size}};
+    if (early)
+        begin["early"] = true;
+    json r;
+    if (!send_all(cfs1::frame(cfs1::FT_FILE_BEGIN, begin.dump())) || !wait_for(cfs1::FT_FILE_BEGIN, r) ||
+        !r.value("ok", false))
+    {
+        std::fprintf(stderr, "FILE_BEGIN failed: %s\n", r.dump().c_str());
+        return 1;
+    }
+    if (r.value("exists", false))
+    {
+        std::printf("%s\n", r.dump().c_str());
+        return 0;
+    }
+    size_t chunk_size = r.value("chunk_size", (size_t)0);
+    std::vector<uint64_t> seqs;
+    for (const auto &m : r["missing"])
+        for (uint64_t s = m[0].get<uint64_t>(); s <= m[1].get<uint64_t>(); ++s)
+            seqs.push_back(s);
+
+    // 分片一口气发完，ACK 最后统一收（每片一条，很小，不会把服务端的发送缓冲撑满）
+    std::vector<char> buf(frame_data);
+    for (uint64_t seq : seqs)
+    {
+        off_t base = (off_t)(seq * chunk_size);
+        size_t len = (size_t)std::min<off_t>((off_t)chunk_size, st.st_size - base);
+        for (size_t off = 0; off < len;)
+        {
+            size_t n = std::min(frame_data, len - off);
+            if (::pread(file, buf.data(), n, base + (off_t)off) != (ssize_t)n)
+            {
+                std::fprintf(stderr, "read %s failed\n", path.c_str());
+                return 1;
+            }
+            std::string f = cfs1::header(cfs1::FT_FILE_CHUNK, cfs1::CHUNK_HEAD + n);
+            cfs1::put_be(f, 1, 4);
+            cfs1::put_be(f, seq, 8);
+            cfs1::put_be(f, off, 4);
+            f.append(buf.data(), n);
+            if (!send_all(f))
+            {
+                std::fprintf(stderr, "send failed\n");
+                return 1;
+            }
+            off += n;
+        }
+    }
+    size_t failed = 0;
+    for (size_t i = 0; i < seqs.size(); ++i)
+    {
+        if (!wait_for(cfs1::FT_FILE_ACK, r))
+        {
+            std::fprintf(stderr, "connection lost\n");
+            return 1;
+        }
+        if (!r.value("ok", false))
+        {
+            std::fprintf(stderr, "chunk %llu: %s\n", (unsigned long long)r.value("seq", 0ULL),
+                         r.value("reason", "").c_str());
+            ++failed;
+        }
+    }
+    if (failed)
+        return 1;
+
+    if (!send_all(cfs1::frame(cfs1::FT_FILE_END, json{{"sid", 1}}.dump())) || !wait_for(cfs1::FT_FILE_END, r))
+    {
+        std::fprintf(stderr, "FILE_END failed\n");
+        return 1;
+    }
+    std::printf("%s\n", r.dump().c_str());
+    return r.value("ok", false) ? 0 : 1;
+}
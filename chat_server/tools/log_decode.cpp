@@ -0,0 +1,370 @@
+// 把二进制日志（LogAsyncOptions::binary / LOG_FORMAT=binary）还原成与文本模式相同的行：
+//   [时间][等级][tid:N][文件:行] 正文
+// 文件格式见 common/logger.hpp。一个文件里可以有多段（换输出、重启后追加），每段以文件头开始。
+// 行按数据块的顺序输出：同一线程内保序，不同线程之间按批交错，和文本模式一样。
+// 分段文件压缩过的旧段（.gz）直接读；正在写的段末尾的零填充当作结束。
+//
+// 用法：log_decode [--color] [file ...]    不给文件就读标准输入
+
+#include "common/logger.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace
+{
+    constexpr uint32_t TEXT_RECORD = 0; // 与 logger.cpp 一致：整行文本
+
+    struct Site
+    {
+        int level = 0;
+        unsigned line = 0;
+        std::string file; // 只留文件名
+        std::string fmt;
+        std::string types;
+        bool known = false; // BIN_SITES 里登记过
+    };
+
+    struct Arg
+    {
+        char type = 'i';
+        uint64_t bits = 0;
+        std::string str;
+    };
+
+    bool g_color = false;
+
+    const char *level_str(int lvl)
+    {
+        static const char *names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+        return lvl >= 0 && lvl < 4 ? names[lvl] : "UNKNOWN";
+    }
+
+    const char *level_color(int lvl)
+    {
+        static const char *colors[] = {"\033[36m", "\033[32m", "\033[33m", "\033[31m"};
+        return g_color && lvl >= 0 && lvl < 4 ? colors[lvl] : "";
+    }
+
+    // 顺序读取输入（gzip 的透明解压），读不够就算截断
+    class Reader
+    {
+    public:
+        explicit Reader(gzFile f) : f_(f) {}
+        bool bytes(void *dst, size_t n) { return n == 0 || gzread(f_, dst, (unsigned)n) == (int)n; }
+        bool str(std::string &s, size_t n)
+        {
+            s.resize(n);
+            return n == 0 || bytes(&s[0], n);
+        }
+        template <typename T>
+        bool le(T &v, int n = (int)sizeof(T))
+        {
+            uint8_t b[8];
+            if (!bytes(b, (size_t)n))
+                return false;
+            uint64_t x = 0;
+            for (int i = n - 1; i >= 0; --i)
+                x = (x << 8) | b[i];
+            v = (T)x;
+            return true;
+        }
+        int peek()
+        {
+            int c = gzgetc(f_);
+            if (c != -1)
+                gzungetc(c, f_);
+            return c;
+        }
+
+    private:
+        gzFile f_;
+    };
+
+    uint64_t rd64(const char *p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    }
+
+    // printf 的一个转换说明按参数类别重拼：整数一律用 ll，浮点去掉长度修饰，再交给 snprintf
+    void format_message(const std::string &fmt, const std::vector<Arg> &args, std::string &out)
+    {
+        size_t ai = 0;
+        char tmp[512];
+        auto next = [&]() -> const Arg * { return ai < args.size() ? &args[ai++] : nullptr; };
+        for (size_t i = 0; i < fmt.size(); ++i)
+        {
+            if (fmt[i] != '%')
+            {
+                out.push_back(fmt[i]);
+                continue;
+            }
+            if (i + 1 < fmt.size() && fmt[i + 1] == '%')
+            {
+                out.push_back('%');
+                ++i;
+                continue;
+            }
+            std::string spec = "%";
+            size_t j = i + 1;
+            while (j < fmt.size() && std::strchr("-+ #0", fmt[j]))
+                spec.push_back(fmt[j++]);
+            for (int part = 0; part < 2; ++part) // 宽度、精度；* 从参数里取
+            {
+                if (part == 1)
+                {
+                    if (j >= fmt.size() || fmt[j] != '.')
+                        break;
+                    spec.push_back(fmt[j++]);
+                }
+                if (j < fmt.size() && fmt[j] == '*')
+                {
+                    const Arg *a = next();
+                    spec += std::to_string(a ? (long long)a->bits : 0);
+                    ++j;
+                }
+                while (j < fmt.size() && fmt[j] >= '0' && fmt[j] <= '9')
+                    spec.push_back(fmt[j++]);
+            }
+            while (j < fmt.size() && std::strchr("hlLqjzt", fmt[j]))
+                ++j;
+            if (j >= fmt.size())
+                break;
+            char conv = fmt[j];
+            i = j;
+            const Arg *a = next();
+            if (!a)
+            {
+                out += "<?>";
+                continue;
+            }
+            int n = 0;
+            if (a->type == 's' && conv == 's')
+                n = std::snprintf(tmp, sizeof(tmp), (spec + "s").c_str(), a->str.c_str());
+            else if (a->type == 's')
+            {
+                out += a->str;
+                continue;
+            }
+            else if (std::strchr("di", conv))
+                n = std::snprintf(tmp, sizeof(tmp), (spec + "ll" + conv).c_str(), (long long)a->bits);
+            else if (std::strchr("uxXo", conv))
+                n = std::snprintf(tmp, sizeof(tmp), (spec + "ll" + conv).c_str(), (unsigned long long)a->bits);
+            else if (conv == 'c')
+                n = std::snprintf(tmp, sizeof(tmp), (spec + "c").c_str(), (int)a->bits);
+            else if (std::strchr("fFeEgGaA", conv))
+            {
+                double d;
+                if (a->type == 'd')
+                    std::memcpy(&d, &a->bits, 8);
+                else
+                    d = a->type == 'i' ? (double)(long long)a->bits : (double)a->bits;
+                n = std::snprintf(tmp, sizeof(tmp), (spec + conv).c_str(), d);
+            }
+            else if (conv == 'p')
+                n = std::snprintf(tmp, sizeof(tmp), "%p", (void *)(uintptr_t)a->bits);
+            else
+            {
+                out += "<?>";
+                continue;
+            }
+            if (n > 0)
+                out.append(tmp, std::min((size_t)n, sizeof(tmp) - 1));
+            else if (n < 0)
+                out += "<?>";
+        }
+    }
+
+    // BIN_SITES 块（类型字节已读）：登记 [first, first + n) 的调用点，sites[id] 就是格式 id 为 id 的
+    bool read_sites(Reader &in, std::vector<Site> &sites)
+    {
+        uint32_t first, n;
+        if (!in.le(first) || !in.le(n) || first == 0)
+            return false;
+        if (sites.size() < (size_t)first + n)
+            sites.resize((size_t)first + n);
+        for (uint32_t i = first; i < first + n; ++i)
+        {
+            Site &s = sites[i];
+            uint16_t fl, ml;
+            uint8_t tl;
+            if (!in.le(s.level, 1) || !in.le(s.line, 4) || !in.le(fl) || !in.str(s.file, fl) || !in.le(ml) ||
+                !in.str(s.fmt, ml) || !in.le(tl) || !in.str(s.types, tl))
+                return false;
+            size_t slash = s.file.find_last_of('/');
+            if (slash != std::string::npos)
+                s.file.erase(0, slash + 1);
+            s.known = true;
+        }
+        return true;
+    }
+
+    bool decode_record(const char *p, size_t n, uint32_t tid, uint64_t sync_ticks, uint64_t sync_ns, uint64_t hz,
+                       const std::vector<Site> &sites, std::string &line)
+    {
+        if (n < 12)
+            return false;
+        uint32_t id;
+        std::memcpy(&id, p, 4);
+        if (id == TEXT_RECORD)
+        {
+            line.assign(p + 12, n - 12);
+            return true;
+        }
+        if (id >= sites.size() || !sites[id].known)
+            return false;
+        const Site &s = sites[id];
+
+        std::vector<Arg> args;
+        size_t off = 12;
+        for (char t : s.types)
+        {
+            Arg a;
+            a.type = t;
+            if (t == 's')
+            {
+                uint32_t len;
+                if (off + 4 > n)
+                    return false;
+                std::memcpy(&len, p + off, 4);
+                if (off + 4 + len > n)
+                    return false;
+                a.str.assign(p + off + 4, len);
+                off += 4 + len;
+            }
+            else
+            {
+                if (off + 8 > n)
+                    return false;
+                a.bits = rd64(p + off);
+                off += 8;
+            }
+            args.push_back(std::move(a));
+        }
+
+        // 同步点之前的 tick 差换成纳秒
+        int64_t back = (int64_t)(sync_ticks - rd64(p + 4));
+        int64_t ns = (int64_t)sync_ns - (int64_t)((double)back * 1e9 / (double)(hz ? hz : 1));
+        time_t sec = (time_t)(ns / 1000000000);
+        long ms = (long)(ns % 1000000000 / 1000000);
+        std::tm tm_buf;
+        localtime_r(&sec, &tm_buf);
+        char head[256];
+        std::snprintf(head, sizeof(head), "[%04d-%02d-%02d %02d:%02d:%02d.%03ld]%s[%s]%s[tid:%u][%s:%u] ",
+                      tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday, tm_buf.tm_hour, tm_buf.tm_min,
+                      tm_buf.tm_sec, ms, level_color(s.level), level_str(s.level), g_color ? "\033[0m" : "", tid,
+                      s.file.c_str(), s.line);
+        line = head;
+        format_message(s.fmt, args, line);
+        line.push_back('\n');
+        return true;
+    }
+
+    // 返回 false 表示文件不完整或不是二进制日志（已输出的行照样有效）
+    bool decode(gzFile f, const char *name)
+    {
+        Reader in(f);
+        uint64_t hz = 0;
+        std::vector<Site> sites;
+        bool have_header = false;
+        std::string body, line;
+        for (;;)
+        {
+            int c = in.peek();
+            if (c == -1 || c == 0) // 结束，或者正在写的段的零填充
+                return true;
+            if (c == logdetail::BIN_MAGIC[0])
+            {
+                char magic[sizeof(logdetail::BIN_MAGIC)];
+                if (!in.bytes(magic, sizeof(magic)) || std::memcmp(magic, logdetail::BIN_MAGIC, sizeof(magic)) != 0 ||
+                    !in.le(hz))
+                {
+                    std::fprintf(stderr, "%s: bad header\n", name);
+                    return false;
+                }
+                sites.clear(); // 新的一段，id 重新编
+                have_header = true;
+                continue;
+            }
+            uint8_t kind;
+            if (!have_header || !in.le(kind) || (kind != logdetail::BIN_SITES && kind != logdetail::BIN_RECORDS))
+            {
+                std::fprintf(stderr, "%s: not a binary log\n", name);
+                return false;
+            }
+            if (kind == logdetail::BIN_SITES)
+            {
+                if (!read_sites(in, sites))
+                {
+                    std::fprintf(stderr, "%s: truncated\n", name);
+                    return false;
+                }
+                continue;
+            }
+            uint32_t tid, len;
+            uint64_t sync_ticks, sync_ns;
+            if (!in.le(tid) || !in.le(sync_ticks) || !in.le(sync_ns) || !in.le(len) || !in.str(body, len))
+            {
+                std::fprintf(stderr, "%s: truncated\n", name);
+                return false;
+            }
+            for (size_t off = 0; off + 4 <= body.size();)
+            {
+                uint32_t n;
+                std::memcpy(&n, body.data() + off, 4);
+                if (off + 4 + n > body.size() ||
+                    !decode_record(body.data() + off + 4, n, tid, sync_ticks, sync_ns, hz, sites, line))
+                {
+                    std::fprintf(stderr, "%s: bad record\n", name);
+                    return false;
+                }
+                std::fwrite(line.data(), 1, line.size(), stdout);
+                off += 4 + n;
+            }
+        }
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<const char *> files;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--color") == 0)
+            g_color = true;
+        else
+            files.push_back(argv[i]);
+    }
+    if (files.empty())
+    {
+        gzFile f = gzdopen(0, "rb");
+        bool ok = f && decode(f, "<stdin>");
+        if (f)
+            gzclose(f);
+        return ok ? 0 : 1;
+    }
+
+    int rc = 0;
+    for (const char *path : files)
+    {
+        gzFile f = gzopen(path, "rb");
+        if (!f)
+        {
+            std::fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+            rc = 1;
+            continue;
+        }
+        if (!decode(f, path))
+            rc = 1;
+        gzclose(f);
+    }
+    return rc;
+}
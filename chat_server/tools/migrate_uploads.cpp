@@ -0,0 +1,169 @@
+// 把旧版平铺在 uploads/ 下的文件迁进 FileCatalog：
+//   - 每个文件按内容算 SHA-256（整文件 + 每 4MB 一片），rename 进 .blobs 的两级目录，
+//     同样内容已在仓库里的直接去重；
+//   - 为它建对象；名字没被占用时让名字指向它，已被更新的上传占用时只建对象（按 id 仍可下载）。
+// blob 的一级 -> 两级目录、平铺的 .part / .part.journal 挪进 .parts，这些只是 rename，
+// FileCatalog::init / journal_ids 每次启动都会顺手做，这里也一并触发。
+// 运行时服务必须停掉（root/.lock 被占用时直接退出）。
+//
+// 用法：migrate_uploads [--dry-run] [root]    root 默认 uploads
+
+#include "common/logger.hpp"
+#include "common/sha256.hpp"
+#include "file/file_catalog.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr size_t CHUNK_SIZE = 4 * 1024 * 1024; // 与 HttpServer::DEFAULT_CHUNK_SIZE 一致，分片去重才对得上
+
+    bool ends_with(const std::string &s, const char *suffix)
+    {
+        size_t n = std::strlen(suffix);
+        return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+    }
+
+    // 整文件摘要与按 CHUNK_SIZE 切分的分片摘要（二进制）
+    bool hash_file(const std::string &path, std::string &hex, std::vector<std::string> &chunks)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        std::vector<char> buf(1024 * 1024);
+        Sha256 whole, piece;
+        size_t in_piece = 0;
+        ssize_t r;
+        uint8_t d[Sha256::DIGEST_SIZE];
+        while ((r = ::read(fd, buf.data(), buf.size())) > 0)
+        {
+            whole.update(buf.data(), (size_t)r);
+            for (size_t off = 0; off < (size_t)r;)
+            {
+                size_t n = std::min((size_t)r - off, CHUNK_SIZE - in_piece);
+                piece.update(buf.data() + off, n);
+                off += n;
+                in_piece += n;
+                if (in_piece == CHUNK_SIZE)
+                {
+                    piece.final(d);
+                    chunks.emplace_back((const char *)d, sizeof(d));
+                    piece.reset();
+                    in_piece = 0;
+                }
+            }
+        }
+        ::close(fd);
+        if (r < 0)
+            return false;
+        if (in_piece > 0)
+        {
+            piece.final(d);
+            chunks.emplace_back((const char *)d, sizeof(d));
+        }
+        whole.final(d);
+        hex = Sha256::to_hex(d);
+        return true;
+    }
+
+    // root 下需要迁移的平铺文件：普通文件，不是隐藏的内部文件，也不是上传中的临时文件
+    std::vector<std::string> flat_files(const std::string &root)
+    {
+        std::vector<std::string> out;
+        DIR *d = ::opendir(root.c_str());
+        if (!d)
+            return out;
+        while (dirent *e = ::readdir(d))
+        {
+            std::string fn = e->d_name;
+            if (fn[0] == '.' || ends_with(fn, ".part") || ends_with(fn, ".part.journal"))
+                continue;
+            struct stat st{};
+            if (::lstat((root + "/" + fn).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                out.push_back(fn);
+        }
+        ::closedir(d);
+        return out;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    bool dry_run = false;
+    std::string root = "uploads";
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        if (a == "--dry-run")
+            dry_run = true;
+        else if (a == "-h" || a == "--help")
+        {
+            std::printf("usage: %s [--dry-run] [root]   (root defaults to uploads)\n", argv[0]);
+            return 0;
+        }
+        else
+            root = a;
+    }
+    Logger::init(LogLevel::INFO);
+
+    std::vector<std::string> files = flat_files(root);
+    if (dry_run)
+    {
+        for (const auto &fn : files)
+        {
+            struct stat st{};
+            ::stat((root + "/" + fn).c_str(), &st);
+            std::printf("would adopt %s (%lld bytes)\n", fn.c_str(), (long long)st.st_size);
+        }
+        std::printf("%zu flat file(s) in %s\n", files.size(), root.c_str());
+        return 0;
+    }
+
+    FileCatalog catalog(root, Durability::FDATASYNC);
+    catalog.set_retention({0, 0}); // 迁移时一个旧版本都不删，服务启动后再按它的规则处理
+    if (!catalog.init())
+    {
+        LOG_ERROR("cannot open catalog at %s (is the server still running?)", root.c_str());
+        return 1;
+    }
+    size_t parts = catalog.journal_ids().size();
+
+    size_t adopted = 0, shadowed = 0, failed = 0;
+    for (const auto &fn : files)
+    {
+        std::string path = root + "/" + fn;
+        struct stat st{};
+        FileEntry e;
+        std::vector<std::string> chunks;
+        bool named = false;
+        if (::stat(path.c_str(), &st) == 0)
+        {
+            e.name = fn;
+            e.size = (int64_t)st.st_size;
+            e.created = st.st_mtime; // 上传者不可考，时间取原文件的修改时间
+        }
+        if (e.name.empty() || !hash_file(path, e.sha256, chunks) ||
+            !catalog.adopt(path, e, CHUNK_SIZE, chunks, named))
+        {
+            LOG_WARN("%s: migrate failed: %s", fn.c_str(), strerror(errno));
+            ++failed;
+            continue;
+        }
+        ++adopted;
+        if (!named)
+            ++shadowed;
+        std::printf("%s -> %s%s\n", fn.c_str(), e.oid.c_str(), named ? "" : " (name already taken, reachable by oid)");
+    }
+    std::printf("adopted %zu file(s) (%zu by oid only), %zu failed; %zu upload(s) in progress\n", adopted, shadowed,
+                failed, parts);
+    return failed ? 1 : 0;
+}
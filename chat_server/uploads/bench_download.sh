@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+usage() {
+  cat <<'USAGE'
+Usage:
+  bench_download.sh <oid> [--host 127.0.0.1] [--port 9080] [--count 3] [--parallel 1] [--pid PID]
+
+Description:
+  - 压测 /download（sendfile）：把 oid 下载 --count 次（同时 --parallel 个），内容丢进 /dev/null
+  - 前后各读一次服务进程的 /proc/PID/stat，报总吞吐和服务端每 GB 花的 CPU 秒数（用户态 + 内核态）
+  - 服务端要在本机跑（默认 pgrep -x chat_server）；先下一遍热身，文件进了页缓存再计时
+  - 文件越大越准，1GB 左右合适：
+      head -c 1G /dev/urandom > big.bin && ./upload_large.sh big.bin --no-hash
+
+Example:
+  ./bench_download.sh 3ab01f174f056a4b0ce14bdaa2f15050 --count 3
+  ./bench_download.sh 3ab01f174f056a4b0ce14bdaa2f15050 --count 16 --parallel 4
+USAGE
+}
+
+HOST="127.0.0.1"
+PORT="9080"
+COUNT=3
+PARALLEL=1
+PID=""
+
+if [ $# -lt 1 ]; then usage; exit 1; fi
+case "$1" in -h|--help) usage; exit 0;; esac
+OID="$1"; shift
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --host) HOST="$2"; shift 2;;
+    --port) PORT="$2"; shift 2;;
+    --count) COUNT="$2"; shift 2;;
+    --parallel) PARALLEL="$2"; shift 2;;
+    --pid) PID="$2"; shift 2;;
+    -h|--help) usage; exit 0;;
+    *) echo "Unknown arg: $1"; usage; exit 1;;
+  esac
+done
+
+[ -z "$PID" ] && PID=$(pgrep -x chat_server | head -1 || true)
+if [ -z "$PID" ] || [ ! -r "/proc/$PID/stat" ]; then
+  echo "chat_server is not running here (use --pid)" >&2; exit 1
+fi
+
+URL="http://$HOST:$PORT/download?oid=$OID"
+TICK=$(getconf CLK_TCK)
+
+# 服务进程累计的 utime + stime（时钟滴答）；comm 里可能有空格，从 ") " 之后数
+cpu_ticks() {
+  sed 's/.*) //' "/proc/$PID/stat" | awk '{ print $12 + $13 }'
+}
+
+SIZE=$(curl -fsS -o /dev/null -w '%{size_download}' "$URL") || { echo "download failed: $URL" >&2; exit 1; }
+echo "[warm] oid=$OID size=$SIZE pid=$PID"
+
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+C0=$(cpu_ticks)
+T0=$(date +%s.%N)
+for ((i = 0; i < COUNT; i++)); do
+  while [ "$(jobs -rp | wc -l)" -ge "$PARALLEL" ]; do wait -n || true; done
+  curl -fsS -o /dev/null -w '%{size_download}\n' "$URL" >> "$OUT" &
+done
+wait
+T1=$(date +%s.%N)
+C1=$(cpu_ticks)
+
+BYTES=$(awk '{ s += $1 } END { print s + 0 }' "$OUT")
+awk -v b="$BYTES" -v t0="$T0" -v t1="$T1" -v c="$((C1 - C0))" -v hz="$TICK" -v n="$COUNT" -v p="$PARALLEL" 'BEGIN {
+  sec = t1 - t0; cpu = c / hz; gb = b / 1e9
+  printf "[done] %d x %d parallel, %.1f MB in %.2f s, %.1f MB/s\n", n, p, b / 1e6, sec, b / 1e6 / sec
+  printf "[done] server cpu %.2f s, %.3f cpu-s/GB\n", cpu, (gb > 0 ? cpu / gb : 0)
+}'
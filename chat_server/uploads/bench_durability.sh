@@ -0,0 +1,94 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+usage() {
+  cat <<'USAGE'
+Usage:
+  bench_durability.sh <chat_server 可执行文件> [--size 1024] [--parallel 4] [--policies "none fdatasync writeback"] [--dir DIR]
+
+Description:
+  - 按 UPLOAD_DURABILITY 的每种策略各起一次服务（工作目录在 --dir 下新建，默认当前目录，
+    即被测的文件系统），传一个 --size MB 的随机文件，报：
+      分片阶段的吞吐、/upload/complete 的耗时、传完那一刻 /proc/meminfo 里的 Dirty
+  - 分片用 curl 并发 --parallel 个；服务端口固定 9000 / 9080，跑之前先停掉本机已有的服务
+  - 每种策略跑完删掉它的目录
+
+Example:
+  ./bench_durability.sh ../build/chat_server --size 1024
+  ./bench_durability.sh ../build/chat_server --size 256 --policies "none writeback" --dir /mnt/ssd
+USAGE
+}
+
+SIZE_MB=1024
+PARALLEL=4
+POLICIES="none fdatasync writeback"
+BASE="."
+PORT=9080
+
+if [ $# -lt 1 ]; then usage; exit 1; fi
+case "$1" in -h|--help) usage; exit 0;; esac
+SERVER=$(realpath "$1"); shift
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --size) SIZE_MB="$2"; shift 2;;
+    --parallel) PARALLEL="$2"; shift 2;;
+    --policies) POLICIES="$2"; shift 2;;
+    --dir) BASE="$2"; shift 2;;
+    -h|--help) usage; exit 0;;
+    *) echo "Unknown arg: $1"; usage; exit 1;;
+  esac
+done
+
+[ -x "$SERVER" ] || { echo "not executable: $SERVER" >&2; exit 1; }
+if curl -s -o /dev/null "http://127.0.0.1:$PORT/"; then
+  echo "something is already listening on $PORT; stop it first" >&2; exit 1
+fi
+
+WORK=$(mktemp -d "$BASE/bench_durability.XXXXXX")
+WORK=$(realpath "$WORK")
+SPID=""
+cleanup() {
+  [ -n "$SPID" ] && kill "$SPID" 2>/dev/null && wait "$SPID" 2>/dev/null || true
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+DATA="$WORK/data.bin"
+head -c "${SIZE_MB}M" /dev/urandom > "$DATA"
+SIZE=$(stat -c%s "$DATA")
+URL="http://127.0.0.1:$PORT"
+echo "[bench] ${SIZE_MB} MB, parallel=$PARALLEL, dir=$WORK"
+
+for P in $POLICIES; do
+  mkdir "$WORK/$P"
+  (cd "$WORK/$P" && UPLOAD_DURABILITY="$P" exec "$SERVER" > server.log 2>&1) &
+  SPID=$!
+  for ((i = 0; i < 50; i++)); do
+    curl -s -o /dev/null "$URL/" && break
+    sleep 0.1
+  done
+  sync
+
+  INIT=$(curl -fsS -X POST "$URL/upload/init" -H 'Content-Type: application/json' \
+    -d "{\"name\":\"bench_$P.bin\",\"size\":$SIZE,\"from\":\"bench\",\"parallel\":$PARALLEL}")
+  ID=$(echo "$INIT" | sed -n 's/.*"id":"\([^"]*\)".*/\1/p')
+  CHUNK=$(echo "$INIT" | sed -n 's/.*"chunk_size":\([0-9]*\).*/\1/p')
+  [ -z "$ID" ] && { echo "[$P] init failed: $INIT"; exit 1; }
+  TOTAL=$(( (SIZE + CHUNK - 1) / CHUNK ))
+
+  T0=$(date +%s.%N)
+  seq 0 $((TOTAL - 1)) | DATA="$DATA" CHUNK="$CHUNK" URL="$URL" ID="$ID" xargs -P "$PARALLEL" -I{} sh -c \
+    'dd if="$DATA" bs="$CHUNK" skip={} count=1 status=none |
+     curl -fsS -o /dev/null -X PUT -H "Expect:" --data-binary @- "$URL/upload/chunk?id=$ID&seq={}"'
+  T1=$(date +%s.%N)
+  DIRTY=$(awk '/^Dirty:/ { print $2 }' /proc/meminfo)
+  CT=$(curl -fsS -o /dev/null -w '%{time_total}' -X POST "$URL/upload/complete" \
+    -d "{\"id\":\"$ID\",\"name\":\"bench_$P.bin\",\"size\":$SIZE,\"from\":\"bench\"}")
+
+  awk -v p="$P" -v b="$SIZE" -v t0="$T0" -v t1="$T1" -v ct="$CT" -v d="$DIRTY" 'BEGIN {
+    printf "[bench] %-10s %8.1f MB/s  complete %7.1f ms  dirty after chunks %8.1f MB\n",
+           p, b / 1e6 / (t1 - t0), ct * 1000, d / 1024
+  }'
+  kill "$SPID"; wait "$SPID" 2>/dev/null || true; SPID=""
+  rm -rf "${WORK:?}/$P"
+done
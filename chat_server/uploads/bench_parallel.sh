@@ -0,0 +1,56 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+usage() {
+  cat <<'USAGE'
+Usage:
+  bench_parallel.sh [--size 64] [--streams "1 4 16"] [--host 127.0.0.1] [--port 9080]
+
+Description:
+  - 压测并发分片上传：生成 --size MB 的随机文件，按 --streams 里的每个并发数
+    用 upload_large.sh --parallel N 各传一遍（跳过摘要，每遍换个名字），报耗时和 MB/s
+  - 本机回环上没有时延，并发几乎没有差别；要看出单条连接受 RTT / 窗口限制的效果，
+    先给回环加时延（需要 root）：
+      tc qdisc add dev lo root netem delay 25ms     # 测完 tc qdisc del dev lo root
+    或者服务端按连接限速（CONN_RATE_KBPS=8192 ./chat_server），N 条流就是 N 倍
+
+Example:
+  ./bench_parallel.sh --size 64
+  ./bench_parallel.sh --size 256 --streams "1 2 4 8 16"
+USAGE
+}
+
+HOST="127.0.0.1"
+PORT="9080"
+SIZE_MB=64
+STREAMS="1 4 16"
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --size) SIZE_MB="$2"; shift 2;;
+    --streams) STREAMS="$2"; shift 2;;
+    --host) HOST="$2"; shift 2;;
+    --port) PORT="$2"; shift 2;;
+    -h|--help) usage; exit 0;;
+    *) echo "Unknown arg: $1"; usage; exit 1;;
+  esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+head -c "${SIZE_MB}M" /dev/urandom > "$TMP/data.bin"
+echo "[bench] ${SIZE_MB} MB, streams: $STREAMS, server $HOST:$PORT"
+
+for N in $STREAMS; do
+  # 名字取自文件名：每遍一个硬链接，免得和上一遍同名
+  F="$TMP/bench_p${N}_$$.bin"
+  ln "$TMP/data.bin" "$F"
+  T0=$(date +%s.%N)
+  if ! LAST=$("$HERE/upload_large.sh" "$F" --no-hash --host "$HOST" --port "$PORT" --parallel "$N" --from bench | tail -1); then
+    echo "[bench] parallel=$N failed: $LAST"; exit 1
+  fi
+  T1=$(date +%s.%N)
+  awk -v n="$N" -v mb="$SIZE_MB" -v t0="$T0" -v t1="$T1" 'BEGIN {
+    printf "[bench] parallel=%-3d %7.2f s  %8.1f MB/s\n", n, t1 - t0, mb * 1.048576 / (t1 - t0)
+  }'
+done
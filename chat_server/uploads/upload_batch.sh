@@ -0,0 +1,57 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+usage() {
+  cat <<'USAGE'
+Usage:
+  upload_batch.sh <file>... [--from NAME] [--host 127.0.0.1] [--port 9080]
+
+Description:
+  - 一个请求上传多个小文件：POST /upload/batch?from=NAME
+  - body 依次是每个文件的记录（整数均为小端）：
+      u16 名字长度 | 名字（UTF-8） | u64 文件长度 | 文件内容
+  - 单个文件不超过 4MB，一批最多 1000 个；更大的文件用 upload_large.sh
+  - 服务端边收边落盘，完成后在聊天里广播一条 file_meta_batch
+
+Example:
+  ./upload_batch.sh shots/*.png --from Alice
+USAGE
+}
+
+FROM="Uploader"
+HOST="127.0.0.1"
+PORT="9080"
+FILES=()
+while [ $# -gt 0 ]; do
+  case "$1" in
+    --from) FROM="$2"; shift 2;;
+    --host) HOST="$2"; shift 2;;
+    --port) PORT="$2"; shift 2;;
+    -h|--help) usage; exit 0;;
+    *) FILES+=("$1"); shift;;
+  esac
+done
+if [ ${#FILES[@]} -eq 0 ]; then usage; exit 1; fi
+
+# 小端整数：$1 值，$2 字节数
+le() {
+  local v=$1 n=$2 i out=""
+  for ((i = 0; i < n; i++)); do
+    out+=$(printf '\\%03o' $((v & 255)))
+    v=$((v >> 8))
+  done
+  printf "$out"
+}
+
+TMP=$(mktemp)
+trap 'rm -f "$TMP"' EXIT
+for f in "${FILES[@]}"; do
+  name=$(basename "$f")
+  size=$(stat -c %s "$f")
+  { le "$(printf '%s' "$name" | wc -c)" 2; printf '%s' "$name"; le "$size" 8; cat "$f"; } >> "$TMP"
+done
+
+from_enc=$(printf '%s' "$FROM" | od -An -tx1 | tr -d ' \n' | sed 's/../%&/g')
+curl -sS -X POST -T "$TMP" -H "Content-Type: application/octet-stream" \
+  "http://${HOST}:${PORT}/upload/batch?from=${from_enc}"
+echo
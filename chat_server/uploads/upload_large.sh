@@ -4,16 +4,21 @@ set -euo pipefail
 usage() {
   cat <<'USAGE'
 Usage:
-  upload_large.sh <file> [--from NAME] [--host 127.0.0.1] [--port 9080]
+  upload_large.sh <file> [--from NAME] [--host 127.0.0.1] [--port 9080] [--resume ID] [--parallel N] [--no-hash]
 
 Description:
   - 初始化：POST /upload/init
-  - 分片上传：PUT  /upload/chunk?id=...&seq=...
+  - 分片上传：PUT  /upload/chunk?id=...&seq=...（可带 X-Chunk-Crc32c: <8 位十六进制> 让服务端校验）
   - 完成提交：POST /upload/complete
-  - 分片大小由服务端返回的 chunk_size（默认 256KB）
+  - 分片大小由服务端返回的 chunk_size（默认 4MB）
+  - 断点续传：--resume ID 跳过 init，先 GET /upload/status 只补缺失的分片
+  - 并发上传：--parallel N 同时发送 N 个分片（默认用 init 返回的 parallel 建议值）
+  - 秒传/去重：init 时附带整文件与各分片的 SHA-256，服务端已有的内容不再上传
+    （--no-hash 跳过本地计算）
 
 Example:
   ./upload_large.sh big.bin --from Alice --host 127.0.0.1 --port 9080
+  ./upload_large.sh big.bin --from Alice --resume 1b2c...
 USAGE
 }
 
@@ -21,6 +26,10 @@ USAGE
 FROM="Uploader"
 HOST="127.0.0.1"
 PORT="9080"
+RESUME_ID=""
+PARALLEL=""
+HASH=1
+DEDUP_CHUNK=4194304 # 与服务端默认分片大小一致时分片摘要才有用
 
 if [ $# -lt 1 ]; then usage; exit 1; fi
 FILE="$1"; shift || true
@@ -29,6 +38,9 @@ while [ $# -gt 0 ]; do
     --from) FROM="$2"; shift 2;;
     --host) HOST="$2"; shift 2;;
     --port) PORT="$2"; shift 2;;
+    --resume) RESUME_ID="$2"; shift 2;;
+    --parallel) PARALLEL="$2"; shift 2;;
+    --no-hash) HASH=0; shift;;
     -h|--help) usage; exit 0;;
     *) echo "Unknown arg: $1"; usage; exit 1;;
   esac
@@ -43,26 +55,67 @@ NAME=$(basename "$FILE")
 
 echo "[init] file=$NAME size=$SIZE host=$HOST port=$PORT from=$FROM"
 
-# ---------- /upload/init ----------
-INIT=$(curl -sS -X POST "http://$HOST:$PORT/upload/init" \
-  -H 'Content-Type: application/json' \
-  -d "{\"name\":\"$NAME\",\"size\":$SIZE}")
-
-echo "[init] resp: $INIT"
-ID=$(echo "$INIT" | sed -n 's/.*"id":"\([^"]*\)".*/\1/p')
-CHUNK=$(echo "$INIT" | sed -n 's/.*"chunk_size":\([0-9]*\).*/\1/p')
-[ -z "$ID" ] && { echo "[init] no id in response"; exit 1; }
-[ -z "$CHUNK" ] && CHUNK=262144
-
-echo "[init] id=$ID chunk_size=$CHUNK"
+if [ -z "$RESUME_ID" ]; then
+  # ---------- 摘要（秒传/分片去重） ----------
+  DIGESTS=""
+  if [ "$HASH" = 1 ]; then
+    SHA=$(sha256sum "$FILE" | cut -d' ' -f1)
+    CHUNKS=""
+    for ((OFF = 0; OFF < SIZE; OFF += DEDUP_CHUNK)); do
+      H=$(dd if="$FILE" iflag=skip_bytes,count_bytes skip=$OFF count=$DEDUP_CHUNK bs=1M status=none | sha256sum | cut -d' ' -f1)
+      CHUNKS="$CHUNKS${CHUNKS:+,}\"$H\""
+    done
+    DIGESTS=",\"sha256\":\"$SHA\",\"chunk_size\":$DEDUP_CHUNK,\"chunk_sha256\":[$CHUNKS]"
+    echo "[init] sha256=$SHA"
+  fi
+
+  # ---------- /upload/init ----------
+  INIT=$(curl -sS -X POST "http://$HOST:$PORT/upload/init" \
+    -H 'Content-Type: application/json' \
+    -d "{\"name\":\"$NAME\",\"size\":$SIZE,\"from\":\"$FROM\"${PARALLEL:+,\"parallel\":$PARALLEL}$DIGESTS}")
+
+  echo "[init] resp: $INIT"
+  if echo "$INIT" | grep -q '"exists":true'; then
+    OID=$(echo "$INIT" | sed -n 's/.*"oid":"\([^"]*\)".*/\1/p')
+    echo "[done] server already has this content. You can GET: http://$HOST:$PORT/download?oid=$OID"
+    exit 0
+  fi
+  ID=$(echo "$INIT" | sed -n 's/.*"id":"\([^"]*\)".*/\1/p')
+  CHUNK=$(echo "$INIT" | sed -n 's/.*"chunk_size":\([0-9]*\).*/\1/p')
+  HINT=$(echo "$INIT" | sed -n 's/.*"parallel":\([0-9]*\).*/\1/p')
+  [ -z "$ID" ] && { echo "[init] no id in response"; exit 1; }
+  [ -z "$CHUNK" ] && CHUNK=262144
+  TOTAL=$(( (SIZE + CHUNK - 1) / CHUNK ))
+  RANGES="0,$((TOTAL - 1))"
+  # 服务端复用了已有分片时只返回缺失的区间
+  if echo "$INIT" | grep -q '"missing":'; then
+    RANGES=$(echo "$INIT" | sed -n 's/.*"missing":\[\(.*\)\].*/\1/p' | grep -o '[0-9]\+,[0-9]\+' || true)
+    echo "[init] reused $(echo "$INIT" | sed -n 's/.*"reused":\([0-9]*\).*/\1/p') chunk(s) already on server"
+  fi
+  echo "[init] id=$ID chunk_size=$CHUNK parallel=${HINT:-1}"
+else
+  # ---------- /upload/status ----------
+  ID="$RESUME_ID"
+  STATUS=$(curl -fsS "http://$HOST:$PORT/upload/status?id=$ID") || { echo "[resume] unknown id $ID"; exit 1; }
+  echo "[resume] status: $STATUS"
+  CHUNK=$(echo "$STATUS" | sed -n 's/.*"chunk_size":\([0-9]*\).*/\1/p')
+  RSIZE=$(echo "$STATUS" | sed -n 's/.*"size":\([0-9]*\).*/\1/p')
+  HINT=$(echo "$STATUS" | sed -n 's/.*"parallel":\([0-9]*\).*/\1/p')
+  [ "$RSIZE" != "$SIZE" ] && { echo "[resume] size mismatch: server=$RSIZE local=$SIZE"; exit 1; }
+  RANGES=$(echo "$STATUS" | sed -n 's/.*"missing":\[\(.*\)\].*/\1/p' | grep -o '[0-9]\+,[0-9]\+' || true)
+fi
 
 # ---------- upload chunks ----------
-OFF=0
-SEQ=0
-RETRIES=3
-
-# dd 使用字节跳过/计数（GNU dd）
-while [ $OFF -lt $SIZE ]; do
+RETRIES=5
+# 服务端会对超出约定并发数的分片回 429，所以客户端并发数不要超过 init 的建议值
+[ -z "$PARALLEL" ] && PARALLEL=${HINT:-1}
+[ -n "$HINT" ] && [ "$PARALLEL" -gt "$HINT" ] && PARALLEL=$HINT
+FAILED=$(mktemp)
+DONE_CNT=0
+
+send_chunk() {
+  local SEQ=$1 OFF COUNT REM CHUNK_DATA TRY
+  OFF=$((SEQ * CHUNK))
   COUNT=$CHUNK; REM=$((SIZE - OFF)); [ $REM -lt $COUNT ] && COUNT=$REM
 
   # 读这一片
@@ -70,35 +123,51 @@ while [ $OFF -lt $SIZE ]; do
   CHUNK_DATA=$(mktemp)
   dd if="$FILE" of="$CHUNK_DATA" iflag=fullblock,skip_bytes,count_bytes skip=$OFF count=$COUNT status=none
 
-  # 发送，带简单重试
+  # 发送，带简单重试（包括 429）
   TRY=1
   while :; do
-    if curl -fsS -X PUT "http://$HOST:$PORT/upload/chunk?id=$ID&seq=$SEQ" \
-          --data-binary @"$CHUNK_DATA" > /dev/null; then
+    # -H 'Expect:'：服务端不回 100 Continue，curl 默认每片要干等 1 秒
+    if curl -fsS -X PUT "http://$HOST:$PORT/upload/chunk?id=$ID&seq=$SEQ" -H 'Expect:' \
+          --data-binary @"$CHUNK_DATA" > /dev/null 2>&1; then
       break
     fi
     if [ $TRY -ge $RETRIES ]; then
-      echo "[chunk] seq=$SEQ failed after $RETRIES attempts"; rm -f "$CHUNK_DATA"; exit 1
+      echo "[chunk] seq=$SEQ failed after $RETRIES attempts"
+      echo "$SEQ" >> "$FAILED"
+      break
     fi
-    echo "[chunk] seq=$SEQ failed, retry $TRY/$RETRIES ..."
     TRY=$((TRY+1))
     sleep 1
   done
-
   rm -f "$CHUNK_DATA"
-  OFF=$((OFF + COUNT))
-  SEQ=$((SEQ + 1))
+}
 
-  # 进度显示
-  PCT=$((100 * OFF / SIZE))
-  printf "\r[upload] %d%%  (%d / %d bytes)" "$PCT" "$OFF" "$SIZE"
+# 只发送 RANGES 里列出的分片（每行 "first,last"），最多 PARALLEL 个同时在途
+for R in $RANGES; do
+  FIRST=${R%,*}; LAST=${R#*,}
+  for SEQ in $(seq "$FIRST" "$LAST"); do
+    while [ "$(jobs -rp | wc -l)" -ge "$PARALLEL" ]; do wait -n || true; done
+    send_chunk "$SEQ" &
+    DONE_CNT=$((DONE_CNT + 1))
+    printf "\r[upload] dispatched %d chunk(s), parallel=%d" "$DONE_CNT" "$PARALLEL"
+  done
 done
+wait
 echo
 
+if [ -s "$FAILED" ]; then
+  rm -f "$FAILED"
+  echo "[chunk] resume later with: $0 $FILE --from $FROM --host $HOST --port $PORT --resume $ID"
+  exit 1
+fi
+rm -f "$FAILED"
+
 # ---------- /upload/complete ----------
 COMP=$(curl -sS -X POST "http://$HOST:$PORT/upload/complete" \
   -H 'Content-Type: application/json' \
   -d "{\"id\":\"$ID\",\"name\":\"$NAME\",\"size\":$SIZE,\"from\":\"$FROM\"}")
 echo "[complete] resp: $COMP"
+OID=$(echo "$COMP" | sed -n 's/.*"oid":"\([^"]*\)".*/\1/p')
+[ -z "$OID" ] && { echo "[complete] failed"; exit 1; }
 
-echo "[done] upload finished. You can GET: http://$HOST:$PORT/download?name=$NAME"
+echo "[done] upload finished. You can GET: http://$HOST:$PORT/download?oid=$OID"